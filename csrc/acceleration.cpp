@@ -15,35 +15,195 @@
  * along with this software.  If not, see <http://www.gnu.org/licenses/>
  */
 
+#include <chrono>
+#include <sstream>
+
 #include "acceleration.hpp"
 #include "center-of-mass.hpp"
 #include "barnes-hut.hpp"
 #include "logger.hpp"
+#include "thread-pool.hpp"
 	 
 /**
- *  Construct oct-tree from particles, and compute centre of mass for tree and its subtrees
+ *  Construct oct-tree from particles, and compute centre of mass for tree and its subtrees,
+ *  unless this has been done while the tree was built. Between full rebuilds, we reuse the 
+ *  existing tree instead. If requested, copy tree to a FlatTree for the force walk.
+ *  The group and packet walks calculate the accelerations of all particles at once, so they
+ *  are performed here, and visit() has nothing left to do. This is also the case if
+ *  several threads have been requested: each calculates the accelerations of a
+ *  chunk of particles, and the time each was busy may be logged.
  *
  *  Parameters:
  *      particles    Pointer to particles
  *      n            Number of particles
  */
-void AccelerationVisitor::initialize(unique_ptr<Particle[]> & particles, int n)  {
-	_tree.reset();
-	_tree = Node::create(particles,n,_verify_tree); 
-	CentreOfMassCalculator calculator(particles);
-	_tree->traverse(calculator);
+void AccelerationVisitor::initialize(ParticleStore & particles, int n)  {
+	_particles = &particles;
+	if (particles.get_n_reorders() != _n_reorders)
+		_costs.clear();    // Costs are recorded by slot, so they no longer apply
+	if (!_reuse_tree(particles,n)) {
+		const double pad = _tree_options.rebuild_interval > 1 ? 0.1 : 1.0e-4; // Leave room for particles to drift between rebuilds
+		_tree.reset();
+		_tree = Node::create(particles,n,_verify_tree,pad,_tree_options,_arena); 
+		_steps_since_build = 0;
+		_n_reorders = particles.get_n_reorders();
+		if (!_tree_options.fused_moments) {
+			CentreOfMassCalculator calculator(particles,_tree_options.quadrupole,_tree_options.tight_bounds);
+			calculator.calculate(_tree.get(),_tree_options.threads);
+		}
+	}
+	_calculated = _tree_options.group_size > 0 || _tree_options.packet_size > 0 || _tree_options.threads > 1;
+	if (_tree_options.group_size > 0)
+		_group_walk.calculate(_tree.get(),particles);
+	else if (_tree_options.packet_size > 0)
+		_packet_walk.calculate(_tree.get(),particles);
+	else {
+		if (_tree_options.flat)
+			_flat_tree.build(_tree.get(),particles,_tree_options.quadrupole,_tree_options.tight_bounds);
+		if (_tree_options.threads > 1) {
+			_calculate_in_parallel(particles,n);
+			if (_tree_options.log_busy_times) {
+				stringstream busy_times;
+				for (const auto busy : _busy_times)
+					busy_times << " " << busy;
+				LOG2("Busy time for each thread:",busy_times.str());
+			}
+		}
+	}
+}
+
+/**
+ *  Calculate the accelerations of all particles. The particles are divided into
+ *  contiguous chunks of equal cost, where the cost of each particle is the number
+ *  of interactions it had in the previous step (the first time, all particles are
+ *  assumed to cost the same). Each thread starts with an equal share of the chunks;
+ *  when it has finished its own, it takes chunks that other threads have not yet
+ *  started, which absorbs whatever imbalance the costs have failed to predict.
+ *
+ *  Each thread uses its own visitor for each particle, so nothing is shared except
+ *  the tree, which is only read, and the particles and their costs, each of which is
+ *  written by one thread only. The particles are processed in the same way whichever
+ *  thread takes them, so the accelerations do not depend on the division of work.
+ *
+ *  Parameters:
+ *      particles    Pointer to particles
+ *      n            Number of particles
+ */
+void AccelerationVisitor::_calculate_in_parallel(ParticleStore & particles, int n)  {
+	const int threads = _tree_options.threads;
+	if (_costs.size() != (size_t)n)
+		_costs.assign(n,1.0);
+	_busy_times.assign(threads,0.0);
+	const int n_chunks = max(1,min(n,threads*ChunksPerThread));
+	const vector<int> starts = _split_by_cost(n_chunks);
+	vector<atomic<int>> next_chunk(threads); // Next chunk to be processed from each thread's share
+	vector<int> end_chunk(threads);
+	for (int thread=0;thread<threads;thread++) {
+		next_chunk[thread] = thread * n_chunks / threads;
+		end_chunk[thread] = (thread + 1) * n_chunks / threads;
+	}
+	ThreadPool::run_in_parallel(threads,[&](int thread){
+		const auto start = chrono::steady_clock::now();
+		for (int k=0;k<threads;k++) {   // Own share first, then the others
+			const int owner = (thread + k) % threads;
+			for (int chunk=next_chunk[owner]++;chunk<end_chunk[owner];chunk=next_chunk[owner]++)
+				for (int i=starts[chunk];i<starts[chunk+1];i++) {
+					WalkCost cost;
+					_calculate(particles[i],&cost);
+					_costs[i] = 1 + cost.get_total();
+				}
+		}
+		const chrono::duration<double> busy = chrono::steady_clock::now() - start;
+		_busy_times[thread] = busy.count();
+	});
+}
+
+/**
+ *  Divide particles into chunks whose costs are as nearly equal as possible.
+ *  Chunk k starts at the first particle at which the cumulative cost reaches
+ *  k/n_chunks of the total.
+ *
+ *  Parameters:
+ *      n_chunks     Number of chunks
+ *
+ *  Returns:
+ *     Index of the first particle in each chunk, followed by the number of particles
+ */
+vector<int> AccelerationVisitor::_split_by_cost(const int n_chunks) const {
+	const int n = _costs.size();
+	vector<double> cumulative(n);
+	double total = 0;
+	for (int i=0;i<n;i++) {
+		total += _costs[i];
+		cumulative[i] = total;
+	}
+	vector<int> starts(n_chunks+1);
+	starts[0] = 0;
+	for (int k=1;k<n_chunks;k++) {
+		const double target = total * k / n_chunks;
+		const int i = lower_bound(cumulative.begin(),cumulative.end(),target) - cumulative.begin();
+		starts[k] = max(starts[k-1],min(n,i+1));
+	}
+	starts[n_chunks] = n;
+	return starts;
+}
+
+/**
+ *  Determine whether tree from previous step can be reused. If so, either update it,
+ *  or keep its topology (refit), and recalculate centres of mass. The tree is no longer
+ *  reusable if too many particles have left the cubes of their External nodes, which
+ *  can only happen if it has been refitted, or if the particles have been reordered,
+ *  as its buckets refer to particles by index.
+ *
+ *  Parameters:
+ *      particles    Pointer to particles
+ *      n            Number of particles
+ *
+ *  Returns:
+ *     true iff tree has been reused, so there is no need to build a new one
+ */
+bool AccelerationVisitor::_reuse_tree(ParticleStore & particles, int n)  {
+	if (_tree == nullptr || ++_steps_since_build >= _tree_options.rebuild_interval) return false;
+	if (particles.get_n_reorders() != _n_reorders) return false;
+	if (!_tree_options.refit && !_tree->update(particles,n,_tree_options,*_arena,_verify_tree)) return false;
+	CentreOfMassCalculator calculator(particles,_tree_options.quadrupole,_tree_options.tight_bounds);
+	calculator.calculate(_tree.get(),_tree_options.threads);
+	return calculator.get_n_escaped() <= _tree_options.max_escaped * n;
 }
 
 /**
  *  Calculate acceleration for one node only. The real work is delegated to the Barnes Hut Visitor,
- *  which computes the force on this particles from each other particle.
+ *  or the FlatTree, which computes the force on this particles from each other particle.
+ *  If the group or packet walk is being used, or several threads, the acceleration has already been
+ *  calculated by initialize().
  *
  *  Parameters:
  *      particle   The particle whose acceleration is to be computed
  */
 void AccelerationVisitor::visit(Particle & particle){
-	BarnesHutVisitor visitor(particle,_theta,_G,_a);
+	if (_calculated) return;
+	_calculate(particle);
+}
+
+/**
+ *  Calculate the acceleration of one particle, using the FlatTree if requested,
+ *  otherwise the BarnesHutVisitor.
+ *
+ *  Parameters:
+ *      particle   The particle whose acceleration is to be computed
+ *      cost       If supplied, used to return the numbers of nodes and particles that the particle has interacted with
+ */
+void AccelerationVisitor::_calculate(Particle & particle, WalkCost * cost){
+	if (_tree_options.flat) {
+		auto acceleration = _flat_tree.get_acceleration(particle,*_criterion,_G,_a,_tree_options.mixed_precision,cost);
+		particle.set_acceleration(acceleration);
+		return;
+	}
+	BarnesHutVisitor visitor(particle,*_particles,*_criterion,_G,_a,_tree_options.quadrupole,_tree_options.tight_bounds,
+							 _tree_options.mixed_precision);
 	_tree->traverse(visitor);
 	visitor.store_accelerations();
+	if (cost != nullptr)
+		*cost = visitor.get_cost();
 }
 
@@ -18,6 +18,10 @@
  * along with this software.  If not, see <http://www.gnu.org/licenses/>
  */
  
+#include "flat-tree.hpp"
+#include "group-walk.hpp"
+#include "opening-criterion.hpp"
+#include "packet-walk.hpp"
 #include "particle.hpp"
 #include "treecode.hpp"
 
@@ -27,13 +31,21 @@ using namespace std;
  * This interface allows the AccelerationVisitor to be mocked for unit tests
  */
 class IAccelerationVisitor : public Visitor<Particle>, public Initializer<Particle> {
-	virtual void initialize(unique_ptr<Particle[]> & particles, int n) {;}
+  public:
+	virtual void initialize(ParticleStore & particles, int n) {;}
 };
 
 /**
  * This class calculates the acceleration for each particle.
  */
 class AccelerationVisitor : public IAccelerationVisitor {
+  public:
+	/**
+	 *  When several threads are used, the particles are divided into this many
+	 *  chunks for each thread, so a thread that finishes its own chunks early
+	 *  can take some from the others.
+	 */
+	enum {ChunksPerThread=8};
 	
   private:
 	/**
@@ -42,9 +54,9 @@ class AccelerationVisitor : public IAccelerationVisitor {
 	unique_ptr<Node> _tree = NULL;
 	
 	/**
-	 *   Ratio for Barnes G=Hut cutoff (Barnes and Hut recommend 1.0)
+	 *   Used to decide whether a node is distant enough to be treated as a whole
 	 */
-	const double _theta;
+	unique_ptr<OpeningCriterion> _criterion;
 	
 	/**
 	 *   Gravitational constant
@@ -61,28 +73,90 @@ class AccelerationVisitor : public IAccelerationVisitor {
 	 */
 	bool _verify_tree;
 	
+	/**
+	 * Used to control how tree is built
+	 */
+	const TreeOptions _tree_options;
+	
+	/**
+	 * Storage for nodes of tree, reused every time we build a new tree
+	 */
+	shared_ptr<NodeArena> _arena = make_shared<NodeArena>();
+	
+	/**
+	 * Copy of tree used to calculate accelerations if _tree_options.flat is set
+	 */
+	FlatTree _flat_tree;
+	
+	/**
+	 * Used to calculate accelerations if _tree_options.group_size is positive
+	 */
+	GroupWalk _group_walk;
+	
+	/**
+	 * Used to calculate accelerations if _tree_options.packet_size is positive
+	 */
+	PacketWalk _packet_walk;
+	
+	/**
+	 * The particles in the tree, recorded by initialize()
+	 */
+	ParticleStore * _particles = nullptr;
+	
+	/**
+	 * Number of times tree has been updated since it was built from scratch
+	 */
+	int _steps_since_build = 0;
+	
+	/**
+	 * Number of times the particles had been reordered when the tree was built: if
+	 * they have been reordered since, the indices in the tree are no longer valid.
+	 */
+	int _n_reorders = 0;
+	
+	/**
+	 * Indicates that initialize() has already calculated the accelerations of all particles
+	 */
+	bool _calculated = false;
+	
+	/**
+	 * Estimated cost of calculating the acceleration of each particle: the number
+	 * of interactions in the previous step, used to divide the work between threads.
+	 */
+	vector<double> _costs;
+	
+	/**
+	 * Time that each thread spent calculating accelerations in the last step (seconds)
+	 */
+	vector<double> _busy_times;
+	
   public:
 	/**
 	 *  Create acceleration visitor
 	 *
 	 *  Parameters:
 	 *      configuration	Container for particles
-	 *		theta           Ratio for Barnes G=Hut cutoff (Barnes and Hut recommend 1.0)
+	 *		criterion       Used to decide whether a node is distant enough to be treated as a whole
 	 *      G				Gravitational constant
 	 *      a				Softening length
 	 *      verify_tree     Determines whether to verify that each particle is in the Tree once and only once.
+	 *      tree_options    Used to control how tree is built
 	 */
-    AccelerationVisitor(const double theta,const double G,const double a, const bool verify_tree) 
-	   : _theta(theta),_G(G),_a(a), _verify_tree(verify_tree){};
+    AccelerationVisitor(unique_ptr<OpeningCriterion> criterion,const double G,const double a, const bool verify_tree,
+						const TreeOptions & tree_options=TreeOptions()) 
+	   : _criterion(std::move(criterion)),_G(G),_a(a), _verify_tree(verify_tree),_tree_options(tree_options),
+		 _group_walk(*_criterion,G,a,tree_options.quadrupole,tree_options.tight_bounds,tree_options.group_size),
+		 _packet_walk(*_criterion,G,a,tree_options.quadrupole,tree_options.tight_bounds,tree_options.packet_size){};
 	 
 	/**
-	 *  Construct oct-tree from particles
+	 *  Construct oct-tree from particles, or update the existing one. If group walk
+	 *  or packet walk has been requested, this also calculates the accelerations of all particles.
 	 *
 	 *  Parameters:
 	 *      particles    Pointer to particles
 	 *      n            Number of particles
 	 */
-	void initialize(unique_ptr<Particle[]> & particles, int n);
+	void initialize(ParticleStore & particles, int n);
 	
 	/**
 	 *  Invoked by Configuration to calculate the acceleration of each particle.
@@ -91,6 +165,64 @@ class AccelerationVisitor : public IAccelerationVisitor {
 	 *      particle   The particle whose acceleration is to be computed
 	 */
 	void visit(Particle & particle);
+	
+	/**
+	 *  Time that each thread spent calculating accelerations in the last step (seconds):
+	 *  empty unless several threads are used.
+	 */
+	const vector<double> & get_busy_times() const {return _busy_times;}
+	
+	/**
+	 *  Number of interactions of each particle in the last step, which is used as the
+	 *  cost of the particle in the next: empty unless several threads are used.
+	 */
+	const vector<double> & get_costs() const {return _costs;}
+	
+  private:
+	/**
+	 *  Determine whether tree from previous step can be reused. If so, either update it,
+	 *  or keep its topology, and recalculate centres of mass.
+	 *
+	 *  Parameters:
+	 *      particles    Pointer to particles
+	 *      n            Number of particles
+	 *
+	 *  Returns:
+	 *     true iff tree has been reused, so there is no need to build a new one
+	 */
+	bool _reuse_tree(ParticleStore & particles, int n);
+	
+	/**
+	 *  Calculate the acceleration of one particle, using the FlatTree if requested,
+	 *  otherwise the BarnesHutVisitor. The tree is only read, so this may be called
+	 *  by several threads at once, provided each has its own particle.
+	 *
+	 *  Parameters:
+	 *      particle   The particle whose acceleration is to be computed
+	 *      cost       If supplied, used to return the numbers of nodes and particles that the particle has interacted with
+	 */
+	void _calculate(Particle & particle, WalkCost * cost=nullptr);
+	
+	/**
+	 *  Calculate the accelerations of all particles, dividing them between threads
+	 *  in chunks of equal cost
+	 *
+	 *  Parameters:
+	 *      particles    Pointer to particles
+	 *      n            Number of particles
+	 */
+	void _calculate_in_parallel(ParticleStore & particles, int n);
+	
+	/**
+	 *  Divide particles into chunks whose costs are as nearly equal as possible
+	 *
+	 *  Parameters:
+	 *      n_chunks     Number of chunks
+	 *
+	 *  Returns:
+	 *     Index of the first particle in each chunk, followed by the number of particles
+	 */
+	vector<int> _split_by_cost(const int n_chunks) const;
 
 };
 
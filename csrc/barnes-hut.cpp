@@ -25,14 +25,19 @@ using namespace std;
   * Initialize BarnesHutVisitor for a specific particle
   *
   * Parameters:
-  *  	me      Particle being processed
-  *  	theta   Ratio for Barnes G=Hut cutoff (Barnes and Hut recommend 1.0)
-  *  	G       Gravitational constant
-  * 	a       Softening length
+  *  	me          Particle being processed
+  *  	particles   All the particles
+  *  	criterion   Used to decide whether a node is distant enough to be treated as a whole
+  *  	G           Gravitational constant
+  * 	a           Softening length
+  *  	quadrupole  Use quadrupole moments of nodes, which must have been calculated
+  *  	tight_bounds Use tight bounding boxes of nodes, which must have been calculated, to decide whether to open them
+  *  	mixed_precision Calculate interactions with distant nodes in single precision
   */
-BarnesHutVisitor::BarnesHutVisitor(Particle& me,const double theta, const double G,const double a)
-	: _id(me.get_id()),_me(me),_theta_squared(sqr(theta)),_G(G),
-	_position(me.get_position()),_a(a),_acceleration({0.0,0.0,0.0}){}
+BarnesHutVisitor::BarnesHutVisitor(Particle& me,ParticleStore & particles,const OpeningCriterion & criterion, const double G,const double a,
+								   const bool quadrupole, const bool tight_bounds, const bool mixed_precision)
+	: _id(me.get_id()),_me(me),_particles(particles),_positions(particles.get_positions()),_masses(particles.get_masses()),_ids(particles.get_ids()),_criterion(criterion),_a_old(get_acceleration_magnitude(me)),_G(G),
+	_position(me.get_position()),_a(a),_interactions(_position,a,InteractionKernel::get_best_implementation(),mixed_precision),_acceleration({0.0,0.0,0.0}),_quadrupole(quadrupole),_tight_bounds(tight_bounds){}
 	
 /**
  * Used to accumulate accelerations for each node
@@ -42,51 +47,86 @@ BarnesHutVisitor::BarnesHutVisitor(Particle& me,const double theta, const double
  *
  */
 Node::Visitor::Status BarnesHutVisitor::visit_internal(Node * internal_node) {
-	const auto m = internal_node->get_mass();
 	const auto X = internal_node->get_centre_of_mass();
 	const auto dsq_node=Particle::get_distance_sq(X,_position);
 	/*
 	 * Is this node distant enough that its particles can be lumped?
 	 * I have checked against Barnes and Hut's paper - they recommend 1.0 for theta.
 	 */
-	if ( sqr(internal_node->get_side())/dsq_node < _theta_squared ) {
-		_accumulate_acceleration(m,X,dsq_node);
+	if (_accept(internal_node,dsq_node)) {
+		_accumulate_node(internal_node,X,dsq_node);
 		return Node::Visitor::Status::DontDescend;
 	}
 	return Node::Visitor::Status::Continue;
 }
 
 /**
- * Used to accumulate accelerations for each external node
+ * Used to accumulate accelerations for each external node. If the node
+ * has several particles, and is distant enough, we use its centre of mass
+ * as we would for an internal node; otherwise we sum directly over the
+ * particles in its bucket.
  *
  * Parameters:
  *     external_node   Current node while iterating over tree
  *
  */
 Node::Visitor::Status BarnesHutVisitor::visit_external(Node * external_node) {
-	if (external_node->get_index() == _id) return Node::Visitor::Status::Continue;
-	const auto m = external_node->get_mass();
-	const auto X = external_node->get_centre_of_mass();
-	const auto dsq_node=Particle::get_distance_sq(X,_position);
-	_accumulate_acceleration(m,X,dsq_node); 
-			
+	const auto bucket = external_node->get_particles();
+	if (bucket.size() > 1) {
+		const auto X = external_node->get_centre_of_mass();
+		const auto dsq_node=Particle::get_distance_sq(X,_position);
+		if (_accept(external_node,dsq_node)) {
+			_accumulate_node(external_node,X,dsq_node);
+			return Node::Visitor::Status::Continue;
+		}
+	}
+	for (int index : bucket) {
+		if (_ids[index] == _id) continue;
+		_accumulate_acceleration(_masses[index],{_positions[0][index],_positions[1][index],_positions[2][index]});
+	}
 	return Node::Visitor::Status::Continue;
 }
 
+/**
+ * Used at the end of calculation to store accelerations back into particle:
+ * the interactions with point masses, which are processed in batches,
+ * plus any contributions from quadrupole moments.
+ */
+void BarnesHutVisitor::store_accelerations() {
+	auto acceleration = _interactions.get_acceleration(_G);
+	for (int i=0;i<NDIM;i++)
+		acceleration[i] += _acceleration[i];
+	_me.set_acceleration(acceleration);
+}
 
 /**
- * Used to add in the contribution to the acceleration from one Node
- * NB: there is a new instance of the visitor for each particle, so
- * acceleration is always zero at the start.
+ * Used to add in the contribution to the acceleration from a Node that is
+ * distant enough to be treated as a whole: its mass, in single precision if requested,
+ * and, if required, its quadrupole.
  *
  * Parameters:
- *     m       Mass contained in contibuting Node
+ *     node    The contributing Node
  *     X       Center of mass of contibuting Node
  *     dsq     Squared distance from corrent particle to centre of mass of contibuting Node
  */
-void BarnesHutVisitor::_accumulate_acceleration(double m,array<double,NDIM> X,double dsq){
-	auto d_factor = pow(dsq + _a*_a,-3/2);
-	for (int i=0;i<NDIM;i++)
-		 _acceleration[i] += _G*m*(X[i]-_position[i])*d_factor;
+void BarnesHutVisitor::_accumulate_node(Node * node,array<double,NDIM> X,double dsq){
+	_interactions.add_far(node->get_mass(),X);
+	_cost.n_nodes++;
+	if (_quadrupole)
+		add_quadrupole_acceleration(node->get_quadrupole(),X,_position,dsq,_G,_a,_acceleration);
+}
+
+/**
+ * Determine whether a node is distant enough to be treated as a whole. The criterion
+ * sees the node's cube, or, if requested, the tight bounding box of its particles.
+ *
+ * Parameters:
+ *     node    The Node
+ *     dsq     Squared distance from corrent particle to centre of mass of Node
+ */
+bool BarnesHutVisitor::_accept(Node * node,const double dsq){
+	if (_tight_bounds)
+		return _criterion.accept(node->get_mass(),node->get_tight_side(),node->get_tight_bmax_sq(),dsq,_a_old);
+	return _criterion.accept(node->get_mass(),node->get_side(),node->get_bmax_sq(),dsq,_a_old);
 }
 
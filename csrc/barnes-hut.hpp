@@ -19,8 +19,11 @@
  */
  
 #include <array>
+#include <cmath>
 #include <tuple>
 
+#include "interaction-kernel.hpp"
+#include "opening-criterion.hpp"
 #include "particle.hpp"
 #include "treecode.hpp"
 
@@ -35,7 +38,7 @@ class BarnesHutVisitor :  public Node::Visitor{
 	
   private:
   	/**
-	 * Keep track of particle index so we don't calculate acceleration of particle caused by itself!
+	 * Keep track of particle ID so we don't calculate acceleration of particle caused by itself!
 	 */
 	const int _id = -1;
 	
@@ -45,9 +48,32 @@ class BarnesHutVisitor :  public Node::Visitor{
 	Particle & _me;
 	
 	/**
-	 * Store squared theta to simplify comparisons
+	 * All the particles: needed for the particles in each bucket
+	 */
+	ParticleStore & _particles;
+	
+	/**
+	 * Arrays of positions and masses from the store, read directly for the particles in
+	 * each bucket, rather than through their proxies
+	 */
+	const array<span<double>,NDIM> _positions;
+	
+	const span<double> _masses;
+	
+	/**
+	 * IDs of particles, used to recognize this particle in its bucket
+	 */
+	const span<int> _ids;
+	
+	/**
+	 * Used to decide whether a node is distant enough to be treated as a whole
 	 */ 
-	const double _theta_squared;
+	const OpeningCriterion & _criterion;
+	
+	/**
+	 * Magnitude of the particle's acceleration from the previous step, used by some criteria
+	 */
+	const double _a_old;
 	
 	/**
 	 * Gravitational constant
@@ -65,21 +91,61 @@ class BarnesHutVisitor :  public Node::Visitor{
 	const double _a;
 	
 	/**
-	 * We accumulate the acceleration here
+	 * We collect the interactions with point masses here, so they can be processed in batches
+	 */
+	InteractionList _interactions;
+	
+	/**
+	 * We accumulate the acceleration from quadrupole moments here
 	 */
 	array<double,NDIM> _acceleration;
+	
+	/**
+	 * Indicates that quadrupole moments of nodes are to be used
+	 */
+	const bool _quadrupole;
+	
+	/**
+	 * Indicates that tight bounding boxes of nodes are to be used instead of cubes in opening criterion
+	 */
+	const bool _tight_bounds;
+	
+	/**
+	 * Number of nodes and particles that this particle has interacted with
+	 */
+	WalkCost _cost;
   
   public:
    /**
     * Initialize BarnesHutVisitor for a specific particle
     *
 	*  Parameters:
-    *  		me      Particle being processed
-    *  		theta   Ratio for Barnes G=Hut cutoff (Barnes and Hut recommend 1.0)
-    *  		G       Gravitational constant
-    *  		a       Softening length
+    *  		me          Particle being processed
+    *  		particles   All the particles
+    *  		criterion   Used to decide whether a node is distant enough to be treated as a whole
+    *  		G           Gravitational constant
+    *  		a           Softening length
+    *  		quadrupole  Use quadrupole moments of nodes, which must have been calculated
+    *  		tight_bounds Use tight bounding boxes of nodes, which must have been calculated, to decide whether to open them
+    *  		mixed_precision Calculate interactions with distant nodes in single precision
     */
-	BarnesHutVisitor(Particle& me, const double theta, const double G,const double a);
+	BarnesHutVisitor(Particle& me, ParticleStore & particles, const OpeningCriterion & criterion, const double G,const double a,
+					 const bool quadrupole=false, const bool tight_bounds=false, const bool mixed_precision=false);
+	
+	/**
+	 * Number of nodes and particles that this particle has interacted with, used to
+	 * estimate the cost of its walk in the next step
+	 */
+	const WalkCost & get_cost() const {return _cost;}
+	
+	/**
+	 * Magnitude of a particle's acceleration, which criteria may use as an estimate of
+	 * the acceleration that is about to be calculated.
+	 */
+	static inline double get_acceleration_magnitude(Particle & particle) {
+		const auto acceleration = particle.get_acceleration();
+		return sqrt(sqr(acceleration[0]) + sqr(acceleration[1]) + sqr(acceleration[2]));
+	}
 	
 	/**
 	 * Used to accumulate accelerations for each internal node
@@ -90,7 +156,7 @@ class BarnesHutVisitor :  public Node::Visitor{
 	Node::Visitor::Status visit_internal(Node * internal_node);
 	
 	/**
-	 * Used to accumulate accelerations for each external node
+	 * Used to accumulate accelerations from the particles in each external node
 	 *
 	 * Parameters:
 	 *   external_node   Current node while iterating over tree
@@ -100,21 +166,87 @@ class BarnesHutVisitor :  public Node::Visitor{
 	/**
 	 * Used at the end of calculation to store accelerations back into particle
 	 */
-	void store_accelerations() {_me.set_acceleration(_acceleration);}
+	void store_accelerations();
+	
+	/**
+	 * Calculate the factor, (dsq + a^2)^(-3/2), that multiplies G m (X - position) to give the 
+	 * acceleration caused by a mass m at X.
+	 *
+	 * Parameters:
+	 *     dsq     Squared distance from particle to mass
+	 *     a       Softening length
+	 */
+	static inline double get_softened_factor(const double dsq,const double a) {return InteractionKernel::get_softened_factor(dsq,a);}
+	
+	/**
+	 * Add the acceleration caused by the quadrupole moment of a node. This is the gradient
+	 * of the quadrupole term of the potential, G r'Qr/(2 |r|^5), where r is the displacement 
+	 * from the centre of mass; we soften |r| as we do for the monopole. This is shared with 
+	 * FlatTree, so both walks give the same result.
+	 *
+	 * Parameters:
+	 *     Q              Quadrupole moment of node
+	 *     X              Centre of mass of node
+	 *     position       Position of particle
+	 *     dsq            Squared distance from particle to centre of mass
+	 *     G              Gravitational constant
+	 *     a              Softening length
+	 *     acceleration   Acceleration of particle, to be updated
+	 */
+	static inline void add_quadrupole_acceleration(const Quadrupole & Q, const array<double,NDIM> & X, const array<double,NDIM> & position,
+												   const double dsq, const double G, const double a, array<double,NDIM> & acceleration) {
+		array<double,NDIM> r;
+		for (int i=0;i<NDIM;i++)
+			r[i] = position[i] - X[i];
+		array<double,NDIM> Qr = {0.0,0.0,0.0};
+		double rQr = 0.0;
+		for (int i=0;i<NDIM;i++) {
+			for (int j=0;j<NDIM;j++)
+				Qr[i] += Q[get_quadrupole_index(i,j)] * r[j];
+			rQr += r[i] * Qr[i];
+		}
+		const double r_sq = dsq + a*a;
+		const double factor5 = 1.0 / (r_sq * r_sq * sqrt(r_sq));
+		const double factor7 = 2.5 * rQr * factor5 / r_sq;
+		for (int i=0;i<NDIM;i++)
+			acceleration[i] += G * (Qr[i] * factor5 - r[i] * factor7);
+	}
 
   private:
   
 	/**
-	 * Used to add in the contribution to the acceleration from one Node
+	 * Used to add in the contribution to the acceleration from one point mass.
 	 * NB: there is a new instance of the visitor for each particle, so
 	 * acceleration is always zero at the start.
 	 *
 	 * Parameters:
 	 *     m       Mass contained in contibuting Node
 	 *     X       Center of mass of contibuting Node
+	 */
+	void _accumulate_acceleration(const double m,const array<double,NDIM> & X) {
+		_interactions.add(m,X);
+		_cost.n_particles++;
+	}
+	
+	/**
+	 * Used to add in the contribution to the acceleration from a Node that is
+	 * distant enough to be treated as a whole: its mass, and, if required, its quadrupole.
+	 *
+	 * Parameters:
+	 *     node    The contributing Node
+	 *     X       Center of mass of contibuting Node
 	 *     dsq     Squared distance from corrent particle to centre of mass of contibuting Node
 	 */
-	void _accumulate_acceleration(double m,array<double,NDIM> X,double dsq);
+	void _accumulate_node(Node * node,array<double,NDIM> X,double dsq);
+	
+	/**
+	 * Determine whether a node is distant enough to be treated as a whole
+	 *
+	 * Parameters:
+	 *     node    The Node
+	 *     dsq     Squared distance from corrent particle to centre of mass of Node
+	 */
+	bool _accept(Node * node,const double dsq);
 		
 };
 
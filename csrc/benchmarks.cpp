@@ -0,0 +1,674 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Benchmarks for the parts of the code that dominate execution time.
+ * 
+ * Usage: benchmarks.exe [number of particles]
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "barnes-hut.hpp"
+#include "center-of-mass.hpp"
+#include "acceleration.hpp"
+#include "direct-sum.hpp"
+#include "flat-tree.hpp"
+#include "fmm.hpp"
+#include "group-walk.hpp"
+#include "packet-walk.hpp"
+#include "space-filling-curve.hpp"
+#include "interaction-kernel.hpp"
+#include "test-utilities.hpp"
+#include "thread-pool.hpp"
+
+using namespace std;
+
+/**
+ *  Execute a function and determine how long it took
+ *
+ *  Returns:
+ *     Elapsed time in seconds
+ */
+double get_elapsed_time(function<void()> task){
+	auto start = chrono::high_resolution_clock::now();
+	task();
+	auto end = chrono::high_resolution_clock::now();
+	return chrono::duration<double>(end - start).count();
+}
+
+/**
+ *  Used to measure the shape of a tree
+ */
+class TreeStatistics : public Node::Visitor {
+  public:
+	int n_nodes = 0;
+	int n_external = 0;
+	double min_side = numeric_limits<double>::max();
+	
+	Node::Visitor::Status visit_internal(Node * node) {
+		n_nodes++;
+		return Node::Visitor::Status::Continue;
+	}
+	
+	Node::Visitor::Status visit_external(Node * node) {
+		n_nodes++;
+		n_external++;
+		min_side = min(min_side,node->get_side());
+		return Node::Visitor::Status::Continue;
+	}
+};
+
+/**
+ *  Compare the time for the force walk over the tree of Nodes with the walk over a FlatTree.
+ *  We report the memory occupied by each representation, as this determines how many
+ *  cache lines each walk touches.
+ */
+void benchmark_flat_tree(ParticleStore & particles, const int n, const double theta){
+	const int count = Node::get_count();
+	unique_ptr<Node> tree = Node::create(particles,n);
+	const int n_nodes = Node::get_count() - count;
+	CentreOfMassCalculator calculator(particles);
+	tree->traverse(calculator);
+	FlatTree flat_tree;
+	const auto time_build_flat = get_elapsed_time([&](){flat_tree.build(tree.get(),particles);});
+	GeometricCriterion criterion(theta);
+	
+	const auto time_nodes = get_elapsed_time([&](){
+		for (int i=0;i<n;i++){
+			BarnesHutVisitor visitor(particles[i],particles,criterion,1.0,0.01);
+			tree->traverse(visitor);
+			visitor.store_accelerations();
+		}
+	});
+	const auto time_flat = get_elapsed_time([&](){
+		for (int i=0;i<n;i++){
+			auto acceleration = flat_tree.get_acceleration(particles[i],criterion,1.0,0.01);
+			particles[i].set_acceleration(acceleration);
+		}
+	});
+	
+	cout << "Force walk, theta=" << theta << endl;
+	cout << setw(12) << "" << setw(12) << "Nodes" << setw(12) << "Bytes/Node" << setw(12) << "MBytes" << setw(12) << "Seconds" << endl;
+	cout << setw(12) << "Node" << setw(12) << n_nodes << setw(12) << sizeof(Node) 
+		 << setw(12) << n_nodes*sizeof(Node)/1.0e6 << setw(12) << time_nodes << endl;
+	cout << setw(12) << "FlatTree" << setw(12) << flat_tree.size() << setw(12) << sizeof(FlatNode) 
+		 << setw(12) << flat_tree.size()*sizeof(FlatNode)/1.0e6 << setw(12) << time_flat << endl;
+	cout << "Time to build FlatTree: " << time_build_flat << " seconds; speedup for walk: " << time_nodes/time_flat << endl << endl;
+}
+
+/**
+ *  Determine how bucket size affects number of nodes, depth of tree, 
+ *  and time to build tree and to calculate accelerations.
+ */
+void benchmark_buckets(ParticleStore & particles, const int n, const double theta){
+	cout << "Bucket size, theta=" << theta << endl;
+	cout << setw(12) << "Bucket" << setw(12) << "Nodes" << setw(12) << "External" << setw(12) << "Depth" 
+		 << setw(12) << "Build" << setw(12) << "Walk" << endl;
+	GeometricCriterion criterion(theta);
+	for (int bucket_size : {1,2,4,8,16,32}) {
+		unique_ptr<Node> tree;
+		const auto time_build = get_elapsed_time([&](){tree = Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=bucket_size});});
+		CentreOfMassCalculator calculator(particles);
+		tree->traverse(calculator);
+		TreeStatistics statistics;
+		tree->traverse(statistics);
+		const auto time_walk = get_elapsed_time([&](){
+			for (int i=0;i<n;i++){
+				BarnesHutVisitor visitor(particles[i],particles,criterion,1.0,0.01);
+				tree->traverse(visitor);
+				visitor.store_accelerations();
+			}
+		});
+		cout << setw(12) << bucket_size << setw(12) << statistics.n_nodes << setw(12) << statistics.n_external 
+			 << setw(12) << lround(log2(tree->get_side()/statistics.min_side))
+			 << setw(12) << time_build << setw(12) << time_walk << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare the time to update a tree after particles have drifted with the time to
+ *  build a new tree. Particles are moved by a fraction of the mean separation.
+ */
+void benchmark_update(ParticleStore & particles, const int n){
+	cout << "Update tree" << endl;
+	cout << setw(12) << "Step" << setw(12) << "Update" << setw(12) << "Build" << endl;
+	const TreeOptions options{.bucket_size=8};
+	shared_ptr<NodeArena> arena = make_shared<NodeArena>();
+	unique_ptr<Node> tree = Node::create(particles,n,false,0.1,options,arena);
+	for (double step : {1.0e-5,1.0e-4,1.0e-3}){
+		move_particles(particles,n,step);
+		bool updated;
+		const auto time_update = get_elapsed_time([&](){updated = tree->update(particles,n,options,*arena);});
+		const auto time_build = get_elapsed_time([&](){Node::create(particles,n,false,0.1,options);});
+		cout << setw(12) << step << setw(12) << (updated ? time_update : nan("")) << setw(12) << time_build << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare the time to build a tree and then calculate its moments in a separate pass
+ *  with the time to build it with moments calculated during construction.
+ */
+void benchmark_fused_moments(ParticleStore & particles, const int n){
+	cout << "Fused moments" << endl;
+	cout << setw(12) << "Bucket" << setw(12) << "Two pass" << setw(12) << "Fused" << endl;
+	shared_ptr<NodeArena> arena = make_shared<NodeArena>();
+	for (int bucket_size : {1,8}){
+		const auto time_two_pass = get_elapsed_time([&](){
+			unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=bucket_size},arena);
+			CentreOfMassCalculator calculator(particles);
+			tree->traverse(calculator);
+		});
+		const auto time_fused = get_elapsed_time([&](){
+			Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=bucket_size,.fused_moments=true},arena);
+		});
+		cout << setw(12) << bucket_size << setw(12) << time_two_pass << setw(12) << time_fused << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare the time to calculate moments serially with the time for the parallel pass
+ */
+void benchmark_parallel_moments(ParticleStore & particles, const int n){
+	cout << "Parallel moments" << endl;
+	cout << setw(12) << "Threads" << setw(12) << "Time" << endl;
+	unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=8});
+	for (int threads : {1,2,4,8}){
+		CentreOfMassCalculator calculator(particles);
+		const auto time = get_elapsed_time([&](){calculator.calculate(tree.get(),threads);});
+		cout << setw(12) << threads << setw(12) << time << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare the time for the force phase, i.e. building the tree and calculating all
+ *  accelerations, on one thread with the time on several, with the thread count
+ *  used for both phases.
+ */
+void benchmark_parallel_force(ParticleStore & particles, const int n, const double theta){
+	cout << "Parallel force walk, theta=" << theta << " (hardware threads: " << thread::hardware_concurrency() << ")" << endl;
+	cout << setw(12) << "Threads" << setw(12) << "Time" << setw(12) << "Speedup" << endl;
+	double time_serial = 0.0;
+	for (int threads : {1,2,4,8,16,64}){
+		AccelerationVisitor visitor(make_unique<GeometricCriterion>(theta),1.0,0.01,false,TreeOptions{.threads=threads,.bucket_size=8});
+		const auto time = get_elapsed_time([&](){
+			visitor.initialize(particles,n);
+			for (int i=0;i<n;i++)
+				visitor.visit(particles[i]);
+		});
+		if (threads == 1) time_serial = time;
+		cout << setw(12) << threads << setw(12) << time << setw(12) << time_serial/time << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Show how the force walk is divided between threads. The first step assumes that all
+ *  particles cost the same; later steps use the number of interactions recorded in the
+ *  previous one. For each step, show the busy time of each thread, and the ratio of the
+ *  largest share of the interactions to the mean, if the particles were divided into
+ *  equal numbers for each thread, which is what the cost model corrects.
+ */
+void benchmark_load_balance(ParticleStore & particles, const int n, const double theta, const int threads=4){
+	cout << "Load balance, theta=" << theta << ", threads=" << threads << " (hardware threads: " << thread::hardware_concurrency() << ")" << endl;
+	AccelerationVisitor visitor(make_unique<GeometricCriterion>(theta),1.0,0.01,false,TreeOptions{.threads=threads,.bucket_size=8});
+	for (int step=0;step<3;step++){
+		const auto time = get_elapsed_time([&](){visitor.initialize(particles,n);});
+		vector<double> shares(threads,0.0);
+		double total = 0;
+		for (int i=0;i<n;i++){
+			shares[(long)i*threads/n] += visitor.get_costs()[i];
+			total += visitor.get_costs()[i];
+		}
+		cout << "Step " << step << ": time " << time << ", imbalance of equal counts " << *max_element(shares.begin(),shares.end())*threads/total
+			 << ", busy times:";
+		for (double busy : visitor.get_busy_times())
+			cout << " " << busy;
+		cout << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare opening criteria: time for the walk over all particles, and RMS relative error
+ *  for a sample of particles, compared with the direct sum. The particles' accelerations 
+ *  must already have been calculated, as the relative criterion uses them.
+ */
+void benchmark_criteria(ParticleStore & particles, const int n){
+	const int n_sample = min(n,100);
+	unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=8});
+	CentreOfMassCalculator calculator(particles);
+	tree->traverse(calculator);
+	auto walk = [&](const OpeningCriterion & criterion,const int i){
+		Particle particle = particles[i];
+		BarnesHutVisitor visitor(particle,particles,criterion,1.0,0.01);
+		tree->traverse(visitor);
+		visitor.store_accelerations();
+		return particle.get_acceleration();
+	};
+	const auto exact = get_direct_accelerations(particles,n,n_sample);
+	
+	cout << "Opening criteria" << endl;
+	cout << setw(12) << "Criterion" << setw(12) << "Parameter" << setw(12) << "Walk" << setw(12) << "Error" << endl;
+	for (auto [name,theta,alpha] : {make_tuple("geometric",0.5,0.0),make_tuple("geometric",0.7,0.0),
+									make_tuple("bmax",0.5,0.0),make_tuple("bmax",0.7,0.0),
+									make_tuple("relative",0.5,0.001),make_tuple("relative",0.5,0.01)}){
+		unique_ptr<OpeningCriterion> criterion = OpeningCriterion::create(name,theta,alpha);
+		const auto time_walk = get_elapsed_time([&](){
+			for (int i=0;i<n;i++)
+				walk(*criterion,i);
+		});
+		vector<array<double,NDIM>> accelerations;
+		for (int i=0;i<n_sample;i++)
+			accelerations.push_back(walk(*criterion,i));
+		cout << setw(12) << name << setw(12) << (alpha > 0 ? alpha : theta) << setw(12) << time_walk 
+			 << setw(12) << get_rms_error(accelerations,exact) << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare the walk using cubes to decide whether to open nodes with the walk 
+ *  using tight bounding boxes: time, and RMS relative error for a sample of particles.
+ */
+void benchmark_tight_bounds(ParticleStore & particles, const int n){
+	const int n_sample = min(n,100);
+	unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=8});
+	CentreOfMassCalculator calculator(particles,false,true);
+	tree->traverse(calculator);
+	auto walk = [&](const OpeningCriterion & criterion,const bool tight_bounds,const int i){
+		Particle particle = particles[i];
+		BarnesHutVisitor visitor(particle,particles,criterion,1.0,0.01,false,tight_bounds);
+		tree->traverse(visitor);
+		visitor.store_accelerations();
+		return particle.get_acceleration();
+	};
+	const auto exact = get_direct_accelerations(particles,n,n_sample);
+	
+	cout << "Tight bounding boxes" << endl;
+	cout << setw(12) << "Theta" << setw(12) << "Bounds" << setw(12) << "Walk" << setw(12) << "Error" << endl;
+	for (double theta : {0.5,0.7})
+		for (bool tight_bounds : {false,true}){
+			GeometricCriterion criterion(theta);
+			const auto time_walk = get_elapsed_time([&](){
+				for (int i=0;i<n;i++)
+					walk(criterion,tight_bounds,i);
+			});
+			vector<array<double,NDIM>> accelerations;
+			for (int i=0;i<n_sample;i++)
+				accelerations.push_back(walk(criterion,tight_bounds,i));
+			cout << setw(12) << theta << setw(12) << (tight_bounds ? "tight" : "cube") << setw(12) << time_walk 
+				 << setw(12) << get_rms_error(accelerations,exact) << endl;
+		}
+	cout << endl;
+}
+
+/**
+ *  Compare the implementations of the interaction kernel that this processor supports:
+ *  rate, in millions of interactions per second, and largest relative difference from scalar.
+ *  The single precision times include calculating the displacements in double precision,
+ *  as InteractionList::add_far() does.
+ */
+void benchmark_kernel(ParticleStore & particles, const int n){
+	const int n_sources = min(n,1024);
+	const int n_targets = min(n,1000);
+	vector<double> x(n_sources), y(n_sources), z(n_sources), m(n_sources);
+	for (int j=0;j<n_sources;j++){
+		const auto X = particles[j].get_position();
+		x[j] = X[0];
+		y[j] = X[1];
+		z[j] = X[2];
+		m[j] = particles[j].get_mass();
+	}
+	auto calculate = [&](const InteractionKernel::Implementation implementation,vector<array<double,NDIM>> & accelerations){
+		for (int i=0;i<n_targets;i++){
+			accelerations[i] = {0.0,0.0,0.0};
+			InteractionKernel::accumulate(x.data(),y.data(),z.data(),m.data(),n_sources,particles[n-1-i].get_position(),0.01,
+										  accelerations[i],implementation);
+		}
+	};
+	vector<array<double,NDIM>> scalar(n_targets);
+	calculate(InteractionKernel::Scalar,scalar);
+	
+	cout << "Interaction kernel" << endl;
+	cout << setw(12) << "Kernel" << setw(12) << "Time" << setw(12) << "Mint/s" << setw(12) << "Difference" << endl;
+	for (auto implementation : {InteractionKernel::Scalar,InteractionKernel::AVX2,InteractionKernel::AVX512}){
+		if (!InteractionKernel::is_supported(implementation)) continue;
+		vector<array<double,NDIM>> accelerations(n_targets);
+		const auto time = get_elapsed_time([&](){calculate(implementation,accelerations);});
+		double difference = 0.0;
+		for (int i=0;i<n_targets;i++)
+			for (int k=0;k<NDIM;k++)
+				difference = max(difference,fabs(accelerations[i][k] - scalar[i][k])/fabs(scalar[i][k]));
+		const char * names[] = {"scalar","avx2","avx512"};
+		cout << setw(12) << names[implementation] << setw(12) << time << setw(12) << 1.0e-6*n_sources*n_targets/time 
+			 << setw(12) << difference << endl;
+	}
+	for (auto implementation : {InteractionKernel::Scalar,InteractionKernel::AVX2,InteractionKernel::AVX512}){
+		if (!InteractionKernel::is_supported(implementation)) continue;
+		vector<array<double,NDIM>> accelerations(n_targets);
+		vector<float> dx(n_sources), dy(n_sources), dz(n_sources), m_float(m.begin(),m.end());
+		const auto time = get_elapsed_time([&](){
+			for (int i=0;i<n_targets;i++){
+				const auto position = particles[n-1-i].get_position();
+				for (int j=0;j<n_sources;j++){
+					dx[j] = x[j] - position[0];
+					dy[j] = y[j] - position[1];
+					dz[j] = z[j] - position[2];
+				}
+				accelerations[i] = {0.0,0.0,0.0};
+				InteractionKernel::accumulate_float(dx.data(),dy.data(),dz.data(),m_float.data(),n_sources,0.01f,
+													accelerations[i],implementation);
+			}
+		});
+		double difference = 0.0;
+		for (int i=0;i<n_targets;i++)
+			for (int k=0;k<NDIM;k++)
+				difference = max(difference,fabs(accelerations[i][k] - scalar[i][k])/fabs(scalar[i][k]));
+		const char * names[] = {"float","avx2-float","avx512-float"};
+		cout << setw(12) << names[implementation] << setw(12) << time << setw(12) << 1.0e-6*n_sources*n_targets/time 
+			 << setw(12) << difference << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare the walk for each particle with the group walk for several group sizes:
+ *  time, and RMS relative error for a sample of particles.
+ */
+void benchmark_group_walk(ParticleStore & particles, const int n, const double theta){
+	const int n_sample = min(n,100);
+	unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=8});
+	CentreOfMassCalculator calculator(particles);
+	tree->traverse(calculator);
+	const auto exact = get_direct_accelerations(particles,n,n_sample);
+	
+	GeometricCriterion criterion(theta);
+	cout << "Group walk, theta=" << theta << endl;
+	cout << setw(12) << "Group" << setw(12) << "Groups" << setw(12) << "Walk" << setw(12) << "Error" << endl;
+	const auto time_particle = get_elapsed_time([&](){
+		for (int i=0;i<n;i++){
+			BarnesHutVisitor visitor(particles[i],particles,criterion,1.0,0.01);
+			tree->traverse(visitor);
+			visitor.store_accelerations();
+		}
+	});
+	cout << setw(12) << "none" << setw(12) << n << setw(12) << time_particle << setw(12) << get_rms_error(particles,exact) << endl;
+	for (int group_size : {8,16,32,64}){
+		GroupWalk walk(criterion,1.0,0.01,false,false,group_size);
+		const auto time_group = get_elapsed_time([&](){walk.calculate(tree.get(),particles);});
+		cout << setw(12) << group_size << setw(12) << walk.get_n_groups() << setw(12) << time_group << setw(12) << get_rms_error(particles,exact) << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare the walk for each particle with the packet walk, which gives the
+ *  same accelerations, for several packet sizes.
+ */
+void benchmark_packet_walk(ParticleStore & particles, const int n, const string & name){
+	unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=8});
+	CentreOfMassCalculator calculator(particles);
+	tree->traverse(calculator);
+	GeometricCriterion criterion(0.5);
+	cout << "Packet walk, " << name << endl;
+	cout << setw(12) << "Packet" << setw(12) << "Walk" << endl;
+	const auto time_particle = get_elapsed_time([&](){
+		for (int i=0;i<n;i++){
+			BarnesHutVisitor visitor(particles[i],particles,criterion,1.0,0.01);
+			tree->traverse(visitor);
+			visitor.store_accelerations();
+		}
+	});
+	cout << setw(12) << "none" << setw(12) << time_particle << endl;
+	for (int width : {4,8,16}){
+		PacketWalk walk(criterion,1.0,0.01,false,false,width);
+		cout << setw(12) << width << setw(12) << get_elapsed_time([&](){walk.calculate(tree.get(),particles);}) << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare Barnes Hut with the Fast Multipole Method, one sided and mutual, so they can be
+ *  compared at the same RMS relative error: time to build tree and calculate all accelerations.
+ *  The accelerations of a sample of particles are compared with direct summation.
+ */
+void benchmark_fmm(ParticleStore & particles, const int n){
+	const int n_sample = min(n,100);
+	const auto exact = get_direct_accelerations(particles,n,n_sample);
+	auto run = [&](IAccelerationVisitor & visitor){
+		return get_elapsed_time([&](){
+			visitor.initialize(particles,n);
+			for (int i=0;i<n;i++)
+				visitor.visit(particles[i]);
+		});
+	};
+	const TreeOptions options{.bucket_size=8};
+	cout << "Fast Multipole Method" << endl;
+	cout << setw(12) << "Method" << setw(12) << "Theta" << setw(12) << "Time" << setw(12) << "Error" << endl;
+	for (double theta : {0.3,0.5,0.7}){
+		AccelerationVisitor barnes_hut(make_unique<GeometricCriterion>(theta),1.0,0.01,false,options);
+		const auto time = run(barnes_hut);
+		cout << setw(12) << "barnes-hut" << setw(12) << theta << setw(12) << time << setw(12) << get_rms_error(particles,exact) << endl;
+	}
+	for (double theta : {0.3,0.4,0.5,0.6,0.7}){
+		FastMultipoleMethod fmm(theta,1.0,0.01,options);
+		const auto time = run(fmm);
+		cout << setw(12) << "fmm" << setw(12) << theta << setw(12) << time << setw(12) << get_rms_error(particles,exact) << endl;
+	}
+	for (double theta : {0.3,0.4,0.5,0.6,0.7}){
+		FastMultipoleMethod falcon(theta,1.0,0.01,options,true);
+		const auto time = run(falcon);
+		cout << setw(12) << "falcon" << setw(12) << theta << setw(12) << time << setw(12) << get_rms_error(particles,exact) << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare mixed precision with double precision, for the Barnes Hut visitor and the
+ *  flat tree: time to calculate all accelerations, and RMS relative difference from the
+ *  accelerations calculated in double precision.
+ */
+void benchmark_mixed_precision(ParticleStore & particles, const int n){
+	auto run = [&](const TreeOptions & options, const double theta){
+		AccelerationVisitor visitor(make_unique<GeometricCriterion>(theta),1.0,0.01,false,options);
+		visitor.initialize(particles,n);
+		const auto time = get_elapsed_time([&](){
+			for (int i=0;i<n;i++)
+				visitor.visit(particles[i]);
+		});
+		vector<array<double,NDIM>> accelerations;
+		for (int i=0;i<n;i++)
+			accelerations.push_back(particles[i].get_acceleration());
+		return make_pair(time,accelerations);
+	};
+	cout << "Mixed precision" << endl;
+	cout << setw(12) << "Walk" << setw(12) << "Theta" << setw(12) << "Double" << setw(12) << "Mixed" << setw(12) << "Difference" << endl;
+	for (const bool flat : {false,true})
+		for (double theta : {0.5,1.0}) {
+			TreeOptions options{.flat=flat,.bucket_size=8,.quadrupole=true};
+			const auto [time_double,expected] = run(options,theta);
+			options.mixed_precision = true;
+			const auto [time_mixed,accelerations] = run(options,theta);
+			cout << setw(12) << (flat ? "flat" : "barnes-hut") << setw(12) << theta << setw(12) << time_double
+				 << setw(12) << time_mixed << setw(12) << get_rms_error(accelerations,expected) << endl;
+		}
+	cout << endl;
+}
+
+/**
+ *  Compare the cost of creating threads for each phase of a step with the cost of
+ *  reusing the threads of a pool: mean time for one drift of the particles' positions.
+ */
+void benchmark_thread_pool(ParticleStore & particles, const int threads=4){
+	cout << "Thread pool, threads=" << threads << " (hardware threads: " << thread::hardware_concurrency() << ")" << endl;
+	cout << setw(12) << "N" << setw(12) << "Spawn" << setw(12) << "Pool" << endl;
+	const int repeats = 200;
+	ThreadPool pool(threads);
+	for (int n : {100,1000,10000,100000}){
+		if (n > particles.size()) break;
+		auto drift = [&](const int i){
+			array<double,NDIM> position = particles[i].get_position();
+			for (int j=0;j<NDIM;j++)
+				position[j] += 1.0e-9 * particles[i].get_velocity()[j];
+			particles[i].set_position(position);
+		};
+		const auto time_spawn = get_elapsed_time([&](){
+			for (int k=0;k<repeats;k++) {
+				vector<thread> workers;
+				for (int t=0;t<threads;t++)
+					workers.push_back(thread([&](int thread){
+						for (int i=(long)thread*n/threads;i<(long)(thread+1)*n/threads;i++)
+							drift(i);
+					},t));
+				for (auto & worker : workers)
+					worker.join();
+			}
+		});
+		const auto time_pool = get_elapsed_time([&](){
+			for (int k=0;k<repeats;k++)
+				pool.parallel_for(n,drift);
+		});
+		cout << setw(12) << n << setw(12) << time_spawn/repeats << setw(12) << time_pool/repeats << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Compare a Leapfrog drift performed one particle at a time, through the Particle proxies,
+ *  as the integrator used to, with one performed on the arrays of the ParticleStore.
+ */
+void benchmark_particle_store(ParticleStore & particles, const int n){
+	cout << "Particle store: mean time for one drift" << endl;
+	cout << setw(12) << "Proxies" << setw(12) << "Arrays" << endl;
+	const int repeats = 100;
+	const double dt = 1.0e-9;
+	const auto time_proxies = get_elapsed_time([&](){
+		for (int k=0;k<repeats;k++)
+			for (int i=0;i<n;i++) {
+				array<double,NDIM> position = particles[i].get_position();
+				array<double,NDIM> velocity = particles[i].get_velocity();
+				for (int j=0;j<NDIM;j++)
+					position[j] += dt * velocity[j];
+				particles[i].set_position(position);
+			}
+	});
+	auto positions = particles.get_positions();
+	auto velocities = particles.get_velocities();
+	const auto time_arrays = get_elapsed_time([&](){
+		for (int k=0;k<repeats;k++)
+			for (int j=0;j<NDIM;j++)
+				for (int i=0;i<n;i++)
+					positions[j][i] += dt * velocities[j][i];
+	});
+	cout << setw(12) << time_proxies/repeats << setw(12) << time_arrays/repeats << endl << endl;
+}
+
+/**
+ *  Compare the force walk, for Node and FlatTree, with particles stored in the order
+ *  in which they were created, and sorted along Morton and Hilbert curves. Uses a
+ *  separate store, so the order of the particles used by the other benchmarks is unchanged.
+ */
+void benchmark_reordering(const int n, const double theta){
+	cout << "Reordering along space-filling curve, theta=" << theta << endl;
+	cout << setw(12) << "Order" << setw(12) << "Sort" << setw(12) << "Node" << setw(12) << "FlatTree" << endl;
+	ParticleStore particles = create_clustered_particles(n);
+	auto get_time = [&](const bool flat){
+		const TreeOptions tree_options{.flat=flat};
+		AccelerationVisitor visitor(make_unique<GeometricCriterion>(theta),1.0,0.01,false,tree_options);
+		visitor.initialize(particles,n);
+		return get_elapsed_time([&](){
+			for (int i=0;i<n;i++)
+				visitor.visit(particles[i]);
+		});
+	};
+	cout << setw(12) << "none" << setw(12) << 0 << setw(12) << get_time(false) << setw(12) << get_time(true) << endl;
+	for (auto [type,name] : {make_pair(SpaceFillingCurve::Morton,"morton"),make_pair(SpaceFillingCurve::Hilbert,"hilbert")}) {
+		const auto time_sort = get_elapsed_time([&](){
+			particles.permute(SpaceFillingCurve::get_order(particles,type));
+		});
+		cout << setw(12) << name << setw(12) << time_sort << setw(12) << get_time(false) << setw(12) << get_time(true) << endl;
+	}
+	cout << endl;
+}
+
+/**
+ *  Find the number of particles below which direct summation is faster than the tree:
+ *  mean time for one step, for Barnes Hut with the default theta and with 0.5, and for
+ *  direct summation, one sided and symmetric, on one thread and on several.
+ */
+void benchmark_direct_sum(const int threads=4){
+	cout << "Direct summation" << endl;
+	cout << setw(8) << "N" << setw(12) << "BH(1.0)" << setw(12) << "BH(0.5)" << setw(12) << "One sided"
+		 << setw(12) << "Symmetric" << setw(12) << "Threads" << endl;
+	for (int n : {32,64,128,256,512,1024,2048,4096,8192}){
+		ParticleStore particles = create_clustered_particles(n);
+		const int repetitions = max(1,20000000/(n*n));
+		auto get_time = [&](IAccelerationVisitor & visitor){
+			return get_elapsed_time([&](){
+				for (int i=0;i<repetitions;i++){
+					visitor.initialize(particles,n);
+					for (int j=0;j<n;j++)
+						visitor.visit(particles[j]);
+				}
+			}) / repetitions;
+		};
+		AccelerationVisitor coarse(make_unique<GeometricCriterion>(1.0),1.0,0.01,false);
+		AccelerationVisitor fine(make_unique<GeometricCriterion>(0.5),1.0,0.01,false);
+		DirectSumAccelerationVisitor one_sided(1.0,0.01,1,false);
+		DirectSumAccelerationVisitor symmetric(1.0,0.01,1,true);
+		DirectSumAccelerationVisitor parallel(1.0,0.01,threads,true);
+		cout << setw(8) << n << setw(12) << get_time(coarse) << setw(12) << get_time(fine) << setw(12) << get_time(one_sided)
+			 << setw(12) << get_time(symmetric) << setw(12) << get_time(parallel) << endl;
+	}
+	cout << endl;
+}
+
+int main(int argc, char **argv) {
+	const int n = argc > 1 ? atoi(argv[1]) : 100000;
+	cout << "Benchmarks for " << n << " particles" << endl << endl;
+	ParticleStore particles = create_clustered_particles(n);
+	benchmark_flat_tree(particles,n,0.5);
+	benchmark_buckets(particles,n,0.5);
+	benchmark_update(particles,n);
+	benchmark_fused_moments(particles,n);
+	benchmark_parallel_moments(particles,n);
+	benchmark_parallel_force(particles,n,0.5);
+	benchmark_load_balance(particles,n,0.5);
+	benchmark_thread_pool(particles);
+	benchmark_particle_store(particles,n);
+	benchmark_reordering(n,0.5);
+	benchmark_criteria(particles,n);
+	benchmark_tight_bounds(particles,n);
+	benchmark_kernel(particles,n);
+	benchmark_group_walk(particles,n,0.5);
+	benchmark_packet_walk(particles,n,"clustered");
+	ParticleStore disc = create_disc_particles(n);
+	benchmark_packet_walk(disc,n,"disc");
+	benchmark_fmm(particles,n);
+	benchmark_mixed_precision(particles,n);
+	benchmark_direct_sum();
+	return EXIT_SUCCESS;
+}
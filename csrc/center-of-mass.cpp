@@ -15,22 +15,114 @@
  * along with this software.  If not, see <http://www.gnu.org/licenses/>
  */
  
+#include <atomic>
+
 #include "center-of-mass.hpp"
+#include "thread-pool.hpp"
 
 using namespace std;
 
-CentreOfMassCalculator::CentreOfMassCalculator(unique_ptr<Particle[]> &particles) 
- : _particles(particles) {}
+/**
+ * Used by CentreOfMassCalculator::calculate() to find the Internal nodes
+ * at one level of the tree, so they can be processed concurrently.
+ */
+class SubtreeCollector : public Node::Visitor {
+  private:
+	const int _partition_level;
+	
+	int _level = 0;
+	
+  public:
+	vector<Node*> subtrees;
+	
+	SubtreeCollector(const int partition_level) : _partition_level(partition_level) {}
+	
+	Node::Visitor::Status visit_internal(Node * internal_node) {
+		if (_level == _partition_level) {
+			subtrees.push_back(internal_node);
+			return Node::Visitor::Status::DontDescend;
+		}
+		_level++;
+		return Node::Visitor::Status::Continue;
+	}
+	
+	Node::Visitor::Status visit_external(Node * external_node) {return Node::Visitor::Status::Continue;}
+	
+	void depart(Node * internal_node) {_level--;}
+};
+
+CentreOfMassCalculator::CentreOfMassCalculator(ParticleStore &particles, const bool quadrupole, const bool tight_bounds) 
+ : _particles(particles), _quadrupole(quadrupole), _tight_bounds(tight_bounds) {}
+
+/**
+ * Calculate masses and centres of mass for a tree. We find the Internal nodes at the 
+ * level that is used to partition the tree for a parallel build. Each thread takes 
+ * subtrees in turn and traverses them with its own calculator. Then we traverse the 
+ * levels above, without descending into the subtrees. Every node is calculated by the 
+ * same code, with its children in the same order, as in a serial traversal, so the
+ * results are bitwise identical.
+ *
+ * Parameters:
+ *     root      Root of tree
+ *     threads   Number of threads
+ */
+void CentreOfMassCalculator::calculate(Node * root, const int threads) {
+	if (threads < 2) {
+		root->traverse(*this);
+		return;
+	}
+	const int partition_level = Node::_get_partition_level(threads);
+	SubtreeCollector collector(partition_level);
+	root->traverse(collector);
+	
+	vector<int> n_escaped(threads,0);
+	atomic<int> next_subtree = 0;
+	ThreadPool::run_in_parallel(threads,[&](int thread){
+		CentreOfMassCalculator calculator(_particles,_quadrupole,_tight_bounds);
+		for (int i=next_subtree++;i<static_cast<int>(collector.subtrees.size());i=next_subtree++)
+			collector.subtrees[i]->traverse(calculator);
+		n_escaped[thread] = calculator.get_n_escaped();
+	});
+	for (int n : n_escaped)
+		_n_escaped += n;
+	
+	_partition_level = partition_level;
+	_level = 0;
+	root->traverse(*this);
+	_partition_level = -1;
+}
+
+/**
+ * Called for each internal node: clear mass and centre of mass, so we can 
+ * accumulate them from children. They may have been calculated already, 
+ * if the tree has been updated instead of being built from scratch.
+ */
+Node::Visitor::Status CentreOfMassCalculator::visit_internal(Node * internal_node) {
+	if (_level == _partition_level) return Node::Visitor::Status::DontDescend;  // Calculated already by calculate()
+	_level++;
+	internal_node->set_mass(0.0);
+	internal_node->set_centre_of_mass({0.0,0.0,0.0});
+	return Node::Visitor::Status::Continue;
+}
 
 /**
- * Called for each External Node: record the position and mass of the particle
+ * Called for each External Node: record the total mass and centre of mass of the 
+ * particles in its bucket, and quadrupole moment and bounding box if required. We also count 
+ * particles that have left the cube, as this indicates that tree needs to be rebuilt.
  */
 
 Node::Visitor::Status CentreOfMassCalculator::visit_external(Node * external_node) {
-	const int particle_index = external_node->get_index(); 
-	Particle & particle = _particles[particle_index];
-	external_node->set_mass(particle.get_mass());
-	external_node->set_centre_of_mass(particle.get_position());
+	const auto bucket = external_node->get_particles();
+	for (int particle_index : bucket)
+		if (!external_node->contains(_particles[particle_index].get_position()))
+			_n_escaped++;
+	const auto [m,X] = external_node->get_bucket_moments(_particles);
+	external_node->set_mass(m);
+	external_node->set_centre_of_mass(X);
+	if (_quadrupole)
+		external_node->set_quadrupole_from_bucket(_particles);
+	if (_tight_bounds)
+		external_node->set_bounds_from_bucket(_particles);
 	return Node::Visitor::Status::Continue;
 }
 
@@ -47,13 +139,20 @@ void CentreOfMassCalculator::accumulate(Node * internal_node,Node * child){
  * This is called when we finish processing an internal Node, after all children 
  * have been processed. At this stage we have accumulated the total mass, and a weighted 
  * sum of positions of centres for children. Divide weighted sum by total mass,
- * and store total mass and centre of mass.
+ * and store total mass and centre of mass. The quadrupole moment, if required,
+ * depends on the centre of mass, so it can only be calculated now. The bounding
+ * box, if required, is the union of the children's boxes.
  */
 void CentreOfMassCalculator::depart(Node * internal_node)  {
+	_level--;
 	const auto m = internal_node->get_mass();
 	auto X = internal_node->get_centre_of_mass();
 	for (int i=0;i<NDIM;i++)
 		X[i] /= m;
 	internal_node->set_centre_of_mass(X);
+	if (_quadrupole)
+		internal_node->set_quadrupole_from_children();
+	if (_tight_bounds)
+		internal_node->set_bounds_from_children();
 }
 
@@ -32,7 +32,33 @@ class CentreOfMassCalculator : public Node::Visitor {
    /**
     * These are the particles whose centre of mass is to be calculated. 
     */
-	unique_ptr<Particle[]> & _particles;
+	ParticleStore & _particles;
+	
+	/**
+	 * Number of particles that are outside the cube of their External node
+	 */
+	int _n_escaped = 0;
+	
+	/**
+	 * Indicates that quadrupole moments are to be calculated
+	 */
+	const bool _quadrupole;
+	
+	/**
+	 * Indicates that tight bounding boxes are to be calculated
+	 */
+	const bool _tight_bounds;
+	
+	/**
+	 * Used by calculate() when the subtrees at this level have been calculated 
+	 * already, so we mustn't descend into them; -1 means that we traverse the whole tree.
+	 */
+	int _partition_level = -1;
+	
+	/**
+	 * Level of the node that is currently being visited
+	 */
+	int _level = 0;
 	
   public:
   
@@ -40,19 +66,32 @@ class CentreOfMassCalculator : public Node::Visitor {
     * Create CentreOfMassCalculator.
 	*
 	* Parameters:
-	*   	particles These are the particles whose centre of mass is to be calculated. 
+	*   	particles  These are the particles whose centre of mass is to be calculated. 
+	*   	quadrupole   Calculate quadrupole moments also
+	*   	tight_bounds Calculate tight bounding boxes also
     */
-	CentreOfMassCalculator(unique_ptr<Particle[]> &particles);
+	CentreOfMassCalculator(ParticleStore &particles, const bool quadrupole=false, const bool tight_bounds=false);
+	
+	/**
+	 * Calculate masses and centres of mass for a tree. The subtrees below the top 
+	 * levels are processed concurrently, then the top levels are processed serially.
+	 * The results are bitwise identical to root->traverse(*this).
+	 *
+	 * Parameters:
+	 *     root      Root of tree
+	 *     threads   Number of threads
+	 */
+	void calculate(Node * root, const int threads);
 	
 	/**
-	 * Called for each internal node: dummy -- does nothing.
+	 * Called for each internal node: clear mass and centre of mass, so we can 
+	 * accumulate them from children. They may have been calculated already, 
+	 * if the tree has been updated instead of being built from scratch.
 	 */
-	Node::Visitor::Status visit_internal(Node * internal_node) {
-		return Node::Visitor::Status::Continue;
-	}
+	Node::Visitor::Status visit_internal(Node * internal_node);
 	
 	/**
-	 * Called for each external node: record the position and mass of the particle
+	 * Called for each external node: record the mass and centre of mass of the particles in its bucket
 	 */
 	Node::Visitor::Status visit_external(Node * external_node);
 	
@@ -69,6 +108,12 @@ class CentreOfMassCalculator : public Node::Visitor {
 	 */
 	virtual void depart(Node * internal_node);
 	
+	/**
+	 * Number of particles that are outside the cube of their External node. This
+	 * can only be non zero if particles have moved since the tree was built.
+	 */
+	int get_n_escaped() {return _n_escaped;}
+	
 };
 
 #endif   //_CENTRE_OF_MASS_HPP
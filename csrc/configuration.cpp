@@ -73,7 +73,7 @@ Configuration::Configuration(string file_name){
 		throw invalid_argument( "Could not open configuration file " + file_name);
 	
 	_n = Configuration::_get_line_count(inputFile) - 6;
-	_particles = make_unique<Particle[]>(_n);
+	_particles = ParticleStore(_n);
 	
 	auto index = 0;
 	string line;
@@ -124,7 +124,7 @@ Configuration::Configuration(string file_name){
  */
 Configuration::Configuration(int n, double particles[]){
 	_n = n;
-	_particles = make_unique<Particle[]>(_n);
+	_particles = ParticleStore(_n);
 	for (int index=0;index<n;index++){
 		auto position = array{particles[7*index],particles[7*index+1],particles[7*index+2]};
 		auto mass = particles[7*index+3];
@@ -194,9 +194,11 @@ Configuration::Configuration(int n, double particles[]){
  */
 array<double,NDIM>  Configuration::get_momentum(){
 	array<double,NDIM> momentum = {0.0,0.0,0.0};
-	for (int i=0;i<_n;i++)
-		for (int j=0;j<NDIM;j++)
-			momentum[j] += _particles[i].get_mass() * _particles[i].get_velocity()[j];
+	const auto m = _particles.get_masses();
+	const auto velocities = _particles.get_velocities();
+	for (int j=0;j<NDIM;j++)
+		for (int i=0;i<_n;i++)
+			momentum[j] += m[i] * velocities[j][i];
 		
 	return momentum;
 }
@@ -209,6 +211,26 @@ void Configuration::iterate(Visitor<Particle> & visitor) {
 		visitor.visit(_particles[i]);	
 }
 
+/**
+ * Visit all Particles in order of ID, i.e. in the order of the configuration file,
+ * however they have been reordered.
+ */
+void Configuration::iterate_by_id(Visitor<Particle> & visitor) {
+	for (int slot : _particles.get_slots_by_id())
+		visitor.visit(_particles[slot]);
+}
+
+/**
+ * Sort particles along a space-filling curve, so particles that are close in space
+ * are close in memory. Each particle keeps its ID.
+ *
+ * Parameters:
+ *     type    Morton or Hilbert
+ */
+void Configuration::reorder(const SpaceFillingCurve::Type type) {
+	_particles.permute(SpaceFillingCurve::get_order(_particles,type));
+}
+
 /**
  * Used to initialize data structures that need to know about particles.
  */
@@ -22,6 +22,7 @@
 #include <string> 
 #include <vector>
 #include "particle.hpp"
+#include "space-filling-curve.hpp"
 
 using namespace std;
 	
@@ -39,7 +40,7 @@ class Configuration {
 	/**
 	 *   The particles making up the model
 	 */
-	unique_ptr<Particle[]> _particles;
+	ParticleStore _particles;
 	
 	/**
 	 *   The number of particles
@@ -94,11 +95,36 @@ class Configuration {
 	 */
 	const string get_version() { return _version;}
 	
+	/**
+	 *    Number of particles
+	 */
+	int get_n() { return _n;}
+	
+	/**
+	 *    The particles, for code that works on their arrays directly
+	 */
+	ParticleStore & get_particles() { return _particles;}
+	
 	/**
 	 * iterate through all Particles, visiting each in turn
 	 */
 	void iterate(Visitor<Particle> & visitor);
 	
+	/**
+	 * Visit all Particles in order of ID, i.e. in the order of the configuration file,
+	 * however they have been reordered.
+	 */
+	void iterate_by_id(Visitor<Particle> & visitor);
+	
+	/**
+	 * Sort particles along a space-filling curve, so particles that are close in space
+	 * are close in memory. Each particle keeps its ID.
+	 *
+	 * Parameters:
+	 *     type    Morton or Hilbert
+	 */
+	void reorder(const SpaceFillingCurve::Type type);
+	
 	/**
 	 * Used to initialize data structures that need to know about particles.
 	 */
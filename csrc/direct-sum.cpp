@@ -0,0 +1,159 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <algorithm>
+#include <atomic>
+
+#include "direct-sum.hpp"
+#include "thread-pool.hpp"
+
+using namespace std;
+
+/**
+ *  Parameters:
+ *      G           Gravitational constant
+ *      a           Softening length
+ *      threads     Number of threads
+ *      symmetric   Process each pair of particles once, and apply the force to both
+ */
+DirectSumAccelerationVisitor::DirectSumAccelerationVisitor(const double G, const double a, const int threads, const bool symmetric)
+	: _G(G), _a(a), _threads(max(threads,1)), _symmetric(symmetric) {}
+
+/**
+ *  Calculate accelerations from the arrays of positions and masses in the store,
+ *  and store them in its arrays of accelerations.
+ *
+ *  Parameters:
+ *      particles    Pointer to particles
+ *      n            Number of particles
+ */
+void DirectSumAccelerationVisitor::initialize(ParticleStore & particles, int n) {
+	_x = particles.get_positions()[0].data();
+	_y = particles.get_positions()[1].data();
+	_z = particles.get_positions()[2].data();
+	_m = particles.get_masses().data();
+	if (_symmetric)
+		_calculate_symmetric(n);
+	else
+		_calculate_one_sided(n);
+	auto accelerations = particles.get_accelerations();
+	for (int i=0;i<n;i++) {
+		accelerations[0][i] = _G*_ax[i];
+		accelerations[1][i] = _G*_ay[i];
+		accelerations[2][i] = _G*_az[i];
+	}
+}
+
+/**
+ *  Calculate the accelerations of all particles, visiting each pair in both directions.
+ *  Each thread takes tiles of particles in turn, and sums over the other particles one
+ *  tile at a time. Each particle is skipped in its own tile by calling the kernel
+ *  for the particles on either side.
+ */
+void DirectSumAccelerationVisitor::_calculate_one_sided(const int n) {
+	_ax.assign(n,0.0);
+	_ay.assign(n,0.0);
+	_az.assign(n,0.0);
+	const int n_tiles = (n + TileSize - 1) / TileSize;
+	atomic<int> next_tile = 0;
+	auto task = [&](int thread){
+		array<array<double,NDIM>,TileSize> accelerations;
+		for (int tile=next_tile++;tile<n_tiles;tile=next_tile++) {
+			const int first = tile * TileSize;
+			const int last = min(first + TileSize,n);
+			for (int i=first;i<last;i++)
+				accelerations[i-first] = {0.0,0.0,0.0};
+			for (int j0=0;j0<n;j0+=TileSize) {
+				const int j1 = min(j0 + TileSize,n);
+				for (int i=first;i<last;i++) {
+					const array<double,NDIM> position = {_x[i],_y[i],_z[i]};
+					if (i < j0 || i >= j1)
+						InteractionKernel::accumulate(_x+j0,_y+j0,_z+j0,_m+j0,j1-j0,
+													  position,_a,accelerations[i-first]);
+					else {
+						InteractionKernel::accumulate(_x+j0,_y+j0,_z+j0,_m+j0,i-j0,
+													  position,_a,accelerations[i-first]);
+						InteractionKernel::accumulate(_x+i+1,_y+i+1,_z+i+1,_m+i+1,j1-i-1,
+													  position,_a,accelerations[i-first]);
+					}
+				}
+			}
+			for (int i=first;i<last;i++) {
+				_ax[i] = accelerations[i-first][0];
+				_ay[i] = accelerations[i-first][1];
+				_az[i] = accelerations[i-first][2];
+			}
+		}
+	};
+	if (_threads > 1)
+		ThreadPool::run_in_parallel(_threads,task);
+	else
+		task(0);
+}
+
+/**
+ *  Calculate the accelerations of all particles, visiting each pair once. Each thread processes
+ *  the pairs within a row of tiles, and between it and each later tile. Particles in other rows
+ *  may be updated by any thread, so each thread has its own copy of the accelerations. Rows are
+ *  dealt out in turn, thread t taking rows t, t+threads, ..., so the early rows, which have the
+ *  most pairs, are spread over all threads. Once all threads have finished, each adds up the
+ *  copies for its own share of the particles. As the rows are assigned statically, and the
+ *  copies are added in order of thread, the result is the same from one run to the next.
+ */
+void DirectSumAccelerationVisitor::_calculate_symmetric(const int n) {
+	_ax.assign(_threads*n,0.0);
+	_ay.assign(_threads*n,0.0);
+	_az.assign(_threads*n,0.0);
+	const int n_tiles = (n + TileSize - 1) / TileSize;
+	auto task = [&](int thread){
+		double * ax = _ax.data() + thread*n;
+		double * ay = _ay.data() + thread*n;
+		double * az = _az.data() + thread*n;
+		for (int tile=thread;tile<n_tiles;tile+=_threads) {
+			const int first = tile * TileSize;
+			const int last = min(first + TileSize,n);
+			for (int j0=first;j0<n;j0+=TileSize) {
+				const int j1 = min(j0 + TileSize,n);
+				for (int i=first;i<last;i++) {
+					const int j = max(j0,i+1);
+					array<double,NDIM> acceleration = {0.0,0.0,0.0};
+					InteractionKernel::accumulate_mutual(_x+j,_y+j,_z+j,_m+j,j1-j,
+														 array<double,NDIM>{_x[i],_y[i],_z[i]},_m[i],_a,
+														 acceleration,ax+j,ay+j,az+j);
+					ax[i] += acceleration[0];
+					ay[i] += acceleration[1];
+					az[i] += acceleration[2];
+				}
+			}
+		}
+	};
+	auto reduce = [&](const int first, const int last){
+		for (int thread=1;thread<_threads;thread++)
+			for (int i=first;i<last;i++) {
+				_ax[i] += _ax[thread*n + i];
+				_ay[i] += _ay[thread*n + i];
+				_az[i] += _az[thread*n + i];
+			}
+	};
+	if (_threads > 1) {
+		ThreadPool::run_in_parallel(_threads,task);
+		ThreadPool::run_in_parallel(_threads,[&](int thread){
+			reduce((long)thread*n/_threads,(long)(thread+1)*n/_threads);
+		});
+	} else
+		task(0);
+}
@@ -0,0 +1,136 @@
+#ifndef _DIRECT_SUM_HPP
+#define _DIRECT_SUM_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <vector>
+
+#include "acceleration.hpp"
+#include "interaction-kernel.hpp"
+#include "particle.hpp"
+
+using namespace std;
+
+/**
+ *  This class calculates the acceleration of every particle by summing over all
+ *  other particles. This is O(N^2), but there is no tree to build, so it is faster
+ *  than the tree for small configurations; it is also exact, so it serves as a
+ *  reference for the tree codes.
+ *
+ *  The positions and masses are read from the arrays of the ParticleStore, and divided into
+ *  tiles, so the particles in one tile stay in cache while they interact with all
+ *  the particles in another. Each interaction is processed by the InteractionKernel.
+ *
+ *  If symmetric is set, each pair of particles is processed once, and the force is applied
+ *  to both, so there is only half as much work, and momentum is conserved. Each thread then
+ *  has its own copy of the accelerations, and the copies are added up at the end. Otherwise
+ *  each thread calculates the accelerations of the particles in its own tiles.
+ */
+class DirectSumAccelerationVisitor : public IAccelerationVisitor {
+  public:
+	/**
+	 *  Number of particles in a tile: the coordinates and masses of two tiles
+	 *  occupy 16 KB, so they fit in the L1 cache.
+	 */
+	enum {TileSize=256};
+
+	/**
+	 *  Configurations with fewer particles than this are faster with direct
+	 *  summation, on one thread, than with the tree and the default theta:
+	 *  measured by benchmark_direct_sum().
+	 */
+	enum {Crossover=8000};
+
+  private:
+	/**
+	 *  Gravitational constant
+	 */
+	const double _G;
+
+	/**
+	 *  Softening length
+	 */
+	const double _a;
+
+	/**
+	 *  Number of threads
+	 */
+	const int _threads;
+
+	/**
+	 *  Indicates that each pair of particles is processed once
+	 */
+	const bool _symmetric;
+
+	/**
+	 *  Positions and masses of particles: arrays belonging to the ParticleStore
+	 */
+	const double * _x = nullptr;
+
+	const double * _y = nullptr;
+
+	const double * _z = nullptr;
+
+	const double * _m = nullptr;
+
+	/**
+	 *  Components of accelerations, without G: one copy for each thread if symmetric is set
+	 */
+	vector<double> _ax;
+
+	vector<double> _ay;
+
+	vector<double> _az;
+
+  public:
+	/**
+	 *  Parameters:
+	 *      G           Gravitational constant
+	 *      a           Softening length
+	 *      threads     Number of threads
+	 *      symmetric   Process each pair of particles once, and apply the force to both
+	 */
+	DirectSumAccelerationVisitor(const double G, const double a, const int threads=1, const bool symmetric=true);
+
+	/**
+	 *  Calculate accelerations of all particles
+	 *
+	 *  Parameters:
+	 *      particles    Pointer to particles
+	 *      n            Number of particles
+	 */
+	void initialize(ParticleStore & particles, int n);
+
+	/**
+	 *  The acceleration has already been calculated by initialize()
+	 */
+	void visit(Particle & particle) {;}
+
+  private:
+	/**
+	 *  Calculate the accelerations of all particles, visiting each pair in both directions
+	 */
+	void _calculate_one_sided(const int n);
+
+	/**
+	 *  Calculate the accelerations of all particles, visiting each pair once
+	 */
+	void _calculate_symmetric(const int n);
+};
+
+#endif   // _DIRECT_SUM_HPP
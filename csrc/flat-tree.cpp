@@ -0,0 +1,148 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+ 
+#include "barnes-hut.hpp"
+#include "flat-tree.hpp"
+#include "interaction-kernel.hpp"
+
+using namespace std;
+
+/**
+ *  Copy an Oct Tree, whose masses and centres of mass have already been 
+ *  calculated. Storage is reused from previous calls.
+ *
+ *  Parameters:
+ *      root        Root of tree
+ *      particles   The particles in the tree
+ *      quadrupole  Copy quadrupole moments, which must have been calculated, and use them in walk
+ *      tight_bounds Use tight bounding boxes, which must have been calculated, instead of cubes
+ */
+void FlatTree::build(Node * root,ParticleStore & particles,const bool quadrupole,const bool tight_bounds){
+	_nodes.clear();
+	_particles.clear();
+	_quadrupoles.clear();
+	if (root->_particle_index == Node::Unused) return;
+	_nodes.resize(1);
+	if (quadrupole)
+		_quadrupoles.resize(1);
+	_copy(root,0,particles,quadrupole,tight_bounds);
+}
+
+/**
+ *  Copy one node, and the subtree below it. We reserve a contiguous block 
+ *  for the children before copying any of them, then copy each child's 
+ *  subtree in turn.
+ *
+ *  Parameters:
+ *      node        The node to be copied
+ *      slot        Location for copy of node in _nodes
+ *      particles   The particles in the tree
+ *      quadrupole  Copy quadrupole moments
+ *      tight_bounds Use tight bounding boxes instead of cubes
+ */
+void FlatTree::_copy(Node * node, const int slot,ParticleStore & particles,const bool quadrupole,const bool tight_bounds){
+	_nodes[slot].m = node->_m;
+	_nodes[slot].center_of_mass = node->_center_of_mass;
+	_nodes[slot].side = tight_bounds ? node->get_tight_side() : node->get_side();
+	_nodes[slot].bmax_sq = tight_bounds ? node->get_tight_bmax_sq() : node->get_bmax_sq();
+	if (quadrupole)
+		_quadrupoles[slot] = node->_quadrupole;
+	if (node->_particle_index != Node::Internal) {
+		const auto bucket = node->get_particles();
+		_nodes[slot].first = _particles.size();
+		_nodes[slot].n_children = 0;
+		_nodes[slot].n_particles = bucket.size();
+		for (int index : bucket)
+			_particles.push_back(FlatParticle{particles[index].get_mass(),particles[index].get_position(),particles[index].get_id()});
+		return;
+	}
+	
+	const int n_children = node->get_n_children();
+	const int first = _nodes.size();
+	_nodes.resize(first + n_children);
+	if (quadrupole)
+		_quadrupoles.resize(first + n_children);
+	_nodes[slot].first = first;
+	_nodes[slot].n_children = n_children;
+	_nodes[slot].n_particles = 0;
+	
+	for (int i=0;i<n_children;i++)
+		_copy(&node->_children[i],first + i,particles,quadrupole,tight_bounds);
+}
+
+/**
+ *  Calculate acceleration of one particle. This performs the same walk,
+ *  in the same order, as BarnesHutVisitor, so the results are identical.
+ *  We use an explicit stack instead of recursion; children are pushed
+ *  in reverse order so they are processed in the same order as Node::traverse().
+ *  An External node is treated as a point mass if it is accepted and has more
+ *  than one particle; otherwise we sum over the particles in its bucket.
+ *  Interactions with point masses are collected, and processed in batches.
+ *
+ *  Parameters:
+ *      particle   The particle whose acceleration is to be computed
+ *  	criterion  Used to decide whether a node is distant enough to be treated as a whole
+ *  	G          Gravitational constant
+ *  	a          Softening length
+ *  	mixed_precision Calculate interactions with distant nodes in single precision
+ *  	cost       If supplied, used to return the numbers of nodes and particles that the particle has interacted with
+ */
+array<double,NDIM> FlatTree::get_acceleration(Particle & particle,const OpeningCriterion & criterion,const double G,const double a,
+											  const bool mixed_precision, WalkCost * cost){
+	array<double,NDIM> acceleration = {0.0,0.0,0.0};
+	if (_nodes.size() == 0) return acceleration;
+	const int id = particle.get_id();
+	const auto position = particle.get_position();
+	InteractionList interactions(position,a,InteractionKernel::get_best_implementation(),mixed_precision);
+	const double a_old = BarnesHutVisitor::get_acceleration_magnitude(particle);
+	vector<int> stack;
+	stack.reserve(8*Node::N_Levels);
+	stack.push_back(0);
+	const bool quadrupole = !_quadrupoles.empty();
+	WalkCost walk_cost;
+	while (!stack.empty()) {
+		const int slot = stack.back();
+		const FlatNode & node = _nodes[slot];
+		stack.pop_back();
+		const double dsq = Particle::get_distance_sq(node.center_of_mass,position);
+		const bool accepted = (node.n_children > 0 || node.n_particles > 1) && criterion.accept(node.m,node.side,node.bmax_sq,dsq,a_old);
+		if (node.n_children == 0 && !accepted) {
+			for (int j=node.first;j<node.first+node.n_particles;j++) {
+				const FlatParticle & other = _particles[j];
+				if (other.id == id) continue;
+				interactions.add(other.m,other.position);
+				walk_cost.n_particles++;
+			}
+			continue;
+		}
+		if (node.n_children > 0 && !accepted) {
+			for (int i=node.n_children-1;i>=0;i--)
+				stack.push_back(node.first + i);
+			continue;
+		}
+		interactions.add_far(node.m,node.center_of_mass);
+		walk_cost.n_nodes++;
+		if (quadrupole)
+			BarnesHutVisitor::add_quadrupole_acceleration(_quadrupoles[slot],node.center_of_mass,position,dsq,G,a,acceleration);
+	}
+	if (cost != nullptr)
+		*cost = walk_cost;
+	const auto monopole = interactions.get_acceleration(G);
+	for (int i=0;i<NDIM;i++)
+		acceleration[i] = monopole[i] + acceleration[i];
+	return acceleration;
+}
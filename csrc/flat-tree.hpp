@@ -0,0 +1,167 @@
+#ifndef _FLAT_TREE_HPP
+#define _FLAT_TREE_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+ 
+#include <array>
+#include <vector>
+
+#include "opening-criterion.hpp"
+#include "particle.hpp"
+#include "treecode.hpp"
+
+using namespace std;
+
+/**
+ *  One node of a FlatTree: just the data that the Barnes Hut walk needs.
+ */
+struct FlatNode {
+	/**
+	 *  Total mass of all particles in or below this node
+	 */
+	double m;
+	
+	/**
+	 *  Centre of mass of all particles in or below this node
+	 */
+	array<double,NDIM> center_of_mass;
+	
+	/**
+	 *  Length of any side of cube, or longest side of tight bounding box
+	 */
+	double side;
+	
+	/**
+	 *  Squared distance from centre of mass to furthest corner of cube, or of tight bounding box
+	 */
+	double bmax_sq;
+	
+	/**
+	 *  For an Internal node, the index of the first child;
+	 *  for an External node, the index of the first FlatParticle in its bucket.
+	 */
+	int first;
+	
+	/**
+	 *  Number of children: zero for an External node
+	 */
+	int n_children;
+	
+	/**
+	 *  Number of particles in bucket: zero for an Internal node
+	 */
+	int n_particles;
+};
+
+/**
+ *  A copy of one particle from the bucket of an External node
+ */
+struct FlatParticle {
+	/**
+	 *  Mass of particle
+	 */
+	double m;
+	
+	/**
+	 *  Position of particle
+	 */
+	array<double,NDIM> position;
+	
+	/**
+	 *  ID of particle, so we can skip it when calculating its own acceleration
+	 */
+	int id;
+};
+
+/**
+ *  This class holds a copy of an Oct Tree as a contiguous array of FlatNodes,
+ *  so the Barnes Hut walk touches fewer cache lines. The children of each node
+ *  are contiguous. Blocks of children are laid out in depth first order, so a subtree occupies a compact region of the array.
+ */
+class FlatTree {
+  private:
+	/**
+	 *  Nodes of tree; the root is at index 0
+	 */
+	vector<FlatNode> _nodes;
+	
+	/**
+	 *  Particles from buckets: each bucket is contiguous, and buckets are in depth first order
+	 */
+	vector<FlatParticle> _particles;
+	
+	/**
+	 *  Quadrupole moments, in the same order as _nodes. These are kept apart from
+	 *  the nodes, so they don't add to the memory traffic when they aren't used:
+	 *  this is empty unless quadrupole moments were requested.
+	 */
+	vector<Quadrupole> _quadrupoles;
+	
+  public:
+	/**
+	 *  Copy an Oct Tree, whose masses and centres of mass have already been 
+	 *  calculated. Storage is reused from previous calls.
+	 *
+	 *  Parameters:
+	 *      root        Root of tree
+	 *      particles   The particles in the tree
+	 *      quadrupole  Copy quadrupole moments, which must have been calculated, and use them in walk
+	 *      tight_bounds Use tight bounding boxes, which must have been calculated, instead of cubes
+	 */
+	void build(Node * root,ParticleStore & particles,const bool quadrupole=false,const bool tight_bounds=false);
+	
+	/**
+	 *  Calculate acceleration of one particle. This performs the same walk,
+	 *  in the same order, as BarnesHutVisitor, so the results are identical.
+	 *
+	 *  Parameters:
+	 *      particle   The particle whose acceleration is to be computed
+	 *  	criterion  Used to decide whether a node is distant enough to be treated as a whole
+	 *  	G          Gravitational constant
+	 *  	a          Softening length
+	 *  	mixed_precision Calculate interactions with distant nodes in single precision
+	 *  	cost       If supplied, used to return the numbers of nodes and particles that the particle has interacted with
+	 */
+	array<double,NDIM> get_acceleration(Particle & particle,const OpeningCriterion & criterion,const double G,const double a,
+										const bool mixed_precision=false, WalkCost * cost=nullptr);
+	
+	/**
+	 *  Number of nodes in tree
+	 */
+	int size() {return _nodes.size();}
+	
+	/**
+	 *  Access one node of tree
+	 */
+	FlatNode & operator[](const int i) {return _nodes[i];}
+	
+  private:
+	/**
+	 *  Copy one node, and the subtree below it.
+	 *
+	 *  Parameters:
+	 *      node        The node to be copied
+	 *      slot        Location for copy of node in _nodes
+	 *      particles   The particles in the tree
+	 *      quadrupole  Copy quadrupole moments
+	 *      tight_bounds Use tight bounding boxes instead of cubes
+	 */
+	void _copy(Node * node, const int slot,ParticleStore & particles,const bool quadrupole,const bool tight_bounds);
+};
+
+#endif   // _FLAT_TREE_HPP
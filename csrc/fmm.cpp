@@ -0,0 +1,398 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <cmath>
+
+#include "center-of-mass.hpp"
+#include "fmm.hpp"
+#include "interaction-kernel.hpp"
+
+using namespace std;
+
+namespace {
+
+	/**
+	 *  Evaluate a local expansion at displacement h from its centre: F + J h + H h h/2
+	 */
+	inline array<double,NDIM> evaluate(const FastMultipoleMethod::LocalExpansion & local, const array<double,NDIM> & h) {
+		array<double,NDIM> result = local.F;
+		for (int i=0;i<NDIM;i++)
+			for (int j=0;j<NDIM;j++) {
+				double Hh = 0.0;
+				for (int k=0;k<NDIM;k++)
+					Hh += local.H[(i*NDIM + j)*NDIM + k] * h[k];
+				result[i] += (local.J[i*NDIM + j] + 0.5*Hh) * h[j];
+			}
+		return result;
+	}
+
+	inline double delta(const int i, const int j) {return i == j ? 1.0 : 0.0;}
+
+}
+
+/**
+ *  Parameters:
+ *      theta           Cells are well separated if the sum of their radii is less than theta times their separation
+ *      G               Gravitational constant
+ *      a               Softening length
+ *      tree_options    Used to control how tree is built
+ *      mutual          Apply each interaction to both cells, or both particles, so momentum is conserved
+ */
+FastMultipoleMethod::FastMultipoleMethod(const double theta, const double G, const double a, const TreeOptions & tree_options,
+										 const bool mutual)
+	: _theta(theta), _G(G), _a(a), _tree_options(tree_options), _mutual(mutual) {}
+
+/**
+ *  Build tree, with quadrupole moments, and calculate accelerations of all particles.
+ *  The tree is built from scratch every step.
+ *
+ *  Parameters:
+ *      particles    Pointer to particles
+ *      n            Number of particles
+ */
+void FastMultipoleMethod::initialize(ParticleStore & particles, int n) {
+	TreeOptions options = _tree_options;
+	options.quadrupole = true;
+	unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,options,_arena);
+	if (!options.fused_moments) {
+		CentreOfMassCalculator calculator(particles,true,options.tight_bounds);
+		calculator.calculate(tree.get(),options.threads);
+	}
+	calculate(tree.get(),particles);
+}
+
+/**
+ *  Calculate accelerations of all particles in a tree whose moments, including
+ *  quadrupoles, have been calculated, and store them in particles.
+ *
+ *  Parameters:
+ *      root        Root of tree
+ *      particles   The particles in the tree
+ */
+void FastMultipoleMethod::calculate(Node * root, ParticleStore & particles) {
+	_cells.clear();
+	_indices.clear();
+	_x.clear();
+	_y.clear();
+	_z.clear();
+	_m.clear();
+	_n_m2l = 0;
+	_n_p2p = 0;
+	if (root->_particle_index == Node::Unused) return;
+	_cells.resize(1);
+	_copy(root,0,particles);
+	_locals.assign(_cells.size(),LocalExpansion{});
+	_accelerations.assign(_indices.size(),array<double,NDIM>{0.0,0.0,0.0});
+	if (_mutual)
+		_interact_self(0);
+	else
+		_interact(0,0);
+	_l2l(0);
+	for (int i=0;i<static_cast<int>(_indices.size());i++)
+		particles[_indices[i]].set_acceleration(_accelerations[i]);
+}
+
+/**
+ *  Copy one node, and the subtree below it. As in FlatTree, we reserve a
+ *  contiguous block for the children before copying any of them. Particles
+ *  are recorded as their leaves are reached, so the particles below each
+ *  cell are contiguous.
+ *
+ *  Parameters:
+ *      node        The node to be copied
+ *      slot        Location for copy of node in _cells
+ *      particles   The particles in the tree
+ */
+void FastMultipoleMethod::_copy(Node * node, const int slot, ParticleStore & particles) {
+	_cells[slot].m = node->_m;
+	_cells[slot].center_of_mass = node->_center_of_mass;
+	_cells[slot].quadrupole = node->_quadrupole;
+	_cells[slot].radius = sqrt(_tree_options.tight_bounds ? node->get_tight_bmax_sq() : node->get_bmax_sq());
+	_cells[slot].first_particle = _indices.size();
+	if (node->_particle_index != Node::Internal) {
+		for (int index : node->get_particles()) {
+			const auto position = particles[index].get_position();
+			_indices.push_back(index);
+			_x.push_back(position[0]);
+			_y.push_back(position[1]);
+			_z.push_back(position[2]);
+			_m.push_back(particles[index].get_mass());
+		}
+		_cells[slot].trace = 0.0;
+		for (int i=_cells[slot].first_particle;i<static_cast<int>(_indices.size());i++)
+			_cells[slot].trace += _m[i] * Particle::get_distance_sq(array<double,NDIM>{_x[i],_y[i],_z[i]},_cells[slot].center_of_mass);
+		_cells[slot].first_child = 0;
+		_cells[slot].n_children = 0;
+		_cells[slot].n_particles = _indices.size() - _cells[slot].first_particle;
+		return;
+	}
+	const int n_children = node->get_n_children();
+	const int first = _cells.size();
+	_cells.resize(first + n_children);
+	_cells[slot].first_child = first;
+	_cells[slot].n_children = n_children;
+	_cells[slot].trace = 0.0;
+	for (int i=0;i<n_children;i++) {
+		_copy(&node->_children[i],first + i,particles);
+		const Cell & child = _cells[first + i];
+		_cells[slot].trace += child.trace + child.m * Particle::get_distance_sq(child.center_of_mass,_cells[slot].center_of_mass);
+	}
+	_cells[slot].n_particles = _indices.size() - _cells[slot].first_particle;
+}
+
+/**
+ *  Find the interactions between the particles in one cell (the sink) and those in
+ *  another (the source). If they are well separated, the source contributes to the
+ *  sink's local expansion; if both are leaves, the particles interact directly;
+ *  otherwise we split the larger cell, and try again with its children. A cell
+ *  interacting with itself is split into all pairs of its children.
+ */
+void FastMultipoleMethod::_interact(const int sink, const int source) {
+	const Cell & A = _cells[sink];
+	const Cell & B = _cells[source];
+	if (sink != source) {
+		const double dsq = Particle::get_distance_sq(A.center_of_mass,B.center_of_mass);
+		if (sqr(A.radius + B.radius) < sqr(_theta) * dsq) {
+			_m2l(sink,source);
+			return;
+		}
+	}
+	if (A.n_children == 0 && B.n_children == 0) {
+		_p2p(sink,source);
+		return;
+	}
+	if (sink == source) {
+		for (int i=A.first_child;i<A.first_child+A.n_children;i++)
+			for (int j=A.first_child;j<A.first_child+A.n_children;j++)
+				_interact(i,j);
+		return;
+	}
+	if (B.n_children == 0 || (A.n_children > 0 && A.radius >= B.radius)) {
+		for (int i=A.first_child;i<A.first_child+A.n_children;i++)
+			_interact(i,source);
+	} else
+		for (int j=B.first_child;j<B.first_child+B.n_children;j++)
+			_interact(sink,j);
+}
+
+/**
+ *  Add the contribution of the multipoles of the source to the local expansion of the sink.
+ *  The acceleration caused by a mass m is G m D1, where Dn is the nth derivative of 1/r,
+ *  softened as in BarnesHutVisitor, so the monopole gives F += G m D1, J += G m D2, and
+ *  H += G m D3; the quadrupole gives F += G Q:D3/6, which is the same as
+ *  BarnesHutVisitor::add_quadrupole_acceleration().
+ */
+void FastMultipoleMethod::_m2l(const int sink, const int source) {
+	_n_m2l++;
+	const Cell & A = _cells[sink];
+	const Cell & B = _cells[source];
+	LocalExpansion & local = _locals[sink];
+	array<double,NDIM> R;
+	for (int i=0;i<NDIM;i++)
+		R[i] = A.center_of_mass[i] - B.center_of_mass[i];
+	const double r_sq = R[0]*R[0] + R[1]*R[1] + R[2]*R[2] + _a*_a;
+	const double inverse_r = 1.0 / sqrt(r_sq);
+	const double inverse_r2 = inverse_r * inverse_r;
+	const double inverse_r3 = inverse_r * inverse_r2;
+	const double inverse_r5 = inverse_r3 * inverse_r2;
+	const double inverse_r7 = inverse_r5 * inverse_r2;
+	const double Gm = _G * B.m;
+	for (int i=0;i<NDIM;i++) {
+		local.F[i] -= Gm * R[i] * inverse_r3;
+		for (int j=0;j<NDIM;j++) {
+			local.J[i*NDIM + j] += Gm * (3.0 * R[i] * R[j] * inverse_r5 - delta(i,j) * inverse_r3);
+			for (int k=0;k<NDIM;k++) {
+				const double D3 = -15.0 * R[i] * R[j] * R[k] * inverse_r7
+								  + 3.0 * (R[i] * delta(j,k) + R[j] * delta(i,k) + R[k] * delta(i,j)) * inverse_r5;
+				local.H[(i*NDIM + j)*NDIM + k] += Gm * D3;
+				local.F[i] += _G * B.quadrupole[get_quadrupole_index(j,k)] * D3 / 6.0;
+			}
+		}
+	}
+}
+
+/**
+ *  Find the mutual interactions between the particles in two different cells. This
+ *  is the same as _interact(), except that each pair is only visited once.
+ */
+void FastMultipoleMethod::_interact_mutual(const int a, const int b) {
+	const Cell & A = _cells[a];
+	const Cell & B = _cells[b];
+	const double dsq = Particle::get_distance_sq(A.center_of_mass,B.center_of_mass);
+	if (sqr(A.radius + B.radius) < sqr(_theta) * dsq) {
+		_m2l_mutual(a,b);
+		return;
+	}
+	if (A.n_children == 0 && B.n_children == 0) {
+		_p2p_mutual(a,b);
+		return;
+	}
+	if (B.n_children == 0 || (A.n_children > 0 && A.radius >= B.radius)) {
+		for (int i=A.first_child;i<A.first_child+A.n_children;i++)
+			_interact_mutual(i,b);
+	} else
+		for (int j=B.first_child;j<B.first_child+B.n_children;j++)
+			_interact_mutual(a,j);
+}
+
+/**
+ *  Find the mutual interactions between the particles in one cell: those within
+ *  each child, and those between each pair of children.
+ */
+void FastMultipoleMethod::_interact_self(const int slot) {
+	const Cell & cell = _cells[slot];
+	if (cell.n_children == 0) {
+		_p2p_self(slot);
+		return;
+	}
+	for (int i=cell.first_child;i<cell.first_child+cell.n_children;i++) {
+		_interact_self(i);
+		for (int j=i+1;j<cell.first_child+cell.n_children;j++)
+			_interact_mutual(i,j);
+	}
+}
+
+/**
+ *  Add the contribution of the multipoles of each cell to the local expansion of the other.
+ *  The derivatives are calculated once: reversing R changes the sign of D1 and D3, but not D2.
+ *  The H term evaluated over the particles of a cell gives the full second moment, so the
+ *  quadrupole term includes the trace, and the total forces on the two cells are opposite.
+ */
+void FastMultipoleMethod::_m2l_mutual(const int a, const int b) {
+	_n_m2l++;
+	const Cell & A = _cells[a];
+	const Cell & B = _cells[b];
+	LocalExpansion & local_a = _locals[a];
+	LocalExpansion & local_b = _locals[b];
+	array<double,NDIM> R;
+	for (int i=0;i<NDIM;i++)
+		R[i] = A.center_of_mass[i] - B.center_of_mass[i];
+	const double r_sq = R[0]*R[0] + R[1]*R[1] + R[2]*R[2] + _a*_a;
+	const double inverse_r = 1.0 / sqrt(r_sq);
+	const double inverse_r2 = inverse_r * inverse_r;
+	const double inverse_r3 = inverse_r * inverse_r2;
+	const double inverse_r5 = inverse_r3 * inverse_r2;
+	const double inverse_r7 = inverse_r5 * inverse_r2;
+	const double Gm_a = _G * A.m;
+	const double Gm_b = _G * B.m;
+	for (int i=0;i<NDIM;i++) {
+		const double D1 = -R[i] * inverse_r3;
+		local_a.F[i] += Gm_b * D1;
+		local_b.F[i] -= Gm_a * D1;
+		for (int j=0;j<NDIM;j++) {
+			const double D2 = 3.0 * R[i] * R[j] * inverse_r5 - delta(i,j) * inverse_r3;
+			local_a.J[i*NDIM + j] += Gm_b * D2;
+			local_b.J[i*NDIM + j] += Gm_a * D2;
+			for (int k=0;k<NDIM;k++) {
+				const double D3 = -15.0 * R[i] * R[j] * R[k] * inverse_r7
+								  + 3.0 * (R[i] * delta(j,k) + R[j] * delta(i,k) + R[k] * delta(i,j)) * inverse_r5;
+				local_a.H[(i*NDIM + j)*NDIM + k] += Gm_b * D3;
+				local_b.H[(i*NDIM + j)*NDIM + k] -= Gm_a * D3;
+				local_a.F[i] += _G * (B.quadrupole[get_quadrupole_index(j,k)] + delta(j,k) * B.trace) * D3 / 6.0;
+				local_b.F[i] -= _G * (A.quadrupole[get_quadrupole_index(j,k)] + delta(j,k) * A.trace) * D3 / 6.0;
+			}
+		}
+	}
+}
+
+/**
+ *  Add the accelerations caused by the particles in each leaf to the particles in the other.
+ *  The force between each pair is calculated once, and applied to both, so they are
+ *  equal and opposite.
+ */
+void FastMultipoleMethod::_p2p_mutual(const int a, const int b) {
+	_n_p2p++;
+	const Cell & A = _cells[a];
+	const Cell & B = _cells[b];
+	for (int i=A.first_particle;i<A.first_particle+A.n_particles;i++)
+		for (int j=B.first_particle;j<B.first_particle+B.n_particles;j++)
+			_add_pair(i,j);
+}
+
+/**
+ *  Add the accelerations caused by the particles in a leaf to each other
+ */
+void FastMultipoleMethod::_p2p_self(const int slot) {
+	_n_p2p++;
+	const Cell & cell = _cells[slot];
+	for (int i=cell.first_particle;i<cell.first_particle+cell.n_particles;i++)
+		for (int j=i+1;j<cell.first_particle+cell.n_particles;j++)
+			_add_pair(i,j);
+}
+
+/**
+ *  Add the accelerations caused by the particles in one leaf to the particles in another.
+ *  If the leaf interacts with itself, we skip each particle's interaction with itself.
+ */
+void FastMultipoleMethod::_p2p(const int sink, const int source) {
+	_n_p2p++;
+	const Cell & A = _cells[sink];
+	const Cell & B = _cells[source];
+	for (int k=A.first_particle;k<A.first_particle+A.n_particles;k++) {
+		const array<double,NDIM> position = {_x[k],_y[k],_z[k]};
+		array<double,NDIM> sum = {0.0,0.0,0.0};
+		if (sink == source) {
+			const int first = B.first_particle;
+			InteractionKernel::accumulate(_x.data()+first,_y.data()+first,_z.data()+first,_m.data()+first,k-first,position,_a,sum);
+			const int last = B.first_particle + B.n_particles;
+			InteractionKernel::accumulate(_x.data()+k+1,_y.data()+k+1,_z.data()+k+1,_m.data()+k+1,last-k-1,position,_a,sum);
+		} else {
+			const int first = B.first_particle;
+			InteractionKernel::accumulate(_x.data()+first,_y.data()+first,_z.data()+first,_m.data()+first,B.n_particles,position,_a,sum);
+		}
+		for (int i=0;i<NDIM;i++)
+			_accelerations[k][i] += _G * sum[i];
+	}
+}
+
+/**
+ *  Pass local expansion of a cell down to its descendants, and evaluate it at the particles in each leaf.
+ *  The expansion about a child's centre is F' = F + J h + H h h/2, J' = J + H h, H' = H,
+ *  where h is the displacement of the child's centre from the parent's.
+ */
+void FastMultipoleMethod::_l2l(const int slot) {
+	const Cell & cell = _cells[slot];
+	const LocalExpansion & local = _locals[slot];
+	if (cell.n_children == 0) {
+		for (int k=cell.first_particle;k<cell.first_particle+cell.n_particles;k++) {
+			const array<double,NDIM> h = {_x[k] - cell.center_of_mass[0],_y[k] - cell.center_of_mass[1],_z[k] - cell.center_of_mass[2]};
+			const auto acceleration = evaluate(local,h);
+			for (int i=0;i<NDIM;i++)
+				_accelerations[k][i] += acceleration[i];
+		}
+		return;
+	}
+	for (int c=cell.first_child;c<cell.first_child+cell.n_children;c++) {
+		LocalExpansion & child = _locals[c];
+		array<double,NDIM> h;
+		for (int i=0;i<NDIM;i++)
+			h[i] = _cells[c].center_of_mass[i] - cell.center_of_mass[i];
+		const auto F = evaluate(local,h);
+		for (int i=0;i<NDIM;i++) {
+			child.F[i] += F[i];
+			for (int j=0;j<NDIM;j++) {
+				double Hh = 0.0;
+				for (int k=0;k<NDIM;k++)
+					Hh += local.H[(i*NDIM + j)*NDIM + k] * h[k];
+				child.J[i*NDIM + j] += local.J[i*NDIM + j] + Hh;
+			}
+		}
+		for (int m=0;m<NDIM*NDIM*NDIM;m++)
+			child.H[m] += local.H[m];
+		_l2l(c);
+	}
+}
@@ -0,0 +1,319 @@
+#ifndef _FMM_HPP
+#define _FMM_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * The Fast Multipole Method, using Cartesian expansions, as described by
+ * Walter Dehnen, A Hierarchical O(N) Force Calculation Algorithm,
+ * Journal of Computational Physics, 179, 27-42 (2002)
+ */
+
+#include <array>
+#include <vector>
+
+#include "acceleration.hpp"
+#include "interaction-kernel.hpp"
+#include "node-arena.hpp"
+#include "particle.hpp"
+#include "treecode.hpp"
+
+using namespace std;
+
+/**
+ *  This class calculates the acceleration of every particle using the Fast
+ *  Multipole Method. It builds the same Oct Tree as AccelerationVisitor, and copies it
+ *  into an array of Cells. The phases are:
+ *
+ *  M2M  Masses, centres of mass and quadrupole moments of all nodes (CentreOfMassCalculator)
+ *  M2L  Pairs of cells that are well separated contribute to each other's local expansions
+ *  P2P  Pairs of leaves that are not well separated interact directly (InteractionKernel)
+ *  L2L  Local expansions are passed down to children, then evaluated at each particle
+ *
+ *  The pairs of cells are found by walking the tree for sinks and sources together,
+ *  so the work is O(N). The local expansion of the acceleration about the centre of
+ *  mass of a cell is F + J h + H h h/2, where h is the displacement from the centre.
+ *  Terms are kept if the order of the multipole plus the order of the local term is
+ *  at most two, so quadrupoles contribute to F only.
+ *
+ *  If requested, interactions are mutual, as in Dehnen's falcON: each pair of cells, or
+ *  of particles, is processed once, and contributes to both. The set of terms kept is 
+ *  symmetric, and expansions are about centres of mass, so the total force on the 
+ *  particles of one cell is equal and opposite to the total force on the other: momentum
+ *  is conserved to round-off, and there is only half as much work.
+ */
+class FastMultipoleMethod : public IAccelerationVisitor {
+  public:
+	/**
+	 *  One node of the tree, as needed by the FMM
+	 */
+	struct Cell {
+		/**
+		 *  Total mass of all particles in or below this cell
+		 */
+		double m;
+
+		/**
+		 *  Centre of mass, which is also the centre of the expansions
+		 */
+		array<double,NDIM> center_of_mass;
+
+		/**
+		 *  Quadrupole moment about centre of mass
+		 */
+		Quadrupole quadrupole;
+
+		/**
+		 *  Sum of m |d|^2 over particles, where d is displacement from centre of mass. The
+		 *  quadrupole is traceless, but the softened potential isn't harmonic, so mutual
+		 *  interactions need the trace to make the forces equal and opposite.
+		 */
+		double trace;
+
+		/**
+		 *  Distance from centre of mass to the furthest corner of cube
+		 */
+		double radius;
+
+		/**
+		 *  Index of first child, or zero for a leaf
+		 */
+		int first_child;
+
+		/**
+		 *  Number of children: zero for a leaf
+		 */
+		int n_children;
+
+		/**
+		 *  Index of first particle below cell, in the order of the leaves of the tree
+		 */
+		int first_particle;
+
+		/**
+		 *  Number of particles below cell
+		 */
+		int n_particles;
+	};
+
+	/**
+	 *  Local expansion of acceleration about the centre of mass of a cell:
+	 *  F + J h + H h h/2. J and H are stored in full.
+	 */
+	struct LocalExpansion {
+		array<double,NDIM> F;
+
+		array<double,NDIM*NDIM> J;
+
+		array<double,NDIM*NDIM*NDIM> H;
+	};
+
+  private:
+	/**
+	 *  Cells are well separated if the sum of their radii is less than theta times
+	 *  the distance between their centres
+	 */
+	const double _theta;
+
+	/**
+	 *  Gravitational constant
+	 */
+	const double _G;
+
+	/**
+	 *  Softening length
+	 */
+	const double _a;
+
+	/**
+	 *  Used to control how tree is built
+	 */
+	const TreeOptions _tree_options;
+
+	/**
+	 *  Indicates that each interaction is applied to both cells, or both particles
+	 */
+	const bool _mutual;
+
+	/**
+	 *  Storage for nodes of tree, reused every time we build a new tree
+	 */
+	shared_ptr<NodeArena> _arena = make_shared<NodeArena>();
+
+	/**
+	 *  Cells of tree; the root is at index 0, and the children of each cell are contiguous
+	 */
+	vector<Cell> _cells;
+
+	/**
+	 *  Local expansions, in the same order as _cells
+	 */
+	vector<LocalExpansion> _locals;
+
+	/**
+	 *  Indices of particles, in the order of the leaves of the tree
+	 */
+	vector<int> _indices;
+
+	/**
+	 *  Positions and masses of particles, in the same order as _indices
+	 */
+	vector<double> _x;
+
+	vector<double> _y;
+
+	vector<double> _z;
+
+	vector<double> _m;
+
+	/**
+	 *  Accelerations of particles, in the same order as _indices
+	 */
+	vector<array<double,NDIM>> _accelerations;
+
+	/**
+	 *  Number of pairs of cells processed by M2L and P2P during last calculation
+	 */
+	int _n_m2l = 0;
+
+	int _n_p2p = 0;
+
+  public:
+	/**
+	 *  Parameters:
+	 *      theta           Cells are well separated if the sum of their radii is less than theta times their separation
+	 *      G               Gravitational constant
+	 *      a               Softening length
+	 *      tree_options    Used to control how tree is built
+	 *      mutual          Apply each interaction to both cells, or both particles, so momentum is conserved
+	 */
+	FastMultipoleMethod(const double theta, const double G, const double a, const TreeOptions & tree_options=TreeOptions(),
+						const bool mutual=false);
+
+	/**
+	 *  Build tree and calculate accelerations of all particles
+	 *
+	 *  Parameters:
+	 *      particles    Pointer to particles
+	 *      n            Number of particles
+	 */
+	void initialize(ParticleStore & particles, int n);
+
+	/**
+	 *  The acceleration has already been calculated by initialize()
+	 */
+	void visit(Particle & particle) {;}
+
+	/**
+	 *  Calculate accelerations of all particles in a tree whose moments, including
+	 *  quadrupoles, have been calculated, and store them in particles.
+	 *
+	 *  Parameters:
+	 *      root        Root of tree
+	 *      particles   The particles in the tree
+	 */
+	void calculate(Node * root, ParticleStore & particles);
+
+	/**
+	 *  Number of pairs of cells processed by M2L during last calculation
+	 */
+	int get_n_m2l() {return _n_m2l;}
+
+	/**
+	 *  Number of pairs of leaves processed by P2P during last calculation
+	 */
+	int get_n_p2p() {return _n_p2p;}
+
+  private:
+	/**
+	 *  Copy one node, and the subtree below it.
+	 *
+	 *  Parameters:
+	 *      node        The node to be copied
+	 *      slot        Location for copy of node in _cells
+	 *      particles   The particles in the tree
+	 */
+	void _copy(Node * node, const int slot, ParticleStore & particles);
+
+	/**
+	 *  Find the interactions between the particles in one cell (the sink) and those in another (the source)
+	 */
+	void _interact(const int sink, const int source);
+
+	/**
+	 *  Add the contribution of the multipoles of the source to the local expansion of the sink
+	 */
+	void _m2l(const int sink, const int source);
+
+	/**
+	 *  Find the mutual interactions between the particles in two different cells
+	 */
+	void _interact_mutual(const int a, const int b);
+
+	/**
+	 *  Find the mutual interactions between the particles in one cell
+	 */
+	void _interact_self(const int slot);
+
+	/**
+	 *  Add the contribution of the multipoles of each cell to the local expansion of the other
+	 */
+	void _m2l_mutual(const int a, const int b);
+
+	/**
+	 *  Add the accelerations caused by the particles in each leaf to the particles in the other
+	 */
+	void _p2p_mutual(const int a, const int b);
+
+	/**
+	 *  Add the accelerations caused by the particles in a leaf to each other
+	 */
+	void _p2p_self(const int slot);
+
+	/**
+	 *  Add the accelerations that two particles cause each other
+	 *
+	 *  Parameters:
+	 *      i     Position of one particle in the order of the leaves
+	 *      j     Position of the other particle
+	 */
+	inline void _add_pair(const int i, const int j) {
+		const double dx = _x[j] - _x[i];
+		const double dy = _y[j] - _y[i];
+		const double dz = _z[j] - _z[i];
+		const double factor = _G * InteractionKernel::get_softened_factor(dx*dx + dy*dy + dz*dz,_a);
+		const double factor_i = _m[j] * factor;
+		const double factor_j = _m[i] * factor;
+		_accelerations[i][0] += dx * factor_i;
+		_accelerations[i][1] += dy * factor_i;
+		_accelerations[i][2] += dz * factor_i;
+		_accelerations[j][0] -= dx * factor_j;
+		_accelerations[j][1] -= dy * factor_j;
+		_accelerations[j][2] -= dz * factor_j;
+	}
+
+	/**
+	 *  Add the accelerations caused by the particles in one leaf to the particles in another
+	 */
+	void _p2p(const int sink, const int source);
+
+	/**
+	 *  Pass local expansion of a cell down to its descendants, and evaluate it at the particles in each leaf
+	 */
+	void _l2l(const int slot);
+};
+
+#endif   // _FMM_HPP
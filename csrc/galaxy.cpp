@@ -20,14 +20,19 @@
 #include <iostream>
 #include <chrono>
 #include <cstdlib>
+#include <sstream>
+#include <stdexcept>
 
 #include "acceleration.hpp"
 #include "barnes-hut.hpp"
+#include "direct-sum.hpp"
+#include "fmm.hpp"
 #include "integrators.hpp"
 #include "logger.hpp"
 #include "parameters.hpp"
 #include "reporter.hpp"
 #include "notifier.hpp"
+#include "thread-pool.hpp"
 
 using namespace std;
 
@@ -41,10 +46,60 @@ int main(int argc, char **argv) {
 		path configuration_file = parameters->get_path();
 		configuration_file /=  parameters->get_config_file();
 		Configuration configuration(configuration_file);
-		AccelerationVisitor calculate_acceleration(parameters->get_theta(),parameters->get_G(),parameters->get_a(),parameters->should_verify_tree());
+		ThreadPool::create(parameters->get_threads(),parameters->should_pin_threads(),parameters->should_spread_numa());
+		TreeOptions tree_options;
+		tree_options.threads = parameters->get_threads();
+		tree_options.flat = parameters->should_use_flat_tree();
+		tree_options.bucket_size = parameters->get_bucket_size();
+		tree_options.max_depth = parameters->get_max_depth();
+		tree_options.rebuild_interval = parameters->get_rebuild_interval();
+		tree_options.refit = parameters->should_refit();
+		tree_options.max_escaped = parameters->get_max_escaped();
+		tree_options.fused_moments = parameters->should_fuse_moments();
+		tree_options.quadrupole = parameters->should_use_quadrupole();
+		tree_options.tight_bounds = parameters->should_use_tight_bounds();
+		tree_options.group_size = parameters->get_group_size();
+		tree_options.packet_size = parameters->get_packet_size();
+		tree_options.mixed_precision = parameters->should_use_mixed_precision();
+		tree_options.log_busy_times = true;
+		unique_ptr<IAccelerationVisitor> calculate_acceleration;
+		const int crossover = parameters->get_crossover() < 0 ? DirectSumAccelerationVisitor::Crossover : parameters->get_crossover();
+		if (parameters->get_method() == "direct" || (parameters->get_method() == "barnes-hut" && configuration.get_n() < crossover)) {
+			LOG2("Direct summation for particles: ",to_string(configuration.get_n()));
+			if (!parameters->get_tree_options().empty())
+				LOG2("Tree options ignored by direct summation:",parameters->get_tree_options());
+			calculate_acceleration = make_unique<DirectSumAccelerationVisitor>(parameters->get_G(),parameters->get_a(),parameters->get_threads());
+		} else if (parameters->get_method() == "barnes-hut") {
+			if ((tree_options.group_size > 0 || tree_options.packet_size > 0) && (tree_options.mixed_precision || tree_options.threads > 1)) {
+				stringstream message;
+				message<<__FILE__ <<" " <<__LINE__<<" Error: the group and packet walks are performed in double precision on one thread,"
+					<< " so they cannot be combined with --mixed_precision or --threads" << endl;
+				throw logic_error(message.str().c_str());
+			}
+			calculate_acceleration = make_unique<AccelerationVisitor>(OpeningCriterion::create(parameters->get_criterion(),parameters->get_theta(),
+																							   parameters->get_alpha(),parameters->get_G()),
+																	  parameters->get_G(),parameters->get_a(),parameters->should_verify_tree(),
+																	  tree_options);
+		} else if (parameters->get_method() == "fmm" || parameters->get_method() == "falcon") {
+			if (tree_options.mixed_precision) {
+				stringstream message;
+				message<<__FILE__ <<" " <<__LINE__<<" Error: " << parameters->get_method()
+					<< " is performed in double precision, so it cannot be combined with --mixed_precision" << endl;
+				throw logic_error(message.str().c_str());
+			}
+			calculate_acceleration = make_unique<FastMultipoleMethod>(parameters->get_theta(),parameters->get_G(),parameters->get_a(),
+																	  tree_options,parameters->get_method() == "falcon");
+		} else {
+			stringstream message;
+			message<<__FILE__ <<" " <<__LINE__<<" Error: unknown method " << parameters->get_method()
+				<< ": should be barnes-hut, fmm, falcon, or direct" << endl;
+			throw logic_error(message.str().c_str());
+		}
 		Reporter reporter(configuration,parameters->get_base(),parameters->get_path(),"csv",parameters->get_frequency());
 		Notifier notifier("kill");
-		Leapfrog integrator(configuration,  calculate_acceleration,reporter,notifier);
+		Leapfrog integrator(configuration,  *calculate_acceleration,reporter,notifier,parameters->get_threads(),
+							parameters->get_reorder_interval(),
+							parameters->should_use_hilbert() ? SpaceFillingCurve::Hilbert : SpaceFillingCurve::Morton);
 		integrator.run(parameters->get_max_iter(),parameters->get_dt());
 	}  catch (const exception& e) {
         cerr << __FILE__ << " " << __LINE__ << " Terminating because of errors: "<< endl;
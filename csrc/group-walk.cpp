@@ -0,0 +1,196 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include "barnes-hut.hpp"
+#include "group-walk.hpp"
+#include "interaction-kernel.hpp"
+
+using namespace std;
+
+/**
+ *  Parameters:
+ *  	criterion   Used to decide whether a node is distant enough to be treated as a whole
+ *  	G           Gravitational constant
+ *  	a           Softening length
+ *  	quadrupole  Use quadrupole moments of nodes, which must have been calculated
+ *  	tight_bounds Use tight bounding boxes of nodes, which must have been calculated, to decide whether to open them
+ *  	group_size  Maximum number of particles in a group
+ */
+GroupWalk::GroupWalk(const OpeningCriterion & criterion, const double G, const double a, const bool quadrupole, const bool tight_bounds,
+					 const int group_size)
+	: _criterion(criterion), _G(G), _a(a), _quadrupole(quadrupole), _tight_bounds(tight_bounds), _group_size(group_size) {}
+
+/**
+ *  Calculate accelerations of all particles in tree, and store them in particles.
+ *  The relative criterion uses the accelerations from the previous step, but each
+ *  group only overwrites the accelerations of its own members after its walk.
+ *
+ *  Parameters:
+ *      root        Root of tree
+ *      particles   The particles in the tree
+ */
+void GroupWalk::calculate(Node * root, ParticleStore & particles) {
+	_groups.clear();
+	if (root->_particle_index == Node::Unused) return;
+	_find_groups(root);
+	for (Node * group : _groups) {
+		_members.clear();
+		_Bmin.fill(numeric_limits<double>::max());
+		_Bmax.fill(numeric_limits<double>::lowest());
+		_a_old = numeric_limits<double>::max();
+		_collect_members(group,particles);
+		_x.clear();
+		_y.clear();
+		_z.clear();
+		_m.clear();
+		_accepted.clear();
+		for (int index : _members)
+			_add(particles[index].get_mass(),particles[index].get_position());
+		_walk(root,group,particles);
+		_evaluate(particles);
+	}
+}
+
+/**
+ *  Find the groups in a subtree. We find the groups below an Internal node first;
+ *  if the node turns out to be small enough, they are replaced by the node itself.
+ *  An External node is always a group, even if its bucket is larger than the group size.
+ *
+ *  Returns:
+ *      Number of particles in subtree
+ */
+int GroupWalk::_find_groups(Node * node) {
+	if (node->_particle_index != Node::Internal) {
+		_groups.push_back(node);
+		return node->get_particles().size();
+	}
+	const size_t mark = _groups.size();
+	int count = 0;
+	for (int i=0;i<node->get_n_children();i++)
+		count += _find_groups(&node->_children[i]);
+	if (count <= _group_size) {
+		_groups.resize(mark);
+		_groups.push_back(node);
+	}
+	return count;
+}
+
+/**
+ *  Record the particles in a group, and their bounding box
+ */
+void GroupWalk::_collect_members(Node * node, ParticleStore & particles) {
+	if (node->_particle_index != Node::Internal) {
+		for (int index : node->get_particles()) {
+			_members.push_back(index);
+			const auto position = particles[index].get_position();
+			for (int i=0;i<NDIM;i++) {
+				_Bmin[i] = min(_Bmin[i],position[i]);
+				_Bmax[i] = max(_Bmax[i],position[i]);
+			}
+			_a_old = min(_a_old,BarnesHutVisitor::get_acceleration_magnitude(particles[index]));
+		}
+		return;
+	}
+	for (int i=0;i<node->get_n_children();i++)
+		_collect_members(&node->_children[i],particles);
+}
+
+/**
+ *  Walk tree to build the list of interactions for the current group. This follows
+ *  BarnesHutVisitor: an External node is treated as a point mass if it is accepted
+ *  and has more than one particle; otherwise we use the particles in its bucket.
+ *  The group's own particles are already in the list, so we skip its subtree.
+ *
+ *  Parameters:
+ *      node        Current node while walking tree
+ *      group       Root of subtree for the current group
+ *      particles   The particles in the tree
+ */
+void GroupWalk::_walk(Node * node, Node * group, ParticleStore & particles) {
+	if (node == group) return;
+	if (node->_particle_index == Node::Internal) {
+		if (_accept(node)) {
+			_add(node->get_mass(),node->get_centre_of_mass());
+			if (_quadrupole) _accepted.push_back(node);
+			return;
+		}
+		for (int i=0;i<node->get_n_children();i++)
+			_walk(&node->_children[i],group,particles);
+		return;
+	}
+	const auto bucket = node->get_particles();
+	if (bucket.size() > 1 && _accept(node)) {
+		_add(node->get_mass(),node->get_centre_of_mass());
+		if (_quadrupole) _accepted.push_back(node);
+		return;
+	}
+	for (int index : bucket)
+		_add(particles[index].get_mass(),particles[index].get_position());
+}
+
+/**
+ *  Determine whether a node is distant enough to be treated as a whole by every
+ *  member of the current group. Each criterion becomes more willing to accept a node
+ *  as the distance, or the previous acceleration, increases, so we use the shortest
+ *  distance from the centre of mass to the group's bounding box, and the smallest
+ *  acceleration of any member. If the centre of mass is inside the box, the distance
+ *  is zero, and the node is opened.
+ */
+bool GroupWalk::_accept(Node * node) {
+	const auto X = node->get_centre_of_mass();
+	double dsq = 0.0;
+	for (int i=0;i<NDIM;i++)
+		dsq += sqr(max({0.0,_Bmin[i] - X[i],X[i] - _Bmax[i]}));
+	if (_tight_bounds)
+		return _criterion.accept(node->get_mass(),node->get_tight_side(),node->get_tight_bmax_sq(),dsq,_a_old);
+	return _criterion.accept(node->get_mass(),node->get_side(),node->get_bmax_sq(),dsq,_a_old);
+}
+
+/**
+ *  Add one point mass to the list of interactions
+ */
+void GroupWalk::_add(const double m, const array<double,NDIM> & X) {
+	_x.push_back(X[0]);
+	_y.push_back(X[1]);
+	_z.push_back(X[2]);
+	_m.push_back(m);
+}
+
+/**
+ *  Evaluate the list of interactions for each member of the current group. Member k
+ *  is at position k in the list, so we evaluate the parts before and after it.
+ */
+void GroupWalk::_evaluate(ParticleStore & particles) {
+	const int n = _m.size();
+	for (int k=0;k<static_cast<int>(_members.size());k++) {
+		Particle & particle = particles[_members[k]];
+		const auto position = particle.get_position();
+		array<double,NDIM> sum = {0.0,0.0,0.0};
+		InteractionKernel::accumulate(_x.data(),_y.data(),_z.data(),_m.data(),k,position,_a,sum);
+		InteractionKernel::accumulate(_x.data()+k+1,_y.data()+k+1,_z.data()+k+1,_m.data()+k+1,n-k-1,position,_a,sum);
+		array<double,NDIM> acceleration = {_G*sum[0],_G*sum[1],_G*sum[2]};
+		for (Node * node : _accepted) {
+			const auto X = node->get_centre_of_mass();
+			BarnesHutVisitor::add_quadrupole_acceleration(node->get_quadrupole(),X,position,Particle::get_distance_sq(X,position),
+														  _G,_a,acceleration);
+		}
+		particle.set_acceleration(acceleration);
+	}
+}
@@ -0,0 +1,180 @@
+#ifndef _GROUP_WALK_HPP
+#define _GROUP_WALK_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <array>
+#include <vector>
+
+#include "opening-criterion.hpp"
+#include "particle.hpp"
+#include "treecode.hpp"
+
+using namespace std;
+
+/**
+ *  This class calculates the accelerations of all particles by walking the tree once
+ *  for each group of nearby particles, instead of once for each particle. A group is
+ *  the largest subtree that has no more than a specified number of particles.
+ *
+ *  The walk for a group builds a list of interactions: the masses of the nodes that
+ *  are distant enough from every particle in the group, and the particles from the
+ *  buckets that aren't. The list is then evaluated for each particle in the group
+ *  by the InteractionKernel.
+ */
+class GroupWalk {
+  private:
+	/**
+	 *  Used to decide whether a node is distant enough to be treated as a whole
+	 */
+	const OpeningCriterion & _criterion;
+
+	/**
+	 *  Gravitational constant
+	 */
+	const double _G;
+
+	/**
+	 *  Softening length
+	 */
+	const double _a;
+
+	/**
+	 *  Indicates that quadrupole moments of nodes are to be used
+	 */
+	const bool _quadrupole;
+
+	/**
+	 *  Indicates that tight bounding boxes of nodes are to be used instead of cubes in opening criterion
+	 */
+	const bool _tight_bounds;
+
+	/**
+	 *  Maximum number of particles in a group
+	 */
+	const int _group_size;
+
+	/**
+	 *  Roots of the subtrees that form groups
+	 */
+	vector<Node*> _groups;
+
+	/**
+	 *  Indices of the particles in the current group
+	 */
+	vector<int> _members;
+
+	/**
+	 *  Bounding box of the particles in the current group
+	 */
+	array<double,NDIM> _Bmin;
+
+	array<double,NDIM> _Bmax;
+
+	/**
+	 *  Smallest magnitude of the previous acceleration of any particle in the current group
+	 */
+	double _a_old;
+
+	/**
+	 *  Interactions for the current group: the members come first, in the same order
+	 *  as _members, so a particle's interaction with itself can be skipped.
+	 */
+	vector<double> _x;
+
+	vector<double> _y;
+
+	vector<double> _z;
+
+	vector<double> _m;
+
+	/**
+	 *  Nodes whose quadrupole moments are needed for the current group
+	 */
+	vector<Node*> _accepted;
+
+  public:
+	/**
+	 *  Parameters:
+	 *  	criterion   Used to decide whether a node is distant enough to be treated as a whole
+	 *  	G           Gravitational constant
+	 *  	a           Softening length
+	 *  	quadrupole  Use quadrupole moments of nodes, which must have been calculated
+	 *  	tight_bounds Use tight bounding boxes of nodes, which must have been calculated, to decide whether to open them
+	 *  	group_size  Maximum number of particles in a group
+	 */
+	GroupWalk(const OpeningCriterion & criterion, const double G, const double a, const bool quadrupole, const bool tight_bounds,
+			  const int group_size);
+
+	/**
+	 *  Calculate accelerations of all particles in tree, and store them in particles.
+	 *  Masses and centres of mass must have been calculated.
+	 *
+	 *  Parameters:
+	 *      root        Root of tree
+	 *      particles   The particles in the tree
+	 */
+	void calculate(Node * root, ParticleStore & particles);
+
+	/**
+	 *  Number of groups found by the last call to calculate()
+	 */
+	int get_n_groups() {return _groups.size();}
+
+  private:
+	/**
+	 *  Find the groups in a subtree
+	 *
+	 *  Returns:
+	 *      Number of particles in subtree
+	 */
+	int _find_groups(Node * node);
+
+	/**
+	 *  Record the particles in a group, and their bounding box
+	 */
+	void _collect_members(Node * node, ParticleStore & particles);
+
+	/**
+	 *  Walk tree to build the list of interactions for the current group
+	 *
+	 *  Parameters:
+	 *      node        Current node while walking tree
+	 *      group       Root of subtree for the current group
+	 *      particles   The particles in the tree
+	 */
+	void _walk(Node * node, Node * group, ParticleStore & particles);
+
+	/**
+	 *  Determine whether a node is distant enough to be treated as a whole by every
+	 *  member of the current group.
+	 */
+	bool _accept(Node * node);
+
+	/**
+	 *  Add one point mass to the list of interactions
+	 */
+	void _add(const double m, const array<double,NDIM> & X);
+
+	/**
+	 *  Evaluate the list of interactions for each member of the current group
+	 */
+	void _evaluate(ParticleStore & particles);
+};
+
+#endif   // _GROUP_WALK_HPP
@@ -23,27 +23,10 @@
 #include "acceleration.hpp"
 #include "integrators.hpp"
 #include "logger.hpp"
+#include "thread-pool.hpp"
 
 using namespace std;
 
-Leapfrog::Euler::Euler(const double dt) 
-   :_dt(dt){}
-   
-/**
- *  Use Euler algorithm for first step. NB: this updates velocity only, so 
- *  position remains at its initial value, as Leapfrog expects.
- *
- *  particles         Vector of particles
- */
- 
-void Leapfrog::Euler::visit(Particle & particle){
-	array<double,NDIM>  velocity = particle.get_velocity();
-	array<double,NDIM>  acceleration = particle.get_acceleration();
-	for (int i=0;i<NDIM;i++)
-		velocity[i] += _dt * acceleration[i];
-	particle.set_velocity(velocity);
-}
-
 /**
  *    Initialize Leapfrog.
  *
@@ -51,39 +34,45 @@ void Leapfrog::Euler::visit(Particle & particle){
  *        configuration             Container for particles
  *        calculate_acceleration    Used to calculate acceleration of each particle
  *        reporter                  Used to record results in a file
+ *        threads                   Number of threads used to update positions and velocities
+ *        reorder_interval          If positive, sort particles along a space-filling curve every reorder_interval steps
+ *        curve                     Curve used to sort particles
  */
-Leapfrog::Leapfrog(Configuration & configuration, IAccelerationVisitor &calculate_acceleration,IReporter & reporter, Notifier & notifier)
+Leapfrog::Leapfrog(Configuration & configuration, IAccelerationVisitor &calculate_acceleration,IReporter & reporter, Notifier & notifier,
+				   const int threads, const int reorder_interval, const SpaceFillingCurve::Type curve)
 	:  	_configuration(configuration),
 		_calculate_acceleration(calculate_acceleration),
-		_reporter(reporter),_notifier(notifier) {;}
+		_reporter(reporter),_notifier(notifier),_threads(threads),
+		_reorder_interval(reorder_interval),_curve(curve) {;}
 		
 /**
- * This function is responsible for integrating an ODE.
+ * This function is responsible for integrating an ODE. The updates of positions
+ * and velocities work on the arrays of the ParticleStore, and are divided between
+ * threads from the shared ThreadPool, which also supplies the threads for building
+ * the tree and calculating accelerations.
  *
  * Parameters:
  *     max_iter   Number of iterations
  *     dt         Time step
  */
 void Leapfrog::run( int max_iter,const double dt){
-	VelocityUpdater velocity_updater(dt);
-	PositionUpdater position_updater(dt);
+	ParticleStore & particles = _configuration.get_particles();
 	/**
-	 *  First, take a half step and update velocities
+	 *  First, take a half step and update velocities, using the Euler algorithm.
+	 *  NB: this updates velocity only, so position remains at its initial value,
+	 *  as Leapfrog expects.
 	 */
-	_configuration.initialize(_calculate_acceleration);
-	_configuration.iterate(_calculate_acceleration);
-	Euler euler(0.5*dt);
-	_configuration.iterate(euler);
+	_calculate_accelerations(0);
+	_advance(particles.get_velocities(),particles.get_accelerations(),0.5*dt);
 	/**
 	 *  Now the velocities are one half step ahead of the position. We keep
 	 *  leapfrogging: use the "half ahead" velocity to update positions,
 	 *  calculate accelerations for the new positions, then update velocity.
 	 */
 	for (int iter=0;iter<max_iter and _notifier.should_continue();iter++) {
-		_configuration.iterate(position_updater);
-		_configuration.initialize(_calculate_acceleration);
-		_configuration.iterate(_calculate_acceleration);
-		_configuration.iterate(velocity_updater);
+		_advance(particles.get_positions(),particles.get_velocities(),dt);
+		_calculate_accelerations(iter+1);
+		_advance(particles.get_velocities(),particles.get_accelerations(),dt);
 		_reporter.report();
 	}
 }
@@ -91,32 +80,46 @@ void Leapfrog::run( int max_iter,const double dt){
 
 
 /**
- *  First half of Leapfrog algorithm - update positions
+ * Calculate accelerations for current positions. Every reorder_interval steps,
+ * the particles are first sorted along a space-filling curve, as they drift
+ * away from the neighbours they had when they were last sorted; this is done
+ * before the tree is built, so the particles in each bucket are close in memory.
  *
- *  dt                Time step
- *  particles         Vector of particles
+ * Parameters:
+ *     step       Number of steps taken so far
  */
-void Leapfrog::PositionUpdater::visit(Particle & particle){
-	array<double,NDIM>  position = particle.get_position();
-	array<double,NDIM>  velocity = particle.get_velocity();
-	for (int i=0;i<NDIM;i++)
-		position[i] += _dt * velocity[i];
-	particle.set_position(position);
+void Leapfrog::_calculate_accelerations(const int step){
+	if (_reorder_interval > 0 && step % _reorder_interval == 0)
+		_configuration.reorder(_curve);
+	_configuration.initialize(_calculate_acceleration);
+	_configuration.iterate(_calculate_acceleration);
 }
 
 /**
- *  Second half of Leapfrog algorithm - update velocities
+ * Add dt times one vector to another, for every particle: used to update
+ * positions from velocities (drift), and velocities from accelerations (kick).
+ * Each thread takes a contiguous range of particles.
  *
- *  dt                Time step
- *  particles         Vector of particles
+ * Parameters:
+ *     target     Components of vector to be updated
+ *     rate       Components of its rate of change
+ *     dt         Time step
  */
-void Leapfrog::VelocityUpdater::visit(Particle & particle){
-	array<double,NDIM>  velocity = particle.get_velocity();
-	array<double,NDIM>  acceleration = particle.get_acceleration();
-	for (int i=0;i<NDIM;i++)
-		velocity[i] += _dt * acceleration[i];
-	particle.set_velocity(velocity);	
+void Leapfrog::_advance(array<span<double>,NDIM> target, array<span<double>,NDIM> rate, const double dt){
+	const int n = target[0].size();
+	auto advance = [&](const int first, const int last){
+		for (int j=0;j<NDIM;j++) {
+			double * x = target[j].data();
+			const double * v = rate[j].data();
+			for (int i=first;i<last;i++)
+				x[i] += dt * v[i];
+		}
+	};
+	if (_threads < 2) {
+		advance(0,n);
+		return;
+	}
+	ThreadPool::run_in_parallel(_threads,[&](int thread){
+		advance((long)thread*n/_threads,(long)(thread+1)*n/_threads);
+	});
 }
-
-
-
@@ -32,63 +32,12 @@ using namespace std;
  * See Peter Young: Leapfrog method and other "symplectic" algorithms for integrating Newton’s laws of motion
  * https://courses.physics.ucsd.edu/2019/Winter/physics141/Assignments/leapfrog.pdf.
  *
- * This class implements Configuration::Visitor. The visit() method is called once
- * for each particle.
+ * The positions and velocities are updated directly in the arrays of the
+ * ParticleStore, one component at a time, so the loops can be vectorized.
  */
 
 class Leapfrog {
 
-	/**
-	 *  Use Euler algorithm for first step. NB: this updates velocity only, so x
-	 *  remains at its initial value, which is what Leapfrog needs.
-	 *  
-	 */
-	class Euler : public Visitor<Particle> {
-	  private:
-		/**
-		 *  _dt  Time step - set to half the timestep for Leapfrog
-		 */ 
-		const double _dt;
-		
-	  public:
-		Euler(const double dt);
-		
-		void visit(Particle & particle);
-	};
-
-	/**
-	 * Class used to implement second half of Verlet algorithm - update positions
-	 */	
-	class PositionUpdater : public Visitor<Particle> {
-	  private:
-		const double _dt;
-		
-	  public:
-		PositionUpdater(const double dt) :_dt(dt){;}
-		
-		/**
-		 * Calculate position one step ahead
-		 */
-		void visit(Particle & particle);
-	};	
-
-	/**
-	 * Class used to implement first half of Verlet algorithm - update velocities
-	 */
-	class VelocityUpdater : public Visitor<Particle> {
-	  private:
-		const double _dt;
-		
-	  public:
-		VelocityUpdater(const double dt) :_dt(dt){;}
-		
-		/**
-		 * Calculate velocity one step ahead, 
-		 * which is half a step ahead of position
-		 */
-		void visit(Particle & particle);
-	};	
-
   private:
 	/**
 	 *   Container for particles
@@ -106,6 +55,21 @@ class Leapfrog {
 	
 	 Notifier & _notifier;
 	
+	/**
+	 *   Number of threads used to update positions and velocities
+	 */
+	const int _threads;
+	
+	/**
+	 *   If positive, sort particles along a space-filling curve every reorder_interval steps
+	 */
+	const int _reorder_interval;
+	
+	/**
+	 *   Curve used to sort particles
+	 */
+	const SpaceFillingCurve::Type _curve;
+	
   public:
   
     /**
@@ -115,8 +79,12 @@ class Leapfrog {
 	 *        configuration             Container for particles
 	 *        calculate_acceleration    Used to calculate acceleration of each particle
 	 *        reporter                  Used to record results in a file
+	 *        threads                   Number of threads used to update positions and velocities
+	 *        reorder_interval          If positive, sort particles along a space-filling curve every reorder_interval steps
+	 *        curve                     Curve used to sort particles
 	 */
-	Leapfrog(Configuration & configuration, IAccelerationVisitor &calculate_acceleration,IReporter & reporter, Notifier & notifier);
+	Leapfrog(Configuration & configuration, IAccelerationVisitor &calculate_acceleration,IReporter & reporter, Notifier & notifier,
+			 const int threads=1, const int reorder_interval=0, const SpaceFillingCurve::Type curve=SpaceFillingCurve::Morton);
 	
 	/**
 	 * This function is responsible for integrating an ODE.
@@ -126,6 +94,27 @@ class Leapfrog {
 	 *     dt         Time step
 	 */
 	void run( int max_iter,const double dt);
+	
+  private:
+	/**
+	 * Add dt times one vector to another, for every particle: used to update
+	 * positions from velocities (drift), and velocities from accelerations (kick).
+	 *
+	 * Parameters:
+	 *     target     Components of vector to be updated
+	 *     rate       Components of its rate of change
+	 *     dt         Time step
+	 */
+	void _advance(array<span<double>,NDIM> target, array<span<double>,NDIM> rate, const double dt);
+	
+	/**
+	 * Calculate accelerations for current positions, having first sorted the
+	 * particles, if this is one of the steps at which they are to be sorted.
+	 *
+	 * Parameters:
+	 *     step       Number of steps taken so far
+	 */
+	void _calculate_accelerations(const int step);
 };
 
 
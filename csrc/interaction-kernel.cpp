@@ -0,0 +1,531 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <sstream>
+#include <stdexcept>
+
+#include "interaction-kernel.hpp"
+
+/**
+ *  The vector implementations are compiled for specific processors using
+ *  the target attribute, so they are only available with gcc or clang on x86-64.
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define _VECTOR_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+	/**
+	 *  Process the interactions from first to n one at a time.
+	 */
+	void accumulate_scalar(const double * x, const double * y, const double * z, const double * m, const int first, const int n,
+						   const array<double,NDIM> & position, const double a, array<double,NDIM> & acceleration) {
+		for (int j=first;j<n;j++) {
+			const double dx = x[j] - position[0];
+			const double dy = y[j] - position[1];
+			const double dz = z[j] - position[2];
+			const double factor = m[j] * InteractionKernel::get_softened_factor(dx*dx + dy*dy + dz*dz,a);
+			acceleration[0] += dx * factor;
+			acceleration[1] += dy * factor;
+			acceleration[2] += dz * factor;
+		}
+	}
+
+	/**
+	 *  Process the mutual interactions from first to n one at a time.
+	 */
+	void accumulate_mutual_scalar(const double * x, const double * y, const double * z, const double * m, const int first, const int n,
+								  const array<double,NDIM> & position, const double mass, const double a,
+								  array<double,NDIM> & acceleration, double * ax, double * ay, double * az) {
+		for (int j=first;j<n;j++) {
+			const double dx = x[j] - position[0];
+			const double dy = y[j] - position[1];
+			const double dz = z[j] - position[2];
+			const double softened_factor = InteractionKernel::get_softened_factor(dx*dx + dy*dy + dz*dz,a);
+			const double factor = m[j] * softened_factor;
+			const double reaction = mass * softened_factor;
+			acceleration[0] += dx * factor;
+			acceleration[1] += dy * factor;
+			acceleration[2] += dz * factor;
+			ax[j] -= dx * reaction;
+			ay[j] -= dy * reaction;
+			az[j] -= dz * reaction;
+		}
+	}
+
+	/**
+	 *  Process the interactions from first to n one at a time, in single precision.
+	 */
+	void accumulate_float_scalar(const float * dx, const float * dy, const float * dz, const float * m, const int first, const int n,
+								 const float a, array<double,NDIM> & acceleration) {
+		float sum[NDIM] = {0.0f,0.0f,0.0f};
+		for (int j=first;j<n;j++) {
+			const float r_sq = dx[j]*dx[j] + dy[j]*dy[j] + dz[j]*dz[j] + a*a;
+			const float inverse_r = 1.0f / sqrtf(r_sq);
+			const float factor = m[j] * inverse_r * inverse_r * inverse_r;
+			sum[0] += dx[j] * factor;
+			sum[1] += dy[j] * factor;
+			sum[2] += dz[j] * factor;
+		}
+		for (int i=0;i<NDIM;i++)
+			acceleration[i] += sum[i];
+	}
+
+#ifdef _VECTOR_KERNELS
+
+	/**
+	 *  Process interactions four at a time. There is no reciprocal square root for doubles
+	 *  in AVX2, so we start from the single precision estimate, which has 12 good bits,
+	 *  and use three Newton steps, y = y(3 - r^2 y^2)/2, each of which doubles the number
+	 *  of good bits. This requires r^2 to be within the range of a float, which it
+	 *  will be unless the softening length is zero and two particles coincide.
+	 */
+	__attribute__((target("avx2,fma")))
+	void accumulate_avx2(const double * x, const double * y, const double * z, const double * m, const int n,
+						 const array<double,NDIM> & position, const double a, array<double,NDIM> & acceleration) {
+		const __m256d px = _mm256_set1_pd(position[0]);
+		const __m256d py = _mm256_set1_pd(position[1]);
+		const __m256d pz = _mm256_set1_pd(position[2]);
+		const __m256d a_sq = _mm256_set1_pd(a*a);
+		const __m256d half = _mm256_set1_pd(0.5);
+		const __m256d three_halves = _mm256_set1_pd(1.5);
+		__m256d ax = _mm256_setzero_pd();
+		__m256d ay = _mm256_setzero_pd();
+		__m256d az = _mm256_setzero_pd();
+		int j = 0;
+		for (;j+4<=n;j+=4) {
+			const __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x+j),px);
+			const __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y+j),py);
+			const __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z+j),pz);
+			const __m256d r_sq = _mm256_fmadd_pd(dz,dz,_mm256_fmadd_pd(dy,dy,_mm256_fmadd_pd(dx,dx,a_sq)));
+			const __m256d half_r_sq = _mm256_mul_pd(half,r_sq);
+			__m256d inverse_r = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r_sq)));
+			for (int k=0;k<3;k++)
+				inverse_r = _mm256_mul_pd(inverse_r,
+										  _mm256_fnmadd_pd(_mm256_mul_pd(half_r_sq,inverse_r),inverse_r,three_halves));
+			const __m256d factor = _mm256_mul_pd(_mm256_loadu_pd(m+j),
+												 _mm256_mul_pd(inverse_r,_mm256_mul_pd(inverse_r,inverse_r)));
+			ax = _mm256_fmadd_pd(dx,factor,ax);
+			ay = _mm256_fmadd_pd(dy,factor,ay);
+			az = _mm256_fmadd_pd(dz,factor,az);
+		}
+		alignas(32) double sum[3][4];
+		_mm256_store_pd(sum[0],ax);
+		_mm256_store_pd(sum[1],ay);
+		_mm256_store_pd(sum[2],az);
+		for (int i=0;i<NDIM;i++)
+			acceleration[i] += (sum[i][0] + sum[i][1]) + (sum[i][2] + sum[i][3]);
+		accumulate_scalar(x,y,z,m,j,n,position,a,acceleration);
+	}
+
+	/**
+	 *  Process interactions eight at a time, in single precision. The reciprocal square
+	 *  root has 12 good bits, so one Newton step gives nearly full single precision.
+	 *  The lanes are converted to double before they are added up.
+	 */
+	__attribute__((target("avx2,fma")))
+	void accumulate_float_avx2(const float * dx, const float * dy, const float * dz, const float * m, const int n,
+							   const float a, array<double,NDIM> & acceleration) {
+		const __m256 a_sq = _mm256_set1_ps(a*a);
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 three_halves = _mm256_set1_ps(1.5f);
+		__m256 ax = _mm256_setzero_ps();
+		__m256 ay = _mm256_setzero_ps();
+		__m256 az = _mm256_setzero_ps();
+		int j = 0;
+		for (;j+8<=n;j+=8) {
+			const __m256 x = _mm256_loadu_ps(dx+j);
+			const __m256 y = _mm256_loadu_ps(dy+j);
+			const __m256 z = _mm256_loadu_ps(dz+j);
+			const __m256 r_sq = _mm256_fmadd_ps(z,z,_mm256_fmadd_ps(y,y,_mm256_fmadd_ps(x,x,a_sq)));
+			__m256 inverse_r = _mm256_rsqrt_ps(r_sq);
+			inverse_r = _mm256_mul_ps(inverse_r,
+									  _mm256_fnmadd_ps(_mm256_mul_ps(_mm256_mul_ps(half,r_sq),inverse_r),inverse_r,three_halves));
+			const __m256 factor = _mm256_mul_ps(_mm256_loadu_ps(m+j),_mm256_mul_ps(inverse_r,_mm256_mul_ps(inverse_r,inverse_r)));
+			ax = _mm256_fmadd_ps(x,factor,ax);
+			ay = _mm256_fmadd_ps(y,factor,ay);
+			az = _mm256_fmadd_ps(z,factor,az);
+		}
+		alignas(32) float partial[3][8];
+		_mm256_store_ps(partial[0],ax);
+		_mm256_store_ps(partial[1],ay);
+		_mm256_store_ps(partial[2],az);
+		alignas(32) double sum[3][4];
+		for (int i=0;i<NDIM;i++) {
+			_mm256_store_pd(sum[i],_mm256_add_pd(_mm256_cvtps_pd(_mm_load_ps(partial[i])),_mm256_cvtps_pd(_mm_load_ps(partial[i]+4))));
+			acceleration[i] += (sum[i][0] + sum[i][1]) + (sum[i][2] + sum[i][3]);
+		}
+		accumulate_float_scalar(dx,dy,dz,m,j,n,a,acceleration);
+	}
+
+	/**
+	 *  Process mutual interactions four at a time, as accumulate_avx2() does.
+	 */
+	__attribute__((target("avx2,fma")))
+	void accumulate_mutual_avx2(const double * x, const double * y, const double * z, const double * m, const int n,
+								const array<double,NDIM> & position, const double mass, const double a,
+								array<double,NDIM> & acceleration, double * ax, double * ay, double * az) {
+		const __m256d px = _mm256_set1_pd(position[0]);
+		const __m256d py = _mm256_set1_pd(position[1]);
+		const __m256d pz = _mm256_set1_pd(position[2]);
+		const __m256d p_mass = _mm256_set1_pd(mass);
+		const __m256d a_sq = _mm256_set1_pd(a*a);
+		const __m256d half = _mm256_set1_pd(0.5);
+		const __m256d three_halves = _mm256_set1_pd(1.5);
+		__m256d sum_x = _mm256_setzero_pd();
+		__m256d sum_y = _mm256_setzero_pd();
+		__m256d sum_z = _mm256_setzero_pd();
+		int j = 0;
+		for (;j+4<=n;j+=4) {
+			const __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x+j),px);
+			const __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y+j),py);
+			const __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z+j),pz);
+			const __m256d r_sq = _mm256_fmadd_pd(dz,dz,_mm256_fmadd_pd(dy,dy,_mm256_fmadd_pd(dx,dx,a_sq)));
+			const __m256d half_r_sq = _mm256_mul_pd(half,r_sq);
+			__m256d inverse_r = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r_sq)));
+			for (int k=0;k<3;k++)
+				inverse_r = _mm256_mul_pd(inverse_r,
+										  _mm256_fnmadd_pd(_mm256_mul_pd(half_r_sq,inverse_r),inverse_r,three_halves));
+			const __m256d softened_factor = _mm256_mul_pd(inverse_r,_mm256_mul_pd(inverse_r,inverse_r));
+			const __m256d factor = _mm256_mul_pd(_mm256_loadu_pd(m+j),softened_factor);
+			const __m256d reaction = _mm256_mul_pd(p_mass,softened_factor);
+			sum_x = _mm256_fmadd_pd(dx,factor,sum_x);
+			sum_y = _mm256_fmadd_pd(dy,factor,sum_y);
+			sum_z = _mm256_fmadd_pd(dz,factor,sum_z);
+			_mm256_storeu_pd(ax+j,_mm256_fnmadd_pd(dx,reaction,_mm256_loadu_pd(ax+j)));
+			_mm256_storeu_pd(ay+j,_mm256_fnmadd_pd(dy,reaction,_mm256_loadu_pd(ay+j)));
+			_mm256_storeu_pd(az+j,_mm256_fnmadd_pd(dz,reaction,_mm256_loadu_pd(az+j)));
+		}
+		alignas(32) double sum[3][4];
+		_mm256_store_pd(sum[0],sum_x);
+		_mm256_store_pd(sum[1],sum_y);
+		_mm256_store_pd(sum[2],sum_z);
+		for (int i=0;i<NDIM;i++)
+			acceleration[i] += (sum[i][0] + sum[i][1]) + (sum[i][2] + sum[i][3]);
+		accumulate_mutual_scalar(x,y,z,m,j,n,position,mass,a,acceleration,ax,ay,az);
+	}
+
+	/**
+	 *  Process interactions eight at a time. AVX-512 has a reciprocal square root for
+	 *  doubles, with 14 good bits, so two Newton steps suffice.
+	 */
+	__attribute__((target("avx512f")))
+	void accumulate_avx512(const double * x, const double * y, const double * z, const double * m, const int n,
+						   const array<double,NDIM> & position, const double a, array<double,NDIM> & acceleration) {
+		const __m512d px = _mm512_set1_pd(position[0]);
+		const __m512d py = _mm512_set1_pd(position[1]);
+		const __m512d pz = _mm512_set1_pd(position[2]);
+		const __m512d a_sq = _mm512_set1_pd(a*a);
+		const __m512d half = _mm512_set1_pd(0.5);
+		const __m512d three_halves = _mm512_set1_pd(1.5);
+		__m512d ax = _mm512_setzero_pd();
+		__m512d ay = _mm512_setzero_pd();
+		__m512d az = _mm512_setzero_pd();
+		int j = 0;
+		for (;j+8<=n;j+=8) {
+			const __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x+j),px);
+			const __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y+j),py);
+			const __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(z+j),pz);
+			const __m512d r_sq = _mm512_fmadd_pd(dz,dz,_mm512_fmadd_pd(dy,dy,_mm512_fmadd_pd(dx,dx,a_sq)));
+			const __m512d half_r_sq = _mm512_mul_pd(half,r_sq);
+			__m512d inverse_r = _mm512_maskz_rsqrt14_pd(0xFF,r_sq);
+			for (int k=0;k<2;k++)
+				inverse_r = _mm512_mul_pd(inverse_r,
+										  _mm512_fnmadd_pd(_mm512_mul_pd(half_r_sq,inverse_r),inverse_r,three_halves));
+			const __m512d factor = _mm512_mul_pd(_mm512_loadu_pd(m+j),
+												 _mm512_mul_pd(inverse_r,_mm512_mul_pd(inverse_r,inverse_r)));
+			ax = _mm512_fmadd_pd(dx,factor,ax);
+			ay = _mm512_fmadd_pd(dy,factor,ay);
+			az = _mm512_fmadd_pd(dz,factor,az);
+		}
+		alignas(64) double sum[3][8];
+		_mm512_store_pd(sum[0],ax);
+		_mm512_store_pd(sum[1],ay);
+		_mm512_store_pd(sum[2],az);
+		for (int i=0;i<NDIM;i++)
+			acceleration[i] += ((sum[i][0] + sum[i][1]) + (sum[i][2] + sum[i][3])) + ((sum[i][4] + sum[i][5]) + (sum[i][6] + sum[i][7]));
+		accumulate_scalar(x,y,z,m,j,n,position,a,acceleration);
+	}
+
+	/**
+	 *  Process interactions sixteen at a time, in single precision. The reciprocal
+	 *  square root has 14 good bits, so one Newton step gives full single precision.
+	 */
+	__attribute__((target("avx512f")))
+	void accumulate_float_avx512(const float * dx, const float * dy, const float * dz, const float * m, const int n,
+								 const float a, array<double,NDIM> & acceleration) {
+		const __m512 a_sq = _mm512_set1_ps(a*a);
+		const __m512 half = _mm512_set1_ps(0.5f);
+		const __m512 three_halves = _mm512_set1_ps(1.5f);
+		__m512 ax = _mm512_setzero_ps();
+		__m512 ay = _mm512_setzero_ps();
+		__m512 az = _mm512_setzero_ps();
+		int j = 0;
+		for (;j+16<=n;j+=16) {
+			const __m512 x = _mm512_loadu_ps(dx+j);
+			const __m512 y = _mm512_loadu_ps(dy+j);
+			const __m512 z = _mm512_loadu_ps(dz+j);
+			const __m512 r_sq = _mm512_fmadd_ps(z,z,_mm512_fmadd_ps(y,y,_mm512_fmadd_ps(x,x,a_sq)));
+			__m512 inverse_r = _mm512_maskz_rsqrt14_ps(0xFFFF,r_sq);
+			inverse_r = _mm512_mul_ps(inverse_r,
+									  _mm512_fnmadd_ps(_mm512_mul_ps(_mm512_mul_ps(half,r_sq),inverse_r),inverse_r,three_halves));
+			const __m512 factor = _mm512_mul_ps(_mm512_loadu_ps(m+j),_mm512_mul_ps(inverse_r,_mm512_mul_ps(inverse_r,inverse_r)));
+			ax = _mm512_fmadd_ps(x,factor,ax);
+			ay = _mm512_fmadd_ps(y,factor,ay);
+			az = _mm512_fmadd_ps(z,factor,az);
+		}
+		alignas(64) float partial[3][16];
+		_mm512_store_ps(partial[0],ax);
+		_mm512_store_ps(partial[1],ay);
+		_mm512_store_ps(partial[2],az);
+		alignas(64) double sum[3][8];
+		for (int i=0;i<NDIM;i++) {
+			_mm512_store_pd(sum[i],_mm512_add_pd(_mm512_maskz_cvtps_pd(0xFF,_mm256_load_ps(partial[i])),
+												  _mm512_maskz_cvtps_pd(0xFF,_mm256_load_ps(partial[i]+8))));
+			acceleration[i] += ((sum[i][0] + sum[i][1]) + (sum[i][2] + sum[i][3])) + ((sum[i][4] + sum[i][5]) + (sum[i][6] + sum[i][7]));
+		}
+		accumulate_float_scalar(dx,dy,dz,m,j,n,a,acceleration);
+	}
+
+	/**
+	 *  Process mutual interactions eight at a time, as accumulate_avx512() does.
+	 */
+	__attribute__((target("avx512f")))
+	void accumulate_mutual_avx512(const double * x, const double * y, const double * z, const double * m, const int n,
+								  const array<double,NDIM> & position, const double mass, const double a,
+								  array<double,NDIM> & acceleration, double * ax, double * ay, double * az) {
+		const __m512d px = _mm512_set1_pd(position[0]);
+		const __m512d py = _mm512_set1_pd(position[1]);
+		const __m512d pz = _mm512_set1_pd(position[2]);
+		const __m512d p_mass = _mm512_set1_pd(mass);
+		const __m512d a_sq = _mm512_set1_pd(a*a);
+		const __m512d half = _mm512_set1_pd(0.5);
+		const __m512d three_halves = _mm512_set1_pd(1.5);
+		__m512d sum_x = _mm512_setzero_pd();
+		__m512d sum_y = _mm512_setzero_pd();
+		__m512d sum_z = _mm512_setzero_pd();
+		int j = 0;
+		for (;j+8<=n;j+=8) {
+			const __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x+j),px);
+			const __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y+j),py);
+			const __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(z+j),pz);
+			const __m512d r_sq = _mm512_fmadd_pd(dz,dz,_mm512_fmadd_pd(dy,dy,_mm512_fmadd_pd(dx,dx,a_sq)));
+			const __m512d half_r_sq = _mm512_mul_pd(half,r_sq);
+			__m512d inverse_r = _mm512_maskz_rsqrt14_pd(0xFF,r_sq);
+			for (int k=0;k<2;k++)
+				inverse_r = _mm512_mul_pd(inverse_r,
+										  _mm512_fnmadd_pd(_mm512_mul_pd(half_r_sq,inverse_r),inverse_r,three_halves));
+			const __m512d softened_factor = _mm512_mul_pd(inverse_r,_mm512_mul_pd(inverse_r,inverse_r));
+			const __m512d factor = _mm512_mul_pd(_mm512_loadu_pd(m+j),softened_factor);
+			const __m512d reaction = _mm512_mul_pd(p_mass,softened_factor);
+			sum_x = _mm512_fmadd_pd(dx,factor,sum_x);
+			sum_y = _mm512_fmadd_pd(dy,factor,sum_y);
+			sum_z = _mm512_fmadd_pd(dz,factor,sum_z);
+			_mm512_storeu_pd(ax+j,_mm512_fnmadd_pd(dx,reaction,_mm512_loadu_pd(ax+j)));
+			_mm512_storeu_pd(ay+j,_mm512_fnmadd_pd(dy,reaction,_mm512_loadu_pd(ay+j)));
+			_mm512_storeu_pd(az+j,_mm512_fnmadd_pd(dz,reaction,_mm512_loadu_pd(az+j)));
+		}
+		alignas(64) double sum[3][8];
+		_mm512_store_pd(sum[0],sum_x);
+		_mm512_store_pd(sum[1],sum_y);
+		_mm512_store_pd(sum[2],sum_z);
+		for (int i=0;i<NDIM;i++)
+			acceleration[i] += ((sum[i][0] + sum[i][1]) + (sum[i][2] + sum[i][3])) + ((sum[i][4] + sum[i][5]) + (sum[i][6] + sum[i][7]));
+		accumulate_mutual_scalar(x,y,z,m,j,n,position,mass,a,acceleration,ax,ay,az);
+	}
+
+#endif   // _VECTOR_KERNELS
+
+}
+
+/**
+ *  The fastest implementation supported by this processor. We only
+ *  need to check once.
+ */
+InteractionKernel::Implementation InteractionKernel::get_best_implementation() {
+	static const Implementation best = is_supported(AVX512) ? AVX512 : is_supported(AVX2) ? AVX2 : Scalar;
+	return best;
+}
+
+/**
+ *  Determine whether this processor supports an implementation
+ */
+bool InteractionKernel::is_supported(const Implementation implementation) {
+	switch (implementation) {
+		case Scalar:
+			return true;
+#ifdef _VECTOR_KERNELS
+		case AVX2:
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		case AVX512:
+			return __builtin_cpu_supports("avx512f");
+#endif
+		default:
+			return false;
+	}
+}
+
+/**
+ *  Add sum of m (X - position) / (|X - position|^2 + a^2)^(3/2) to acceleration.
+ *
+ *  Parameters:
+ *      x              x coordinates of masses
+ *      y              y coordinates of masses
+ *      z              z coordinates of masses
+ *      m              Masses
+ *      n              Number of masses
+ *      position       Position of particle
+ *      a              Softening length
+ *      acceleration   Sum is added to this
+ *      implementation Which implementation to use: it must be supported
+ */
+void InteractionKernel::accumulate(const double * x, const double * y, const double * z, const double * m, const int n,
+								   const array<double,NDIM> & position, const double a, array<double,NDIM> & acceleration,
+								   const Implementation implementation) {
+	switch (implementation) {
+		case Scalar:
+			accumulate_scalar(x,y,z,m,0,n,position,a,acceleration);
+			return;
+#ifdef _VECTOR_KERNELS
+		case AVX2:
+			accumulate_avx2(x,y,z,m,n,position,a,acceleration);
+			return;
+		case AVX512:
+			accumulate_avx512(x,y,z,m,n,position,a,acceleration);
+			return;
+#endif
+		default: {
+			stringstream message;
+			message<<__FILE__ <<" " <<__LINE__<<" Error: interaction kernel " << implementation << " is not available" << endl;
+			throw logic_error(message.str().c_str());
+		}
+	}
+}
+
+/**
+ *  Apply the interactions between a particle and a batch of masses to both: add
+ *  sum of m (X - position) / (|X - position|^2 + a^2)^(3/2) to acceleration, as
+ *  accumulate() does, and subtract mass (X - position) / (|X - position|^2 + a^2)^(3/2)
+ *  from the acceleration of each mass.
+ *
+ *  Parameters:
+ *      x              x coordinates of masses
+ *      y              y coordinates of masses
+ *      z              z coordinates of masses
+ *      m              Masses
+ *      n              Number of masses
+ *      position       Position of particle
+ *      mass           Mass of particle
+ *      a              Softening length
+ *      acceleration   Sum is added to this
+ *      ax             x components of accelerations of masses
+ *      ay             y components of accelerations of masses
+ *      az             z components of accelerations of masses
+ *      implementation Which implementation to use: it must be supported
+ */
+void InteractionKernel::accumulate_mutual(const double * x, const double * y, const double * z, const double * m, const int n,
+										  const array<double,NDIM> & position, const double mass, const double a,
+										  array<double,NDIM> & acceleration, double * ax, double * ay, double * az,
+										  const Implementation implementation) {
+	switch (implementation) {
+		case Scalar:
+			accumulate_mutual_scalar(x,y,z,m,0,n,position,mass,a,acceleration,ax,ay,az);
+			return;
+#ifdef _VECTOR_KERNELS
+		case AVX2:
+			accumulate_mutual_avx2(x,y,z,m,n,position,mass,a,acceleration,ax,ay,az);
+			return;
+		case AVX512:
+			accumulate_mutual_avx512(x,y,z,m,n,position,mass,a,acceleration,ax,ay,az);
+			return;
+#endif
+		default: {
+			stringstream message;
+			message<<__FILE__ <<" " <<__LINE__<<" Error: interaction kernel " << implementation << " is not available" << endl;
+			throw logic_error(message.str().c_str());
+		}
+	}
+}
+
+/**
+ *  Add sum of m d / (|d|^2 + a^2)^(3/2) to acceleration, calculated in single precision.
+ *
+ *  Parameters:
+ *      dx             x components of displacements from particle to masses
+ *      dy             y components of displacements
+ *      dz             z components of displacements
+ *      m              Masses
+ *      n              Number of masses
+ *      a              Softening length
+ *      acceleration   Sum is added to this
+ *      implementation Which implementation to use: it must be supported
+ */
+void InteractionKernel::accumulate_float(const float * dx, const float * dy, const float * dz, const float * m, const int n,
+										 const float a, array<double,NDIM> & acceleration, const Implementation implementation) {
+	switch (implementation) {
+		case Scalar:
+			accumulate_float_scalar(dx,dy,dz,m,0,n,a,acceleration);
+			return;
+#ifdef _VECTOR_KERNELS
+		case AVX2:
+			accumulate_float_avx2(dx,dy,dz,m,n,a,acceleration);
+			return;
+		case AVX512:
+			accumulate_float_avx512(dx,dy,dz,m,n,a,acceleration);
+			return;
+#endif
+		default: {
+			stringstream message;
+			message<<__FILE__ <<" " <<__LINE__<<" Error: interaction kernel " << implementation << " is not available" << endl;
+			throw logic_error(message.str().c_str());
+		}
+	}
+}
+
+/**
+ *  Process any interactions that are still waiting, then calculate the acceleration
+ *
+ *  Parameters:
+ *      G    Gravitational constant
+ */
+array<double,NDIM> InteractionList::get_acceleration(const double G) {
+	_flush();
+	_flush_far();
+	return array<double,NDIM>{G*_sum[0],G*_sum[1],G*_sum[2]};
+}
+
+/**
+ *  Process the interactions that are waiting
+ */
+void InteractionList::_flush() {
+	if (_n == 0) return;
+	InteractionKernel::accumulate(_x,_y,_z,_m,_n,_position,_a,_sum,_implementation);
+	_n = 0;
+}
+
+/**
+ *  Process the interactions with distant nodes that are waiting
+ */
+void InteractionList::_flush_far() {
+	if (_n_far == 0) return;
+	InteractionKernel::accumulate_float(_dx_far,_dy_far,_dz_far,_m_far,_n_far,_a,_sum,_implementation);
+	_n_far = 0;
+}
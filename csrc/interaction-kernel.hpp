@@ -0,0 +1,264 @@
+#ifndef _INTERACTION_KERNEL_HPP
+#define _INTERACTION_KERNEL_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * The innermost loop of the force calculation: softened gravity between
+ * one particle and a batch of point masses.
+ */
+
+#include <array>
+#include <cmath>
+
+#include "particle.hpp"
+
+using namespace std;
+
+/**
+ *  Calculate sum of m (X - position) / (|X - position|^2 + a^2)^(3/2) over a batch
+ *  of masses m at positions X. Coordinates are passed as separate arrays, so
+ *  several interactions can be processed by one vector instruction.
+ *
+ *  There are three implementations: scalar, AVX2, and AVX-512. The vector implementations
+ *  use an approximate reciprocal square root, refined by Newton's method; the
+ *  one to be used by default is chosen when the program starts, using the
+ *  capabilities of the processor, so the executable does not need to be built
+ *  for a specific processor.
+ */
+class InteractionKernel {
+  public:
+	enum Implementation {Scalar, AVX2, AVX512};
+
+	/**
+	 *  Calculate the factor, (dsq + a^2)^(-3/2), that multiplies G m (X - position) to give the
+	 *  acceleration caused by a mass m at X.
+	 *
+	 *  Parameters:
+	 *     dsq     Squared distance from particle to mass
+	 *     a       Softening length
+	 */
+	static inline double get_softened_factor(const double dsq,const double a) {
+		const double r_sq = dsq + a*a;
+		const double inverse_r = 1.0 / sqrt(r_sq);
+		return inverse_r * inverse_r * inverse_r;
+	}
+
+	/**
+	 *  The fastest implementation supported by this processor
+	 */
+	static Implementation get_best_implementation();
+
+	/**
+	 *  Determine whether this processor supports an implementation
+	 */
+	static bool is_supported(const Implementation implementation);
+
+	/**
+	 *  Add sum of m (X - position) / (|X - position|^2 + a^2)^(3/2) to acceleration.
+	 *
+	 *  Parameters:
+	 *      x              x coordinates of masses
+	 *      y              y coordinates of masses
+	 *      z              z coordinates of masses
+	 *      m              Masses
+	 *      n              Number of masses
+	 *      position       Position of particle
+	 *      a              Softening length
+	 *      acceleration   Sum is added to this
+	 *      implementation Which implementation to use: it must be supported
+	 */
+	static void accumulate(const double * x, const double * y, const double * z, const double * m, const int n,
+						   const array<double,NDIM> & position, const double a, array<double,NDIM> & acceleration,
+						   const Implementation implementation=get_best_implementation());
+
+	/**
+	 *  Apply the interactions between a particle and a batch of masses to both: add
+	 *  sum of m (X - position) / (|X - position|^2 + a^2)^(3/2) to acceleration, as
+	 *  accumulate() does, and subtract mass (X - position) / (|X - position|^2 + a^2)^(3/2)
+	 *  from the acceleration of each mass.
+	 *
+	 *  Parameters:
+	 *      x              x coordinates of masses
+	 *      y              y coordinates of masses
+	 *      z              z coordinates of masses
+	 *      m              Masses
+	 *      n              Number of masses
+	 *      position       Position of particle
+	 *      mass           Mass of particle
+	 *      a              Softening length
+	 *      acceleration   Sum is added to this
+	 *      ax             x components of accelerations of masses
+	 *      ay             y components of accelerations of masses
+	 *      az             z components of accelerations of masses
+	 *      implementation Which implementation to use: it must be supported
+	 */
+	static void accumulate_mutual(const double * x, const double * y, const double * z, const double * m, const int n,
+								  const array<double,NDIM> & position, const double mass, const double a,
+								  array<double,NDIM> & acceleration, double * ax, double * ay, double * az,
+								  const Implementation implementation=get_best_implementation());
+
+	/**
+	 *  Add sum of m d / (|d|^2 + a^2)^(3/2) to acceleration, calculated in single
+	 *  precision, so twice as many interactions are processed by each vector instruction.
+	 *  The displacements are supplied instead of the positions, so they can be calculated
+	 *  in double precision first. Used for distant nodes, where the relative error of
+	 *  about 1e-7 is much less than the error of the multipole approximation.
+	 *
+	 *  Parameters:
+	 *      dx             x components of displacements from particle to masses
+	 *      dy             y components of displacements
+	 *      dz             z components of displacements
+	 *      m              Masses
+	 *      n              Number of masses
+	 *      a              Softening length
+	 *      acceleration   Sum is added to this
+	 *      implementation Which implementation to use: it must be supported
+	 */
+	static void accumulate_float(const float * dx, const float * dy, const float * dz, const float * m, const int n,
+								 const float a, array<double,NDIM> & acceleration,
+								 const Implementation implementation=get_best_implementation());
+};
+
+/**
+ *  Used by BarnesHutVisitor and FlatTree to collect the interactions of one particle,
+ *  so they can be passed to the InteractionKernel in batches. Each batch is processed
+ *  as soon as it is full, so no storage needs to be allocated.
+ *
+ *  If mixed precision is requested, interactions with distant nodes are collected in a
+ *  separate batch of floats; interactions with particles are always in double precision,
+ *  as is the sum.
+ */
+class InteractionList {
+  public:
+	/**
+	 *  Number of interactions in a batch
+	 */
+	enum {Capacity=64};
+
+  private:
+	alignas(64) double _x[Capacity];
+
+	alignas(64) double _y[Capacity];
+
+	alignas(64) double _z[Capacity];
+
+	alignas(64) double _m[Capacity];
+
+	/**
+	 *  Displacements and masses of distant nodes, if mixed precision is used
+	 */
+	alignas(64) float _dx_far[Capacity];
+
+	alignas(64) float _dy_far[Capacity];
+
+	alignas(64) float _dz_far[Capacity];
+
+	alignas(64) float _m_far[Capacity];
+
+	/**
+	 *  Number of interactions waiting to be processed
+	 */
+	int _n = 0;
+
+	/**
+	 *  Number of interactions with distant nodes waiting to be processed
+	 */
+	int _n_far = 0;
+
+	/**
+	 *  Position of the particle whose acceleration is being calculated
+	 */
+	const array<double,NDIM> _position;
+
+	/**
+	 *  Softening length
+	 */
+	const double _a;
+
+	/**
+	 *  Sum of m (X - position) / (|X - position|^2 + a^2)^(3/2) for the batches processed so far
+	 */
+	array<double,NDIM> _sum = {0.0,0.0,0.0};
+
+	const InteractionKernel::Implementation _implementation;
+
+	/**
+	 *  Indicates that interactions with distant nodes are calculated in single precision
+	 */
+	const bool _mixed_precision;
+
+  public:
+	/**
+	 *  Parameters:
+	 *      position        Position of the particle whose acceleration is being calculated
+	 *      a               Softening length
+	 *      implementation  Which implementation of the kernel to use
+	 *      mixed_precision Calculate interactions with distant nodes in single precision
+	 */
+	InteractionList(const array<double,NDIM> & position, const double a,
+					const InteractionKernel::Implementation implementation=InteractionKernel::get_best_implementation(),
+					const bool mixed_precision=false)
+		: _position(position), _a(a), _implementation(implementation), _mixed_precision(mixed_precision) {}
+
+	/**
+	 *  Record the interaction with a mass m at X
+	 */
+	inline void add(const double m, const array<double,NDIM> & X) {
+		_x[_n] = X[0];
+		_y[_n] = X[1];
+		_z[_n] = X[2];
+		_m[_n] = m;
+		if (++_n == Capacity) _flush();
+	}
+
+	/**
+	 *  Record the interaction with a distant node, whose mass m is at X. This is
+	 *  the same as add(), unless mixed precision was requested.
+	 */
+	inline void add_far(const double m, const array<double,NDIM> & X) {
+		if (!_mixed_precision) {
+			add(m,X);
+			return;
+		}
+		_dx_far[_n_far] = X[0] - _position[0];
+		_dy_far[_n_far] = X[1] - _position[1];
+		_dz_far[_n_far] = X[2] - _position[2];
+		_m_far[_n_far] = m;
+		if (++_n_far == Capacity) _flush_far();
+	}
+
+	/**
+	 *  Process any interactions that are still waiting, then calculate the acceleration
+	 *
+	 *  Parameters:
+	 *      G    Gravitational constant
+	 */
+	array<double,NDIM> get_acceleration(const double G);
+
+  private:
+	/**
+	 *  Process the interactions that are waiting
+	 */
+	void _flush();
+
+	/**
+	 *  Process the interactions with distant nodes that are waiting
+	 */
+	void _flush_far();
+};
+
+#endif   // _INTERACTION_KERNEL_HPP
@@ -0,0 +1,137 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+#include <stdexcept>
+
+#include "node-arena.hpp"
+#include "treecode.hpp"
+
+using namespace std;
+
+/**
+ *  Allocate space for contiguous Nodes. The caller is responsible for
+ *  constructing them. If current chunk does not have enough space left, 
+ *  move on to the next, which will be taken from the heap if we haven't
+ *  needed this many chunks before.
+ *
+ *  Parameters:
+ *      n     Number of Nodes (no more than Chunk_Size)
+ */
+Node * NodeArena::Lane::allocate(const int n){
+	assert(n <= Chunk_Size);
+	if (_used + n > Chunk_Size) {
+		_chunk++;
+		_used = 0;
+		if (_chunk == static_cast<int>(_chunks.size()))
+			_chunks.push_back(make_unique<byte[]>(Chunk_Size*sizeof(Node)));
+	}
+	Node * product = reinterpret_cast<Node*>(_chunks[_chunk].get()) + _used;
+	_used += n;
+	_count += n;
+	return product;
+}
+
+/**
+ *  Make all chunks available for reuse. Nodes don't own any resources,
+ *  so we don't need to call their destructors.
+ *
+ *  Returns:
+ *     Number of Nodes that have been released
+ */
+int NodeArena::Lane::reset(){
+	const int product = _count;
+	_chunk = -1;
+	_used = Chunk_Size;
+	_count = 0;
+	return product;
+}
+
+/**
+ *  Prepare arena for building a tree. 
+ *
+ *  Parameters:
+ *      lanes    Number of threads that will be building tree
+ */
+void NodeArena::acquire(const int lanes){
+	if (_in_use) {
+		stringstream message;
+		message<<__FILE__ <<" " <<__LINE__<<" Error: arena is already in use by another tree" << endl; 
+		throw logic_error(message.str().c_str()); 
+	}
+	_in_use = true;
+	if (static_cast<int>(_lanes.size()) < lanes)
+		_lanes.resize(lanes);
+}
+
+/**
+ *  Used when tree is no longer needed: release all Nodes, and
+ *  update count of Nodes.
+ */
+void NodeArena::release(){
+	int released = 0;
+	for (auto & lane : _lanes)
+		released += lane.reset();
+	Node::_release(released);
+	for (auto & chunk : _bucket_chunks)
+		chunk.clear();
+	_bucket_chunk = -1;
+	_in_use = false;
+}
+
+/**
+ *  Allocate storage for a bucket when a tree is updated. If current
+ *  chunk does not have enough space left, move on to the next. We never
+ *  let a chunk grow beyond its capacity, so buckets don't move.
+ *
+ *  Parameters:
+ *      n     Number of particles in bucket
+ */
+int * NodeArena::allocate_bucket(const int n){
+	if (_bucket_chunk < 0 || _bucket_chunks[_bucket_chunk].size() + n > _bucket_chunks[_bucket_chunk].capacity()) {
+		_bucket_chunk++;
+		if (_bucket_chunk == static_cast<int>(_bucket_chunks.size()))
+			_bucket_chunks.emplace_back();
+		if (static_cast<int>(_bucket_chunks[_bucket_chunk].capacity()) < n)
+			_bucket_chunks[_bucket_chunk].reserve(max(n,static_cast<int>(Lane::Chunk_Size)));
+	}
+	vector<int> & chunk = _bucket_chunks[_bucket_chunk];
+	chunk.resize(chunk.size() + n);
+	return chunk.data() + chunk.size() - n;
+}
+
+/**
+ *  Number of Nodes allocated since arena was acquired
+ */
+int NodeArena::size(){
+	int product = 0;
+	for (auto & lane : _lanes)
+		product += lane.size();
+	return product;
+}
+
+/**
+ *  Number of Nodes that can be allocated before we need another chunk from the heap
+ */
+int NodeArena::capacity(){
+	int product = 0;
+	for (auto & lane : _lanes)
+		product += lane.capacity();
+	return product;
+}
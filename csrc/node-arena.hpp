@@ -0,0 +1,185 @@
+#ifndef _NODE_ARENA_HPP
+#define _NODE_ARENA_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+ 
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+class Node;
+
+/**
+ *  This class provides the storage for the Nodes of an Oct Tree. Nodes are taken
+ *  from large chunks, so the children of a Node are contiguous, and the whole 
+ *  tree can be released in one operation. Chunks are kept when the tree is released,
+ *  so the next tree can reuse them without going back to the heap.
+ */
+class NodeArena {
+	
+  public:
+	/**
+	 *  Each thread that builds part of the tree has its own Lane, so no locking is needed.
+	 */
+	class Lane {
+	  public:
+		/**
+		 *  Number of Nodes in each chunk
+		 */
+		enum {Chunk_Size=4096};
+		
+	  private:
+		/**
+		 *  Memory for Nodes. Chunks are retained after reset().
+		 */
+		vector<unique_ptr<byte[]>> _chunks;
+		
+		/**
+		 *  The chunk that is currently being filled
+		 */
+		int _chunk = -1;
+		
+		/**
+		 *  Number of Nodes used from current chunk
+		 */
+		int _used = Chunk_Size;
+		
+		/**
+		 *  Number of Nodes allocated since last reset(), less any that have been discarded
+		 */
+		int _count = 0;
+		
+	  public:
+		/**
+		 *  Allocate space for contiguous Nodes. The caller is responsible for
+		 *  constructing them.
+		 *
+		 *  Parameters:
+		 *      n     Number of Nodes (no more than Chunk_Size)
+		 */
+		Node * allocate(const int n);
+		
+		/**
+		 *  Used when Nodes are no longer needed, but can't be released until the
+		 *  next reset(), e.g. when a block of children has been copied to a larger block.
+		 *
+		 *  Parameters:
+		 *      n     Number of Nodes
+		 */
+		void discard(const int n) {_count -= n;}
+		
+		/**
+		 *  Make all chunks available for reuse.
+		 *
+		 *  Returns:
+		 *     Number of Nodes that have been released
+		 */
+		int reset();
+		
+		/**
+		 *  Number of Nodes allocated since last reset()
+		 */
+		int size() {return _count;}
+		
+		/**
+		 *  Number of Nodes that can be allocated before we need another chunk from the heap
+		 */
+		int capacity() {return _chunks.size() * Chunk_Size;}
+	};
+	
+  private:
+	/**
+	 *  One Lane for each thread that builds part of the tree
+	 */
+	vector<Lane> _lanes;
+	
+	/**
+	 *  Indicates that a tree is using this arena
+	 */
+	bool _in_use = false;
+	
+	/**
+	 *  Indices of the particles in the buckets of External Nodes. Each bucket
+	 *  is a contiguous range.
+	 */
+	vector<int> _particle_indices;
+	
+	/**
+	 *  Buckets that have been created after the tree was built. These are
+	 *  allocated from chunks, which never move, and are retained after release().
+	 */
+	vector<vector<int>> _bucket_chunks;
+	
+	/**
+	 *  The chunk of buckets that is currently being filled
+	 */
+	int _bucket_chunk = -1;
+	
+  public:
+	/**
+	 *  Prepare arena for building a tree. 
+	 *
+	 *  Parameters:
+	 *      lanes    Number of threads that will be building tree
+	 */
+	void acquire(const int lanes);
+	
+	/**
+	 *  Used when tree is no longer needed: release all Nodes, and
+	 *  update count of Nodes.
+	 */
+	void release();
+	
+	/**
+	 *  Access the Lane used by a specific thread
+	 */
+	Lane & get_lane(const int lane) {return _lanes[lane];}
+	
+	/**
+	 *  Storage for the indices of the particles in buckets; reused from one tree to the next.
+	 *
+	 *  Parameters:
+	 *      n     Number of particles
+	 */
+	int * get_particle_indices(const int n) {
+		_particle_indices.resize(n);
+		return _particle_indices.data();
+	}
+	
+	/**
+	 *  Allocate storage for a bucket when a tree is updated.
+	 *
+	 *  Parameters:
+	 *      n     Number of particles in bucket
+	 */
+	int * allocate_bucket(const int n);
+	
+	/**
+	 *  Number of Nodes allocated since arena was acquired
+	 */
+	int size();
+	
+	/**
+	 *  Number of Nodes that can be allocated before we need another chunk from the heap
+	 */
+	int capacity();
+};
+
+#endif   // _NODE_ARENA_HPP
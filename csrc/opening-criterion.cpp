@@ -0,0 +1,76 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <sstream>
+#include <stdexcept>
+
+#include "opening-criterion.hpp"
+#include "particle.hpp"
+
+using namespace std;
+
+/**
+ *  Create a criterion
+ *
+ *  Parameters:
+ *      name      One of "geometric", "bmax", or "relative"
+ *      theta     Opening angle
+ *      alpha     Tolerance for relative criterion
+ *      G         Gravitational constant
+ */
+unique_ptr<OpeningCriterion> OpeningCriterion::create(const string & name, const double theta, const double alpha, const double G){
+	if (name == "geometric")
+		return make_unique<GeometricCriterion>(theta);
+	if (name == "bmax")
+		return make_unique<BmaxCriterion>(theta);
+	if (name == "relative")
+		return make_unique<RelativeCriterion>(theta,alpha,G);
+	stringstream message;
+	message<<__FILE__ <<" " <<__LINE__<<" Error: unknown opening criterion " << name
+		<< ": should be geometric, bmax, or relative" << endl;
+	throw logic_error(message.str().c_str());
+}
+
+GeometricCriterion::GeometricCriterion(const double theta) : _theta_squared(sqr(theta)) {}
+
+/**
+ *  Accept if side/d < theta
+ */
+bool GeometricCriterion::accept(const double m, const double side, const double bmax_sq, const double dsq, const double a_old) const {
+	return sqr(side)/dsq < _theta_squared;
+}
+
+BmaxCriterion::BmaxCriterion(const double theta) : _theta_squared(sqr(theta)) {}
+
+/**
+ *  Accept if bmax/d < theta
+ */
+bool BmaxCriterion::accept(const double m, const double side, const double bmax_sq, const double dsq, const double a_old) const {
+	return bmax_sq/dsq < _theta_squared;
+}
+
+RelativeCriterion::RelativeCriterion(const double theta, const double alpha, const double G)
+  : _alpha(alpha), _G(G), _first_step(theta) {}
+
+/**
+ *  Accept if G m side^2/d^4 <= alpha |a_old|, and particle is further than one side from centre of mass
+ */
+bool RelativeCriterion::accept(const double m, const double side, const double bmax_sq, const double dsq, const double a_old) const {
+	if (a_old == 0.0) return _first_step.accept(m,side,bmax_sq,dsq,a_old);
+	const double side_sq = sqr(side);
+	return side_sq < dsq && _G * m * side_sq <= _alpha * a_old * sqr(dsq);
+}
@@ -0,0 +1,112 @@
+#ifndef _OPENING_CRITERION_HPP
+#define _OPENING_CRITERION_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Multipole acceptance criteria: these decide whether a node of the tree is
+ * distant enough from a particle that it can be treated as a whole.
+ */
+
+#include <memory>
+#include <string>
+
+using namespace std;
+
+/**
+ *  The policy used by BarnesHutVisitor and FlatTree to decide whether to open a node.
+ *  Implementations must not have any state that changes during the walk, so one
+ *  criterion can be shared by all particles.
+ */
+class OpeningCriterion {
+  public:
+	virtual ~OpeningCriterion() {;}
+
+	/**
+	 *  Determine whether a node is distant enough that it can be treated as a whole.
+	 *
+	 *  Parameters:
+	 *      m          Mass of node
+	 *      side       Length of any side of node's cube
+	 *      bmax_sq    Squared distance from centre of mass to furthest corner of cube
+	 *      dsq        Squared distance from particle to centre of mass
+	 *      a_old      Magnitude of particle's acceleration from the previous step, or zero if there isn't one
+	 */
+	virtual bool accept(const double m, const double side, const double bmax_sq, const double dsq, const double a_old) const = 0;
+
+	/**
+	 *  Create a criterion
+	 *
+	 *  Parameters:
+	 *      name      One of "geometric", "bmax", or "relative"
+	 *      theta     Opening angle
+	 *      alpha     Tolerance for relative criterion
+	 *      G         Gravitational constant
+	 */
+	static unique_ptr<OpeningCriterion> create(const string & name, const double theta, const double alpha=0.001, const double G=1.0);
+};
+
+/**
+ *  The original criterion from Barnes and Hut: accept if side/d < theta.
+ *  This ignores how the mass is distributed within the node.
+ */
+class GeometricCriterion : public OpeningCriterion {
+  private:
+	const double _theta_squared;
+
+  public:
+	GeometricCriterion(const double theta);
+
+	bool accept(const double m, const double side, const double bmax_sq, const double dsq, const double a_old) const;
+};
+
+/**
+ *  Salmon and Warren's criterion: accept if bmax/d < theta, where bmax is the distance from
+ *  the centre of mass to the furthest corner of the cube. This is more cautious than
+ *  the geometric criterion when the centre of mass is close to one side of the cube.
+ */
+class BmaxCriterion : public OpeningCriterion {
+  private:
+	const double _theta_squared;
+
+  public:
+	BmaxCriterion(const double theta);
+
+	bool accept(const double m, const double side, const double bmax_sq, const double dsq, const double a_old) const;
+};
+
+/**
+ *  Relative criterion, as used in GADGET: accept if the estimated error, G m side^2/d^4,
+ *  is less than alpha times the particle's acceleration from the previous step. As a
+ *  safeguard, we never accept a node if the particle is within one side of its centre
+ *  of mass. There is no acceleration during the first step, so we fall back to the
+ *  geometric criterion.
+ */
+class RelativeCriterion : public OpeningCriterion {
+  private:
+	const double _alpha;
+
+	const double _G;
+
+	const GeometricCriterion _first_step;
+
+  public:
+	RelativeCriterion(const double theta, const double alpha, const double G);
+
+	bool accept(const double m, const double side, const double bmax_sq, const double dsq, const double a_old) const;
+};
+
+#endif   // _OPENING_CRITERION_HPP
@@ -0,0 +1,198 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <algorithm>
+#include <bit>
+#include <sstream>
+#include <stdexcept>
+
+#include "barnes-hut.hpp"
+#include "packet-walk.hpp"
+
+using namespace std;
+
+namespace {
+
+	/**
+	 *  Used to list the particles in the order of the leaves of the tree
+	 */
+	class LeafOrder : public Node::Visitor {
+		vector<int> & _order;
+
+	  public:
+		LeafOrder(vector<int> & order) : _order(order) {}
+
+		Node::Visitor::Status visit_internal(Node * internal_node) {return Node::Visitor::Status::Continue;}
+
+		Node::Visitor::Status visit_external(Node * external_node) {
+			for (int index : external_node->get_particles())
+				_order.push_back(index);
+			return Node::Visitor::Status::Continue;
+		}
+	};
+
+}
+
+/**
+ *  Parameters:
+ *  	particles   All the particles
+ *  	indices     Indices of the particles in the packet
+ *  	width       Number of particles in the packet
+ *  	criterion   Used to decide whether a node is distant enough to be treated as a whole
+ *  	G           Gravitational constant
+ *  	a           Softening length
+ *  	quadrupole  Use quadrupole moments of nodes, which must have been calculated
+ *  	tight_bounds Use tight bounding boxes of nodes, which must have been calculated, to decide whether to open them
+ */
+PacketVisitor::PacketVisitor(ParticleStore & particles, const int * indices, const int width, const OpeningCriterion & criterion,
+							 const double G, const double a, const bool quadrupole, const bool tight_bounds)
+	: _particles(particles), _indices(indices), _width(width), _criterion(criterion), _G(G), _a(a),
+	  _quadrupole(quadrupole), _tight_bounds(tight_bounds) {
+	_interactions.reserve(_width);
+	for (int lane=0;lane<_width;lane++) {
+		Particle & particle = _particles[_indices[lane]];
+		const auto position = particle.get_position();
+		_x[lane] = position[0];
+		_y[lane] = position[1];
+		_z[lane] = position[2];
+		_a_old[lane] = BarnesHutVisitor::get_acceleration_magnitude(particle);
+		_interactions.emplace_back(position,a);
+		_accelerations[lane] = {0.0,0.0,0.0};
+	}
+	_masks.reserve(Node::N_Levels + 1);
+	_masks.push_back((1u << _width) - 1);
+}
+
+/**
+ *  Lanes that accept an Internal node accumulate its contribution; the others
+ *  remain active for its children. If there are none, we don't descend, and
+ *  depart() won't be called, so we only push the mask if we descend.
+ *
+ *  Parameters:
+ *     internal_node   Current node while iterating over tree
+ */
+Node::Visitor::Status PacketVisitor::visit_internal(Node * internal_node) {
+	const uint32_t active = _accept(internal_node,_masks.back());
+	if (active == 0) return Node::Visitor::Status::DontDescend;
+	_masks.push_back(active);
+	return Node::Visitor::Status::Continue;
+}
+
+/**
+ *  Lanes that accept an External node with several particles treat it as a point;
+ *  the others sum over the particles in its bucket.
+ *
+ *  Parameters:
+ *     external_node   Current node while iterating over tree
+ */
+Node::Visitor::Status PacketVisitor::visit_external(Node * external_node) {
+	const auto bucket = external_node->get_particles();
+	uint32_t active = _masks.back();
+	if (bucket.size() > 1)
+		active = _accept(external_node,active);
+	for (uint32_t bits=active;bits != 0;bits &= bits - 1) {
+		const int lane = countr_zero(bits);
+		for (int index : bucket) {
+			if (index == _indices[lane]) continue;
+			Particle & particle = _particles[index];
+			_interactions[lane].add(particle.get_mass(),particle.get_position());
+		}
+	}
+	return Node::Visitor::Status::Continue;
+}
+
+/**
+ *  Determine which active lanes accept a node, and add its contribution to them.
+ *  The distances are calculated for all active lanes together, then the criterion
+ *  is applied to each lane.
+ *
+ *  Returns:
+ *      The lanes that are still active
+ */
+uint32_t PacketVisitor::_accept(Node * node, const uint32_t mask) {
+	const auto X = node->get_centre_of_mass();
+	for (int lane=0;lane<_width;lane++)
+		_dsq[lane] = sqr(_x[lane] - X[0]) + sqr(_y[lane] - X[1]) + sqr(_z[lane] - X[2]);
+	const double m = node->get_mass();
+	const double side = _tight_bounds ? node->get_tight_side() : node->get_side();
+	const double bmax_sq = _tight_bounds ? node->get_tight_bmax_sq() : node->get_bmax_sq();
+	uint32_t active = mask;
+	for (uint32_t bits=mask;bits != 0;bits &= bits - 1) {
+		const int lane = countr_zero(bits);
+		if (!_criterion.accept(m,side,bmax_sq,_dsq[lane],_a_old[lane])) continue;
+		_interactions[lane].add(m,X);
+		if (_quadrupole)
+			BarnesHutVisitor::add_quadrupole_acceleration(node->get_quadrupole(),X,array<double,NDIM>{_x[lane],_y[lane],_z[lane]},
+														  _dsq[lane],_G,_a,_accelerations[lane]);
+		active &= ~(1u << lane);
+	}
+	return active;
+}
+
+/**
+ *  Used at the end of calculation to store accelerations back into particles:
+ *  for each lane, the interactions with point masses, plus any contributions from
+ *  quadrupole moments.
+ */
+void PacketVisitor::store_accelerations() {
+	for (int lane=0;lane<_width;lane++) {
+		auto acceleration = _interactions[lane].get_acceleration(_G);
+		for (int i=0;i<NDIM;i++)
+			acceleration[i] += _accelerations[lane][i];
+		_particles[_indices[lane]].set_acceleration(acceleration);
+	}
+}
+
+/**
+ *  Parameters:
+ *  	criterion   Used to decide whether a node is distant enough to be treated as a whole
+ *  	G           Gravitational constant
+ *  	a           Softening length
+ *  	quadrupole  Use quadrupole moments of nodes, which must have been calculated
+ *  	tight_bounds Use tight bounding boxes of nodes, which must have been calculated, to decide whether to open them
+ *  	width       Number of particles in each packet: no more than PacketVisitor::MaxWidth, or zero if unused
+ */
+PacketWalk::PacketWalk(const OpeningCriterion & criterion, const double G, const double a, const bool quadrupole, const bool tight_bounds,
+					   const int width)
+	: _criterion(criterion), _G(G), _a(a), _quadrupole(quadrupole), _tight_bounds(tight_bounds), _width(width) {
+	if (width < 0 || width > PacketVisitor::MaxWidth) {
+		stringstream message;
+		message<<__FILE__ <<" " <<__LINE__<<" Error: packet size " << width << " should not exceed " << PacketVisitor::MaxWidth << endl;
+		throw logic_error(message.str().c_str());
+	}
+}
+
+/**
+ *  Calculate accelerations of all particles in tree, and store them in particles.
+ *  The last packet may be narrower than the others.
+ *
+ *  Parameters:
+ *      root        Root of tree
+ *      particles   The particles in the tree
+ */
+void PacketWalk::calculate(Node * root, ParticleStore & particles) {
+	_order.clear();
+	if (root->get_index() == Node::Unused) return;
+	LeafOrder leaf_order(_order);
+	root->traverse(leaf_order);
+	const int n = _order.size();
+	for (int first=0;first<n;first+=_width) {
+		PacketVisitor visitor(particles,_order.data()+first,min(_width,n-first),_criterion,_G,_a,_quadrupole,_tight_bounds);
+		root->traverse(visitor);
+		visitor.store_accelerations();
+	}
+}
@@ -0,0 +1,221 @@
+#ifndef _PACKET_WALK_HPP
+#define _PACKET_WALK_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "interaction-kernel.hpp"
+#include "opening-criterion.hpp"
+#include "particle.hpp"
+#include "treecode.hpp"
+
+using namespace std;
+
+/**
+ *  This class is used to calculate the accelerations of a packet of nearby particles,
+ *  which walk the tree together. Each particle occupies one lane of the packet. A mask
+ *  records which lanes are still active, i.e. haven't accepted the current node or
+ *  one of its ancestors; we descend as long as any lane is active. Each lane makes
+ *  the same decisions as it would in BarnesHutVisitor, and accumulates the same
+ *  interactions in the same order, so the results are identical.
+ */
+class PacketVisitor : public Node::Visitor {
+  public:
+	/**
+	 *  Maximum number of particles in a packet
+	 */
+	enum {MaxWidth=16};
+
+  private:
+	/**
+	 *  All the particles: needed for the particles in each bucket
+	 */
+	ParticleStore & _particles;
+
+	/**
+	 *  Indices of the particles in the packet
+	 */
+	const int * _indices;
+
+	/**
+	 *  Number of particles in the packet
+	 */
+	const int _width;
+
+	/**
+	 *  Used to decide whether a node is distant enough to be treated as a whole
+	 */
+	const OpeningCriterion & _criterion;
+
+	/**
+	 *  Gravitational constant
+	 */
+	const double _G;
+
+	/**
+	 *  Softening length
+	 */
+	const double _a;
+
+	/**
+	 *  Indicates that quadrupole moments of nodes are to be used
+	 */
+	const bool _quadrupole;
+
+	/**
+	 *  Indicates that tight bounding boxes of nodes are to be used instead of cubes in opening criterion
+	 */
+	const bool _tight_bounds;
+
+	/**
+	 *  Positions of the particles in the packet, one array for each coordinate
+	 */
+	array<double,MaxWidth> _x;
+
+	array<double,MaxWidth> _y;
+
+	array<double,MaxWidth> _z;
+
+	/**
+	 *  Magnitudes of the particles' accelerations from the previous step
+	 */
+	array<double,MaxWidth> _a_old;
+
+	/**
+	 *  Squared distances from each particle to the centre of mass of the current node
+	 */
+	array<double,MaxWidth> _dsq;
+
+	/**
+	 *  Masks of active lanes: one for each Internal node on the path from the root
+	 *  to the current node, and one for the packet as a whole at the bottom.
+	 */
+	vector<uint32_t> _masks;
+
+	/**
+	 *  Interactions with point masses, one list for each lane
+	 */
+	vector<InteractionList> _interactions;
+
+	/**
+	 *  Accelerations from quadrupole moments, one for each lane
+	 */
+	array<array<double,NDIM>,MaxWidth> _accelerations;
+
+  public:
+	/**
+	 *  Parameters:
+	 *  	particles   All the particles
+	 *  	indices     Indices of the particles in the packet
+	 *  	width       Number of particles in the packet
+	 *  	criterion   Used to decide whether a node is distant enough to be treated as a whole
+	 *  	G           Gravitational constant
+	 *  	a           Softening length
+	 *  	quadrupole  Use quadrupole moments of nodes, which must have been calculated
+	 *  	tight_bounds Use tight bounding boxes of nodes, which must have been calculated, to decide whether to open them
+	 */
+	PacketVisitor(ParticleStore & particles, const int * indices, const int width, const OpeningCriterion & criterion,
+				  const double G, const double a, const bool quadrupole=false, const bool tight_bounds=false);
+
+	/**
+	 *  Lanes that accept an Internal node accumulate its contribution; the others
+	 *  remain active for its children.
+	 */
+	Node::Visitor::Status visit_internal(Node * internal_node);
+
+	/**
+	 *  Lanes that accept an External node with several particles treat it as a point;
+	 *  the others sum over the particles in its bucket.
+	 */
+	Node::Visitor::Status visit_external(Node * external_node);
+
+	/**
+	 *  Restore the active lanes of the parent
+	 */
+	void depart(Node * node) {_masks.pop_back();}
+
+	/**
+	 *  Used at the end of calculation to store accelerations back into particles
+	 */
+	void store_accelerations();
+
+  private:
+	/**
+	 *  Determine which active lanes accept a node, and add its contribution to them.
+	 *
+	 *  Returns:
+	 *      The lanes that are still active
+	 */
+	uint32_t _accept(Node * node, const uint32_t mask);
+};
+
+/**
+ *  This class calculates the accelerations of all particles, using PacketVisitor. The
+ *  particles are taken in the order of the leaves of the tree, so each packet contains
+ *  particles that are close together, and whose walks are similar.
+ */
+class PacketWalk {
+  private:
+	const OpeningCriterion & _criterion;
+
+	const double _G;
+
+	const double _a;
+
+	const bool _quadrupole;
+
+	const bool _tight_bounds;
+
+	/**
+	 *  Number of particles in each packet
+	 */
+	const int _width;
+
+	/**
+	 *  Indices of particles, in the order of the leaves of the tree
+	 */
+	vector<int> _order;
+
+  public:
+	/**
+	 *  Parameters:
+	 *  	criterion   Used to decide whether a node is distant enough to be treated as a whole
+	 *  	G           Gravitational constant
+	 *  	a           Softening length
+	 *  	quadrupole  Use quadrupole moments of nodes, which must have been calculated
+	 *  	tight_bounds Use tight bounding boxes of nodes, which must have been calculated, to decide whether to open them
+	 *  	width       Number of particles in each packet: no more than PacketVisitor::MaxWidth, or zero if unused
+	 */
+	PacketWalk(const OpeningCriterion & criterion, const double G, const double a, const bool quadrupole, const bool tight_bounds,
+			   const int width);
+
+	/**
+	 *  Calculate accelerations of all particles in tree, and store them in particles.
+	 *  Masses and centres of mass must have been calculated.
+	 *
+	 *  Parameters:
+	 *      root        Root of tree
+	 *      particles   The particles in the tree
+	 */
+	void calculate(Node * root, ParticleStore & particles);
+};
+
+#endif   // _PACKET_WALK_HPP
@@ -39,6 +39,27 @@ struct option Parameters::long_options[] ={
 	{"frequency",required_argument,NULL,'f'},
 	{"help",no_argument,NULL,'h'},
 	{"verify_tree",no_argument,NULL,'v'},
+	{"threads",required_argument,NULL,'t'},
+	{"flat_tree",no_argument,NULL,'F'},
+	{"bucket_size",required_argument,NULL,'b'},
+	{"max_depth",required_argument,NULL,'D'},
+	{"rebuild_interval",required_argument,NULL,'R'},
+	{"refit",no_argument,NULL,'K'},
+	{"max_escaped",required_argument,NULL,'E'},
+	{"fused_moments",no_argument,NULL,'M'},
+	{"quadrupole",no_argument,NULL,'Q'},
+	{"criterion",required_argument,NULL,'C'},
+	{"alpha",required_argument,NULL,'A'},
+	{"tight_bounds",no_argument,NULL,'B'},
+	{"group_size",required_argument,NULL,'g'},
+	{"packet_size",required_argument,NULL,'P'},
+	{"method",required_argument,NULL,'m'},
+	{"crossover",required_argument,NULL,'X'},
+	{"mixed_precision",no_argument,NULL,'x'},
+	{"pin_threads",no_argument,NULL,'p'},
+	{"numa",no_argument,NULL,'u'},
+	{"reorder_interval",required_argument,NULL,'o'},
+	{"hilbert",no_argument,NULL,'H'},
 	{NULL, 0, NULL, 0}
 };
 
@@ -57,13 +78,20 @@ Parameters::Parameters() {
 		_log_path = _get_path_name(env_p);
 }
 
+/**
+ *  Options that only affect the tree
+ */
+const string tree_options = "eFbDRKEMQCABgPvx";
+
 /**
  *  Parse command line parameters.
  */
 unique_ptr<Parameters> Parameters::get_options(int argc, char **argv){
 	unique_ptr<Parameters> parameters = make_unique<Parameters>();
 	char ch;
-	while ((ch = getopt_long(argc, argv, "c:N:s:f:a:G:d:e:h", long_options, NULL)) != -1){
+	while ((ch = getopt_long(argc, argv, "c:N:s:f:a:G:d:e:ht:Fb:D:R:KE:MQC:A:Bg:P:m:X:xpuo:H", long_options, NULL)) != -1){
+	  if (tree_options.find(ch) != string::npos)
+		  parameters->_tree_options += string(" -") + ch;
 	  switch (ch)    {
 		 case 'c':
 			 parameters->_config_file = optarg; 
@@ -92,6 +120,69 @@ unique_ptr<Parameters> Parameters::get_options(int argc, char **argv){
 		case 'v':
 			parameters->_verify_tree = true; 
 			break;
+		case 't':
+			parameters->_threads = atoi(optarg); 
+			break;
+		case 'F':
+			parameters->_flat_tree = true; 
+			break;
+		case 'b':
+			parameters->_bucket_size = atoi(optarg); 
+			break;
+		case 'D':
+			parameters->_max_depth = atoi(optarg); 
+			break;
+		case 'R':
+			parameters->_rebuild_interval = atoi(optarg); 
+			break;
+		case 'K':
+			parameters->_refit = true; 
+			break;
+		case 'E':
+			parameters->_max_escaped = atof(optarg); 
+			break;
+		case 'M':
+			parameters->_fused_moments = true; 
+			break;
+		case 'Q':
+			parameters->_quadrupole = true; 
+			break;
+		case 'C':
+			parameters->_criterion = optarg; 
+			break;
+		case 'A':
+			parameters->_alpha = atof(optarg); 
+			break;
+		case 'B':
+			parameters->_tight_bounds = true; 
+			break;
+		case 'g':
+			parameters->_group_size = atoi(optarg); 
+			break;
+		case 'P':
+			parameters->_packet_size = atoi(optarg); 
+			break;
+		case 'm':
+			parameters->_method = optarg; 
+			break;
+		case 'X':
+			parameters->_crossover = atoi(optarg); 
+			break;
+		case 'x':
+			parameters->_mixed_precision = true; 
+			break;
+		case 'p':
+			parameters->_pin_threads = true; 
+			break;
+		case 'u':
+			parameters->_numa = true; 
+			break;
+		case 'o':
+			parameters->_reorder_interval = atoi(optarg); 
+			break;
+		case 'H':
+			parameters->_hilbert = true; 
+			break;
 		default:
 			parameters->usage();
 			exit(EXIT_FAILURE);
@@ -115,6 +206,27 @@ void Parameters::usage() {
 	cout << "\t-f" << "\t--frequency" << endl;
 	cout <<"\t-h" << "\t--help"  << endl;
 	cout <<"\t-v" << "\t--verify_tree"  << endl;
+	cout <<"\t-t" << "\t--threads"  << endl;
+	cout <<"\t-F" << "\t--flat_tree"  << endl;
+	cout <<"\t-b" << "\t--bucket_size"  << endl;
+	cout <<"\t-D" << "\t--max_depth"  << endl;
+	cout <<"\t-R" << "\t--rebuild_interval"  << endl;
+	cout <<"\t-K" << "\t--refit"  << endl;
+	cout <<"\t-E" << "\t--max_escaped"  << endl;
+	cout <<"\t-M" << "\t--fused_moments"  << endl;
+	cout <<"\t-Q" << "\t--quadrupole"  << endl;
+	cout <<"\t-C" << "\t--criterion -- geometric, bmax, or relative"  << endl;
+	cout <<"\t-A" << "\t--alpha -- tolerance for relative criterion"  << endl;
+	cout <<"\t-B" << "\t--tight_bounds"  << endl;
+	cout <<"\t-g" << "\t--group_size -- walk tree once for each group of up to this many particles, on one thread, in double precision"  << endl;
+	cout <<"\t-P" << "\t--packet_size -- walk tree with packets of 4, 8, or 16 particles together, on one thread, in double precision"  << endl;
+	cout <<"\t-m" << "\t--method -- barnes-hut, fmm, falcon (fmm with mutual interactions, which conserves momentum), or direct"  << endl;
+	cout <<"\t-X" << "\t--crossover -- barnes-hut runs with fewer particles than this use direct summation, ignoring tree options"  << endl;
+	cout <<"\t-x" << "\t--mixed_precision -- calculate interactions with distant nodes in single precision (barnes-hut only)"  << endl;
+	cout <<"\t-p" << "\t--pin_threads -- bind each thread to a single processor"  << endl;
+	cout <<"\t-u" << "\t--numa -- spread threads over NUMA nodes"  << endl;
+	cout <<"\t-o" << "\t--reorder_interval -- sort particles along a space-filling curve every this many steps"  << endl;
+	cout <<"\t-H" << "\t--hilbert -- sort particles along Hilbert curve instead of Morton"  << endl;
 }
 
 /**
@@ -90,6 +90,117 @@ class Parameters {
 	 */
 	bool _verify_tree = false;
 	
+	/**
+	 *   Number of threads used to build tree, calculate accelerations, and update particles
+	 */
+	int _threads = 1;
+	
+	/**
+	 *   Copy tree to a FlatTree for calculating accelerations
+	 */
+	bool _flat_tree = false;
+	
+	/**
+	 *   Maximum number of particles in each External node of tree
+	 */
+	int _bucket_size = 1;
+	
+	/**
+	 *   Maximum depth of tree: the default is the resolution of the Morton keys
+	 */
+	int _max_depth = 21;
+	
+	/**
+	 *   Number of steps between building tree from scratch: it is updated incrementally in between
+	 */
+	int _rebuild_interval = 1;
+	
+	/**
+	 *   Keep topology of tree fixed between rebuilds, instead of updating it
+	 */
+	bool _refit = false;
+	
+	/**
+	 *   Fraction of particles that may leave their External nodes before tree is rebuilt
+	 */
+	double _max_escaped = 0.1;
+	
+	/**
+	 *   Calculate masses and centres of mass while tree is being built
+	 */
+	bool _fused_moments = false;
+	
+	/**
+	 *   Use quadrupole moments in force calculation
+	 */
+	bool _quadrupole = false;
+	
+	/**
+	 *   Criterion used to decide whether a node can be treated as a whole: geometric, bmax, or relative
+	 */
+	string _criterion = "geometric";
+	
+	/**
+	 *   Tolerance for relative criterion
+	 */
+	double _alpha = 0.001;
+	
+	/**
+	 *   Use tight bounding boxes of particles to decide whether to open nodes
+	 */
+	bool _tight_bounds = false;
+	
+	/**
+	 *   If positive, walk tree once for each group of up to this many particles
+	 */
+	int _group_size = 0;
+	
+	/**
+	 *   If positive, walk tree for packets of this many particles together
+	 */
+	int _packet_size = 0;
+	
+	/**
+	 *   Method used to calculate accelerations: barnes-hut or fmm
+	 */
+	string _method = "barnes-hut";
+	
+	/**
+	 *   Use direct summation instead of barnes-hut for fewer particles than this;
+	 *   if negative, use DirectSumAccelerationVisitor::Crossover
+	 */
+	int _crossover = -1;
+	
+	/**
+	 *   Calculate interactions with distant nodes in single precision
+	 */
+	bool _mixed_precision = false;
+	
+	/**
+	 *   Bind each thread to a single processor
+	 */
+	bool _pin_threads = false;
+	
+	/**
+	 *   Spread threads over NUMA nodes
+	 */
+	bool _numa = false;
+	
+	/**
+	 *   If positive, sort particles along a space-filling curve every reorder_interval steps
+	 */
+	int _reorder_interval = 0;
+	
+	/**
+	 *   Use Hilbert curve instead of Morton to sort particles
+	 */
+	bool _hilbert = false;
+	
+	/**
+	 *   Options given on the command line that only affect the tree, e.g. " -b -Q"
+	 */
+	string _tree_options;
+	
   public:
   
 	/**
@@ -164,6 +275,118 @@ class Parameters {
 	 */
 	bool should_verify_tree() {return _verify_tree;}
 	
+	/**
+	 *   Get number of threads used to build tree, calculate accelerations, and update particles
+	 */
+	int get_threads() {return _threads;}
+	
+	/**
+	 *   Determine whether to copy tree to a FlatTree for calculating accelerations
+	 */
+	bool should_use_flat_tree() {return _flat_tree;}
+	
+	/**
+	 *   Get maximum number of particles in each External node of tree
+	 */
+	int get_bucket_size() {return _bucket_size;}
+	
+	/**
+	 *   Get maximum depth of tree
+	 */
+	int get_max_depth() {return _max_depth;}
+	
+	/**
+	 *   Get number of steps between building tree from scratch
+	 */
+	int get_rebuild_interval() {return _rebuild_interval;}
+	
+	/**
+	 *   Determine whether to keep topology of tree fixed between rebuilds
+	 */
+	bool should_refit() {return _refit;}
+	
+	/**
+	 *   Get fraction of particles that may leave their External nodes before tree is rebuilt
+	 */
+	double get_max_escaped() {return _max_escaped;}
+	
+	/**
+	 *   Determine whether masses and centres of mass are calculated while tree is being built
+	 */
+	bool should_fuse_moments() {return _fused_moments;}
+	
+	/**
+	 *   Determine whether quadrupole moments are used in force calculation
+	 */
+	bool should_use_quadrupole() {return _quadrupole;}
+	
+	/**
+	 *   Get criterion used to decide whether a node can be treated as a whole
+	 */
+	string get_criterion() {return _criterion;}
+	
+	/**
+	 *   Get tolerance for relative criterion
+	 */
+	double get_alpha() {return _alpha;}
+	
+	/**
+	 *   Determine whether to use tight bounding boxes of particles to decide whether to open nodes
+	 */
+	bool should_use_tight_bounds() {return _tight_bounds;}
+	
+	/**
+	 *   Get maximum number of particles in a group, or zero if tree is walked separately for each particle
+	 */
+	int get_group_size() {return _group_size;}
+	
+	/**
+	 *   Get number of particles that walk tree together, or zero if tree is walked separately for each particle
+	 */
+	int get_packet_size() {return _packet_size;}
+	
+	/**
+	 *   Get method used to calculate accelerations
+	 */
+	string get_method() {return _method;}
+	
+	/**
+	 *   Get number of particles below which direct summation is used instead of barnes-hut,
+	 *   or a negative number to use the default
+	 */
+	int get_crossover() {return _crossover;}
+	
+	/**
+	 *   Determine whether interactions with distant nodes are to be calculated in single precision
+	 */
+	bool should_use_mixed_precision() {return _mixed_precision;}
+	
+	/**
+	 *   Determine whether each thread is to be bound to a single processor
+	 */
+	bool should_pin_threads() {return _pin_threads;}
+	
+	/**
+	 *   Determine whether threads are to be spread over NUMA nodes
+	 */
+	bool should_spread_numa() {return _numa;}
+	
+	/**
+	 *   Get number of steps between sorting particles along a space-filling curve: 0 means never
+	 */
+	int get_reorder_interval() {return _reorder_interval;}
+	
+	/**
+	 *   Determine whether particles are to be sorted along a Hilbert curve instead of Morton
+	 */
+	bool should_use_hilbert() {return _hilbert;}
+	
+	/**
+	 *   Get options given on the command line that only affect the tree, so they
+	 *   are ignored if direct summation is used
+	 */
+	string get_tree_options() {return _tree_options;}
+	
 	/**
 	 *  Show list of command line parameters.
 	 */
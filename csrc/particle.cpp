@@ -15,10 +15,46 @@
  * along with this software.  If not, see <http://www.gnu.org/licenses/>
  */
  
+ #include <algorithm>
+ #include <numeric>
+ #include <sstream>
+ #include <stdexcept>
+
  #include "particle.hpp"
  
  using namespace std;
  
+/**
+ *  Allocate arrays for n particles, at rest at the origin, with unit mass.
+ *  Each array is padded to a whole number of cache lines, so the next one is aligned.
+ */
+ParticleArrays::ParticleArrays(const int n) : n(n), id(n,-1) {
+	const int per_line = Alignment / sizeof(double);
+	const int stride = max(1,(n + per_line - 1) / per_line) * per_line;
+	const int n_arrays = 3*NDIM + 1;
+	block = unique_ptr<double[],Deleter>(new (align_val_t(Alignment)) double[n_arrays*stride]());
+	for (int i=0;i<NDIM;i++) {
+		position[i] = block.get() + i*stride;
+		velocity[i] = block.get() + (NDIM + i)*stride;
+		acceleration[i] = block.get() + (2*NDIM + i)*stride;
+	}
+	m = block.get() + 3*NDIM*stride;
+	for (int i=0;i<n;i++)
+		m[i] = 1.0;
+}
+
+/**
+ *  Copy position, velocity, acceleration, mass and ID from another particle
+ */
+Particle & Particle::operator=(const Particle & other) {
+	if (this == &other) return *this;
+	set_position(other.get_position());
+	set_velocity(other.get_velocity());
+	set_acceleration(other.get_acceleration());
+	_arrays->m[_index] = other.get_mass();
+	_arrays->id[_index] = other.get_id();
+	return *this;
+}
 
 /**
  *   Used to set initial position and velocity when configuration is initialized.
@@ -30,18 +66,67 @@
  *       id          Unique "name" of this particle
  */
  void Particle::init(const array<double,NDIM> position, const array<double,NDIM> velocity, const double m, const int id) {
-	_id = id;
-	_m = m;
-	_position = position;
-	_velocity = velocity;
+	_arrays->id[_index] = id;
+	_arrays->m[_index] = m;
+	set_position(position);
+	set_velocity(velocity);
  }
- 
 
- 
+/**
+ *  Create store for n particles, at rest at the origin, with unit mass.
+ */
+ParticleStore::ParticleStore(const int n) : _arrays(make_unique<ParticleArrays>(n)) {
+	_particles.reserve(n);
+	for (int i=0;i<n;i++)
+		_particles.push_back(Particle(_arrays.get(),i));
+}
+
+/**
+ *  Rearrange the particles, keeping their IDs, so that slot i holds the particle
+ *  that was in slot order[i]. The data are gathered into new arrays, which then
+ *  replace the old ones in the same ParticleArrays, so the proxies remain valid.
+ *
+ *  Parameters:
+ *      order     Slots of particles in the new order: a permutation of 0,...,n-1
+ */
+void ParticleStore::permute(const vector<int> & order) {
+	const int n = size();
+	if ((int)order.size() != n) {
+		stringstream message;
+		message<<__FILE__ <<" " <<__LINE__<<" Order has " << order.size() << " slots, but there are " << n << " particles" << endl;
+		throw logic_error(message.str().c_str());
+	}
+	ParticleArrays permuted(n);
+	for (int j=0;j<NDIM;j++)
+		for (int i=0;i<n;i++) {
+			permuted.position[j][i] = _arrays->position[j][order[i]];
+			permuted.velocity[j][i] = _arrays->velocity[j][order[i]];
+			permuted.acceleration[j][i] = _arrays->acceleration[j][order[i]];
+		}
+	for (int i=0;i<n;i++) {
+		permuted.m[i] = _arrays->m[order[i]];
+		permuted.id[i] = _arrays->id[order[i]];
+	}
+	*_arrays = std::move(permuted);
+	_n_reorders++;
+}
+
+/**
+ *  Determine slots of particles in order of ID
+ */
+vector<int> ParticleStore::get_slots_by_id() {
+	vector<int> slots(size());
+	iota(slots.begin(),slots.end(),0);
+	sort(slots.begin(),slots.end(),[this](int i,int j){return _arrays->id[i] < _arrays->id[j];});
+	return slots;
+}
+
  /**
  * Output position, velocity, and mass.
  */
 ostream& operator<<(ostream& s, Particle& p) {
-	return s<< p._id <<","<<p._position[0] <<"," << p._position[1] <<"," << p._position[2] <<"," <<
-			p._velocity[0] <<"," << p._velocity[1] <<"," << p._velocity[2] <<"," <<p._m;
-}
\ No newline at end of file
+	const auto position = p.get_position();
+	const auto velocity = p.get_velocity();
+	return s<< p.get_id() <<","<<position[0] <<"," << position[1] <<"," << position[2] <<"," <<
+			velocity[0] <<"," << velocity[1] <<"," << velocity[2] <<"," <<p.get_mass();
+}
@@ -17,11 +17,14 @@
  * You should have received a copy of the GNU General Public License
  * along with this software.  If not, see <http://www.gnu.org/licenses/>
  */
- 
+
 #include <array>
 #include <iostream>
 #include <ostream>
 #include <memory>
+#include <new>
+#include <span>
+#include <vector>
 
 using namespace std;
 
@@ -32,43 +35,116 @@ const int NDIM = 3;
 
 /**
  * Square a distance
- */ 
+ */
 inline auto sqr(auto x) {return x*x;}
 
+/**
+ *  The data for a set of particles, held as a structure of arrays: one array
+ *  for each component of position, velocity, and acceleration, and one for mass.
+ *  Each array starts on a cache line, so it can be loaded into SIMD registers
+ *  without gathers. The arrays are allocated together, in one block.
+ */
+struct ParticleArrays {
+	/**
+	 *  Each array is aligned to this many bytes
+	 */
+	enum {Alignment=64};
+
+	/**
+	 *  Used to release the block with the alignment it was allocated with
+	 */
+	struct Deleter {
+		void operator()(double * block) const {::operator delete[](block,align_val_t(Alignment));}
+	};
+
+	/**
+	 *  Number of particles
+	 */
+	int n;
+
+	/**
+	 *  Storage for all the arrays
+	 */
+	unique_ptr<double[],Deleter> block;
+
+	/**
+	 *  Components of position, velocity, and acceleration
+	 */
+	array<double*,NDIM> position;
+
+	array<double*,NDIM> velocity;
+
+	array<double*,NDIM> acceleration;
+
+	/**
+	 *  Masses of particles
+	 */
+	double * m;
+
+	/**
+	 *  ID of each particle, which identifies it even if the particles are reordered,
+	 *  so it isn't necessarily equal to its index
+	 */
+	vector<int> id;
+
+	/**
+	 *  Allocate arrays for n particles, at rest at the origin, with unit mass.
+	 */
+	ParticleArrays(const int n);
+};
+
 /**
  * A Particle represents one of the bodies whose motion is being simulated.
- * It is just a passive container for data.
+ * It is just a passive container for data. The data lives in a ParticleArrays,
+ * usually that of a ParticleStore, and the Particle is a proxy for one slot in it;
+ * a Particle that is created on its own, or copied, has arrays of its own, which
+ * hold just that particle.
  */
 class Particle {
- 
+  friend class ParticleStore;
+
   private:
-  	/**
-	 *  The ID of a particle is equal to its index in the array of configurations
-	 */
-	int _id = -1;
-	
 	/**
-	 *  Location of particle
+	 *  Arrays that hold the data for this particle
 	 */
-    array<double,NDIM> _position = {0.0, 0.0, 0.0};
-	
+	ParticleArrays * _arrays;
+
 	/**
-	 *   Velocity of particle
+	 *  Position of this particle in the arrays
 	 */
-	array<double,NDIM> _velocity = {0.0, 0.0, 0.0};
-	
+	int _index;
+
 	/**
-	 *  Acceleration of particle
+	 *  Arrays for a Particle that doesn't belong to a ParticleStore
 	 */
-	array<double,NDIM> _acceleration ={0.0, 0.0, 0.0};
-	
+	unique_ptr<ParticleArrays> _own;
+
 	/**
-	 * Mass of particle
+	 *  Create a proxy for a particle in a ParticleStore
 	 */
-	double _m = 1.0;
-	
+	Particle(ParticleArrays * arrays, const int index) : _arrays(arrays), _index(index) {;}
+
   public:
-  	
+	/**
+	 *  Create a particle that doesn't belong to a ParticleStore
+	 */
+	Particle() : _own(make_unique<ParticleArrays>(1)) {
+		_arrays = _own.get();
+		_index = 0;
+	}
+
+	/**
+	 *  Copying a particle creates a new particle, which doesn't belong to a ParticleStore
+	 */
+	Particle(const Particle & other) : Particle() {*this = other;}
+
+	Particle(Particle && other) = default;
+
+	/**
+	 *  Copy position, velocity, acceleration, mass and ID from another particle
+	 */
+	Particle & operator=(const Particle & other);
+
 	/**
 	 * Determine squared distance between two points
 	 */
@@ -78,14 +154,14 @@ class Particle {
 			sum += sqr(position1[i] - position2[i]);
 		return sum;
 	}
-	
+
 	/**
 	 * Determine squared distance between two particles
 	 */
 	static inline auto get_distance_sq(Particle&particle1,Particle&particle2)  {
-		return get_distance_sq(particle1._position,particle2._position);
+		return get_distance_sq(particle1.get_position(),particle2.get_position());
 	}
-	
+
 	/**
 	 *   Used to set initial position and velocity when configuration is initialized.
 	 *
@@ -96,61 +172,172 @@ class Particle {
 	 *       id          Unique "name" of this particle
 	 */
 	void init(const array<double,NDIM> position, const array<double,NDIM> velocity, const double m, const int id);
-	
+
 	/**
 	 *  Accessor for mass
 	 */
-	inline auto get_mass() {return _m;}
-	
+	inline auto get_mass() const {return _arrays->m[_index];}
+
 	/**
 	 *  Accessor for ID
 	 */
-	inline auto get_id() {return _id;}
-	
+	inline auto get_id() const {return _arrays->id[_index];}
+
 	/**
 	 *  Accessor for position
 	 */
-	inline auto & get_position() {return _position;} 
-	
+	inline array<double,NDIM> get_position() const {return _get(_arrays->position);}
+
 	/**
 	 *  Used to assign a new position
 	 */
-	inline void set_position(array<double,NDIM> &  position) {_position = position;}
-	
+	inline void set_position(const array<double,NDIM> &  position) {_set(_arrays->position,position);}
+
 	/**
 	 *  Accessor for velocity
 	 */
-	inline auto & get_velocity() {return _velocity;}  
-	
+	inline array<double,NDIM> get_velocity() const {return _get(_arrays->velocity);}
+
 	/**
 	 *  Used to assign a new velocity
 	 */
-	inline void set_velocity(array<double,NDIM> &  velocity) {_velocity = velocity;}
-	
+	inline void set_velocity(const array<double,NDIM> &  velocity) {_set(_arrays->velocity,velocity);}
+
 	/**
-	 *  Accessor for acceleration
 	 *  Accessor for acceleration
 	 */
-	inline auto & get_acceleration() {return _acceleration;}  
-	
+	inline array<double,NDIM> get_acceleration() const {return _get(_arrays->acceleration);}
+
 	/**
 	 *  Used to assign acceleration
 	 */
-	inline void set_acceleration(array<double,NDIM> &  acceleration) {_acceleration = acceleration;}
-	 
+	inline void set_acceleration(const array<double,NDIM> &  acceleration) {_set(_arrays->acceleration,acceleration);}
+
 
 	/**
      * Output position, velocity, and mass.
      */
 	friend ostream& operator<<(ostream& s, Particle& p);
-	
+
 	/**
 	 * The == operator is used when we calculate the attraction between particles
 	 * to ensure that a particle doesn't attract itself.
 	 */
-	bool operator == (const Particle & other)  const {return _id == other._id;} 
-	
+	bool operator == (const Particle & other)  const {return get_id() == other.get_id();}
+
+  private:
+	/**
+	 *  Gather the components of a vector for this particle from the arrays
+	 */
+	inline array<double,NDIM> _get(const array<double*,NDIM> & components) const {
+		array<double,NDIM> result;
+		for (int i=0;i<NDIM;i++)
+			result[i] = components[i][_index];
+		return result;
+	}
+
+	/**
+	 *  Scatter the components of a vector for this particle to the arrays
+	 */
+	inline void _set(const array<double*,NDIM> & components, const array<double,NDIM> & value) {
+		for (int i=0;i<NDIM;i++)
+			components[i][_index] = value[i];
+	}
+};
+
+/**
+ *  This class owns the data for a set of particles, as a structure of arrays,
+ *  and a Particle for each, which serves as a proxy, so code that works one
+ *  particle at a time can use particles[i] as before. Code that processes all
+ *  the particles, such as the integrator or a force kernel, can use the arrays directly.
+ */
+class ParticleStore {
+  private:
+	/**
+	 *  The data for the particles: held by pointer, so the proxies remain valid
+	 *  if the store is moved.
+	 */
+	unique_ptr<ParticleArrays> _arrays;
+
+	/**
+	 *  Proxy for each particle
+	 */
+	vector<Particle> _particles;
+
+	/**
+	 *  Number of times the particles have been reordered
+	 */
+	int _n_reorders = 0;
+
+  public:
+	/**
+	 *  Create store for n particles, at rest at the origin, with unit mass.
+	 */
+	ParticleStore(const int n=0);
+
+	ParticleStore(ParticleStore && other) = default;
+
+	ParticleStore & operator=(ParticleStore && other) = default;
+
+	/**
+	 *  Proxy for one particle
+	 */
+	inline Particle & operator[](const int i) {return _particles[i];}
+
+	/**
+	 *  Number of particles
+	 */
+	inline int size() const {return _arrays->n;}
+
+	/**
+	 *  Components of positions, velocities, and accelerations: one array for each axis
+	 */
+	array<span<double>,NDIM> get_positions() {return _get_view(_arrays->position);}
+
+	array<span<double>,NDIM> get_velocities() {return _get_view(_arrays->velocity);}
+
+	array<span<double>,NDIM> get_accelerations() {return _get_view(_arrays->acceleration);}
+
+	/**
+	 *  Masses of particles
+	 */
+	span<double> get_masses() {return span<double>(_arrays->m,_arrays->n);}
+
+	/**
+	 *  IDs of particles
+	 */
+	span<int> get_ids() {return span<int>(_arrays->id);}
+
+	/**
+	 *  Rearrange the particles, keeping their IDs, so that slot i holds the particle
+	 *  that was in slot order[i]. Indices into the store, such as the buckets of a tree,
+	 *  are no longer valid afterwards, but the proxies still refer to the same slots.
+	 *
+	 *  Parameters:
+	 *      order     Slots of particles in the new order: a permutation of 0,...,n-1
+	 */
+	void permute(const vector<int> & order);
+
+	/**
+	 *  Number of times the particles have been reordered: code that holds indices into the
+	 *  store can compare this with the value when it took them, to see if they are still valid.
+	 */
+	int get_n_reorders() const {return _n_reorders;}
+
+	/**
+	 *  Determine slots of particles in order of ID
+	 */
+	vector<int> get_slots_by_id();
+
+  private:
+	array<span<double>,NDIM> _get_view(const array<double*,NDIM> & components) {
+		array<span<double>,NDIM> view;
+		for (int i=0;i<NDIM;i++)
+			view[i] = span<double>(components[i],_arrays->n);
+		return view;
+	}
 };
+
 /**
  * class used to iterate over particles.
  */
@@ -170,7 +357,7 @@ template<typename T>
  template<typename T>
 class Initializer{
   public:
-	virtual void initialize(unique_ptr<T[]> & particles,int n) =  0;
+	virtual void initialize(ParticleStore & particles,int n) =  0;
 };
-	
+
 #endif //_PARTICLE_HPP
@@ -26,7 +26,9 @@
 using namespace std;
 
 /**
- *   Record configuration in a csv file
+ *   Record configuration in a csv file. Particles are written in order of ID,
+ *   so each line refers to the same particle from one file to the next,
+ *   even if the particles have been reordered in memory.
  */
 void Reporter::report(){
 	_sequence++;
@@ -35,7 +37,7 @@ void Reporter::report(){
 	string file_name = _get_file_name();
 	_output.open(file_name);
 	if (_output.is_open()){
-        _configuration.iterate(*this);
+        _configuration.iterate_by_id(*this);
 		_output.close();
 		LOG(_configuration.get_momentum());
     } else {
@@ -0,0 +1,115 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "space-filling-curve.hpp"
+
+using namespace std;
+
+/**
+ *  Calculate key from integer coordinates of a cell
+ *
+ *  Parameters:
+ *      cell    Coordinates, each less than 2^bits
+ *      type    Morton or Hilbert
+ *      bits    Number of bits in each coordinate
+ */
+uint64_t SpaceFillingCurve::get_key(array<uint32_t,NDIM> cell, const Type type, const int bits) {
+	if (type == Hilbert)
+		_axes_to_transpose(cell,bits);
+	return _interleave(cell,bits);
+}
+
+/**
+ *  Determine the order of particles along the curve. Each particle is assigned to a cell
+ *  of the cube that bounds all the particles, in the same way as the tree does, and the
+ *  particles are sorted by the keys of their cells; ties are broken by slot, so the order
+ *  is reproducible.
+ *
+ *  Parameters:
+ *      particles   The particles
+ *      type        Morton or Hilbert
+ *
+ *  Returns:
+ *     Slots of particles, in order of key
+ */
+vector<int> SpaceFillingCurve::get_order(ParticleStore & particles, const Type type) {
+	const int n = particles.size();
+	const auto positions = particles.get_positions();
+	double zmin = numeric_limits<double>::max();
+	double zmax = -zmin;
+	for (const auto & component : positions)
+		for (int i=0;i<n;i++) {
+			zmin = min(zmin,component[i]);
+			zmax = max(zmax,component[i]);
+		}
+	const array<double,NDIM> Xmin = {zmin,zmin,zmin};
+	const array<double,NDIM> Xmax = {zmax,zmax,zmax};
+	vector<pair<uint64_t,int>> keys(n);
+	for (int i=0;i<n;i++) {
+		const array<double,NDIM> position = {positions[0][i],positions[1][i],positions[2][i]};
+		keys[i] = make_pair(get_key(Node::get_cell(position,Xmin,Xmax),type),i);
+	}
+	sort(keys.begin(),keys.end());
+	vector<int> order(n);
+	for (int i=0;i<n;i++)
+		order[i] = keys[i].second;
+	return order;
+}
+
+/**
+ *  Interleave bits of coordinates, most significant first
+ */
+uint64_t SpaceFillingCurve::_interleave(const array<uint32_t,NDIM> & cell, const int bits) {
+	uint64_t key = 0;
+	for (int bit=bits-1;bit>=0;bit--)
+		for (int j=0;j<NDIM;j++)
+			key = (key << 1) | ((cell[j] >> bit) & 1);
+	return key;
+}
+
+/**
+ *  Transform coordinates in place so that interleaving their bits gives the Hilbert key:
+ *  John Skilling, Programming the Hilbert curve, AIP Conference Proceedings 707, 381 (2004).
+ *  The first loop undoes the rotations and reflections of the curve, level by level;
+ *  the rest is a Gray code.
+ */
+void SpaceFillingCurve::_axes_to_transpose(array<uint32_t,NDIM> & cell, const int bits) {
+	const uint32_t M = 1u << (bits - 1);
+	for (uint32_t Q=M;Q>1;Q>>=1) {
+		const uint32_t P = Q - 1;
+		for (int j=0;j<NDIM;j++)
+			if (cell[j] & Q)
+				cell[0] ^= P;
+			else {
+				const uint32_t t = (cell[0] ^ cell[j]) & P;
+				cell[0] ^= t;
+				cell[j] ^= t;
+			}
+	}
+	for (int j=1;j<NDIM;j++)
+		cell[j] ^= cell[j-1];
+	uint32_t t = 0;
+	for (uint32_t Q=M;Q>1;Q>>=1)
+		if (cell[NDIM-1] & Q)
+			t ^= Q - 1;
+	for (int j=0;j<NDIM;j++)
+		cell[j] ^= t;
+}
@@ -0,0 +1,84 @@
+#ifndef _SPACE_FILLING_CURVE_HPP
+#define _SPACE_FILLING_CURVE_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "particle.hpp"
+#include "treecode.hpp"
+
+using namespace std;
+
+/**
+ *  This class maps positions to keys along a space-filling curve, so that sorting
+ *  particles by key puts particles that are close in space close together in memory.
+ *  The bounding cube is divided into cells by Node::get_cell(), which the tree also
+ *  uses for its Morton keys, so the Morton order is the order of the tree's leaves.
+ *
+ *  Morton (Z-order) keys interleave the bits of the cell coordinates; they follow the
+ *  octants of the tree, but the curve jumps between octants. Hilbert keys visit
+ *  the cells in an order in which consecutive cells always share a face.
+ */
+class SpaceFillingCurve {
+  public:
+	enum Type {Morton, Hilbert};
+
+	/**
+	 *  Number of bits for each coordinate: the key has NDIM times as many
+	 */
+	enum {N_Bits=Node::N_Levels};
+
+	/**
+	 *  Calculate key from integer coordinates of a cell
+	 *
+	 *  Parameters:
+	 *      cell    Coordinates, each less than 2^bits
+	 *      type    Morton or Hilbert
+	 *      bits    Number of bits in each coordinate
+	 */
+	static uint64_t get_key(array<uint32_t,NDIM> cell, const Type type, const int bits=N_Bits);
+
+	/**
+	 *  Determine the order of particles along the curve
+	 *
+	 *  Parameters:
+	 *      particles   The particles
+	 *      type        Morton or Hilbert
+	 *
+	 *  Returns:
+	 *     Slots of particles, in order of key
+	 */
+	static vector<int> get_order(ParticleStore & particles, const Type type);
+
+  private:
+	/**
+	 *  Interleave bits of coordinates, most significant first
+	 */
+	static uint64_t _interleave(const array<uint32_t,NDIM> & cell, const int bits);
+
+	/**
+	 *  Transform coordinates in place so that interleaving their bits gives the Hilbert key:
+	 *  John Skilling, Programming the Hilbert curve, AIP Conference Proceedings 707, 381 (2004).
+	 */
+	static void _axes_to_transpose(array<uint32_t,NDIM> & cell, const int bits);
+};
+
+#endif  // _SPACE_FILLING_CURVE_HPP
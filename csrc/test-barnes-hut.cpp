@@ -0,0 +1,601 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * This file exercises the Barnes Hut force walk. 
+ */
+ 
+#include "catch.hpp"
+#include "acceleration.hpp"
+#include "barnes-hut.hpp"
+#include "center-of-mass.hpp"
+#include "flat-tree.hpp"
+#include "group-walk.hpp"
+#include "interaction-kernel.hpp"
+#include "packet-walk.hpp"
+#include "test-utilities.hpp"
+
+using namespace std;
+using namespace Catch::Matchers;
+
+/**
+ *  Build tree and calculate centres of mass
+ */
+unique_ptr<Node> create_tree(ParticleStore & particles, const int n, const TreeOptions & options=TreeOptions()){
+	unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,options);
+	CentreOfMassCalculator calculator(particles,options.quadrupole);
+	tree->traverse(calculator);
+	return tree;
+}
+
+/**
+ *  Use BarnesHutVisitor to calculate acceleration of one particle, and store it in particle
+ */
+array<double,NDIM> get_acceleration(unique_ptr<Node> & tree, ParticleStore & particles, Particle & particle, 
+									 const OpeningCriterion & criterion, const double G=1.0, const double a=0.01, const bool quadrupole=false){
+	BarnesHutVisitor visitor(particle,particles,criterion,G,a,quadrupole);
+	tree->traverse(visitor);
+	visitor.store_accelerations();
+	return particle.get_acceleration();
+}
+
+/**
+ *  Use BarnesHutVisitor with geometric criterion to calculate acceleration of one particle
+ */
+array<double,NDIM> get_acceleration(unique_ptr<Node> & tree, ParticleStore & particles, Particle & particle, 
+									 const double theta, const double G=1.0, const double a=0.01, const bool quadrupole=false){
+	return get_acceleration(tree,particles,particle,GeometricCriterion(theta),G,a,quadrupole);
+}
+
+TEST_CASE( "Barnes Hut Tests", "[barnes-hut]" ) {
+	
+	/**
+	 * If theta is large enough, the root is accepted, so the walk stops
+	 * immediately, and the whole mass is treated as a point.
+	 */
+	SECTION("Walk does not descend below an accepted node") {
+		const int n = 100;
+		ParticleStore particles = create_random_particles(n);
+		unique_ptr<Node> tree = create_tree(particles,n);
+		Particle outsider;
+		outsider.init(array{10.0,10.0,10.0},array{0.0,0.0,0.0},1.0,n);
+		auto acceleration = get_acceleration(tree,particles,outsider,1.0e6);
+		const auto X = tree->get_centre_of_mass();
+		const auto d_factor = BarnesHutVisitor::get_softened_factor(Particle::get_distance_sq(X,outsider.get_position()),0.01);
+		for (int i=0;i<NDIM;i++)
+			REQUIRE_THAT(acceleration[i],WithinRel(n*(X[i]-outsider.get_position()[i])*d_factor,1.0e-12));
+	}
+	
+	/**
+	 * If theta is zero, no Internal Nodes are accepted, so we have the direct sum,
+	 * whether or not particles share buckets.
+	 */
+	SECTION("Walk with theta zero gives direct sum") {
+		const int n = 100;
+		const int bucket_size = GENERATE(1,8);
+		ParticleStore particles = create_random_particles(n);
+		unique_ptr<Node> tree = create_tree(particles,n,TreeOptions{.bucket_size=bucket_size});
+		const auto expected = get_direct_accelerations(particles,n);
+		for (int i=0;i<n;i++){
+			auto acceleration = get_acceleration(tree,particles,particles[i],0.0);
+			for (int k=0;k<NDIM;k++)
+				REQUIRE_THAT(acceleration[k],WithinAbs(expected[i][k],1.0e-9));
+		}
+	}
+	
+	/**
+	 * Seen from a distance, the quadrupole term should account for most of the
+	 * difference between the exact (unsoftened) field and the field of a point mass.
+	 * The particles are stretched into an ellipsoid, so the quadrupole is significant.
+	 */
+	SECTION("Quadrupole term corrects far field of point mass") {
+		const int n = 100;
+		ParticleStore particles = create_random_particles(n);
+		for (int j=0;j<n;j++){
+			auto position = particles[j].get_position();
+			position[0] *= 2.0;
+			position[2] *= 0.5;
+			particles[j].set_position(position);
+		}
+		unique_ptr<Node> tree = create_tree(particles,n,TreeOptions{.bucket_size=8,.quadrupole=true});
+		const auto X = tree->get_centre_of_mass();
+		for (auto position : {array{10.0,0.0,0.0},array{6.0,-5.0,3.0},array{-2.0,4.0,-8.0}}){
+			array<double,NDIM> exact = {0.0,0.0,0.0};
+			for (int j=0;j<n;j++){
+				const double d = sqrt(Particle::get_distance_sq(particles[j].get_position(),position));
+				for (int k=0;k<NDIM;k++)
+					exact[k] += particles[j].get_mass()*(particles[j].get_position()[k]-position[k])/(d*d*d);
+			}
+			const double dsq = Particle::get_distance_sq(X,position);
+			array<double,NDIM> monopole;
+			for (int k=0;k<NDIM;k++)
+				monopole[k] = tree->get_mass()*(X[k]-position[k])/(dsq*sqrt(dsq));
+			array<double,NDIM> quadrupole = {0.0,0.0,0.0};
+			BarnesHutVisitor::add_quadrupole_acceleration(tree->get_quadrupole(),X,position,dsq,1.0,0.0,quadrupole);
+			double error_monopole = 0.0, error_quadrupole = 0.0;
+			for (int k=0;k<NDIM;k++){
+				error_monopole += sqr(exact[k] - monopole[k]);
+				error_quadrupole += sqr(exact[k] - monopole[k] - quadrupole[k]);
+			}
+			REQUIRE(error_monopole > 0);
+			REQUIRE(sqrt(error_quadrupole) < 0.1*sqrt(error_monopole));
+		}
+	}
+}
+
+TEST_CASE( "Interaction Kernel Tests", "[barnes-hut]" ) {
+	
+	/**
+	 * The factor must be (dsq + a^2)^(-3/2), not (dsq + a^2)^(-1)
+	 */
+	SECTION("Softened factor has correct exponent") {
+		REQUIRE(InteractionKernel::get_softened_factor(3.0,1.0) == 0.125);
+		REQUIRE_THAT(BarnesHutVisitor::get_softened_factor(0.5,0.01),WithinRel(pow(0.5 + 0.0001,-1.5),1.0e-15));
+	}
+	
+	/**
+	 * Compare each implementation that this processor supports with a sum in long double.
+	 * The sizes include partial vectors; the error is measured relative to the sum of 
+	 * the magnitudes of the terms, as the terms may cancel.
+	 */
+	SECTION("Kernel agrees with long double reference") {
+		const auto implementation = GENERATE(InteractionKernel::Scalar,InteractionKernel::AVX2,InteractionKernel::AVX512);
+		const int n = GENERATE(0,1,3,4,7,8,9,17,64,200);
+		if (!InteractionKernel::is_supported(implementation)) return;
+		mt19937 generator(n);
+		uniform_real_distribution<double> distribution(-1.0,1.0);
+		vector<double> x(n), y(n), z(n), m(n);
+		for (int j=0;j<n;j++){
+			x[j] = distribution(generator);
+			y[j] = distribution(generator);
+			z[j] = distribution(generator);
+			m[j] = 1.0 + distribution(generator);
+		}
+		const array<double,NDIM> position = {0.1,-0.2,0.3};
+		const double a = 0.01;
+		array<long double,NDIM> expected = {0.0L,0.0L,0.0L};
+		array<long double,NDIM> magnitude = {0.0L,0.0L,0.0L};
+		for (int j=0;j<n;j++){
+			const array<long double,NDIM> d = {(long double)x[j]-position[0],(long double)y[j]-position[1],(long double)z[j]-position[2]};
+			const long double r_sq = d[0]*d[0] + d[1]*d[1] + d[2]*d[2] + (long double)a*a;
+			const long double factor = m[j] / (r_sq * sqrtl(r_sq));
+			for (int k=0;k<NDIM;k++){
+				expected[k] += d[k] * factor;
+				magnitude[k] += fabsl(d[k] * factor);
+			}
+		}
+		array<double,NDIM> acceleration = {0.0,0.0,0.0};
+		InteractionKernel::accumulate(x.data(),y.data(),z.data(),m.data(),n,position,a,acceleration,implementation);
+		for (int k=0;k<NDIM;k++)
+			REQUIRE(fabsl(acceleration[k] - expected[k]) <= 1.0e-14 * magnitude[k]);
+	}
+	
+	/**
+	 * The mutual kernel gives the same acceleration to the particle as the one sided
+	 * kernel, and the reaction on each mass is the particle's mass times its term.
+	 */
+	SECTION("Mutual kernel agrees with one sided kernel") {
+		const auto implementation = GENERATE(InteractionKernel::Scalar,InteractionKernel::AVX2,InteractionKernel::AVX512);
+		const int n = GENERATE(0,1,7,8,9,17,64);
+		if (!InteractionKernel::is_supported(implementation)) return;
+		mt19937 generator(n);
+		uniform_real_distribution<double> distribution(-1.0,1.0);
+		vector<double> x(n), y(n), z(n), m(n), ax(n,0.0), ay(n,0.0), az(n,0.0);
+		for (int j=0;j<n;j++){
+			x[j] = distribution(generator);
+			y[j] = distribution(generator);
+			z[j] = distribution(generator);
+			m[j] = 1.0 + distribution(generator);
+		}
+		const array<double,NDIM> position = {0.1,-0.2,0.3};
+		const double mass = 2.5;
+		const double a = 0.01;
+		array<double,NDIM> expected = {0.0,0.0,0.0};
+		InteractionKernel::accumulate(x.data(),y.data(),z.data(),m.data(),n,position,a,expected,implementation);
+		array<double,NDIM> acceleration = {0.0,0.0,0.0};
+		InteractionKernel::accumulate_mutual(x.data(),y.data(),z.data(),m.data(),n,position,mass,a,acceleration,
+											 ax.data(),ay.data(),az.data(),implementation);
+		for (int k=0;k<NDIM;k++)
+			REQUIRE(acceleration[k] == expected[k]);
+		for (int j=0;j<n;j++){
+			const double factor = mass * InteractionKernel::get_softened_factor(sqr(x[j]-position[0]) + sqr(y[j]-position[1]) + sqr(z[j]-position[2]),a);
+			REQUIRE_THAT(ax[j],WithinAbs(-factor*(x[j]-position[0]),1.0e-14*factor));
+			REQUIRE_THAT(ay[j],WithinAbs(-factor*(y[j]-position[1]),1.0e-14*factor));
+			REQUIRE_THAT(az[j],WithinAbs(-factor*(z[j]-position[2]),1.0e-14*factor));
+		}
+	}
+	
+	/**
+	 * An InteractionList processes several batches, and multiplies by G
+	 */
+	SECTION("Interaction list gives same result as kernel") {
+		const int n = 3*InteractionList::Capacity + 5;
+		ParticleStore particles = create_random_particles(n);
+		const array<double,NDIM> position = {0.1,-0.2,0.3};
+		InteractionList interactions(position,0.01);
+		vector<double> x(n), y(n), z(n), m(n);
+		for (int j=0;j<n;j++){
+			const auto X = particles[j].get_position();
+			interactions.add(particles[j].get_mass(),X);
+			x[j] = X[0];
+			y[j] = X[1];
+			z[j] = X[2];
+			m[j] = particles[j].get_mass();
+		}
+		array<double,NDIM> expected = {0.0,0.0,0.0};
+		InteractionKernel::accumulate(x.data(),y.data(),z.data(),m.data(),n,position,0.01,expected,InteractionKernel::Scalar);
+		const auto acceleration = interactions.get_acceleration(2.0);
+		for (int k=0;k<NDIM;k++)
+			REQUIRE_THAT(acceleration[k],WithinRel(2.0*expected[k],1.0e-12));
+	}
+}
+
+TEST_CASE( "Opening Criterion Tests", "[barnes-hut]" ) {
+	
+	SECTION("Criteria are created by name") {
+		REQUIRE(dynamic_cast<GeometricCriterion*>(OpeningCriterion::create("geometric",0.5).get()) != nullptr);
+		REQUIRE(dynamic_cast<BmaxCriterion*>(OpeningCriterion::create("bmax",0.5).get()) != nullptr);
+		REQUIRE(dynamic_cast<RelativeCriterion*>(OpeningCriterion::create("relative",0.5).get()) != nullptr);
+		REQUIRE_THROWS_AS(OpeningCriterion::create("nonsense",0.5),logic_error);
+	}
+	
+	/**
+	 * A node whose centre of mass is at a corner of the cube: the geometric criterion
+	 * only sees the side, so it accepts, but bmax is the diagonal, so bmax rejects.
+	 */
+	SECTION("Bmax criterion allows for centre of mass away from centre of cube") {
+		GeometricCriterion geometric(0.6);
+		BmaxCriterion bmax(0.6);
+		REQUIRE(geometric.accept(1.0,1.0,3.0,4.0,0.0));
+		REQUIRE_FALSE(bmax.accept(1.0,1.0,3.0,4.0,0.0));
+		REQUIRE(bmax.accept(1.0,1.0,0.75,4.0,0.0));
+	}
+	
+	SECTION("Relative criterion compares error estimate with previous acceleration") {
+		RelativeCriterion relative(0.6,0.01,1.0);
+		REQUIRE(relative.accept(1.0,1.0,3.0,4.0,0.0));       // No previous acceleration, so geometric
+		REQUIRE_FALSE(relative.accept(1.0,1.0,3.0,4.0,1.0)); // G m side^2/d^4 = 1/16 > 0.01
+		REQUIRE(relative.accept(1.0,1.0,3.0,4.0,10.0));      // 1/16 <= 0.1
+		REQUIRE_FALSE(relative.accept(1.0,1.0,3.0,0.81,1.0e6)); // Particle within one side
+	}
+	
+	/**
+	 * Every criterion must give the direct sum when no node can be accepted,
+	 * and a good approximation for moderate parameters.
+	 */
+	SECTION("Walk agrees with direct sum for each criterion") {
+		const int n = 500;
+		const string name = GENERATE("geometric","bmax","relative");
+		ParticleStore particles = create_clustered_particles(n);
+		unique_ptr<Node> tree = create_tree(particles,n,TreeOptions{.bucket_size=4});
+		auto exact = get_direct_accelerations(particles,n);
+		for (int i=0;i<n;i++)
+			particles[i].set_acceleration(exact[i]);
+		unique_ptr<OpeningCriterion> criterion = OpeningCriterion::create(name,0.5,0.001);
+		vector<array<double,NDIM>> approximate;
+		for (int i=0;i<n;i++)
+			approximate.push_back(get_acceleration(tree,particles,particles[i],*criterion));
+		REQUIRE(get_rms_error(approximate,exact) < 0.05);
+	}
+}
+
+/**
+ *  Used to count how many nodes are tested by a criterion
+ */
+class CountingCriterion : public GeometricCriterion {
+  public:
+	mutable int count = 0;
+	
+	CountingCriterion(const double theta) : GeometricCriterion(theta) {}
+	
+	bool accept(const double m, const double side, const double bmax_sq, const double dsq, const double a_old) const {
+		count++;
+		return GeometricCriterion::accept(m,side,bmax_sq,dsq,a_old);
+	}
+};
+
+TEST_CASE( "Tight Bounds Tests", "[barnes-hut]" ) {
+	
+	/**
+	 * With tight bounding boxes, fewer nodes are opened, so fewer are tested,
+	 * and the accuracy is comparable. FlatTree must agree with BarnesHutVisitor.
+	 */
+	SECTION("Tight bounding boxes reduce number of nodes opened") {
+		const int n = 2000;
+		ParticleStore particles = create_clustered_particles(n);
+		const TreeOptions options{.bucket_size=4,.tight_bounds=true};
+		unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,options);
+		CentreOfMassCalculator calculator(particles,false,true);
+		tree->traverse(calculator);
+		FlatTree flat_tree;
+		flat_tree.build(tree.get(),particles,false,true);
+		CountingCriterion cube(0.5), tight(0.5);
+		const auto exact = get_direct_accelerations(particles,n);
+		vector<array<double,NDIM>> accelerations_cube, accelerations_tight;
+		for (int i=0;i<n;i++){
+			auto acceleration_cube = get_acceleration(tree,particles,particles[i],cube);
+			auto acceleration_flat = flat_tree.get_acceleration(particles[i],GeometricCriterion(0.5),1.0,0.01);
+			BarnesHutVisitor visitor(particles[i],particles,tight,1.0,0.01,false,true);
+			tree->traverse(visitor);
+			visitor.store_accelerations();
+			auto acceleration_tight = particles[i].get_acceleration();
+			REQUIRE(acceleration_flat == acceleration_tight);
+			accelerations_cube.push_back(acceleration_cube);
+			accelerations_tight.push_back(acceleration_tight);
+		}
+		REQUIRE(tight.count < cube.count);
+		REQUIRE(get_rms_error(accelerations_tight,exact) < 0.05);
+		REQUIRE(get_rms_error(accelerations_cube,exact) < 0.05);
+	}
+}
+
+TEST_CASE( "Flat Tree Tests", "[barnes-hut]" ) {
+	
+	/**
+	 * The relative criterion depends on the previous acceleration, so the FlatTree walk 
+	 * is done first, as BarnesHutVisitor stores the acceleration that it calculates.
+	 */
+	SECTION("Flat tree gives same accelerations as BarnesHutVisitor") {
+		const int n = 2000;
+		const int bucket_size = GENERATE(1,8);
+		const bool quadrupole = GENERATE(false,true);
+		const string name = GENERATE("geometric","bmax","relative");
+		ParticleStore particles = create_clustered_particles(n);
+		unique_ptr<Node> tree = create_tree(particles,n,TreeOptions{.bucket_size=bucket_size,.quadrupole=quadrupole});
+		FlatTree flat_tree;
+		flat_tree.build(tree.get(),particles,quadrupole);
+		REQUIRE(flat_tree[0].m == tree->get_mass());
+		for (double theta : {0.5,1.0}) {
+			unique_ptr<OpeningCriterion> criterion = OpeningCriterion::create(name,theta,0.01);
+			for (int i=0;i<n;i++){
+				auto acceleration = flat_tree.get_acceleration(particles[i],*criterion,1.0,0.01);
+				auto expected = get_acceleration(tree,particles,particles[i],*criterion,1.0,0.01,quadrupole);
+				REQUIRE(acceleration == expected);
+			}
+		}
+	}
+	
+	SECTION("Children are contiguous, and every particle is in a bucket") {
+		const int n = 1000;
+		const int bucket_size = GENERATE(1,8);
+		ParticleStore particles = create_random_particles(n);
+		unique_ptr<Node> tree = create_tree(particles,n,TreeOptions{.bucket_size=bucket_size});
+		FlatTree flat_tree;
+		flat_tree.build(tree.get(),particles);
+		int n_external = 0;
+		int n_children = 0;
+		for (int i=0;i<flat_tree.size();i++)
+			if (flat_tree[i].n_children == 0) {
+				REQUIRE(flat_tree[i].n_particles <= bucket_size);
+				n_external += flat_tree[i].n_particles;
+			} else {
+				REQUIRE(flat_tree[i].first > i);
+				n_children += flat_tree[i].n_children;
+				double m = 0;
+				for (int j=0;j<flat_tree[i].n_children;j++)
+					m += flat_tree[flat_tree[i].first+j].m;
+				REQUIRE_THAT(m,WithinRel(flat_tree[i].m,1.0e-12));
+			}
+		REQUIRE(n_external == n);
+		REQUIRE(n_children == flat_tree.size() - 1);
+	}
+}
+
+TEST_CASE( "Group Walk Tests", "[barnes-hut]" ) {
+	
+	/**
+	 * If theta is zero, no nodes are accepted, so we have the direct sum,
+	 * whatever the sizes of groups and buckets.
+	 */
+	SECTION("Group walk with theta zero gives direct sum") {
+		const int n = 200;
+		const int bucket_size = GENERATE(1,8);
+		const int group_size = GENERATE(1,8,32,1000);
+		ParticleStore particles = create_random_particles(n);
+		unique_ptr<Node> tree = create_tree(particles,n,TreeOptions{.bucket_size=bucket_size});
+		vector<array<double,NDIM>> expected;
+		for (int i=0;i<n;i++)
+			expected.push_back(get_acceleration(tree,particles,particles[i],0.0));
+		array<double,NDIM> zero = {0.0,0.0,0.0};
+		for (int i=0;i<n;i++)
+			particles[i].set_acceleration(zero);
+		GeometricCriterion criterion(0.0);
+		GroupWalk walk(criterion,1.0,0.01,false,false,group_size);
+		walk.calculate(tree.get(),particles);
+		REQUIRE(walk.get_n_groups() <= n);
+		for (int i=0;i<n;i++)
+			for (int k=0;k<NDIM;k++)
+				REQUIRE_THAT(particles[i].get_acceleration()[k],WithinAbs(expected[i][k],1.0e-9));
+	}
+	
+	/**
+	 * The group walk only accepts a node if it would be accepted by every
+	 * member of the group, so it should be at least as accurate as the
+	 * walk for each particle.
+	 */
+	SECTION("Group walk is as accurate as walk for each particle") {
+		const int n = 1000;
+		const bool quadrupole = GENERATE(false,true);
+		ParticleStore particles = create_clustered_particles(n);
+		unique_ptr<Node> tree = create_tree(particles,n,TreeOptions{.bucket_size=8,.quadrupole=quadrupole});
+		const auto exact = get_direct_accelerations(particles,n);
+		vector<array<double,NDIM>> approximate;
+		for (int i=0;i<n;i++)
+			approximate.push_back(get_acceleration(tree,particles,particles[i],0.7,1.0,0.01,quadrupole));
+		GeometricCriterion criterion(0.7);
+		GroupWalk walk(criterion,1.0,0.01,quadrupole,false,32);
+		walk.calculate(tree.get(),particles);
+		REQUIRE(walk.get_n_groups() < n/4);
+		REQUIRE(get_rms_error(particles,exact) <= get_rms_error(approximate,exact));
+	}
+}
+
+TEST_CASE( "Packet Walk Tests", "[barnes-hut]" ) {
+	
+	/**
+	 * Each lane makes the same decisions as BarnesHutVisitor, and accumulates
+	 * the same interactions in the same order, so the results are identical.
+	 */
+	SECTION("Packet walk gives same accelerations as BarnesHutVisitor") {
+		const int n = 500;
+		const int width = GENERATE(1,4,8,16);
+		const bool quadrupole = GENERATE(false,true);
+		const string name = GENERATE("geometric","relative");
+		ParticleStore particles = create_clustered_particles(n);
+		unique_ptr<Node> tree = create_tree(particles,n,TreeOptions{.bucket_size=4,.quadrupole=quadrupole});
+		for (int i=0;i<n;i++)
+			get_acceleration(tree,particles,particles[i],0.5);
+		unique_ptr<OpeningCriterion> criterion = OpeningCriterion::create(name,0.5,0.001);
+		vector<array<double,NDIM>> expected;
+		for (int i=0;i<n;i++){
+			Particle particle = particles[i];
+			expected.push_back(get_acceleration(tree,particles,particle,*criterion,1.0,0.01,quadrupole));
+		}
+		PacketWalk walk(*criterion,1.0,0.01,quadrupole,false,width);
+		walk.calculate(tree.get(),particles);
+		for (int i=0;i<n;i++)
+			REQUIRE(particles[i].get_acceleration() == expected[i]);
+	}
+	
+	SECTION("Packets cannot be wider than the mask") {
+		GeometricCriterion criterion(0.5);
+		REQUIRE_THROWS_AS(PacketWalk(criterion,1.0,0.01,false,false,PacketVisitor::MaxWidth+1),logic_error);
+	}
+}
+
+TEST_CASE( "Mixed Precision Tests", "[barnes-hut]" ) {
+	
+	/**
+	 * The single precision kernel should be accurate to about 1e-7, relative to
+	 * the sum of the magnitudes of the terms.
+	 */
+	SECTION("Single precision kernel agrees with long double reference") {
+		const auto implementation = GENERATE(InteractionKernel::Scalar,InteractionKernel::AVX2,InteractionKernel::AVX512);
+		const int n = GENERATE(0,1,7,8,15,16,17,64);
+		if (!InteractionKernel::is_supported(implementation)) return;
+		mt19937 generator(n);
+		uniform_real_distribution<float> distribution(-1.0f,1.0f);
+		vector<float> dx(n), dy(n), dz(n), m(n);
+		for (int j=0;j<n;j++){
+			dx[j] = distribution(generator);
+			dy[j] = distribution(generator);
+			dz[j] = distribution(generator);
+			m[j] = 1.0f + distribution(generator);
+		}
+		const float a = 0.01f;
+		array<long double,NDIM> expected = {0.0L,0.0L,0.0L};
+		array<long double,NDIM> magnitude = {0.0L,0.0L,0.0L};
+		for (int j=0;j<n;j++){
+			const array<long double,NDIM> d = {dx[j],dy[j],dz[j]};
+			const long double r_sq = d[0]*d[0] + d[1]*d[1] + d[2]*d[2] + (long double)a*a;
+			const long double factor = m[j] / (r_sq * sqrtl(r_sq));
+			for (int k=0;k<NDIM;k++){
+				expected[k] += d[k] * factor;
+				magnitude[k] += fabsl(d[k] * factor);
+			}
+		}
+		array<double,NDIM> acceleration = {0.0,0.0,0.0};
+		InteractionKernel::accumulate_float(dx.data(),dy.data(),dz.data(),m.data(),n,a,acceleration,implementation);
+		for (int k=0;k<NDIM;k++)
+			REQUIRE(fabsl(acceleration[k] - expected[k]) <= 1.0e-6 * magnitude[k]);
+	}
+	
+	/**
+	 * Mixed precision differs from double precision by much less than the error
+	 * of the tree, and the flat tree still agrees with BarnesHutVisitor.
+	 */
+	SECTION("Mixed precision agrees with double precision") {
+		const int n = 2000;
+		const bool quadrupole = GENERATE(false,true);
+		ParticleStore particles = create_clustered_particles(n);
+		unique_ptr<Node> tree = create_tree(particles,n,TreeOptions{.bucket_size=8,.quadrupole=quadrupole});
+		FlatTree flat_tree;
+		flat_tree.build(tree.get(),particles,quadrupole);
+		GeometricCriterion criterion(0.5);
+		vector<array<double,NDIM>> expected, accelerations;
+		for (int i=0;i<n;i++){
+			expected.push_back(get_acceleration(tree,particles,particles[i],criterion,1.0,0.01,quadrupole));
+			BarnesHutVisitor visitor(particles[i],particles,criterion,1.0,0.01,quadrupole,false,true);
+			tree->traverse(visitor);
+			visitor.store_accelerations();
+			const auto acceleration = particles[i].get_acceleration();
+			REQUIRE(flat_tree.get_acceleration(particles[i],criterion,1.0,0.01,true) == acceleration);
+			accelerations.push_back(acceleration);
+		}
+		const double error = get_rms_error(accelerations,expected);
+		REQUIRE(error > 0.0);
+		REQUIRE(error < 1.0e-5);
+	}
+}
+
+TEST_CASE( "Parallel Force Tests", "[barnes-hut]" ) {
+	
+	/**
+	 * Each particle is processed by the same code whichever thread it is assigned to,
+	 * so the accelerations are identical to those from a single thread.
+	 */
+	SECTION("Parallel force walk gives same accelerations as serial") {
+		const int n = 2000;
+		const bool flat = GENERATE(false,true);
+		const int threads = GENERATE(2,3,8);
+		ParticleStore particles = create_clustered_particles(n);
+		AccelerationVisitor serial(make_unique<GeometricCriterion>(0.5),1.0,0.01,false,TreeOptions{.flat=flat,.bucket_size=8,.quadrupole=true});
+		serial.initialize(particles,n);
+		vector<array<double,NDIM>> expected;
+		for (int i=0;i<n;i++) {
+			serial.visit(particles[i]);
+			expected.push_back(particles[i].get_acceleration());
+		}
+		array<double,NDIM> zero = {0.0,0.0,0.0};
+		for (int i=0;i<n;i++)
+			particles[i].set_acceleration(zero);
+		AccelerationVisitor parallel(make_unique<GeometricCriterion>(0.5),1.0,0.01,false,
+									 TreeOptions{.threads=threads,.flat=flat,.bucket_size=8,.quadrupole=true});
+		parallel.initialize(particles,n);
+		for (int i=0;i<n;i++) {
+			parallel.visit(particles[i]);
+			REQUIRE(particles[i].get_acceleration() == expected[i]);
+		}
+	}
+	
+	/**
+	 * The second step divides the work using the costs recorded in the first,
+	 * which must not change the accelerations; the costs must be the numbers
+	 * of interactions, which are at least the number of particles in a bucket.
+	 */
+	SECTION("Cost model records interactions and preserves accelerations") {
+		const int n = 2000;
+		const bool flat = GENERATE(false,true);
+		const int threads = 3;
+		ParticleStore particles = create_clustered_particles(n);
+		AccelerationVisitor parallel(make_unique<GeometricCriterion>(0.5),1.0,0.01,false,
+									 TreeOptions{.threads=threads,.flat=flat,.bucket_size=8});
+		parallel.initialize(particles,n);
+		vector<array<double,NDIM>> expected;
+		for (int i=0;i<n;i++)
+			expected.push_back(particles[i].get_acceleration());
+		REQUIRE(parallel.get_busy_times().size() == threads);
+		REQUIRE(parallel.get_costs().size() == n);
+		double total = 0;
+		for (int i=0;i<n;i++) {
+			REQUIRE(parallel.get_costs()[i] > 8);
+			total += parallel.get_costs()[i];
+		}
+		REQUIRE(total < (double)n*n);
+		parallel.initialize(particles,n);
+		for (int i=0;i<n;i++)
+			REQUIRE(particles[i].get_acceleration() == expected[i]);
+	}
+}
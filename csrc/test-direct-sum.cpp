@@ -0,0 +1,150 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * This file exercises direct summation, and uses it to check the tree.
+ */
+
+#include "catch.hpp"
+#include "acceleration.hpp"
+#include "direct-sum.hpp"
+#include "thread-pool.hpp"
+#include "test-utilities.hpp"
+
+using namespace std;
+using namespace Catch::Matchers;
+
+/**
+ *  Create particles uniformly distributed in a cube, with a range of masses
+ */
+ParticleStore create_weighted_particles(const int n, const int seed=42){
+	mt19937 generator(seed);
+	uniform_real_distribution<double> position(-1.0,1.0);
+	uniform_real_distribution<double> mass(0.1,10.0);
+	ParticleStore particles = ParticleStore(n);
+	for (int i=0;i<n;i++)
+		particles[i].init(array{position(generator),position(generator),position(generator)},
+						  array{0.0,0.0,0.0},mass(generator),i);
+	return particles;
+}
+
+TEST_CASE( "Direct Sum Tests", "[direct]" ) {
+
+	/**
+	 * Compare with a straightforward double loop, in long double. The number of particles
+	 * is not a multiple of the tile size, so some tiles are partly filled.
+	 */
+	SECTION("Direct sum matches reference") {
+		const int n = 3*DirectSumAccelerationVisitor::TileSize + 17;
+		const int threads = GENERATE(1,3);
+		const bool symmetric = GENERATE(false,true);
+		ParticleStore particles = create_weighted_particles(n);
+		DirectSumAccelerationVisitor direct_sum(2.0,0.01,threads,symmetric);
+		direct_sum.initialize(particles,n);
+		for (int i=0;i<n;i++) {
+			array<long double,NDIM> exact = {0.0,0.0,0.0};
+			long double scale = 0.0;
+			for (int j=0;j<n;j++) {
+				if (i == j) continue;
+				array<long double,NDIM> d;
+				long double r_sq = 0.01L*0.01L;
+				for (int k=0;k<NDIM;k++) {
+					d[k] = static_cast<long double>(particles[j].get_position()[k]) - particles[i].get_position()[k];
+					r_sq += d[k]*d[k];
+				}
+				const long double factor = 2.0L * particles[j].get_mass() / (r_sq * sqrtl(r_sq));
+				for (int k=0;k<NDIM;k++) {
+					exact[k] += factor * d[k];
+					scale += fabsl(factor * d[k]);
+				}
+			}
+			for (int k=0;k<NDIM;k++)
+				REQUIRE_THAT(particles[i].get_acceleration()[k],WithinAbs(static_cast<double>(exact[k]),1.0e-13*static_cast<double>(scale)));
+		}
+	}
+
+	/**
+	 * If each pair is processed once, the forces are equal and opposite
+	 */
+	SECTION("Symmetric direct sum conserves momentum") {
+		const int n = 2000;
+		const int threads = GENERATE(1,4);
+		ParticleStore particles = create_weighted_particles(n);
+		DirectSumAccelerationVisitor direct_sum(1.0,0.01,threads,true);
+		direct_sum.initialize(particles,n);
+		array<double,NDIM> total = {0.0,0.0,0.0};
+		double scale = 0.0;
+		for (int i=0;i<n;i++)
+			for (int k=0;k<NDIM;k++) {
+				total[k] += particles[i].get_mass() * particles[i].get_acceleration()[k];
+				scale += particles[i].get_mass() * fabs(particles[i].get_acceleration()[k]);
+			}
+		for (int k=0;k<NDIM;k++)
+			REQUIRE(fabs(total[k]) < 1.0e-13 * scale);
+	}
+
+	/**
+	 * Each thread always processes the same rows of tiles, so the copies of the accelerations,
+	 * and their sum, don't depend on timing.
+	 */
+	SECTION("Symmetric direct sum is reproducible") {
+		const int n = 2000;
+		ParticleStore particles = create_weighted_particles(n);
+		DirectSumAccelerationVisitor direct_sum(1.0,0.01,4,true);
+		direct_sum.initialize(particles,n);
+		vector<array<double,NDIM>> first;
+		for (int i=0;i<n;i++)
+			first.push_back(particles[i].get_acceleration());
+		for (int run=0;run<5;run++) {
+			direct_sum.initialize(particles,n);
+			for (int i=0;i<n;i++)
+				REQUIRE(particles[i].get_acceleration() == first[i]);
+		}
+	}
+
+	/**
+	 * Direct summation may be requested by a thread that is executing a task
+	 * from the shared pool, and then it uses threads of its own.
+	 */
+	SECTION("Direct sum can be called from a pool task") {
+		const int n = 1000;
+		const bool symmetric = GENERATE(false,true);
+		ParticleStore particles = create_weighted_particles(n);
+		DirectSumAccelerationVisitor direct_sum(1.0,0.01,3,symmetric);
+		direct_sum.initialize(particles,n);
+		vector<array<double,NDIM>> expected(n);
+		for (int i=0;i<n;i++)
+			expected[i] = particles[i].get_acceleration();
+		ThreadPool::get_instance(2).run([&](int thread){
+			if (thread == 0) direct_sum.initialize(particles,n);
+		},2);
+		for (int i=0;i<n;i++)
+			REQUIRE(particles[i].get_acceleration() == expected[i]);
+	}
+
+	/**
+	 * Use direct summation as a reference for the tree
+	 */
+	SECTION("Tree agrees with direct sum") {
+		const int n = 10000;
+		ParticleStore particles = create_clustered_particles(n);
+		const auto exact = get_direct_accelerations(particles,n);
+		AccelerationVisitor barnes_hut(make_unique<GeometricCriterion>(0.5),1.0,0.01,false,TreeOptions{.quadrupole=true});
+		barnes_hut.initialize(particles,n);
+		for (int i=0;i<n;i++)
+			barnes_hut.visit(particles[i]);
+		REQUIRE(get_rms_error(particles,exact) < 0.01);
+	}
+}
@@ -0,0 +1,169 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * This file exercises the Fast Multipole Method.
+ */
+
+#include <random>
+
+#include "catch.hpp"
+#include "barnes-hut.hpp"
+#include "fmm.hpp"
+#include "integrators.hpp"
+#include "test-utilities.hpp"
+
+using namespace std;
+using namespace Catch::Matchers;
+
+/**
+ *  Reporter for tests that don't need to record anything
+ */
+class NullReporter : public IReporter {
+  public:
+	void visit(Particle & particle) {;}
+
+	void report() {;}
+};
+
+/**
+ *  Used to add up the magnitudes of the particles' momenta
+ */
+class MomentumMagnitude : public Visitor<Particle> {
+  public:
+	double total = 0.0;
+
+	void visit(Particle & particle) {
+		const auto velocity = particle.get_velocity();
+		total += particle.get_mass() * sqrt(sqr(velocity[0]) + sqr(velocity[1]) + sqr(velocity[2]));
+	}
+};
+
+/**
+ *  Integrate a cluster of particles, initially at rest, and return the total momentum at the end,
+ *  relative to the sum of the magnitudes of the particles' momenta.
+ */
+double get_momentum_drift(IAccelerationVisitor & calculate_acceleration, const int n, const int steps, const double dt){
+	mt19937 generator(42);
+	normal_distribution<double> position(0.0,1.0);
+	uniform_real_distribution<double> mass(0.5,1.5);
+	vector<double> params;
+	for (int i=0;i<n;i++){
+		for (int k=0;k<NDIM;k++)
+			params.push_back(position(generator));
+		params.push_back(mass(generator)/n);
+		for (int k=0;k<NDIM;k++)
+			params.push_back(0.0);
+	}
+	Configuration configuration(n,params.data());
+	NullReporter reporter;
+	Notifier notifier("kill");
+	Leapfrog integrator(configuration,calculate_acceleration,reporter,notifier);
+	integrator.run(steps,dt);
+	MomentumMagnitude magnitude;
+	configuration.iterate(magnitude);
+	const auto momentum = configuration.get_momentum();
+	return sqrt(sqr(momentum[0]) + sqr(momentum[1]) + sqr(momentum[2])) / magnitude.total;
+}
+
+TEST_CASE( "FMM Tests", "[fmm]" ) {
+
+	/**
+	 * If theta is zero, no cells are well separated, so every pair of leaves
+	 * interacts directly.
+	 */
+	SECTION("FMM with theta zero gives direct sum") {
+		const int n = 200;
+		const int bucket_size = GENERATE(1,8);
+		ParticleStore particles = create_random_particles(n);
+		const auto exact = get_direct_accelerations(particles,n);
+		FastMultipoleMethod fmm(0.0,1.0,0.01,TreeOptions{.bucket_size=bucket_size});
+		fmm.initialize(particles,n);
+		REQUIRE(fmm.get_n_m2l() == 0);
+		for (int i=0;i<n;i++)
+			for (int k=0;k<NDIM;k++)
+				REQUIRE_THAT(particles[i].get_acceleration()[k],WithinAbs(exact[i][k],1.0e-9));
+	}
+
+	/**
+	 * As theta decreases, fewer pairs of cells are well separated, and the 
+	 * expansions are more accurate.
+	 */
+	SECTION("FMM is accurate, and error decreases with theta") {
+		const int n = 2000;
+		ParticleStore particles = create_clustered_particles(n);
+		const auto exact = get_direct_accelerations(particles,n);
+		double previous = 1.0;
+		for (double theta : {0.8,0.6,0.4}){
+			FastMultipoleMethod fmm(theta,1.0,0.01,TreeOptions{.bucket_size=8});
+			fmm.initialize(particles,n);
+			REQUIRE(fmm.get_n_m2l() > 0);
+			const double error = get_rms_error(particles,exact);
+			REQUIRE(error < previous);
+			previous = error;
+		}
+		REQUIRE(previous < 1.0e-3);
+	}
+
+	/**
+	 * Several steps use the same FastMultipoleMethod, so storage is reused
+	 */
+	SECTION("FMM can be used for several steps") {
+		const int n = 500;
+		ParticleStore particles = create_random_particles(n);
+		FastMultipoleMethod fmm(0.5,1.0,0.01,TreeOptions{.bucket_size=8});
+		for (int step=0;step<3;step++){
+			move_particles(particles,n,0.01,step);
+			const auto exact = get_direct_accelerations(particles,n);
+			fmm.initialize(particles,n);
+			for (int i=0;i<n;i++)
+				fmm.visit(particles[i]);
+			REQUIRE(get_rms_error(particles,exact) < 0.01);
+		}
+	}
+
+	/**
+	 * Mutual interactions give the same accelerations as one sided ones, to within
+	 * the accuracy of the expansions, but only visit each pair of cells once.
+	 */
+	SECTION("Mutual FMM is accurate") {
+		const int n = 2000;
+		ParticleStore particles = create_clustered_particles(n);
+		const auto exact = get_direct_accelerations(particles,n);
+		FastMultipoleMethod exhaustive(0.0,1.0,0.01,TreeOptions{.bucket_size=8},true);
+		exhaustive.initialize(particles,n);
+		REQUIRE(get_rms_error(particles,exact) < 1.0e-12);
+		FastMultipoleMethod one_sided(0.5,1.0,0.01,TreeOptions{.bucket_size=8});
+		one_sided.initialize(particles,n);
+		const double error = get_rms_error(particles,exact);
+		FastMultipoleMethod mutual(0.5,1.0,0.01,TreeOptions{.bucket_size=8},true);
+		mutual.initialize(particles,n);
+		REQUIRE(get_rms_error(particles,exact) < 2*error);
+		REQUIRE(mutual.get_n_m2l() < one_sided.get_n_m2l());
+	}
+
+	/**
+	 * Regression test for Issue #72: total momentum drifts. With mutual interactions,
+	 * the drift should be at the level of round-off.
+	 */
+	SECTION("Mutual FMM conserves momentum") {
+		const int n = 1000;
+		FastMultipoleMethod mutual(0.6,1.0,0.01,TreeOptions{.bucket_size=8},true);
+		const double drift = get_momentum_drift(mutual,n,20,0.01);
+		REQUIRE(drift < 1.0e-12);
+		FastMultipoleMethod one_sided(0.6,1.0,0.01,TreeOptions{.bucket_size=8});
+		REQUIRE(get_momentum_drift(one_sided,n,20,0.01) > 1000*drift);
+	}
+}
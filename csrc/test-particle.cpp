@@ -34,5 +34,35 @@ TEST_CASE( "Particle Tests", "[particle]" ) {
 		REQUIRE(foo != bar);
 	}
 	
+	/**
+	 * A particle from the store reads and writes the store's arrays, which are aligned;
+	 * a copy is independent of the store, and moving the store keeps the particles valid.
+	 */
+	SECTION("Particle store") {
+		const int n = 11;
+		ParticleStore particles(n);
+		REQUIRE(particles.size() == n);
+		for (int i=0;i<n;i++)
+			particles[i].init(array{1.0*i,2.0*i,3.0*i},array{-1.0*i,0.0,0.0},0.5*i,i);
+		for (const auto & component : particles.get_positions())
+			REQUIRE(reinterpret_cast<uintptr_t>(component.data()) % ParticleArrays::Alignment == 0);
+		REQUIRE(particles.get_positions()[1][5] == 10.0);
+		REQUIRE(particles.get_velocities()[0][5] == -5.0);
+		REQUIRE(particles.get_masses()[5] == 2.5);
+		REQUIRE(particles.get_ids()[5] == 5);
+		particles.get_accelerations()[2][7] = 42.0;
+		REQUIRE(particles[7].get_acceleration()[2] == 42.0);
+		
+		Particle copy = particles[7];
+		copy.set_position(array{0.0,0.0,0.0});
+		REQUIRE(particles[7].get_position()[0] == 7.0);
+		REQUIRE(copy.get_acceleration()[2] == 42.0);
+		REQUIRE(copy == particles[7]);
+		
+		ParticleStore moved = std::move(particles);
+		moved[3].set_velocity(array{9.0,9.0,9.0});
+		REQUIRE(moved.get_velocities()[1][3] == 9.0);
+	}
+	
 
 }
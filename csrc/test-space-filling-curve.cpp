@@ -0,0 +1,146 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * This file exercises space-filling curves, and reordering particles along them.
+ */
+
+#include <cstdlib>
+#include <set>
+
+#include "catch.hpp"
+#include "acceleration.hpp"
+#include "configuration.hpp"
+#include "space-filling-curve.hpp"
+#include "test-utilities.hpp"
+
+using namespace std;
+
+/**
+ *  Used to record the IDs of particles in the order they are visited
+ */
+class IdRecorder : public Visitor<Particle> {
+  public:
+	vector<int> ids;
+
+	void visit(Particle & particle) {ids.push_back(particle.get_id());}
+};
+
+TEST_CASE( "Space Filling Curve Tests", "[space-filling-curve]" ) {
+
+	/**
+	 * Each cell of a small grid has its own key, and, along the Hilbert curve,
+	 * consecutive cells share a face, which is not true for Morton.
+	 */
+	SECTION("Keys are distinct, and Hilbert curve is continuous") {
+		const int bits = 3;
+		const uint32_t side = 1u << bits;
+		for (auto type : {SpaceFillingCurve::Morton,SpaceFillingCurve::Hilbert}) {
+			vector<array<uint32_t,NDIM>> cells(side*side*side);
+			for (uint32_t i=0;i<side;i++)
+				for (uint32_t j=0;j<side;j++)
+					for (uint32_t k=0;k<side;k++) {
+						const uint64_t key = SpaceFillingCurve::get_key(array{i,j,k},type,bits);
+						REQUIRE(key < cells.size());
+						cells[key] = array{i,j,k};
+					}
+			int max_step = 0;
+			for (size_t key=1;key<cells.size();key++) {
+				int step = 0;
+				for (int j=0;j<NDIM;j++)
+					step += abs((int)cells[key][j] - (int)cells[key-1][j]);
+				max_step = max(step,max_step);
+			}
+			if (type == SpaceFillingCurve::Hilbert)
+				REQUIRE(max_step == 1);
+			else
+				REQUIRE(max_step > 1);
+		}
+	}
+
+	/**
+	 * Reordering keeps the IDs and data of the particles, and Configuration
+	 * can still visit them in order of ID.
+	 */
+	SECTION("Reordering keeps identity of particles") {
+		const int n = 500;
+		ParticleStore original = create_clustered_particles(n);
+		vector<double> values(7*n);
+		for (int i=0;i<n;i++) {
+			const auto position = original[i].get_position();
+			const auto velocity = original[i].get_velocity();
+			values[7*i] = position[0];
+			values[7*i+1] = position[1];
+			values[7*i+2] = position[2];
+			values[7*i+3] = original[i].get_mass();
+			values[7*i+4] = velocity[0] + i;
+			values[7*i+5] = velocity[1];
+			values[7*i+6] = velocity[2];
+		}
+		Configuration configuration(n,values.data());
+		const auto type = GENERATE(SpaceFillingCurve::Morton,SpaceFillingCurve::Hilbert);
+		configuration.reorder(type);
+		ParticleStore & particles = configuration.get_particles();
+		REQUIRE(particles.get_n_reorders() == 1);
+		bool moved = false;
+		set<int> ids;
+		for (int i=0;i<n;i++) {
+			const int id = particles[i].get_id();
+			ids.insert(id);
+			moved = moved || id != i;
+			REQUIRE(particles[i].get_position() == original[id].get_position());
+			REQUIRE(particles[i].get_mass() == original[id].get_mass());
+			REQUIRE(particles[i].get_velocity()[0] == original[id].get_velocity()[0] + id);
+		}
+		REQUIRE(moved);
+		REQUIRE(ids.size() == n);
+		IdRecorder recorder;
+		configuration.iterate_by_id(recorder);
+		for (int i=0;i<n;i++)
+			REQUIRE(recorder.ids[i] == i);
+		const auto order = SpaceFillingCurve::get_order(particles,type);
+		for (int i=0;i<n;i++)
+			REQUIRE(order[i] == i);
+	}
+
+	/**
+	 * Accelerations don't depend on the order of the particles, except for rounding,
+	 * and a visitor that reuses its tree builds a new one once the particles have been reordered.
+	 */
+	SECTION("Accelerations follow particles when they are reordered") {
+		const int n = 2000;
+		const bool flat = GENERATE(false,true);
+		ParticleStore particles = create_clustered_particles(n);
+		const TreeOptions tree_options{.flat=flat,.bucket_size=8,.rebuild_interval=5,.refit=true,.max_escaped=1.0};
+		AccelerationVisitor visitor(make_unique<GeometricCriterion>(0.5),1.0,0.01,false,tree_options);
+		visitor.initialize(particles,n);
+		for (int i=0;i<n;i++)
+			visitor.visit(particles[i]);
+		vector<array<double,NDIM>> expected(n);
+		for (int i=0;i<n;i++)
+			expected[particles[i].get_id()] = particles[i].get_acceleration();
+
+		particles.permute(SpaceFillingCurve::get_order(particles,SpaceFillingCurve::Hilbert));
+		visitor.initialize(particles,n);
+		for (int i=0;i<n;i++)
+			visitor.visit(particles[i]);
+		for (int i=0;i<n;i++) {
+			const auto acceleration = particles[i].get_acceleration();
+			const auto & reference = expected[particles[i].get_id()];
+			for (int j=0;j<NDIM;j++)
+				REQUIRE_THAT(acceleration[j],Catch::Matchers::WithinAbs(reference[j],1.0e-9*(1+abs(reference[j]))));
+		}
+	}
+}
@@ -0,0 +1,152 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * This file exercises the thread pool.
+ */
+
+#include <atomic>
+#include <stdexcept>
+
+#include "catch.hpp"
+#include "thread-pool.hpp"
+
+using namespace std;
+
+TEST_CASE( "Thread Pool Tests", "[thread-pool]" ) {
+
+	/**
+	 * Each thread number is used once, and only the threads requested take part
+	 */
+	SECTION("Run uses each thread once") {
+		ThreadPool pool(8);
+		REQUIRE(pool.get_size() == 8);
+		for (int threads : {1,3,8})
+			for (int repeat=0;repeat<10;repeat++){
+				vector<atomic<int>> counts(8);
+				pool.run([&](int thread){counts[thread]++;},threads);
+				for (int thread=0;thread<8;thread++)
+					REQUIRE(counts[thread] == (thread < threads ? 1 : 0));
+			}
+	}
+
+	/**
+	 * Every index is visited exactly once, even if there are fewer indices than threads
+	 */
+	SECTION("Parallel for visits each index once") {
+		ThreadPool pool(4);
+		for (int n : {0,3,1001}) {
+			vector<int> counts(n,0);
+			pool.parallel_for(n,[&](int i){counts[i]++;});
+			for (int i=0;i<n;i++)
+				REQUIRE(counts[i] == 1);
+		}
+	}
+
+	/**
+	 * The partial results are combined in order, so a reduction that is not
+	 * commutative gives the same answer as a serial loop.
+	 */
+	SECTION("Parallel reduce combines in order") {
+		ThreadPool pool(5);
+		const int n = 1000;
+		const int sum = pool.parallel_reduce<int>(n,0,[](int i){return i;},[](int a,int b){return a+b;});
+		REQUIRE(sum == n*(n-1)/2);
+		const string digits = pool.parallel_reduce<string>(n,"",[](int i){return to_string(i%10);},
+														   [](string a,string b){return a+b;});
+		string expected;
+		for (int i=0;i<n;i++)
+			expected += to_string(i%10);
+		REQUIRE(digits == expected);
+	}
+
+	/**
+	 * No thread gets past a barrier until all threads have reached it
+	 */
+	SECTION("Barrier holds threads until all arrive") {
+		const int threads = 6;
+		ThreadPool pool(threads);
+		atomic<int> arrived = 0;
+		vector<int> seen(threads*3,0);
+		pool.run([&](int thread){
+			for (int phase=0;phase<3;phase++) {
+				arrived++;
+				pool.barrier();
+				seen[phase*threads + thread] = arrived;
+				pool.barrier();
+			}
+		});
+		for (int phase=0;phase<3;phase++)
+			for (int thread=0;thread<threads;thread++)
+				REQUIRE(seen[phase*threads + thread] == (phase+1)*threads);
+	}
+
+	/**
+	 * The shared pool grows if more threads are needed, and tasks can't be nested
+	 */
+	SECTION("Shared pool") {
+		ThreadPool & pool = ThreadPool::get_instance(2);
+		REQUIRE(pool.get_size() >= 2);
+		REQUIRE(ThreadPool::get_instance(9).get_size() >= 9);
+		REQUIRE_FALSE(ThreadPool::is_in_task());
+		bool nested = false;
+		ThreadPool::get_instance(2).run([&](int thread){
+			if (thread == 0)
+				nested = ThreadPool::is_in_task();
+		},2);
+		REQUIRE(nested);
+		REQUIRE_THROWS_AS(ThreadPool::get_instance(2).run([&](int thread){
+								if (thread == 0) ThreadPool::get_instance(2).run([](int){;},2);
+							},2),logic_error);
+		vector<int> counts(3,0);
+		ThreadPool::get_instance(2).run([&](int thread){
+			if (thread == 0) ThreadPool::run_in_parallel(3,[&](int inner){counts[inner]++;});
+		},2);
+		REQUIRE(counts == vector<int>{1,1,1});
+	}
+
+	/**
+	 * An exception thrown by any thread is rethrown to the caller, once all threads
+	 * have finished, and the pool can still be used afterwards
+	 */
+	SECTION("Exceptions are rethrown") {
+		ThreadPool pool(4);
+		for (int thrower : {0,3}) {
+			atomic<int> finished = 0;
+			REQUIRE_THROWS_AS(pool.run([&](int thread){
+									if (thread == thrower) throw runtime_error("failed");
+									finished++;
+								}),runtime_error);
+			REQUIRE(finished == 3);
+		}
+		vector<atomic<int>> counts(4);
+		pool.run([&](int thread){counts[thread]++;});
+		for (int thread=0;thread<4;thread++)
+			REQUIRE(counts[thread] == 1);
+		REQUIRE_THROWS_AS(ThreadPool::get_instance(2).run([&](int thread){
+								if (thread == 0)
+									ThreadPool::run_in_parallel(3,[](int inner){if (inner == 2) throw runtime_error("failed");});
+							},2),runtime_error);
+	}
+
+	/**
+	 * Placement options don't change the results
+	 */
+	SECTION("Pinned threads") {
+		ThreadPool pool(4,true,GENERATE(false,true));
+		const int sum = pool.parallel_reduce<int>(100,0,[](int i){return i;},[](int a,int b){return a+b;});
+		REQUIRE(sum == 4950);
+	}
+}
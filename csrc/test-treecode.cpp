@@ -17,10 +17,83 @@
  * This file exercises treecode. 
  */
  
+#include <cmath>
+#include <stdexcept>
+#include <vector>
 #include "catch.hpp"
+#include "center-of-mass.hpp"
 #include "treecode.hpp"
+#include "test-utilities.hpp"
 
 using namespace std;
+using namespace Catch::Matchers;
+
+/**
+ *  Used to compare trees: records type, size, particle, and number of particles
+ *  in bucket for each node, depth first.
+ */
+class TreeRecorder : public Node::Visitor {
+  public:
+	vector<tuple<int,double,int>> nodes;
+	
+	Node::Visitor::Status visit_internal(Node * node) {
+		nodes.push_back(make_tuple(node->get_index(),node->get_side(),0));
+		return Node::Visitor::Status::Continue;
+	}
+	
+	Node::Visitor::Status visit_external(Node * node) {
+		nodes.push_back(make_tuple(node->get_index(),node->get_side(),node->get_particles().size()));
+		return Node::Visitor::Status::Continue;
+	}
+};
+
+/**
+ *  Used to compare moments: records mass and centre of mass for each node, depth first.
+ */
+class MomentRecorder : public Node::Visitor {
+  public:
+	vector<tuple<double,array<double,NDIM>>> moments;
+	
+	Node::Visitor::Status visit_internal(Node * node) {
+		moments.push_back(make_tuple(node->get_mass(),node->get_centre_of_mass()));
+		return Node::Visitor::Status::Continue;
+	}
+	
+	Node::Visitor::Status visit_external(Node * node) {
+		moments.push_back(make_tuple(node->get_mass(),node->get_centre_of_mass()));
+		return Node::Visitor::Status::Continue;
+	}
+};
+
+/**
+ *  Build a tree and record its structure
+ *
+ *  Returns:
+ *     Number of nodes, and type, size, and bucket size of each node
+ */
+tuple<int,vector<tuple<int,double,int>>> record_tree(ParticleStore & particles, const int n, const TreeOptions & options){
+	TreeRecorder recorder;
+	const int count = Node::get_count();
+	unique_ptr<Node> tree = Node::create(particles,n,true,1.0e-4,options);
+	tree->traverse(recorder);
+	return make_tuple(Node::get_count() - count,recorder.nodes);
+}
+
+/**
+ *  Verify that create() builds the same tree as create_by_insertion()
+ */
+void require_same_tree(ParticleStore & particles, const int n){
+	TreeRecorder sorted, inserted;
+	const int count = Node::get_count();
+	unique_ptr<Node> tree1 = Node::create(particles,n,true);
+	const int count1 = Node::get_count() - count;
+	tree1->traverse(sorted);
+	unique_ptr<Node> tree2 = Node::create_by_insertion(particles,n,true);
+	const int count2 = Node::get_count() - count - count1;
+	tree2->traverse(inserted);
+	REQUIRE(count1 == count2);
+	REQUIRE(sorted.nodes == inserted.nodes);
+}
 
 const double offset=1.0/1024.0;
 TEST_CASE( "Tree Tests", "[tree]" ) {
@@ -31,15 +104,15 @@ TEST_CASE( "Tree Tests", "[tree]" ) {
 	 *      Head (Internal Node)
 	 *        External Node
 	 *        External Node
-	 *        8 * Unused Node
+	 * Only occupied octants have children, so there are no Unused nodes.
 	 */
 	SECTION("Trivial Tree Insert") {
-		unique_ptr<Particle[]> particles = make_unique<Particle[]>(2);
+		ParticleStore particles = ParticleStore(2);
 		auto n = 0;
 		particles[n++].init(array{-1.0,-1.0,-1.0},array{0.0,0.0,0.0},1.0,0);
 		particles[n++].init(array{-1.0,-1.0,+1.0},array{0.0,0.0,0.0},1.0,1);
 		unique_ptr<Node> tree = Node::create(particles,n,true);
-		REQUIRE(Node::get_count() == Node::N_Children+1);
+		REQUIRE(Node::get_count() == 1+n);
 	}
 	
 	/**
@@ -56,39 +129,32 @@ TEST_CASE( "Tree Tests", "[tree]" ) {
 	 *        					Internal Node       [0.5,0.5315]
 	 *        						External Node       [0.5,0.515625]
 	 *        						External Node       [0.51562,0.5315]
-	 *                              6 * Unused Node
-	 *                          7 * Unused Node
-	 *                    	7 * Unused Node
-	 *                  7 * Unused Node
-	 *              7 * Unused Node
-	 *          7 * Unused Node
-	 *        5 * Unused Node
 	 */
 	SECTION("Insert two nodes that are close enough to force a second level") {
-		unique_ptr<Particle[]> particles = make_unique<Particle[]>(4);
+		ParticleStore particles = ParticleStore(4);
 		auto n = 0;
 		particles[n++].init(array{-1.0,-1.0,-1.0},array{0.0,0.0,0.0},1.0,0);
 		particles[n++].init(array{+1.0,+1.0,+1.0},array{0.0,0.0,0.0},1.0,1);
 		particles[n++].init(array{-1.0,-1.0,0.5 + offset},array{0.0,0.0,0.0},1.0,2);
 		particles[n++].init(array{-1.0,-1.0,0.525 + offset},array{0.0,0.0,0.0},1.0,3);
 		unique_ptr<Node> tree = Node::create(particles,n,true);
-		REQUIRE(Node::get_count() == 7*Node::N_Children+1);
+		REQUIRE(Node::get_count() == 7+n);
 	}
 	
 	
 	SECTION("Insert two nodes that are close enough to force a second level") {
-		unique_ptr<Particle[]> particles = make_unique<Particle[]>(4);
+		ParticleStore particles = ParticleStore(4);
 		auto n = 0;
 		particles[n++].init(array{-1.0,-1.0,-1.0},array{0.0,0.0,0.0},1.0,0);
 		particles[n++].init(array{-1.0,-1.0,+1.0},array{0.0,0.0,0.0},1.0,1);
 		particles[n++].init(array{-1.0,-1.0,0.5 + offset},array{0.0,0.0,0.0},1.0,2);
 		particles[n++].init(array{-1.0,-1.0,0.50625 + offset},array{0.0,0.0,0.0},1.0,3);
 		unique_ptr<Node> tree = Node::create(particles,n,true);
-		REQUIRE(Node::get_count() == 9*Node::N_Children+1);
+		REQUIRE(Node::get_count() == 9+n);
 	}
 	
 	SECTION("Larger Tree Insert") {
-		unique_ptr<Particle[]> particles = make_unique<Particle[]>(8);
+		ParticleStore particles = ParticleStore(8);
 		auto n = 0;
 		particles[n++].init(array{-1.0,-1.0,-1.0},array{0.0,0.0,0.0},1.0,0);
 		particles[n++].init(array{-1.0,-1.0,+1.0},array{0.0,0.0,0.0},1.0,0);
@@ -99,11 +165,11 @@ TEST_CASE( "Tree Tests", "[tree]" ) {
 		particles[n++].init(array{+1.0,+1.0,-1.0},array{0.0,0.0,0.0},1.0,0);
 		particles[n++].init(array{+1.0,+1.0,+1.0},array{0.0,0.0,0.0},1.0,0);
 		unique_ptr<Node> tree = Node::create(particles,n,true);
-		REQUIRE(Node::get_count() == Node::N_Children+1);
+		REQUIRE(Node::get_count() == 1+n);
 	}
 	
 	SECTION("2nd layer Tree Insert") {
-		unique_ptr<Particle[]> particles = make_unique<Particle[]>(9);
+		ParticleStore particles = ParticleStore(9);
 		auto n = 0;
 		particles[n++].init(array{-1.0,-1.0,-1.0},array{0.0,0.0,0.0},1.0,0);
 		particles[n++].init(array{-1.0,-1.0,+1.0},array{0.0,0.0,0.0},1.0,0);
@@ -115,11 +181,11 @@ TEST_CASE( "Tree Tests", "[tree]" ) {
 		particles[n++].init(array{+1.0,+1.0,+1.0},array{0.0,0.0,0.0},1.0,0);
 		particles[n++].init(array{+0.2, +0.2, +1.0},array{0.0,0.0,0.0},1.0,0);
 		unique_ptr<Node> tree = Node::create(particles,n,true);
-		REQUIRE(Node::get_count() == 2*Node::N_Children+1);
+		REQUIRE(Node::get_count() == 2+n);
 	}
 	
 	SECTION("3rd layer Tree Insert: https://www.cs.princeton.edu/courses/archive/fall03/cs126/assignments/barnes-hut.html") {
-		unique_ptr<Particle[]> particles = make_unique<Particle[]>(8);
+		ParticleStore particles = ParticleStore(8);
 		auto n = 0;
 		particles[n++].init(array{-2.0,2.0,0.0},array{0.0,0.0,0.0},1.0,0);
 		particles[n++].init(array{1.5,3.5,0.0},array{0.0,0.0,0.0},1.0,0);
@@ -130,7 +196,556 @@ TEST_CASE( "Tree Tests", "[tree]" ) {
 		particles[n++].init(array{-1.0,-3.0,0.0},array{0.0,0.0,0.0},1.0,0);
 		particles[n++].init(array{2.0,-2.0,0.0},array{0.0,0.0,0.0},1.0,0);
 		unique_ptr<Node> tree = Node::create(particles,n,true);
-		REQUIRE(Node::get_count() == 4*Node::N_Children+1);
+		REQUIRE(Node::get_count() == 4+n);
+	}
+	REQUIRE(Node::get_count() == 0);
+}
+
+/**
+ *  Used to count calls made by Node::traverse; it stops at any
+ *  internal node smaller than stop_side.
+ */
+class CountingVisitor : public Node::Visitor {
+  public:
+	const double stop_side;
+	int n_internal = 0;
+	int n_external = 0;
+	int n_accumulate = 0;
+	int n_depart = 0;
+
+	CountingVisitor(const double stop_side) : stop_side(stop_side) {;}
+
+	Status visit_internal(Node * node) {
+		n_internal++;
+		return node->get_side() < stop_side ? Status::DontDescend : Status::Continue;
+	}
+
+	Status visit_external(Node * node) {
+		n_external++;
+		return Status::Continue;
+	}
+
+	void accumulate(Node * node,Node * child) {n_accumulate++;}
+
+	void depart(Node * node) {n_depart++;}
+};
+
+TEST_CASE( "Traversal Tests", "[tree]" ) {
+	REQUIRE(Node::get_count() == 0);
+	
+	SECTION("Traverse visits every node") {
+		const int n = 1000;
+		ParticleStore particles = create_random_particles(n);
+		unique_ptr<Node> tree = Node::create(particles,n);
+		CountingVisitor visitor(0.0);
+		tree->traverse(visitor);
+		REQUIRE(visitor.n_external == n);
+		REQUIRE(visitor.n_depart == visitor.n_internal);
+		REQUIRE(visitor.n_accumulate == visitor.n_internal + visitor.n_external - 1);
+	}
+	
+	/**
+	 * If visit_internal() returns DontDescend, the children of the node are
+	 * neither visited nor accumulated, and the node isn't departed.
+	 */
+	SECTION("Traverse does not descend below a node when told not to") {
+		const int n = 1000;
+		ParticleStore particles = create_random_particles(n);
+		unique_ptr<Node> tree = Node::create(particles,n);
+		CountingVisitor visitor(2*tree->get_side());
+		tree->traverse(visitor);
+		REQUIRE(visitor.n_internal == 1);
+		REQUIRE(visitor.n_external == 0);
+		REQUIRE(visitor.n_accumulate == 0);
+		REQUIRE(visitor.n_depart == 0);
+	}
+	REQUIRE(Node::get_count() == 0);
+}
+
+TEST_CASE( "Sorted Build Tests", "[tree]" ) {
+	REQUIRE(Node::get_count() == 0);
+	
+	SECTION("Random particles") {
+		const int n = 1000;
+		ParticleStore particles = create_random_particles(n);
+		require_same_tree(particles,n);
+	}
+	
+	SECTION("Single particle") {
+		ParticleStore particles = create_random_particles(1);
+		require_same_tree(particles,1);
+		unique_ptr<Node> tree = Node::create(particles,1,true);
+		REQUIRE(tree->get_index() == 0);
+	}
+	
+	/**
+	 * Every node that has been allocated is either Internal or External
+	 */
+	SECTION("Only occupied octants have children") {
+		const int n = 1000;
+		ParticleStore particles = create_clustered_particles(n,17);
+		auto [count,nodes] = record_tree(particles,n,TreeOptions());
+		REQUIRE(count == static_cast<int>(nodes.size()));
+		for (auto [index,side,bucket_size] : nodes)
+			REQUIRE(index != Node::Unused);
+	}
+	REQUIRE(Node::get_count() == 0);
+}
+
+TEST_CASE( "Parallel Build Tests", "[tree]" ) {
+	REQUIRE(Node::get_count() == 0);
+	
+	SECTION("Parallel build gives same tree as serial build, for any number of threads") {
+		const int n = 10000;
+		for (int clustered=0;clustered<2;clustered++){
+			ParticleStore particles = clustered ? create_clustered_particles(n) : create_random_particles(n);
+			auto [count,nodes] = record_tree(particles,n,TreeOptions());
+			for (int threads : {2,3,8,64}){
+				auto [parallel_count,parallel_nodes] = record_tree(particles,n,TreeOptions{.threads=threads});
+				REQUIRE(parallel_count == count);
+				REQUIRE(parallel_nodes == nodes);
+			}
+		}
+	}
+	
+	SECTION("Parallel build with fewer particles than threads") {
+		const int n = 3;
+		ParticleStore particles = create_random_particles(n);
+		auto [count,nodes] = record_tree(particles,n,TreeOptions());
+		auto [parallel_count,parallel_nodes] = record_tree(particles,n,TreeOptions{.threads=8});
+		REQUIRE(parallel_count == count);
+		REQUIRE(parallel_nodes == nodes);
+	}
+	REQUIRE(Node::get_count() == 0);
+}
+
+/**
+ * Moments calculated during the build must be identical to those from 
+ * a separate pass with CentreOfMassCalculator, for serial and parallel builds.
+ * The build also verifies them, as verify is set.
+ */
+TEST_CASE( "Fused Moments Tests", "[tree]" ) {
+	REQUIRE(Node::get_count() == 0);
+	
+	SECTION("Fused moments match two pass moments") {
+		const int n = 5000;
+		const int threads = GENERATE(1,4);
+		const int bucket_size = GENERATE(1,8);
+		ParticleStore particles = create_clustered_particles(n);
+		unique_ptr<Node> tree = Node::create(particles,n,true,1.0e-4,
+											 TreeOptions{.threads=threads,.bucket_size=bucket_size,.fused_moments=true});
+		MomentRecorder fused;
+		tree->traverse(fused);
+		CentreOfMassCalculator calculator(particles);
+		tree->traverse(calculator);
+		MomentRecorder two_pass;
+		tree->traverse(two_pass);
+		REQUIRE(fused.moments.size() == two_pass.moments.size());
+		REQUIRE(fused.moments == two_pass.moments);
+	}
+	
+	SECTION("Parallel moment pass matches serial pass") {
+		const int n = 5000;
+		const int threads = GENERATE(2,3,8);
+		const int bucket_size = GENERATE(1,8);
+		ParticleStore particles = create_clustered_particles(n);
+		unique_ptr<Node> serial_tree = Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=bucket_size});
+		unique_ptr<Node> parallel_tree = Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=bucket_size});
+		move_particles(particles,n,0.05);
+		CentreOfMassCalculator serial(particles);
+		serial_tree->traverse(serial);
+		MomentRecorder serial_moments;
+		serial_tree->traverse(serial_moments);
+		CentreOfMassCalculator parallel(particles);
+		parallel.calculate(parallel_tree.get(),threads);
+		MomentRecorder parallel_moments;
+		parallel_tree->traverse(parallel_moments);
+		REQUIRE(parallel_moments.moments == serial_moments.moments);
+		REQUIRE(parallel.get_n_escaped() == serial.get_n_escaped());
+	}
+	
+	/**
+	 * The quadrupole of the root, accumulated up the tree with the parallel axis theorem,
+	 * must agree with the sum over particles about the centre of mass.
+	 */
+	SECTION("Quadrupole moment of root agrees with direct sum") {
+		const int n = 2000;
+		const int threads = GENERATE(1,4);
+		const bool fused = GENERATE(false,true);
+		ParticleStore particles = create_clustered_particles(n);
+		const TreeOptions options{.threads=threads,.bucket_size=8,.fused_moments=fused,.quadrupole=true};
+		unique_ptr<Node> tree = Node::create(particles,n,true,1.0e-4,options);
+		if (!fused) {
+			CentreOfMassCalculator calculator(particles,true);
+			calculator.calculate(tree.get(),threads);
+		}
+		const auto X = tree->get_centre_of_mass();
+		Quadrupole expected = {0.0,0.0,0.0,0.0,0.0,0.0};
+		for (int k=0;k<n;k++){
+			array<double,NDIM> d;
+			for (int i=0;i<NDIM;i++)
+				d[i] = particles[k].get_position()[i] - X[i];
+			const double dsq = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+			for (int i=0;i<NDIM;i++)
+				for (int j=0;j<NDIM;j++)
+					if (j >= i)
+						expected[get_quadrupole_index(i,j)] += particles[k].get_mass()*(3*d[i]*d[j] - (i==j ? dsq : 0.0));
+		}
+		const auto Q = tree->get_quadrupole();
+		REQUIRE_THAT(Q[0] + Q[1] + Q[2],WithinAbs(0.0,1.0e-9));
+		for (int i=0;i<static_cast<int>(Q.size());i++)
+			REQUIRE_THAT(Q[i],WithinAbs(expected[i],1.0e-9));
+	}
+	
+	SECTION("Fused moments for a single particle") {
+		ParticleStore particles = create_random_particles(1);
+		unique_ptr<Node> tree = Node::create(particles,1,true,1.0e-4,TreeOptions{.fused_moments=true});
+		REQUIRE(tree->get_mass() == particles[0].get_mass());
+		REQUIRE(tree->get_centre_of_mass() == particles[0].get_position());
+	}
+	REQUIRE(Node::get_count() == 0);
+}
+
+/**
+ *  Used to check tight bounding boxes: each box must lie within the node's cube,
+ *  and contain the particles in the node's bucket and the boxes of its children.
+ */
+class BoundsChecker : public Node::Visitor {
+  private:
+	ParticleStore & _particles;
+	
+	vector<tuple<array<double,NDIM>,array<double,NDIM>>> _parents;
+	
+  public:
+	BoundsChecker(ParticleStore & particles) : _particles(particles) {}
+	
+	Node::Visitor::Status visit_internal(Node * node) {
+		_check(node);
+		_parents.push_back(node->get_bounds());
+		return Node::Visitor::Status::Continue;
+	}
+	
+	Node::Visitor::Status visit_external(Node * node) {
+		_check(node);
+		auto [Bmin,Bmax] = node->get_bounds();
+		for (int index : node->get_particles())
+			for (int i=0;i<NDIM;i++){
+				REQUIRE(Bmin[i] <= _particles[index].get_position()[i]);
+				REQUIRE(_particles[index].get_position()[i] <= Bmax[i]);
+			}
+		return Node::Visitor::Status::Continue;
+	}
+	
+	void depart(Node * node) {_parents.pop_back();}
+	
+  private:
+	void _check(Node * node) {
+		auto [Bmin,Bmax] = node->get_bounds();
+		REQUIRE(node->contains(Bmin));
+		REQUIRE(node->contains(Bmax));
+		for (int i=0;i<NDIM;i++){
+			REQUIRE(Bmin[i] <= node->get_centre_of_mass()[i] + 1.0e-12);
+			REQUIRE(node->get_centre_of_mass()[i] <= Bmax[i] + 1.0e-12);
+			if (!_parents.empty()){
+				REQUIRE(get<0>(_parents.back())[i] <= Bmin[i]);
+				REQUIRE(Bmax[i] <= get<1>(_parents.back())[i]);
+			}
+		}
+		REQUIRE(node->get_tight_side() <= node->get_side());
+	}
+};
+
+TEST_CASE( "Bounding Box Tests", "[tree]" ) {
+	REQUIRE(Node::get_count() == 0);
+	
+	SECTION("Tight bounding boxes are nested, and contain their particles") {
+		const int n = 5000;
+		const int threads = GENERATE(1,4);
+		const bool fused = GENERATE(false,true);
+		ParticleStore particles = create_clustered_particles(n);
+		const TreeOptions options{.threads=threads,.bucket_size=8,.fused_moments=fused,.tight_bounds=true};
+		unique_ptr<Node> tree = Node::create(particles,n,true,1.0e-4,options);
+		if (!fused) {
+			CentreOfMassCalculator calculator(particles,false,true);
+			calculator.calculate(tree.get(),threads);
+		}
+		BoundsChecker checker(particles);
+		tree->traverse(checker);
+		
+		array<double,NDIM> Bmin = particles[0].get_position();
+		array<double,NDIM> Bmax = particles[0].get_position();
+		for (int k=1;k<n;k++)
+			for (int i=0;i<NDIM;i++){
+				Bmin[i] = min(Bmin[i],particles[k].get_position()[i]);
+				Bmax[i] = max(Bmax[i],particles[k].get_position()[i]);
+			}
+		REQUIRE(tree->get_bounds() == make_tuple(Bmin,Bmax));
+	}
+	
+	SECTION("Bounding box of a single particle has no size") {
+		ParticleStore particles = create_random_particles(1);
+		unique_ptr<Node> tree = Node::create(particles,1,true,1.0e-4,TreeOptions{.fused_moments=true,.tight_bounds=true});
+		REQUIRE(tree->get_tight_side() == 0);
+		REQUIRE(tree->get_tight_bmax_sq() == 0);
+	}
+	REQUIRE(Node::get_count() == 0);
+}
+
+TEST_CASE( "Bucket Tests", "[tree]" ) {
+	REQUIRE(Node::get_count() == 0);
+	
+	SECTION("Buckets are no larger than bucket size, and every particle is in one") {
+		const int n = 10000;
+		ParticleStore particles = create_clustered_particles(n);
+		auto [count,nodes] = record_tree(particles,n,TreeOptions());
+		for (int bucket_size : {4,16}){
+			auto [bucket_count,bucket_nodes] = record_tree(particles,n,TreeOptions{.bucket_size=bucket_size});
+			int n_particles = 0;
+			for (auto [index,side,n_bucket] : bucket_nodes){
+				REQUIRE(n_bucket <= bucket_size);
+				n_particles += n_bucket;
+			}
+			REQUIRE(n_particles == n);
+			REQUIRE(bucket_count < count);
+		}
+	}
+	
+	SECTION("Parallel build gives same tree as serial build with buckets") {
+		const int n = 10000;
+		ParticleStore particles = create_clustered_particles(n);
+		auto [count,nodes] = record_tree(particles,n,TreeOptions{.bucket_size=8});
+		for (int threads : {3,8}){
+			auto [parallel_count,parallel_nodes] = record_tree(particles,n,TreeOptions{.threads=threads,.bucket_size=8});
+			REQUIRE(parallel_count == count);
+			REQUIRE(parallel_nodes == nodes);
+		}
+	}
+	
+	/**
+	 * Particles are too close to be separated by Morton key, or coincide, so 
+	 * they have to share a bucket at the maximum depth.
+	 */
+	SECTION("Particles closer than resolution of Morton key share a bucket") {
+		const int n = 100;
+		ParticleStore particles = create_random_particles(n);
+		particles[n-1].init(array{0.5,0.5,0.5},array{0.0,0.0,0.0},1.0,n-1);
+		particles[n-2].init(array{0.5,0.5,0.5 + 1.0e-9},array{0.0,0.0,0.0},1.0,n-2);
+		particles[n-3].init(array{0.5,0.5 + 1.0e-9,0.5},array{0.0,0.0,0.0},1.0,n-3);
+		particles[n-4].init(array{0.5,0.5,0.5},array{0.0,0.0,0.0},1.0,n-4);
+		for (int threads : {1,4}) {
+			auto [count,nodes] = record_tree(particles,n,TreeOptions{.threads=threads});
+			const double root_side = get<1>(nodes.front());
+			int n_shared = 0;
+			for (auto [index,side,n_bucket] : nodes)
+				if (n_bucket > 1) {
+					n_shared++;
+					REQUIRE(n_bucket == 4);
+					REQUIRE_THAT(side,WithinRel(ldexp(root_side,-Node::N_Levels),1.0e-6));
+				}
+			REQUIRE(n_shared == 1);
+		}
+	}
+	
+	SECTION("Tree is no deeper than maximum depth") {
+		const int n = 10000;
+		const int max_depth = 3;
+		ParticleStore particles = create_clustered_particles(n);
+		auto [count,nodes] = record_tree(particles,n,TreeOptions{.max_depth=max_depth});
+		const double root_side = get<1>(nodes.front());
+		for (auto [index,side,n_bucket] : nodes){
+			REQUIRE(side >= ldexp(root_side,-max_depth)*(1 - 1.0e-6));
+			if (n_bucket > 1)
+				REQUIRE_THAT(side,WithinRel(ldexp(root_side,-max_depth),1.0e-6));
+		}
+	}
+	
+	SECTION("Invalid options are rejected") {
+		const int n = 100;
+		ParticleStore particles = create_random_particles(n);
+		REQUIRE_THROWS_AS(Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=0}),logic_error);
+		REQUIRE_THROWS_AS(Node::create(particles,n,false,1.0e-4,TreeOptions{.max_depth=Node::N_Levels+1}),logic_error);
+	}
+	REQUIRE(Node::get_count() == 0);
+}
+
+TEST_CASE( "Update Tests", "[tree]" ) {
+	REQUIRE(Node::get_count() == 0);
+	
+	/**
+	 * Particles drift for several steps; after each step the updated tree must 
+	 * contain each particle once, with no empty nodes, and with buckets no larger
+	 * than bucket size. The centre of mass must agree with a tree built from scratch.
+	 * The root is padded so particles don't drift out of it.
+	 */
+	SECTION("Updated tree is equivalent to new tree") {
+		const int n = 2000;
+		const int bucket_size = GENERATE(1,8);
+		const TreeOptions options{.bucket_size=bucket_size};
+		ParticleStore particles = create_clustered_particles(n);
+		shared_ptr<NodeArena> arena = make_shared<NodeArena>();
+		unique_ptr<Node> tree = Node::create(particles,n,true,0.1,options,arena);
+		for (int step=0;step<5;step++){
+			move_particles(particles,n,0.05,step);
+			REQUIRE(tree->update(particles,n,options,*arena,true));
+			REQUIRE(Node::get_count() == arena->size() + 1);
+			TreeRecorder recorder;
+			tree->traverse(recorder);
+			REQUIRE(static_cast<int>(recorder.nodes.size()) == arena->size() + 1);
+			for (auto [index,side,n_bucket] : recorder.nodes){
+				REQUIRE(index != Node::Unused);
+				REQUIRE(n_bucket <= bucket_size);
+			}
+			
+			CentreOfMassCalculator calculator(particles);
+			tree->traverse(calculator);
+			unique_ptr<Node> new_tree = Node::create(particles,n,false,1.0e-4,options);
+			new_tree->traverse(calculator);
+			REQUIRE_THAT(tree->get_mass(),WithinRel(new_tree->get_mass(),1.0e-12));
+			for (int i=0;i<NDIM;i++)
+				REQUIRE_THAT(tree->get_centre_of_mass()[i],WithinAbs(new_tree->get_centre_of_mass()[i],1.0e-12));
+		}
+	}
+	
+	SECTION("Tree has to be rebuilt if a particle leaves the root") {
+		const int n = 100;
+		ParticleStore particles = create_random_particles(n);
+		shared_ptr<NodeArena> arena = make_shared<NodeArena>();
+		unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,TreeOptions(),arena);
+		array<double,NDIM> outside = {2.0,0.0,0.0};
+		particles[0].set_position(outside);
+		REQUIRE_FALSE(tree->update(particles,n,TreeOptions(),*arena));
+	}
+	
+	/**
+	 * A particle that moves onto another can't be separated from it, so 
+	 * they share a bucket at maximum depth.
+	 */
+	SECTION("Particle moves onto another") {
+		const int n = 100;
+		ParticleStore particles = create_random_particles(n);
+		shared_ptr<NodeArena> arena = make_shared<NodeArena>();
+		unique_ptr<Node> tree = Node::create(particles,n,true,1.0e-4,TreeOptions(),arena);
+		particles[0].set_position(particles[1].get_position());
+		REQUIRE(tree->update(particles,n,TreeOptions(),*arena,true));
+		TreeRecorder recorder;
+		tree->traverse(recorder);
+		const double root_side = get<1>(recorder.nodes.front());
+		int n_shared = 0;
+		for (auto [index,side,n_bucket] : recorder.nodes)
+			if (n_bucket > 1) {
+				n_shared++;
+				REQUIRE_THAT(side,WithinRel(ldexp(root_side,-Node::N_Levels),1.0e-6));
+			}
+		REQUIRE(n_shared == 1);
+	}
+	
+	SECTION("All particles leave a subtree") {
+		const int n = 100;
+		ParticleStore particles = create_random_particles(n);
+		shared_ptr<NodeArena> arena = make_shared<NodeArena>();
+		unique_ptr<Node> tree = Node::create(particles,n,true,1.0e-4,TreeOptions{.bucket_size=4},arena);
+		for (int i=0;i<n;i++){
+			array<double,NDIM> position = particles[i].get_position();
+			position[0] = -abs(position[0]);
+			particles[i].set_position(position);
+		}
+		REQUIRE(tree->update(particles,n,TreeOptions{.bucket_size=4},*arena,true));
+		REQUIRE(Node::get_count() == arena->size() + 1);
+		TreeRecorder recorder;
+		tree->traverse(recorder);
+		REQUIRE(static_cast<int>(recorder.nodes.size()) == arena->size() + 1);
+	}
+	REQUIRE(Node::get_count() == 0);
+}
+
+TEST_CASE( "Refit Tests", "[tree]" ) {
+	REQUIRE(Node::get_count() == 0);
+	
+	SECTION("No particles escape from a new tree") {
+		const int n = 1000;
+		ParticleStore particles = create_clustered_particles(n);
+		unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,TreeOptions{.bucket_size=8});
+		CentreOfMassCalculator calculator(particles);
+		tree->traverse(calculator);
+		REQUIRE(calculator.get_n_escaped() == 0);
+	}
+	
+	SECTION("Particle that moves to another leaf has escaped") {
+		const int n = 100;
+		ParticleStore particles = create_random_particles(n);
+		unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,TreeOptions());
+		particles[0].set_position(particles[1].get_position());
+		CentreOfMassCalculator calculator(particles);
+		tree->traverse(calculator);
+		REQUIRE(calculator.get_n_escaped() == 1);
+	}
+	
+	/**
+	 * Refitting keeps the topology, so moments are stale only in the sense that
+	 * the cubes no longer bound the particles: the total mass and centre of mass
+	 * must agree with a tree built from scratch.
+	 */
+	SECTION("Refitted tree has same centre of mass as new tree") {
+		const int n = 2000;
+		const int bucket_size = GENERATE(1,8);
+		const TreeOptions options{.bucket_size=bucket_size};
+		ParticleStore particles = create_clustered_particles(n);
+		unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,options);
+		for (int step=0;step<3;step++){
+			move_particles(particles,n,0.05,step);
+			CentreOfMassCalculator calculator(particles);
+			tree->traverse(calculator);
+			REQUIRE(calculator.get_n_escaped() > 0);
+			unique_ptr<Node> new_tree = Node::create(particles,n,false,1.0e-4,options);
+			CentreOfMassCalculator new_calculator(particles);
+			new_tree->traverse(new_calculator);
+			REQUIRE(new_calculator.get_n_escaped() == 0);
+			REQUIRE_THAT(tree->get_mass(),WithinRel(new_tree->get_mass(),1.0e-12));
+			for (int i=0;i<NDIM;i++)
+				REQUIRE_THAT(tree->get_centre_of_mass()[i],WithinAbs(new_tree->get_centre_of_mass()[i],1.0e-12));
+		}
+	}
+	REQUIRE(Node::get_count() == 0);
+}
+
+TEST_CASE( "Arena Tests", "[tree]" ) {
+	REQUIRE(Node::get_count() == 0);
+	
+	SECTION("Arena is reused for next tree") {
+		const int n = 10000;
+		ParticleStore particles = create_random_particles(n);
+		shared_ptr<NodeArena> arena = make_shared<NodeArena>();
+		unique_ptr<Node> tree = Node::create(particles,n,true,1.0e-4,TreeOptions(),arena);
+		const int size = arena->size();
+		const int capacity = arena->capacity();
+		REQUIRE(Node::get_count() == size + 1);
+		REQUIRE(size <= capacity);
+		tree.reset();
+		REQUIRE(Node::get_count() == 0);
+		REQUIRE(arena->size() == 0);
+		REQUIRE(arena->capacity() == capacity);
+		tree = Node::create(particles,n,true,1.0e-4,TreeOptions(),arena);
+		REQUIRE(arena->size() == size);
+		REQUIRE(arena->capacity() == capacity);
+	}
+	
+	SECTION("Arena is reused for parallel build") {
+		const int n = 10000;
+		ParticleStore particles = create_clustered_particles(n);
+		shared_ptr<NodeArena> arena = make_shared<NodeArena>();
+		for (int i=0;i<3;i++){
+			unique_ptr<Node> tree = Node::create(particles,n,true,1.0e-4,TreeOptions{.threads=4},arena);
+			REQUIRE(Node::get_count() == arena->size() + 1);
+		}
+		REQUIRE(Node::get_count() == 0);
+	}
+	
+	SECTION("Arena can only be used by one tree at a time") {
+		const int n = 100;
+		ParticleStore particles = create_random_particles(n);
+		shared_ptr<NodeArena> arena = make_shared<NodeArena>();
+		unique_ptr<Node> tree = Node::create(particles,n,false,1.0e-4,TreeOptions(),arena);
+		REQUIRE_THROWS_AS(Node::create(particles,n,false,1.0e-4,TreeOptions(),arena),logic_error);
 	}
 	REQUIRE(Node::get_count() == 0);
 }
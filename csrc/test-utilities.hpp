@@ -0,0 +1,155 @@
+#ifndef _TEST_UTILITIES_HPP
+#define _TEST_UTILITIES_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * Configurations of particles shared by tests and benchmarks
+ */
+ 
+#include <array>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "direct-sum.hpp"
+#include "particle.hpp"
+
+using namespace std;
+
+/**
+ *  Create particles at random positions in a cube
+ */
+inline ParticleStore create_random_particles(const int n, const int seed=42){
+	mt19937 generator(seed);
+	uniform_real_distribution<double> distribution(-1.0,1.0);
+	ParticleStore particles = ParticleStore(n);
+	for (int i=0;i<n;i++)
+		particles[i].init(array{distribution(generator),distribution(generator),distribution(generator)},
+						  array{0.0,0.0,0.0},1.0,i);
+	return particles;
+}
+
+/**
+ *  Create particles clustered around a few centres, with a spread of sizes
+ */
+inline ParticleStore create_clustered_particles(const int n, const int seed=42){
+	mt19937 generator(seed);
+	normal_distribution<double> distribution(0.0,1.0);
+	const array<array<double,NDIM>,4> centres = {array{0.0,0.0,0.0},array{5.0,1.0,-2.0},array{-3.0,4.0,1.0},array{1.0,-6.0,3.0}};
+	const array<double,4> sizes = {1.0,0.1,0.01,0.001};
+	ParticleStore particles = ParticleStore(n);
+	for (int i=0;i<n;i++){
+		const int cluster = i % centres.size();
+		array<double,NDIM> position;
+		for (int j=0;j<NDIM;j++)
+			position[j] = centres[cluster][j] + sizes[cluster]*distribution(generator);
+		particles[i].init(position,array{0.0,0.0,0.0},1.0,i);
+	}
+	return particles;
+}
+
+/**
+ *  Create particles in a thin disc, like a spiral galaxy: surface density falls off
+ *  exponentially with radius, and the thickness is a tenth of the scale length.
+ */
+inline ParticleStore create_disc_particles(const int n, const int seed=42){
+	mt19937 generator(seed);
+	gamma_distribution<double> radius(2.0,1.0);
+	uniform_real_distribution<double> angle(0.0,2.0*M_PI);
+	normal_distribution<double> height(0.0,0.1);
+	ParticleStore particles = ParticleStore(n);
+	for (int i=0;i<n;i++){
+		const double r = radius(generator);
+		const double phi = angle(generator);
+		particles[i].init(array{r*cos(phi),r*sin(phi),height(generator)},array{0.0,0.0,0.0},1.0,i);
+	}
+	return particles;
+}
+
+/**
+ *  Move each particle by a random displacement, as if it had drifted for one step
+ *
+ *  Parameters:
+ *      particles   The particles
+ *      n           Number of particles
+ *      step        Maximum displacement along each axis
+ *      seed        Used to initialize random number generator
+ */
+inline void move_particles(ParticleStore & particles, const int n, const double step, const int seed=42){
+	mt19937 generator(seed);
+	uniform_real_distribution<double> distribution(-step,step);
+	for (int i=0;i<n;i++){
+		array<double,NDIM> position = particles[i].get_position();
+		for (int j=0;j<NDIM;j++)
+			position[j] += distribution(generator);
+		particles[i].set_position(position);
+	}
+}
+
+/**
+ *  Calculate accelerations by direct summation, to serve as a reference for the tree codes.
+ *  The particles' own accelerations are left as they were.
+ *
+ *  Parameters:
+ *      particles   The particles
+ *      n           Number of particles
+ *      n_sample    Number of particles, from the first, whose accelerations are wanted: all, if omitted
+ *      a           Softening length
+ */
+inline vector<array<double,NDIM>> get_direct_accelerations(ParticleStore & particles, const int n, const int n_sample=-1,
+															const double a=0.01){
+	vector<array<double,NDIM>> previous, accelerations;
+	for (int i=0;i<n;i++)
+		previous.push_back(particles[i].get_acceleration());
+	DirectSumAccelerationVisitor direct_sum(1.0,a);
+	direct_sum.initialize(particles,n);
+	for (int i=0;i<(n_sample < 0 ? n : n_sample);i++)
+		accelerations.push_back(particles[i].get_acceleration());
+	for (int i=0;i<n;i++)
+		particles[i].set_acceleration(previous[i]);
+	return accelerations;
+}
+
+/**
+ *  RMS relative error of accelerations, compared with reference values
+ */
+inline double get_rms_error(const vector<array<double,NDIM>> & accelerations, const vector<array<double,NDIM>> & exact){
+	double sum_sq = 0.0;
+	for (size_t i=0;i<exact.size();i++){
+		double error_sq = 0.0, norm_sq = 0.0;
+		for (int k=0;k<NDIM;k++){
+			error_sq += sqr(accelerations[i][k] - exact[i][k]);
+			norm_sq += sqr(exact[i][k]);
+		}
+		sum_sq += error_sq / norm_sq;
+	}
+	return sqrt(sum_sq/exact.size());
+}
+
+/**
+ *  RMS relative error of accelerations stored in particles, compared with reference
+ *  values for as many particles, from the first, as there are values
+ */
+inline double get_rms_error(ParticleStore & particles, const vector<array<double,NDIM>> & exact){
+	vector<array<double,NDIM>> accelerations;
+	for (size_t i=0;i<exact.size();i++)
+		accelerations.push_back(particles[i].get_acceleration());
+	return get_rms_error(accelerations,exact);
+}
+
+#endif  // _TEST_UTILITIES_HPP
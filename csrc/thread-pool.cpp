@@ -0,0 +1,312 @@
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "particle.hpp"
+#include "logger.hpp"
+#include "thread-pool.hpp"
+
+using namespace std;
+
+unique_ptr<ThreadPool> ThreadPool::_instance = nullptr;
+
+thread_local bool ThreadPool::_in_task = false;
+
+namespace {
+	/**
+	 *  Processors belonging to each NUMA node, read from sysfs. If this information
+	 *  is not available, all processors are treated as one node.
+	 */
+	vector<vector<int>> get_numa_nodes() {
+		vector<vector<int>> nodes;
+		for (int node=0;;node++) {
+			ifstream cpulist("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+			if (!cpulist.is_open()) break;
+			vector<int> cpus;
+			string range;
+			while (getline(cpulist,range,',')) {   // e.g. 0-3,8-11
+				const auto dash = range.find('-');
+				const int first = stoi(range.substr(0,dash));
+				const int last = dash == string::npos ? first : stoi(range.substr(dash+1));
+				for (int cpu=first;cpu<=last;cpu++)
+					cpus.push_back(cpu);
+			}
+			if (!cpus.empty())
+				nodes.push_back(cpus);
+		}
+		if (nodes.empty()) {
+			nodes.push_back(vector<int>());
+			for (int cpu=0;cpu<(int)max(1u,thread::hardware_concurrency());cpu++)
+				nodes.back().push_back(cpu);
+		}
+		return nodes;
+	}
+}
+
+/**
+ *  Create a pool and start its workers.
+ *
+ *  Parameters:
+ *      threads    Number of threads, including the caller of run()
+ *      pin        Bind each thread to a single processor
+ *      numa       Spread threads over NUMA nodes
+ */
+ThreadPool::ThreadPool(const int threads, const bool pin, const bool numa) : _pin(pin), _numa(numa) {
+	if (threads < 1) {
+		stringstream message;
+		message<<__FILE__ <<" " <<__LINE__<<" Thread pool needs at least one thread: " << threads << endl;
+		throw logic_error(message.str().c_str());
+	}
+	for (int i=1;i<threads;i++)
+		_workers.push_back(thread(&ThreadPool::_work,this,i));
+}
+
+/**
+ *  Stop workers and wait for them to exit
+ */
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stop = true;
+	}
+	_start.notify_all();
+	for (auto & worker : _workers)
+		worker.join();
+}
+
+/**
+ *  Create the shared pool, replacing any existing one.
+ *
+ *  Parameters:
+ *      threads    Number of threads, including the caller of run()
+ *      pin        Bind each thread to a single processor
+ *      numa       Spread threads over NUMA nodes
+ */
+ThreadPool & ThreadPool::create(const int threads, const bool pin, const bool numa) {
+	_instance.reset();
+	_instance = make_unique<ThreadPool>(threads,pin,numa);
+	_instance->_place(0);
+	return *_instance;
+}
+
+/**
+ *  Retrieve the shared pool, creating it, or replacing it with a larger one
+ *  (with the same placement options), if it has fewer than the specified number of threads.
+ */
+ThreadPool & ThreadPool::get_instance(const int threads) {
+	if (_instance == nullptr)
+		return create(threads);
+	if (_instance->get_size() < threads)
+		return create(threads,_instance->_pin,_instance->_numa);
+	return *_instance;
+}
+
+/**
+ *  Execute a function on several threads from the shared pool, and wait for all of them
+ *  to finish. If the current thread is already executing a task from the pool, new
+ *  threads are created instead, since run() cannot be nested. If any thread throws
+ *  an exception, the first is rethrown once all have finished.
+ *
+ *  Parameters:
+ *     threads   Number of threads
+ *     task      Function to be executed: its parameter is the thread number
+ */
+void ThreadPool::run_in_parallel(const int threads, function<void(int)> task) {
+	if (!_in_task) {
+		get_instance(threads).run(task,threads);
+		return;
+	}
+	mutex failure_mutex;
+	exception_ptr failure = nullptr;
+	vector<thread> workers;
+	for (int i=0;i<threads;i++)
+		workers.push_back(thread([&,i]{
+			try {
+				task(i);
+			} catch (...) {
+				lock_guard<mutex> lock(failure_mutex);
+				if (failure == nullptr)
+					failure = current_exception();
+			}
+		}));
+	for (auto & worker : workers)
+		worker.join();
+	if (failure != nullptr)
+		rethrow_exception(failure);
+}
+
+/**
+ *  Execute a function on several threads, and wait for all of them to finish.
+ *  The caller executes it as thread 0. If any thread throws an exception, the
+ *  first is rethrown once all have finished, so no worker is still using the
+ *  caller's data when the exception propagates.
+ *
+ *  Parameters:
+ *     task      Function to be executed: its parameter is the thread number
+ *     threads   Number of threads: if omitted, all threads in pool are used
+ */
+void ThreadPool::run(function<void(int)> task, const int threads) {
+	if (_in_task) {
+		stringstream message;
+		message<<__FILE__ <<" " <<__LINE__<<" Thread pool cannot run a task from inside another" << endl;
+		throw logic_error(message.str().c_str());
+	}
+	const int active = _get_active(threads);
+	{
+		lock_guard<mutex> lock(_mutex);
+		_task = task;
+		_active = active;
+		_pending = active - 1;
+		_failure = nullptr;
+		_generation++;
+	}
+	_start.notify_all();
+	_in_task = true;
+	try {
+		task(0);
+	} catch (...) {
+		_record_failure(current_exception());
+	}
+	_in_task = false;
+	unique_lock<mutex> lock(_mutex);
+	_done.wait(lock,[this]{return _pending == 0;});
+	if (_failure != nullptr) {
+		exception_ptr failure = _failure;
+		_failure = nullptr;
+		rethrow_exception(failure);
+	}
+}
+
+/**
+ *  Call a function for each index from 0 to n-1. Each thread takes a contiguous
+ *  range of indices, and this returns when they have all finished.
+ *
+ *  Parameters:
+ *     n         Number of indices
+ *     body      Function to be called for each index
+ *     threads   Number of threads: if omitted, all threads in pool are used
+ */
+void ThreadPool::parallel_for(const int n, function<void(int)> body, const int threads) {
+	const int active = _get_active(threads);
+	run([&](int thread){
+		for (int i=(long)thread*n/active;i<(long)(thread+1)*n/active;i++)
+			body(i);
+	},active);
+}
+
+/**
+ *  Called by each thread executing a task: none returns until all have called it.
+ *  The generation distinguishes successive uses of the barrier, so a thread that
+ *  races ahead to the next one cannot release the threads still waiting at this one.
+ */
+void ThreadPool::barrier() {
+	unique_lock<mutex> lock(_barrier_mutex);
+	const int generation = _barrier_generation;
+	if (++_barrier_waiting == _active) {
+		_barrier_waiting = 0;
+		_barrier_generation++;
+		_barrier_released.notify_all();
+	} else
+		_barrier_released.wait(lock,[&]{return generation != _barrier_generation;});
+}
+
+/**
+ *  Wait for tasks, and execute them, until told to stop. A worker whose number is
+ *  not less than the number of threads requested for a task sits it out.
+ *
+ *  Parameters:
+ *     thread   Thread number
+ */
+void ThreadPool::_work(const int thread) {
+	_place(thread);
+	int generation = 0;
+	while (true) {
+		{
+			unique_lock<mutex> lock(_mutex);
+			_start.wait(lock,[&]{return _stop || _generation != generation;});
+			if (_stop) return;
+			generation = _generation;
+			if (thread >= _active) continue;
+		}
+		_in_task = true;
+		try {
+			_task(thread);
+		} catch (...) {
+			_record_failure(current_exception());
+		}
+		_in_task = false;
+		lock_guard<mutex> lock(_mutex);
+		if (--_pending == 0)
+			_done.notify_one();
+	}
+}
+
+/**
+ *  Record an exception thrown by a thread executing the current task, unless
+ *  another thread has already thrown one, so run() can rethrow it
+ *
+ *  Parameters:
+ *     failure   The exception
+ */
+void ThreadPool::_record_failure(exception_ptr failure) {
+	lock_guard<mutex> lock(_mutex);
+	if (_failure == nullptr)
+		_failure = failure;
+}
+
+/**
+ *  Bind the current thread to processors, if pinning or NUMA placement has been requested.
+ *  With NUMA placement, successive threads go to successive nodes, so the memory bandwidth
+ *  of all nodes is used; within a node, a pinned thread gets the next processor, otherwise
+ *  it may run on any processor of its node. Without NUMA placement, thread i is pinned
+ *  to processor i.
+ *
+ *  Parameters:
+ *     thread   Thread number
+ */
+void ThreadPool::_place(const int thread) const {
+	if (!_pin && !_numa) return;
+#ifdef __linux__
+	const vector<vector<int>> nodes = _numa ? get_numa_nodes() : vector<vector<int>>{};
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	if (_numa) {
+		const vector<int> & node = nodes[thread % nodes.size()];
+		if (_pin)
+			CPU_SET(node[(thread / nodes.size()) % node.size()],&cpus);
+		else
+			for (const int cpu : node)
+				CPU_SET(cpu,&cpus);
+	} else
+		CPU_SET(thread % max(1u,std::thread::hardware_concurrency()),&cpus);
+	if (pthread_setaffinity_np(pthread_self(),sizeof(cpus),&cpus) != 0)
+		LOG2("Could not set affinity for thread ",to_string(thread));
+#else
+	if (thread == 0)
+		LOG("Thread pinning and NUMA placement are only supported on Linux");
+#endif
+}
@@ -0,0 +1,264 @@
+#ifndef _THREAD_POOL_HPP
+#define _THREAD_POOL_HPP
+
+/**
+ * Copyright (C) 2025 Simon Crase
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ *  A set of worker threads that persist for the whole run, so each phase of a step
+ *  can be performed in parallel without the cost of creating and joining threads.
+ *  The thread that calls run() takes part as thread 0, and the workers are threads
+ *  1, 2, ...; run() returns when all of them have finished.
+ *
+ *  There is one shared pool, which is created by galaxy.cpp, or the first time
+ *  that get_instance() is called; it grows if more threads are requested.
+ */
+class ThreadPool {
+
+  private:
+	/**
+	 *  The shared pool
+	 */
+	static unique_ptr<ThreadPool> _instance;
+
+	/**
+	 *  Set while a thread is executing a task, so a nested call to run() can be detected
+	 */
+	static thread_local bool _in_task;
+
+	/**
+	 *  Workers: thread 0 is the caller of run(), so it doesn't have one
+	 */
+	vector<thread> _workers;
+
+	/**
+	 *  Bind each thread to a single processor
+	 */
+	const bool _pin;
+
+	/**
+	 *  Spread threads over NUMA nodes in turn, binding each to the processors of its node
+	 */
+	const bool _numa;
+
+	/**
+	 *  Protects the fields below, which describe the task being executed
+	 */
+	mutex _mutex;
+
+	/**
+	 *  Signals workers that there is a new task, or that they are to stop
+	 */
+	condition_variable _start;
+
+	/**
+	 *  Signals caller of run() that the workers have finished
+	 */
+	condition_variable _done;
+
+	/**
+	 *  Function being executed: its parameter is the thread number
+	 */
+	function<void(int)> _task;
+
+	/**
+	 *  Number of threads executing the current task
+	 */
+	int _active = 0;
+
+	/**
+	 *  Number of workers that have not yet finished the current task
+	 */
+	int _pending = 0;
+
+	/**
+	 *  Incremented for each task, so workers can tell that a new one has arrived
+	 */
+	int _generation = 0;
+
+	/**
+	 *  Tells workers to exit
+	 */
+	bool _stop = false;
+
+	/**
+	 *  First exception thrown by any thread executing the current task
+	 */
+	exception_ptr _failure = nullptr;
+
+	/**
+	 *  Used to implement barrier()
+	 */
+	mutex _barrier_mutex;
+
+	condition_variable _barrier_released;
+
+	int _barrier_waiting = 0;
+
+	int _barrier_generation = 0;
+
+  public:
+	/**
+	 *  Create a pool and start its workers.
+	 *
+	 *  Parameters:
+	 *      threads    Number of threads, including the caller of run()
+	 *      pin        Bind each thread to a single processor
+	 *      numa       Spread threads over NUMA nodes
+	 */
+	ThreadPool(const int threads, const bool pin=false, const bool numa=false);
+
+	/**
+	 *  Stop workers and wait for them to exit
+	 */
+	~ThreadPool();
+
+	/**
+	 *  Create the shared pool, replacing any existing one.
+	 *
+	 *  Parameters:
+	 *      threads    Number of threads, including the caller of run()
+	 *      pin        Bind each thread to a single processor
+	 *      numa       Spread threads over NUMA nodes
+	 */
+	static ThreadPool & create(const int threads, const bool pin=false, const bool numa=false);
+
+	/**
+	 *  Retrieve the shared pool, creating it, or replacing it with a larger one,
+	 *  if it has fewer than the specified number of threads.
+	 */
+	static ThreadPool & get_instance(const int threads);
+
+	/**
+	 *  Execute a function on several threads from the shared pool, and wait for all of them
+	 *  to finish. If the current thread is already executing a task from the pool, new
+	 *  threads are created instead, since run() cannot be nested. If any thread throws
+	 *  an exception, the first is rethrown once all have finished.
+	 *
+	 *  Parameters:
+	 *     threads   Number of threads
+	 *     task      Function to be executed: its parameter is the thread number
+	 */
+	static void run_in_parallel(const int threads, function<void(int)> task);
+
+	/**
+	 *  Determine whether the current thread is executing a task from a pool
+	 */
+	static bool is_in_task() {return _in_task;}
+
+	/**
+	 *  Number of threads, including the caller of run()
+	 */
+	int get_size() const {return _workers.size() + 1;}
+
+	/**
+	 *  Execute a function on several threads, and wait for all of them to finish.
+	 *  If any thread throws an exception, the first is rethrown once all have finished.
+	 *
+	 *  Parameters:
+	 *     task      Function to be executed: its parameter is the thread number
+	 *     threads   Number of threads: if omitted, all threads in pool are used
+	 */
+	void run(function<void(int)> task, const int threads=0);
+
+	/**
+	 *  Call a function for each index from 0 to n-1. Each thread takes a contiguous
+	 *  range of indices, and this returns when they have all finished.
+	 *
+	 *  Parameters:
+	 *     n         Number of indices
+	 *     body      Function to be called for each index
+	 *     threads   Number of threads: if omitted, all threads in pool are used
+	 */
+	void parallel_for(const int n, function<void(int)> body, const int threads=0);
+
+	/**
+	 *  Apply a function to each index from 0 to n-1, and combine the results. Each thread
+	 *  combines the results for a contiguous range of indices, and the partial results
+	 *  are combined in order of thread, so the result does not depend on timing.
+	 *
+	 *  Parameters:
+	 *     n         Number of indices
+	 *     zero      Identity for combine
+	 *     map       Function to be called for each index
+	 *     combine   Used to combine two results
+	 *     threads   Number of threads: if omitted, all threads in pool are used
+	 */
+	template<typename T> T parallel_reduce(const int n, const T zero, function<T(int)> map, function<T(T,T)> combine,
+										   const int threads=0) {
+		const int n_threads = _get_active(threads);
+		vector<T> partials(n_threads,zero);
+		run([&](int thread){
+			T partial = zero;
+			for (int i=(long)thread*n/n_threads;i<(long)(thread+1)*n/n_threads;i++)
+				partial = combine(partial,map(i));
+			partials[thread] = partial;
+		},n_threads);
+		T result = zero;
+		for (const T & partial : partials)
+			result = combine(result,partial);
+		return result;
+	}
+
+	/**
+	 *  Called by each thread executing a task: none returns until all have called it.
+	 */
+	void barrier();
+
+  private:
+	/**
+	 *  Wait for tasks, and execute them, until told to stop
+	 *
+	 *  Parameters:
+	 *     thread   Thread number
+	 */
+	void _work(const int thread);
+
+	/**
+	 *  Record an exception thrown by a thread executing the current task, unless
+	 *  another thread has already thrown one
+	 */
+	void _record_failure(exception_ptr failure);
+
+	/**
+	 *  Number of threads that will execute a task
+	 *
+	 *  Parameters:
+	 *     threads   Number of threads requested: zero means all threads in pool
+	 */
+	int _get_active(const int threads) const {return threads > 0 && threads < get_size() ? threads : get_size();}
+
+	/**
+	 *  Bind the current thread to processors, if pinning or NUMA placement has been requested
+	 *
+	 *  Parameters:
+	 *     thread   Thread number
+	 */
+	void _place(const int thread) const;
+};
+
+#endif  // _THREAD_POOL_HPP
@@ -29,7 +29,8 @@ using namespace std;
  *  Build the data structure needed to verify that each  
  *  particle is in the Tree once and only once.
  */
-TreeVerifier::TreeVerifier(unique_ptr<Particle[]> &particles, const int n) : _particles(particles),_n(n) {
+TreeVerifier::TreeVerifier(ParticleStore &particles, const int n, const bool check_moments)
+  : _particles(particles),_n(n),_check_moments(check_moments) {
 	_particle_verified = vector<bool>();
 	for (int i=0;i<n;i++)
 		_particle_verified.push_back(false);
@@ -47,26 +48,35 @@ Node::Visitor::Status TreeVerifier::visit_internal(Node * node){
 			for (int k=0;k<2;k++)
 				block[i][j][k] = false;
 	_child_within_limits.push_back(block);
+	_moments.push_back(make_tuple(0.0,array<double,NDIM>{0.0,0.0,0.0}));
 	return Node::Visitor::Status::Continue;
 }
 
 /**
- *  Verify that each particle is in the Tree once and only once.
+ *  Verify that each particle is in the Tree once and only once. If requested, verify
+ *  that the mass and centre of mass are the same as CentreOfMassCalculator would give.
  */
 Node::Visitor::Status TreeVerifier::visit_external(Node * node){
-	const int index = node->get_index();
-	assert(!_particle_verified[index]);
-	_particle_verified[index] = true;
+	for (int index : node->get_particles()) {
+		assert(!_particle_verified[index]);
+		_particle_verified[index] = true;
+	}
+	if (_check_moments) {
+		auto [m,X] = node->get_bucket_moments(_particles);
+		assert(node->get_mass() == m);
+		assert(node->get_centre_of_mass() == X);
+	}
 	return Node::Visitor::Status::Continue;
 }
 
 /**
  *  This function is used to verify that subtrees are nested properly. It tests one axis to see
- *  whether it belongs to upper or lower half
+ *  whether it belongs to upper or lower half. The tolerance is relative to the side of the node.
  */
 int TreeVerifier::_get_index(Node * node,Node * child,const int i,double tolerance) {
-	if (abs(node->_Xmin[i] - child->_Xmin[i]) && abs(node->_Xmean[i] - child->_Xmax[i])) return 0;
-	if (abs(node->_Xmax[i] - child->_Xmax[i]) && abs(node->_Xmean[i] - child->_Xmin[i])) return 1;
+	const double epsilon = tolerance * (node->_Xmax[i] - node->_Xmin[i]);  // Boxes can be very small deep in the tree
+	if (abs(node->_Xmin[i] - child->_Xmin[i]) < epsilon && abs(node->_Xmean[i] - child->_Xmax[i]) < epsilon) return 0;
+	if (abs(node->_Xmax[i] - child->_Xmax[i]) < epsilon && abs(node->_Xmean[i] - child->_Xmin[i]) < epsilon) return 1;
 	stringstream message;
 	message<<__FILE__ <<" " <<__LINE__<<" Error: determine index " <<i << endl; 
 	throw logic_error(message.str().c_str()); 
@@ -83,18 +93,31 @@ void TreeVerifier::accumulate(Node * node,Node * child){
 	auto k = _get_index(node,child,2);
 	assert(!_child_within_limits.back()[i][j][k]);
 	_child_within_limits.back()[i][j][k]	= true;
+	auto & [m,X] = _moments.back();
+	m += child->get_mass();
+	for (int axis=0;axis<NDIM;axis++)
+		X[axis] += child->get_mass() * child->get_centre_of_mass()[axis];
 }
 
 /**
  *  This function is used to verify that subtrees are nested properly. 
  *  It checks the collection of octants build by visit_internal()
- *  and accumulate() to ensure that it is complete.
+ *  and accumulate() to ensure that it matches the occupancy of the node.
+ *  If requested, it also checks the moments accumulated from the children.
  */ 
 void TreeVerifier::depart(Node * node) {
+	auto [m,X] = _moments.back();
+	_moments.pop_back();
+	if (_check_moments) {
+		for (int i=0;i<NDIM;i++)
+			X[i] /= m;
+		assert(node->get_mass() == m);
+		assert(node->get_centre_of_mass() == X);
+	}
 	for (int i=0;i<2;i++)
 		for (int j=0;j<2;j++)
 			for (int k=0;k<2;k++)
-				assert(_child_within_limits.back()[i][j][k]);
+				assert(_child_within_limits.back()[i][j][k] == ((node->_occupancy >> Node::_triple_to_octant(i,j,k)) & 1));
 	_child_within_limits.pop_back();
 }
 
@@ -107,4 +130,4 @@ bool TreeVerifier::has_been_verified(){
 			return false;
 	assert(_child_within_limits.size()==0);
 	return true;
-}
\ No newline at end of file
+}
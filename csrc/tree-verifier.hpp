@@ -29,7 +29,7 @@ using namespace std;
  */
 class TreeVerifier: public Node::Visitor{
   private:
-    unique_ptr<Particle[]> &_particles;
+    ParticleStore &_particles;
 
 	const int _n;
  
@@ -37,9 +37,27 @@ class TreeVerifier: public Node::Visitor{
 	
 	vector<array<array<array<bool,2>,2>,2>> _child_within_limits;
 	
+	/**
+	 *  Indicates that masses and centres of mass are to be checked
+	 */
+	const bool _check_moments;
+	
+	/**
+	 *  Used to check moments: mass and weighted sum of centres of mass
+	 *  of the children of each Internal node that is being visited
+	 */
+	vector<tuple<double,array<double,NDIM>>> _moments;
+	
    public:
 	
-	TreeVerifier(unique_ptr<Particle[]> &particles, const int n);
+	/**
+	 *  Parameters:
+	 *      particles      The particles
+	 *      n              Number of particles
+	 *      check_moments  Also check that masses and centres of mass match those 
+	 *                     that CentreOfMassCalculator would calculate
+	 */
+	TreeVerifier(ParticleStore &particles, const int n, const bool check_moments=false);
 	
 	/**
 	 *  This function initializes the data structure that is used to verify
@@ -49,7 +67,7 @@ class TreeVerifier: public Node::Visitor{
 	Node::Visitor::Status visit_internal(Node * node);
 
 	/**
-	 *  Used to verify that all particles have been added
+	 *  Used to verify that all particles have been added, and to check moments
 	 */
 	Node::Visitor::Status visit_external(Node * node);
 	
@@ -63,7 +81,7 @@ class TreeVerifier: public Node::Visitor{
 	/**
 	 *  This function is used to verify that subtrees are nested properly. 
 	 *  It checks the collection of octants build by visit_internal()
-	 *  and accumulate() to ensure that it is complete.
+	 *  and accumulate() to ensure that it matches the occupancy of the node.
 	 */ 
 	void depart(Node * node);
 	
@@ -81,4 +99,4 @@ class TreeVerifier: public Node::Visitor{
 			
 };
  
- #endif // _TREE_VERIFIER_HPP
\ No newline at end of file
+ #endif // _TREE_VERIFIER_HPP
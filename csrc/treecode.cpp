@@ -15,35 +15,446 @@
  * along with this software.  If not, see <http://www.gnu.org/licenses/>
  */
  
+#include <algorithm>
+#include <bit>
 #include <limits>
 #include <cassert>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
+#include "space-filling-curve.hpp"
+#include "thread-pool.hpp"
 #include "treecode.hpp"
 #include "tree-verifier.hpp"
 
 using namespace std;
 
-int Node::_count=0;   // Initially tree is empty
+atomic<int> Node::_count=0;   // Initially tree is empty
 
 /**
- * Create an oct-tree from a set of particles
+ *  The root of a tree holds the arena that stores the other Nodes, so
+ *  the whole tree is released when the root is deleted.
  */
-unique_ptr<Node> Node::create(unique_ptr<Particle[]> &particles, int n,const bool verify,const double pad){
+class RootNode : public Node {
+  private:
+	shared_ptr<NodeArena> _arena;
+	
+  public:
+	RootNode(array<double,NDIM> Xmin, array<double,NDIM> Xmax,shared_ptr<NodeArena> arena)
+		: Node(Xmin,Xmax), _arena(arena) {;}
+		
+	virtual ~RootNode() {_arena->release();}
+};
+
+/**
+ * Create an oct-tree from a set of particles. Instead of inserting particles one at a time,
+ * which means walking down from the root for each particle, we calculate a Morton key for
+ * each particle, sort, and split the sorted keys into ranges, one for each node.
+ * If options.fused_moments is set, masses and centres of mass are calculated as
+ * each subtree is completed.
+ */
+unique_ptr<Node> Node::create(ParticleStore &particles, int n,const bool verify,const double pad,
+							  const TreeOptions & options, shared_ptr<NodeArena> arena){
+	_validate(options);
+	unique_ptr<Node> product = _create_root(particles,n,pad,arena,options.threads);
+
+	if (options.threads > 1)
+		product->_insert_sorted_parallel(particles,n,options,*arena);
+	else if (n > 0) {
+		vector<pair<uint64_t,int>> keys(n);
+		for (int index=0;index<n;index++)
+			keys[index] = make_pair(_get_morton_key(particles[index].get_position(),product->_Xmin,product->_Xmax),index);
+		sort(keys.begin(),keys.end());
+		int * bucket = arena->get_particle_indices(n);
+		for (int i=0;i<n;i++)
+			bucket[i] = keys[i].second;
+		product->_insert_sorted(particles,keys,bucket,options,arena->get_lane(0));
+	}
+
+	if (verify)
+		_verify(product.get(),particles,n,options.fused_moments);
+	return product;
+}
+
+/**
+ * Create an oct-tree by inserting particles one at a time. This is
+ * the original algorithm: it is retained so we can check that create()
+ * builds the same tree.
+ */
+unique_ptr<Node> Node::create_by_insertion(ParticleStore &particles, int n,const bool verify,const double pad){
+	shared_ptr<NodeArena> arena = nullptr;
+	unique_ptr<Node> product = _create_root(particles,n,pad,arena,1);
+
+	for (int index=0;index<n;index++)
+		product->insert(index,particles,arena->get_lane(0));
+
+	if (verify)
+		_verify(product.get(),particles,n);
+	return product;
+}
+
+/**
+ * Update tree (this must be the root) after particles have moved, instead of
+ * building a new one. Most particles will still be in the cube of their External node,
+ * so they can be left alone. Particles that have left are removed, subtrees that have
+ * been emptied are removed, and then the particles are inserted again. Every particle
+ * has moved, so mass and centre of mass need to be recalculated for every node afterwards.
+ *
+ * Parameters:
+ *     particles    The particles
+ *     n			Number of particles
+ *     options      Determine bucket size and maximum depth
+ *     arena        The arena that was used to build tree
+ *     verify       Verify tree after update
+ *
+ * Returns:
+ *     false if a particle has left the cube of the root, so tree needs to be built from scratch
+ */
+bool Node::update(ParticleStore &particles, const int n, const TreeOptions & options, NodeArena & arena, const bool verify){
+	for (int index=0;index<n;index++)
+		if (!contains(particles[index].get_position())) return false;
+	
+	vector<int> movers;
+	_remove_movers(particles,movers,arena.get_lane(0));
+	for (int index : movers)
+		_reinsert(index,particles,options,arena,0);
+	
+	if (verify)
+		_verify(this,particles,n);
+	return true;
+}
+
+/**
+ * Create root of tree, with a bounding box that contains all the particles
+ *
+ * Parameters:
+ *     particles    The particles
+ *     n			Number of particles
+ *     pad			Box will be expanded by a factor of (1+pad)
+ *     arena        Used to allocate nodes below root (a new one is created if this is null)
+ *     lanes        Number of threads that will use arena
+ */
+unique_ptr<Node> Node::_create_root(ParticleStore &particles, int n, const double pad, shared_ptr<NodeArena> & arena, const int lanes){
 	double zmin, zmax;
 	tie(zmin,zmax) = _get_limits(particles,n,pad);
 	array<double,NDIM> Xmin = {zmin,zmin,zmin};
 	array<double,NDIM> Xmax = {zmax,zmax,zmax};
-	unique_ptr<Node> product = unique_ptr<Node>(new Node(Xmin,Xmax));
+	if (arena == nullptr)
+		arena = make_shared<NodeArena>();
+	arena->acquire(lanes);
+	return unique_ptr<Node>(new RootNode(Xmin,Xmax,arena));
+}
 
-	for (int index=0;index<n;index++)
-		product->insert(index,particles);
+/**
+ * Verify tree if requested by caller of create(...)
+ *
+ * Parameters:
+ *     root           Root of tree
+ *     particles      The particles
+ *     n              Number of particles
+ *     check_moments  Also check masses and centres of mass, which must have been calculated already
+ */
+void Node::_verify(Node * root,ParticleStore &particles, const int n, const bool check_moments){
+	TreeVerifier verifier(particles,n,check_moments);
+	root->traverse(verifier);
+	assert(verifier.has_been_verified());
+}
+
+/**
+ * Find the cell that contains a particle, on a grid of 2^N_Levels cells along each axis.
+ * We descend through N_Levels of octants, splitting the box exactly as _split_node()
+ * does, so each bit of a coordinate is the half that insert() would have chosen
+ * at that level.
+ *
+ * Parameters:
+ *     position    Position of particle
+ *     Xmin        Lower bound of box for root of tree
+ *     Xmax        Upper bound of box for root of tree
+ */
+array<uint32_t,NDIM> Node::get_cell(const array<double,NDIM> & position,array<double,NDIM> Xmin, array<double,NDIM> Xmax){
+	array<uint32_t,NDIM> cell = {0,0,0};
+	for (int level=0;level<N_Levels;level++)
+		for (int i=0;i<NDIM;i++){
+			const double mean = 0.5 * (Xmin[i] + Xmax[i]);
+			const int index = (position[i] > mean);
+			tie(Xmin[i],Xmax[i]) = _get_refined_bounds(index,Xmin[i],Xmax[i],mean);
+			cell[i] = (cell[i] << 1) | index;
+		}
+	return cell;
+}
+
+/**
+ * Calculate Morton key for a particle, from the cell that contains it, so each
+ * group of N_Bits is the octant that insert() would have chosen at that level.
+ *
+ * Parameters:
+ *     position    Position of particle
+ *     Xmin        Lower bound of box for root of tree
+ *     Xmax        Upper bound of box for root of tree
+ */
+uint64_t Node::_get_morton_key(const array<double,NDIM> & position,array<double,NDIM> Xmin, array<double,NDIM> Xmax){
+	return SpaceFillingCurve::get_key(get_cell(position,Xmin,Xmax),SpaceFillingCurve::Morton,N_Levels);
+}
 
-	if (verify){
-		TreeVerifier verifier(particles,n);
-		product->traverse(verifier);
-		assert(verifier.has_been_verified());
+/**
+ * Determine number of levels, starting from root, for which two keys are in the same octant
+ */
+int Node::_get_shared_levels(uint64_t key1, uint64_t key2){
+	const uint64_t difference = key1 ^ key2;
+	if (difference == 0) return N_Levels;
+	const int highest_bit = numeric_limits<uint64_t>::digits - 1 - countl_zero(difference);
+	return N_Levels - 1 - highest_bit / N_Bits;
+}
+
+/**
+ * Build tree below this node (which must be Unused) from particles sorted by Morton key.
+ *
+ * The particles that belong in each child are a contiguous range of the keys, as they share the
+ * same octant at this level, so we find the ranges by binary search and build each child in turn.
+ * A node becomes External if it has few enough particles to fit in a bucket, or if it is at the
+ * maximum depth: this also takes care of particles that are too close to be separated by their keys.
+ * If moments are required, each node's are calculated once its children are complete.
+ *
+ * Parameters:
+ *     particles    The particles: only used if options.fused_moments is set
+ *     keys         Pairs (Morton key, particle index), sorted by key 
+ *     bucket       Indices of the same particles, in the same order: External nodes point into this
+ *     options      Determine bucket size, maximum depth, and whether to calculate moments
+ *     lane         Used to allocate Nodes 
+ *     level        Level of this node in tree: all keys share this many levels
+ */
+void Node::_insert_sorted(ParticleStore &particles, span<pair<uint64_t,int>> keys, int * bucket,
+						  const TreeOptions & options, NodeArena::Lane & lane, const int level){
+	const int n = keys.size();
+	if (n <= options.bucket_size || level == options.max_depth) {
+		_set_bucket(bucket,n);
+		if (options.fused_moments)
+			_set_moments_from_bucket(particles,options);
+		return;
+	}
+	array<int,N_Children+1> ranges;  // Keys for octant i are ranges[i] up to ranges[i+1]
+	ranges[0] = 0;
+	uint8_t occupancy = 0;
+	for (int octant=0;octant<N_Children;octant++){
+		auto end = partition_point(keys.begin() + ranges[octant],keys.end(),
+								   [level,octant](const pair<uint64_t,int> & key_index){return _get_octant(key_index.first,level) <= octant;});
+		ranges[octant+1] = end - keys.begin();
+		if (ranges[octant+1] > ranges[octant])
+			occupancy |= 1 << octant;
+	}
+	_split_node(lane,occupancy);
+	for (int octant=0;octant<N_Children;octant++)
+		if (Node * child = _get_child(octant))
+			child->_insert_sorted(particles,keys.subspan(ranges[octant],ranges[octant+1] - ranges[octant]),bucket + ranges[octant],
+								  options,lane,level+1);
+	if (options.fused_moments)
+		_set_moments_from_children(options);
+}
+
+/**
+ * Calculate mass and centre of mass of an External node from its bucket,
+ * and quadrupole moment and tight bounding box if required.
+ *
+ * Parameters:
+ *     particles   The particles
+ *     options     Determine whether quadrupole moment and bounding box are required
+ */
+void Node::_set_moments_from_bucket(ParticleStore &particles, const TreeOptions & options){
+	tie(_m,_center_of_mass) = get_bucket_moments(particles);
+	if (options.quadrupole)
+		set_quadrupole_from_bucket(particles);
+	if (options.tight_bounds)
+		set_bounds_from_bucket(particles);
+}
+
+/**
+ * Calculate mass and centre of mass of an Internal node from its children,
+ * in the same order as CentreOfMassCalculator, so the results are identical.
+ *
+ * Parameters:
+ *     options     Determine whether quadrupole moment and bounding box are required
+ */
+void Node::_set_moments_from_children(const TreeOptions & options){
+	_m = 0.0;
+	_center_of_mass = {0.0,0.0,0.0};
+	for (int i=0;i<get_n_children();i++)
+		accumulate_center_of_mass(&_children[i]);
+	for (int i=0;i<NDIM;i++)
+		_center_of_mass[i] /= _m;
+	if (options.quadrupole)
+		set_quadrupole_from_children();
+	if (options.tight_bounds)
+		set_bounds_from_children();
+}
+
+/**
+ * Used by _insert_sorted_parallel() to calculate moments for the levels of the
+ * tree above the subtrees that were built in parallel. Subtrees at partition_level
+ * already have their moments; External nodes above it are calculated from their buckets.
+ *
+ * Parameters:
+ *     particles        The particles
+ *     level            Level of this node in tree
+ *     partition_level  Level of the subtrees that were built in parallel
+ *     options          Determine whether quadrupole moments and bounding boxes are required
+ */
+void Node::_set_top_level_moments(ParticleStore &particles, const int level, const int partition_level, const TreeOptions & options){
+	switch (_particle_index) {
+		case Unused:
+			return;
+		case Internal:
+			if (level == partition_level) return;
+			for (int i=0;i<get_n_children();i++)
+				_children[i]._set_top_level_moments(particles,level+1,partition_level,options);
+			_set_moments_from_children(options);
+			return;
+		default:
+			_set_moments_from_bucket(particles,options);
+	}
+}
+
+/**
+ * Make this node External, holding a bucket of particles
+ *
+ * Parameters:
+ *     bucket       Indices of particles
+ *     n            Number of particles
+ */
+void Node::_set_bucket(int * bucket, const int n){
+	_particle_index = bucket[0];
+	_bucket = bucket;
+	_n_particles = n;
+}
+
+/**
+ * Used to check that options are valid before we build tree
+ */
+void Node::_validate(const TreeOptions & options){
+	if (options.bucket_size < 1 || options.max_depth < 0 || options.max_depth > N_Levels) {
+		stringstream message;
+		message<<__FILE__ <<" " <<__LINE__<<" Error: bucket size " << options.bucket_size 
+			<< " must be at least 1, and maximum depth " << options.max_depth << " must be between 0 and " << N_Levels << endl; 
+		throw logic_error(message.str().c_str()); 
 	}
-	return product;
+}
+
+/**
+ * Build tree below this node (the root) using several threads. 
+ *
+ * We calculate keys in parallel, then partition the particles by the cell they occupy at
+ * partition_level. The levels above that are built serially, then each thread takes subtrees 
+ * in turn, sorts the keys that belong to the subtree, and builds it using _insert_sorted().
+ * Since the subtrees are disjoint, no synchronization is needed beyond the task counter.
+ *
+ * Parameters:
+ *     particles    The particles
+ *     n            Number of particles
+ *     options      Determine number of threads, bucket size, and maximum depth
+ *     arena        Used to allocate Nodes: each thread has its own Lane
+ */
+void Node::_insert_sorted_parallel(ParticleStore &particles, const int n, const TreeOptions & options, NodeArena & arena){
+	const int threads = options.threads;
+	vector<pair<uint64_t,int>> keys(n);
+	const int chunk = (n + threads - 1) / threads;
+	ThreadPool::run_in_parallel(threads,[&](int thread){
+		for (int index=thread*chunk;index<min(n,(thread+1)*chunk);index++)
+			keys[index] = make_pair(_get_morton_key(particles[index].get_position(),_Xmin,_Xmax),index);
+	});
+	
+	const int partition_level = _get_partition_level(threads);
+	const int shift = N_Bits * (N_Levels - partition_level);
+	const int n_cells = 1 << (N_Bits * partition_level);
+	vector<int> cells(n_cells+1,0);
+	for (auto [key,_] : keys)
+		cells[(key >> shift) + 1]++;
+	for (int i=0;i<n_cells;i++)
+		cells[i+1] += cells[i];
+	vector<pair<uint64_t,int>> partitioned(n);
+	vector<int> next(cells.begin(),cells.end()-1);
+	for (auto key_index : keys)
+		partitioned[next[key_index.first >> shift]++] = key_index;
+	
+	vector<tuple<Node*,int,int>> subtrees;
+	int * bucket = arena.get_particle_indices(n);
+	_split_top_levels(partitioned,cells,0,n_cells,0,partition_level,subtrees,bucket,options,arena.get_lane(0));
+	
+	atomic<int> next_subtree = 0;
+	ThreadPool::run_in_parallel(threads,[&](int thread){
+		for (int i=next_subtree++;i<static_cast<int>(subtrees.size());i=next_subtree++){
+			auto [node,begin,end] = subtrees[i];
+			sort(partitioned.begin()+begin,partitioned.begin()+end);
+			for (int j=begin;j<end;j++)
+				bucket[j] = partitioned[j].second;
+			node->_insert_sorted(particles,span(partitioned.begin()+begin,partitioned.begin()+end),bucket+begin,
+								 options,arena.get_lane(thread),partition_level);
+		}
+	});
+	
+	if (options.fused_moments)
+		_set_top_level_moments(particles,0,partition_level,options);
+}
+
+/**
+ * Used by _insert_sorted_parallel() to build the levels of the tree above the subtrees
+ * that will be built in parallel. A node whose particles fit in a bucket becomes External
+ * as it would in _insert_sorted(), so the tree is the same as the serial build. The keys
+ * for such a node haven't been sorted yet, so we sort them to match the serial build.
+ *
+ * Parameters:
+ *     keys         Pairs (Morton key, particle index), grouped by cell
+ *     cells        Index into keys for the start of each cell; cells[i+1] is one past the end 
+ *     cell_begin   The first cell that belongs to this node
+ *     cell_end     One past the last cell that belongs to this node
+ *     level        Level of this node in tree
+ *     partition_level   Level of the subtrees that will be built in parallel
+ *     subtrees     Used to record the subtrees, with indices into keys
+ *     bucket       Indices of particles for External nodes, in the same order as keys
+ *     options      Determine bucket size and maximum depth
+ *     lane         Used to allocate Nodes 
+ */
+void Node::_split_top_levels(vector<pair<uint64_t,int>> & keys, vector<int> & cells, const int cell_begin, const int cell_end,
+							 const int level, const int partition_level, vector<tuple<Node*,int,int>> & subtrees,
+							 int * bucket, const TreeOptions & options, NodeArena::Lane & lane){
+	const int begin = cells[cell_begin];
+	const int end = cells[cell_end];
+	if (end == begin) return;
+	
+	if (end - begin <= options.bucket_size || level == options.max_depth) {
+		sort(keys.begin()+begin,keys.begin()+end);
+		for (int i=begin;i<end;i++)
+			bucket[i] = keys[i].second;
+		_set_bucket(bucket+begin,end-begin);
+		return;
+	}
+	
+	if (level == partition_level) {
+		subtrees.push_back(make_tuple(this,begin,end));
+		return;
+	}
+	
+	const int cells_per_child = (cell_end - cell_begin) / N_Children;
+	uint8_t occupancy = 0;
+	for (int i=0;i<N_Children;i++)
+		if (cells[cell_begin + (i+1)*cells_per_child] > cells[cell_begin + i*cells_per_child])
+			occupancy |= 1 << i;
+	_split_node(lane,occupancy);
+	for (int i=0;i<N_Children;i++)
+		if (Node * child = _get_child(i))
+			child->_split_top_levels(keys,cells,cell_begin + i*cells_per_child,cell_begin + (i+1)*cells_per_child,
+									 level+1,partition_level,subtrees,bucket,options,lane);
+}
+
+/**
+ * Determine level of subtrees that will be built in parallel.
+ * We need enough subtrees to keep all the threads busy, allowing
+ * for the fact that particles won't be distributed evenly between them.
+ */
+int Node::_get_partition_level(const int threads){
+	int level = 1;
+	while (level < N_Levels / 2 && (1 << (N_Bits*level)) < 4 * threads)
+		level++;
+	return level;
 }
 
 /**
@@ -56,13 +467,13 @@ unique_ptr<Node> Node::create(unique_ptr<Particle[]> &particles, int n,const boo
  *     n			Number of particles
  *     pad			Box will be expanded by a factor of (1+pad)
  */
-tuple<double,double> Node::_get_limits(unique_ptr<Particle[]>& particles,int n,const double pad){
+tuple<double,double> Node::_get_limits(ParticleStore& particles,int n,const double pad){
 	auto zmin = numeric_limits<double>::max();
 	auto zmax = -zmin;
-	for (int i=0;i<n;i++)
-		for (int j=0;j<NDIM;j++){
-			zmin = min(zmin,particles[i].get_position()[j]);
-			zmax = max(particles[i].get_position()[j],zmax);
+	for (const auto & component : particles.get_positions())
+		for (int i=0;i<n;i++){
+			zmin = min(zmin,component[i]);
+			zmax = max(component[i],zmax);
 		}
 
 	if (zmin < 0)
@@ -87,33 +498,36 @@ tuple<double,double> Node::_get_limits(unique_ptr<Particle[]>& particles,int n,c
 Node::Node(array<double,NDIM> Xmin,array<double,NDIM> Xmax)
   : _id(_count),_particle_index(Unused),
   	_m(0.0), _center_of_mass({0.0,0.0,0.0}),
-	_Xmin(Xmin), _Xmax(Xmax){
+	_Xmin(Xmin), _Xmax(Xmax), _children(nullptr), _occupancy(0), _n_particles(0){
 	for (int i=0;i<NDIM;i++)
 		_Xmean[i] = 0.5 * (Xmin[i] + Xmax[i]);
-	for (int i=0;i<N_Children;i++)
-		_child[i] = NULL;
 	_count++;
 }
 
 
 /**
- * Insert one particle in tree.
+ * Insert one particle in tree. This is used to build trees with one particle in 
+ * each bucket, so it doesn't allow for External nodes that have been built by create().
  *
  * Recursively descend until we find an empty node.
  */
-void Node::insert(int new_particle_index,unique_ptr<Particle[]> &particles) {
+void Node::insert(int new_particle_index,ParticleStore &particles,NodeArena::Lane & lane) {
 
 	switch(_particle_index){
 		case Unused:                              // This Node is currently Unused
 			_particle_index = new_particle_index; // so we can add particle to it, making it External
+			_n_particles = 1;
 			return;
-		case Internal: { 																// This Node is Internal
-			Node * subtree = _child[_get_octant_number(particles[new_particle_index])]; // so we can add particle to the appropriate subtree
-			subtree->insert(new_particle_index,particles);
+		case Internal: { 													// This Node is Internal
+			const int octant = _get_octant_number(particles[new_particle_index]); // so we can add particle to the appropriate subtree
+			Node * subtree = _get_child(octant);
+			if (subtree == nullptr)                                           // creating it if octant was empty
+				subtree = _add_child(octant,lane);
+			subtree->insert(new_particle_index,particles,lane);
 			return;
 		}
 		default:                                                                   // This Node is External
-			_split_and_insert_below(new_particle_index,_particle_index,particles); // so we already have a particle here; we have to move it
+			_split_and_insert_below(new_particle_index,_particle_index,particles,lane); // so we already have a particle here; we have to move it
 	}
 }
 
@@ -134,61 +548,231 @@ int Node::_get_octant_number(Particle &particle) {
 /**
  * Split an External node, and insert the new particle and the incumbent into subtrees.
  */
-void Node::_split_and_insert_below(int new_particle_index,int incumbent,unique_ptr<Particle[]> &particles) {
-	_split_node();
-	_insert_or_propagate(new_particle_index,incumbent,particles);
+void Node::_split_and_insert_below(int new_particle_index,int incumbent,ParticleStore &particles,NodeArena::Lane & lane) {
+	_split_node(lane,(1 << _get_octant_number(particles[new_particle_index])) | (1 << _get_octant_number(particles[incumbent])));
+	_insert_or_propagate(new_particle_index,incumbent,particles,lane);
 } 
 
 /**
  * Used when we have just split an External node, so we need to pass
  * the incumbent and a new particle down the tree
  */
-void Node::_insert_or_propagate(int new_particle_index,int incumbent,unique_ptr<Particle[]> &particles) {
+void Node::_insert_or_propagate(int new_particle_index,int incumbent,ParticleStore &particles,NodeArena::Lane & lane) {
 	const int child_index_new = _get_octant_number(particles[new_particle_index]);
 	const int child_index_incumbent = _get_octant_number(particles[incumbent]);
 	if (child_index_new ==  child_index_incumbent)
-		_child[child_index_incumbent]->_split_and_insert_below(new_particle_index,incumbent,particles);
+		_get_child(child_index_incumbent)->_split_and_insert_below(new_particle_index,incumbent,particles,lane);
 	else {
-		_child[child_index_new]->insert(new_particle_index,particles);
-		_child[child_index_incumbent]->insert(incumbent,particles);
+		_get_child(child_index_new)->insert(new_particle_index,particles,lane);
+		_get_child(child_index_incumbent)->insert(incumbent,particles,lane);
 	}
 }
 
 /**
  * Convert an External Node into an Internal one, and
  * partition bounding box into eight, one for each child, so we can 
- * assign particle to a member of the partition. We end up with 8
- * unused nodes below this one.
+ * assign particle to a member of the partition. We end up with an
+ * unused node below this one for each occupied octant, contiguous in the arena.
+ *
+ * Parameters:
+ *     lane         Used to allocate children
+ *     occupancy    Bit i is set iff a child is needed for octant i
  */
-void Node::_split_node() {
+void Node::_split_node(NodeArena::Lane & lane,const uint8_t occupancy) {
 	_particle_index = Internal;
+	_occupancy = occupancy;
+	_children = lane.allocate(get_n_children());
+	Node * slot = _children;
+	for (int octant=0;octant<N_Children;octant++)
+		if ((occupancy >> octant) & 1)
+			_create_child(slot++,octant);
+} 
+
+/**
+ * Used by insert() to create a child for an octant that was empty.
+ * We need a bigger block, so the existing children are copied, and
+ * the old block is discarded. The copies replace the originals, 
+ * so the count of nodes only changes by one.
+ *
+ * Parameters:
+ *     octant    The octant that needs a child
+ *     lane      Used to allocate children
+ *
+ * Returns:
+ *     The new child
+ */
+Node * Node::_add_child(const int octant,NodeArena::Lane & lane) {
+	const int n_children = get_n_children();
+	const uint8_t occupancy = _occupancy | (1 << octant);
+	Node * children = lane.allocate(n_children + 1);
+	Node * slot = children;
+	Node * original = _children;
+	for (int i=0;i<N_Children;i++)
+		if (i == octant)
+			_create_child(slot++,i);
+		else if ((occupancy >> i) & 1)
+			new (slot++) Node(*original++);
+	lane.discard(n_children);
+	_children = children;
+	_occupancy = occupancy;
+	return _get_child(octant);
+}
+
+/**
+ * Construct a child node, whose box is one octant of this node's box
+ *
+ * Parameters:
+ *     slot      Where the child is to be constructed
+ *     octant    Octant for child
+ */
+void Node::_create_child(Node * slot,const int octant) {
+	const auto indices = _octant_to_triple(octant);
 	array<double,NDIM> Xmin;
 	array<double,NDIM> Xmax;
-	for (int i=0;i<2;i++) {
-		tie (Xmin[0], Xmax[0]) = _get_refined_bounds(i, _Xmin[0], _Xmax[0],  _Xmean[0]);
-		for (int j=0;j<2;j++) {
-			tie (Xmin[1], Xmax[1])  = _get_refined_bounds(j, _Xmin[1], _Xmax[1],  _Xmean[1]);
-			for (int k=0;k<2;k++) {
-				tie (Xmin[2], Xmax[2])  = _get_refined_bounds(k, _Xmin[2],  _Xmax[2],  _Xmean[2]);
-				_child[_triple_to_octant(i,j,k)] = new Node(Xmin, Xmax);
+	for (int i=0;i<NDIM;i++)
+		tie (Xmin[i], Xmax[i]) = _get_refined_bounds(indices[i], _Xmin[i], _Xmax[i],  _Xmean[i]);
+	new (slot) Node(Xmin, Xmax);
+}
+
+/**
+ * Used by update() to remove particles that have left the cube of their External node,
+ * and to remove subtrees that have been emptied. We process children in reverse order,
+ * so removing a child does not move the children that haven't been processed yet.
+ *
+ * Parameters:
+ *     particles    The particles
+ *     movers       Used to collect particles that have been removed
+ *     lane         Used to record nodes that have been removed
+ *
+ * Returns:
+ *     true if this node is now empty
+ */
+bool Node::_remove_movers(ParticleStore &particles, vector<int> & movers, NodeArena::Lane & lane){
+	switch (_particle_index) {
+		case Internal:
+			for (int octant=N_Children-1;octant>=0;octant--)
+				if (Node * child = _get_child(octant)) {
+					if (child->_remove_movers(particles,movers,lane))
+						_remove_child(octant,lane);
+				}
+			if (_occupancy != 0) return false;
+			_particle_index = Unused;
+			_children = nullptr;
+			return true;
+		case Unused:
+			return true;
+		default: {
+			const auto bucket = get_particles();
+			int kept = 0;
+			for (int index : bucket)
+				if (contains(particles[index].get_position()))
+					bucket[kept++] = index;
+				else
+					movers.push_back(index);
+			if (kept == static_cast<int>(bucket.size())) return false;
+			if (kept > 0) {
+				_set_bucket(bucket.data(),kept);
+				return false;
 			}
+			_particle_index = Unused;
+			_bucket = nullptr;
+			_n_particles = 0;
+			return true;
 		}
 	}
-} 
+}
+
+/**
+ * Remove an empty child, moving the children that follow it down
+ * to keep the block contiguous. The space at the end of the block is not
+ * reused until the arena is released.
+ *
+ * Parameters:
+ *     octant    The octant whose child is to be removed
+ *     lane      Used to record nodes that have been removed
+ */
+void Node::_remove_child(const int octant, NodeArena::Lane & lane){
+	const int n_children = get_n_children();
+	for (int i=_get_child(octant)-_children;i<n_children-1;i++)
+		_children[i] = _children[i+1];
+	_occupancy &= ~(1 << octant);
+	lane.discard(1);
+	_release(1);
+}
+
+/**
+ * Used by update() to insert a particle that has been removed. We descend
+ * to the External node whose cube contains it, creating a child if the octant
+ * is empty, and add particle to its bucket. If the bucket is already full, 
+ * the node is split, and the particles are inserted into the new children.
+ *
+ * Parameters:
+ *     index        The particle
+ *     particles    The particles
+ *     options      Determine bucket size and maximum depth
+ *     arena        Used to allocate Nodes and buckets
+ *     level        Level of this node in tree
+ */
+void Node::_reinsert(const int index, ParticleStore &particles, const TreeOptions & options, NodeArena & arena, const int level){
+	switch (_particle_index) {
+		case Unused:
+			_particle_index = index;
+			_n_particles = 1;
+			return;
+		case Internal: {
+			const int octant = _get_octant_number(particles[index]);
+			Node * child = _get_child(octant);
+			if (child == nullptr)
+				child = _add_child(octant,arena.get_lane(0));
+			child->_reinsert(index,particles,options,arena,level+1);
+			return;
+		}
+		default: {
+			if (_n_particles < options.bucket_size || level == options.max_depth) {
+				_add_to_bucket(index,arena);
+				return;
+			}
+			const auto bucket = get_particles();
+			vector<int> incumbents(bucket.begin(),bucket.end());
+			incumbents.push_back(index);
+			uint8_t occupancy = 0;
+			for (int incumbent : incumbents)
+				occupancy |= 1 << _get_octant_number(particles[incumbent]);
+			_split_node(arena.get_lane(0),occupancy);
+			for (int incumbent : incumbents)
+				_get_child(_get_octant_number(particles[incumbent]))->_reinsert(incumbent,particles,options,arena,level+1);
+		}
+	}
+}
+
+/**
+ * Add one particle to the bucket of an External node. The bucket is copied into
+ * a larger one, allocated from the arena, as the existing one may share 
+ * storage with its neighbours.
+ */
+void Node::_add_to_bucket(const int index, NodeArena & arena){
+	const auto bucket = get_particles();
+	const int n = bucket.size();
+	int * extended = arena.allocate_bucket(n+1);
+	copy(bucket.begin(),bucket.end(),extended);
+	extended[n] = index;
+	_set_bucket(extended,n+1);
+}
 
 /**
  * Traverse Tree, visiting each node depth first.  The Visitor decides whether
- * we continue all the way down. After visiting each child of the current node
- * we call accumulate() on the node itself, and then finally call depart() on 
- * the current node after all children processed.
+ * we continue all the way down: if visit_internal() returns DontDescend, the
+ * children are skipped, and so are accumulate() and depart(). Otherwise, after 
+ * visiting each child of the current node we call accumulate() on the node itself,
+ * and then finally call depart() on the current node after all children processed.
  */
 void Node::traverse(Visitor & visitor) {
 	switch (_particle_index) {
 		case Internal:
-			visitor.visit_internal(this);
-			for (int i=0;i<N_Children;i++) {
-				_child[i]->traverse(visitor);
-				visitor.accumulate(this,_child[i]);
+			if (visitor.visit_internal(this) == Visitor::Status::DontDescend) return;
+			for (int i=0;i<get_n_children();i++) {
+				_children[i].traverse(visitor);
+				visitor.accumulate(this,&_children[i]);
 			}
 			visitor.depart(this);
 			return;
@@ -210,13 +794,119 @@ void Node::accumulate_center_of_mass(Node* child) {
 }
 
 /**
- * Used to delete tree
+ *   Calculate total mass and centre of mass of the particles in the bucket of an External node.
+ *   If there is only one particle, we use its position as it is, without multiplying
+ *   and dividing by its mass.
+ *
+ *   Parameters:
+ *       particles    The particles
+ */
+tuple<double,array<double,NDIM>> Node::get_bucket_moments(ParticleStore &particles) {
+	const auto bucket = get_particles();
+	if (bucket.size() == 1)
+		return make_tuple(particles[bucket[0]].get_mass(),particles[bucket[0]].get_position());
+	double m = 0.0;
+	array<double,NDIM> X = {0.0,0.0,0.0};
+	for (int particle_index : bucket) {
+		Particle & particle = particles[particle_index];
+		const auto position = particle.get_position();
+		m += particle.get_mass();
+		for (int i=0;i<NDIM;i++)
+			X[i] += particle.get_mass() * position[i];
+	}
+	for (int i=0;i<NDIM;i++)
+		X[i] /= m;
+	return make_tuple(m,X);
+}
+
+/**
+ *   Calculate quadrupole moment of an External node from the particles in its bucket.
+ *   The centre of mass must have been calculated already.
+ *
+ *   Parameters:
+ *       particles    The particles
+ */
+void Node::set_quadrupole_from_bucket(ParticleStore &particles) {
+	_quadrupole = {0.0,0.0,0.0,0.0,0.0,0.0};
+	for (int particle_index : get_particles()) {
+		Particle & particle = particles[particle_index];
+		const auto position = particle.get_position();
+		array<double,NDIM> d;
+		for (int i=0;i<NDIM;i++)
+			d[i] = position[i] - _center_of_mass[i];
+		_add_point_quadrupole(_quadrupole,particle.get_mass(),d);
+	}
+}
+
+/**
+ *   Calculate quadrupole moment of an Internal node from those of its children, using the
+ *   parallel axis theorem: each child contributes its own quadrupole, plus that of its
+ *   mass concentrated at its centre of mass.
+ */
+void Node::set_quadrupole_from_children() {
+	_quadrupole = {0.0,0.0,0.0,0.0,0.0,0.0};
+	for (int k=0;k<get_n_children();k++) {
+		Node & child = _children[k];
+		for (int i=0;i<static_cast<int>(_quadrupole.size());i++)
+			_quadrupole[i] += child._quadrupole[i];
+		array<double,NDIM> d;
+		for (int i=0;i<NDIM;i++)
+			d[i] = child._center_of_mass[i] - _center_of_mass[i];
+		_add_point_quadrupole(_quadrupole,child._m,d);
+	}
+}
+
+/**
+ *   Calculate the tight bounding box of the particles in the bucket of an External node
+ *
+ *   Parameters:
+ *       particles    The particles
+ */
+void Node::set_bounds_from_bucket(ParticleStore &particles) {
+	_Bmin = particles[_particle_index].get_position();
+	_Bmax = _Bmin;
+	for (int particle_index : get_particles()) {
+		const auto position = particles[particle_index].get_position();
+		for (int i=0;i<NDIM;i++) {
+			_Bmin[i] = min(_Bmin[i],position[i]);
+			_Bmax[i] = max(_Bmax[i],position[i]);
+		}
+	}
+}
+
+/**
+ *   Calculate the tight bounding box of an Internal node from the boxes of its children
+ */
+void Node::set_bounds_from_children() {
+	_Bmin = _children[0]._Bmin;
+	_Bmax = _children[0]._Bmax;
+	for (int k=1;k<get_n_children();k++)
+		for (int i=0;i<NDIM;i++) {
+			_Bmin[i] = min(_Bmin[i],_children[k]._Bmin[i]);
+			_Bmax[i] = max(_Bmax[i],_children[k]._Bmax[i]);
+		}
+}
+
+/**
+ * Add the quadrupole moment of a point mass to a quadrupole tensor
+ *
+ * Parameters:
+ *     Q     The tensor
+ *     m     Mass of point
+ *     d     Displacement of point from centre of mass
+ */
+void Node::_add_point_quadrupole(Quadrupole & Q, const double m, const array<double,NDIM> & d) {
+	const double dsq = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+	for (int i=0;i<NDIM;i++)
+		for (int j=i;j<NDIM;j++)
+			Q[get_quadrupole_index(i,j)] += m * (3*d[i]*d[j] - (i==j ? dsq : 0.0));
+}
+
+/**
+ * Used to delete root of tree. Other nodes are released by the NodeArena
+ * that owns them, without calling their destructors.
  */ 
 Node::~Node() {
-	for (int i=0;i<N_Children;i++)
-		if (_child[i] != NULL)
-			delete _child[i];
-
 	Node::_count--;
 }
 
@@ -18,28 +18,162 @@
  * along with this software.  If not, see <http://www.gnu.org/licenses/>
  */
  
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <span>
 #include <tuple>
+#include <vector>
 
+#include "node-arena.hpp"
 #include "particle.hpp"
 
 using namespace std;
 
+/**
+ *  Used to control how the tree is built and used.
+ */
+struct TreeOptions {
+	/**
+	 *  Number of threads used to build tree
+	 */
+	int threads = 1;
+	
+	/**
+	 *  Copy tree into a FlatTree, and use that to calculate accelerations
+	 */
+	bool flat = false;
+	
+	/**
+	 *  Maximum number of particles in an External node (unless it is at max_depth)
+	 */
+	int bucket_size = 1;
+	
+	/**
+	 *  Nodes at this level are never split, however many particles they contain.
+	 *  It cannot exceed Node::N_Levels, the resolution of the Morton keys.
+	 */
+	int max_depth = 21;
+	
+	/**
+	 *  Tree is built from scratch every rebuild_interval steps, and updated
+	 *  incrementally in between; 1 means that it is always built from scratch.
+	 */
+	int rebuild_interval = 1;
+	
+	/**
+	 *  Between rebuilds, keep the topology of the tree fixed, and just recalculate
+	 *  masses and centres of mass, instead of updating tree.
+	 */
+	bool refit = false;
+	
+	/**
+	 *  Tree is rebuilt early if more than this fraction of the particles have left
+	 *  the cubes of their External nodes.
+	 */
+	double max_escaped = 0.1;
+	
+	/**
+	 *  Calculate masses and centres of mass while tree is being built, so it
+	 *  doesn't need to be traversed by CentreOfMassCalculator afterwards.
+	 */
+	bool fused_moments = false;
+	
+	/**
+	 *  Calculate quadrupole moments for each node, and use them in the force walk,
+	 *  which allows a larger theta for the same accuracy.
+	 */
+	bool quadrupole = false;
+	
+	/**
+	 *  Calculate the tight bounding box of the particles in each node, and use it
+	 *  instead of the node's cube when deciding whether to open the node.
+	 */
+	bool tight_bounds = false;
+	
+	/**
+	 *  If positive, calculate accelerations by walking the tree once for each group
+	 *  of up to group_size particles, instead of once for each particle.
+	 */
+	int group_size = 0;
+	
+	/**
+	 *  If positive, calculate accelerations by walking the tree with packets of
+	 *  packet_size nearby particles together, instead of one particle at a time.
+	 */
+	int packet_size = 0;
+	
+	/**
+	 *  Calculate interactions with distant nodes in single precision, in the
+	 *  Barnes Hut walk and the flat tree. Interactions with particles, and the sums,
+	 *  remain in double precision.
+	 */
+	bool mixed_precision = false;
+	
+	/**
+	 *  Write the time each thread spends in the parallel force walk to the log,
+	 *  after every step, so the balance between threads can be checked.
+	 */
+	bool log_busy_times = false;
+};
+
+/**
+ *  A traceless quadrupole tensor: sum of m (3 d d' - |d|^2 I) over particles, where d
+ *  is displacement from centre of mass. As it is symmetric, we store just the components
+ *  xx, yy, zz, xy, xz, yz, in that order.
+ */
+using Quadrupole = array<double,6>;
+
+/**
+ *  Map component (i,j) of a symmetric tensor to its position in a Quadrupole
+ */
+inline int get_quadrupole_index(const int i, const int j) {
+	static const int index[NDIM][NDIM] = {{0,3,4},{3,1,5},{4,5,2}};
+	return index[i][j];
+}
+
+/**
+ *  The work done by the force walk for one particle: the number of nodes treated
+ *  as a whole, and the number of particles summed over directly.
+ */
+struct WalkCost {
+	int n_nodes = 0;
+	
+	int n_particles = 0;
+	
+	/**
+	 *  Estimate of time to walk tree: one unit for each interaction
+	 */
+	int get_total() const {return n_nodes + n_particles;}
+};
+
 /**
  *  Represents one node in an Oct Tree. The space is partitioned into cubes,
  *  each associated with one node.
  *
  *  Node                                Associated Cube
  *  Unused   - Terminal Node            Empty cube
- *  External - Terminal Node            Cube contains precisely one particle
- *  Internal  - precisely 8 child nodes  Cube is subdivided into smaller cubes
+ *  External - Terminal Node            Cube contains a bucket of particles
+ *  Internal  - up to 8 child nodes     Cube is subdivided into smaller cubes
+ *
+ *  A bucket holds up to TreeOptions::bucket_size particles, or more if the node
+ *  is at TreeOptions::max_depth. Trees built by insertion have one particle per bucket.
  *
  *  When we build the tree we will sometimes have to split External nodes if another
- *  particle wants to live in the associated cube.
+ *  particle wants to live in the associated cube. Only the octants that contain 
+ *  particles have child nodes, so the only Unused node is the root of an empty tree.
  */
 class Node {
   friend class TreeVerifier;	
+  friend class NodeArena;
+  friend class FlatTree;
+  friend class CentreOfMassCalculator;
+  friend class GroupWalk;
+  friend class FastMultipoleMethod;
   public:
   enum  {N_Halves=2};
 	/**
@@ -47,6 +181,25 @@ class Node {
 	 *   along each of x, y, and z axes.
 	 */
 	enum {N_Children=N_Halves*N_Halves*N_Halves};
+	
+	/**
+	 *   Used by create() to sort particles. Each level of the tree contributes
+	 *   N_Bits (one per axis) to a Morton key, so 21 levels fit in 63 bits.
+	 */
+	enum {N_Bits=NDIM, N_Levels=21};
+	
+	/**
+	 * Find the cell that contains a particle, on a grid of 2^N_Levels cells along each axis.
+	 * We descend through N_Levels of octants, splitting the box exactly as _split_node()
+	 * does, so each bit of a coordinate is the half that insert() would have chosen
+	 * at that level. Used for Morton keys, and by SpaceFillingCurve.
+	 *
+	 * Parameters:
+	 *     position    Position of particle
+	 *     Xmin        Lower bound of box for root of tree
+	 *     Xmax        Upper bound of box for root of tree
+	 */
+	static array<uint32_t,NDIM> get_cell(const array<double,NDIM> & position,array<double,NDIM> Xmin, array<double,NDIM> Xmax);
 
   private:	
 	/**
@@ -56,7 +209,7 @@ class Node {
 	
 	/**
 	 * Indicates type of node. External Nodes use the index of the
-     * associated particle instead of one of these values.
+     * first particle in their bucket instead of one of these values.
 	 */
 	int _particle_index;
 	
@@ -69,21 +222,53 @@ class Node {
 	 *  Centre of mass of all particles in or below this node
 	 */
 	array<double,NDIM> _center_of_mass;
+	
+	/**
+	 *  Quadrupole moment about centre of mass: only calculated if TreeOptions::quadrupole is set
+	 */
+	Quadrupole _quadrupole;
+	
+	/**
+	 *  Tight bounding box of the particles in or below this node, which may be
+	 *  much smaller than the cube: only calculated if TreeOptions::tight_bounds is set
+	 */
+	array<double,NDIM> _Bmin, _Bmax;
 
 	/**
 	 * Bounding box for Node. This will be subdivided as we move down the tree
 	 */
 	array<double,NDIM> _Xmin, _Xmax, _Xmean;
 	
+	union {
+		/**
+		 * Descendants of this node - only for an Internal Node. The 
+		 * children are contiguous, as they are allocated together from a NodeArena,
+		 * and are stored in order of octant.
+		 */
+		Node * _children;
+		
+		/**
+		 * Indices of particles in bucket - only for an External Node.
+		 * If this is null, the bucket is just _particle_index.
+		 */
+		int * _bucket;
+	};
+	
 	/**
-	 * Descendants of this node - only for an Internal Node
+	 * Bit i is set iff octant i has a child.
 	 */
-	Node * _child[N_Children];
+	uint8_t _occupancy;
 	
 	/**
-	 * Number of nodes allocated: used in testing
+	 * Number of particles in bucket - only for an External Node
 	 */
-	 static int _count;
+	int _n_particles;
+	
+	/**
+	 * Number of nodes allocated: used in testing. This is atomic 
+	 * because subtrees may be built by several threads.
+	 */
+	 static atomic<int> _count;
 	 
   public:
   
@@ -143,9 +328,37 @@ class Node {
 	 static int get_count();
   
 	/**
-	 * Create an oct-tree from a set of particles
+	 * Create an oct-tree from a set of particles. Particles are sorted by
+	 * Morton key, and the tree is emitted in one pass over the sorted keys.
+	 * Nodes below the root are allocated from an arena, which is released
+	 * when the root is deleted. The caller can supply an arena, so its 
+	 * memory can be reused from one tree to the next.
+	 */
+	static unique_ptr<Node> create(ParticleStore &particles, const int n, const bool verify=false, const double pad=1.0e-4,
+								   const TreeOptions & options=TreeOptions(), shared_ptr<NodeArena> arena=nullptr);
+	
+	/**
+	 * Create an oct-tree by inserting particles one at a time. This is
+	 * the original algorithm: it is retained so we can check that create()
+	 * builds the same tree.
+	 */
+	static unique_ptr<Node> create_by_insertion(ParticleStore &particles, const int n, const bool verify=false, const double pad=1.0e-4);
+	
+	/**
+	 * Update tree (this must be the root) after particles have moved, instead of
+	 * building a new one. Mass and centre of mass need to be recalculated afterwards.
+	 *
+	 * Parameters:
+	 *     particles    The particles
+	 *     n			Number of particles
+	 *     options      Determine bucket size and maximum depth
+	 *     arena        The arena that was used to build tree
+	 *     verify       Verify tree after update
+	 *
+	 * Returns:
+	 *     false if a particle has left the cube of the root, so tree needs to be built from scratch
 	 */
-	static unique_ptr<Node> create(unique_ptr<Particle[]> &particles, const int n, const bool verify=false, const double pad=1.0e-4);
+	bool update(ParticleStore &particles, const int n, const TreeOptions & options, NodeArena & arena, const bool verify=false);
 	
 	/**
 	 *  Create one node for tree. I have made this private, 
@@ -154,19 +367,25 @@ class Node {
 	Node(array<double,NDIM> Xmin, array<double,NDIM> Xmax);
 
 	/**
-	 * Destroy node and its descendants.
+	 * Destroy node. Descendants belong to a NodeArena, so they are released with it.
 	 */
 	virtual ~Node();
 
 	/**
 	 * Insert one particle in tree
+	 *
+	 * Parameters:
+	 *     new_particle_index   Particle to be inserted
+	 *     particles            The particles
+	 *     lane                 Used to allocate Nodes if we need to split
 	 */
-	void insert(int new_particle_index,unique_ptr<Particle[]> &particles);
+	void insert(int new_particle_index,ParticleStore &particles,NodeArena::Lane & lane);
 	
 	/**
 	 * Traverse Tree, visiting each node depth first.  The Visitor decides whether
-	 * we continue all the way down. After visiting each child of the current node
-	 * we call farewell() on the node itself, and then finally call depart() on 
+	 * we continue all the way down: if visit_internal() returns DontDescend, the
+	 * children are skipped. After visiting each child of the current node
+	 * we call accumulate() on the node itself, and then finally call depart() on 
 	 * the current node after all children processed.
 	 *
 	 * Returns:
@@ -176,10 +395,17 @@ class Node {
 	
 	/**
 	 * Indicates type of node. External Nodes use the index of the
-     * associated particle instead of one of these values.
+     * first particle in their bucket instead of one of these values.
 	 */
 	inline auto get_index() { return _particle_index;}
 	
+	/**
+	 * Indices of the particles in an External Node's bucket
+	 */
+	inline span<int> get_particles() {
+		return _bucket == nullptr ? span<int>(&_particle_index,1) : span<int>(_bucket,_n_particles);
+	}
+	
 	/**
 	 * Get mass
 	 */
@@ -204,11 +430,103 @@ class Node {
 	 *   Used to calculate centre of mass for internal nodes.
 	 */
 	void accumulate_center_of_mass(Node* child);
+	
+	/**
+	 *   Calculate total mass and centre of mass of the particles in the bucket of an External node.
+	 *
+	 *   Parameters:
+	 *       particles    The particles
+	 */
+	tuple<double,array<double,NDIM>> get_bucket_moments(ParticleStore &particles);
+	
+	/**
+	 *   Get quadrupole moment about centre of mass
+	 */
+	inline const Quadrupole & get_quadrupole() {return _quadrupole;}
+	
+	/**
+	 *   Calculate quadrupole moment of an External node from the particles in its bucket.
+	 *   The centre of mass must have been calculated already.
+	 *
+	 *   Parameters:
+	 *       particles    The particles
+	 */
+	void set_quadrupole_from_bucket(ParticleStore &particles);
+	
+	/**
+	 *   Calculate quadrupole moment of an Internal node from those of its children.
+	 *   The centres of mass of the node and children, and the quadrupole moments
+	 *   of the children, must have been calculated already.
+	 */
+	void set_quadrupole_from_children();
+	
+	/**
+	 *   Calculate the tight bounding box of the particles in the bucket of an External node
+	 *
+	 *   Parameters:
+	 *       particles    The particles
+	 */
+	void set_bounds_from_bucket(ParticleStore &particles);
+	
+	/**
+	 *   Calculate the tight bounding box of an Internal node from the boxes of its children
+	 */
+	void set_bounds_from_children();
 
 	/**
 	 * Determine length of any side of cube.
 	 */
 	inline auto get_side() {return _Xmax[0] - _Xmin[0];}
+	
+	/**
+	 * Determine squared distance from centre of mass to the furthest corner of cube
+	 */
+	inline double get_bmax_sq() {
+		double bmax_sq = 0.0;
+		for (int i=0;i<NDIM;i++)
+			bmax_sq += sqr(max(_center_of_mass[i] - _Xmin[i],_Xmax[i] - _center_of_mass[i]));
+		return bmax_sq;
+	}
+	
+	/**
+	 * Determine length of longest side of tight bounding box
+	 */
+	inline double get_tight_side() {
+		double side = 0.0;
+		for (int i=0;i<NDIM;i++)
+			side = max(side,_Bmax[i] - _Bmin[i]);
+		return side;
+	}
+	
+	/**
+	 * Determine squared distance from centre of mass to the furthest corner of tight bounding box
+	 */
+	inline double get_tight_bmax_sq() {
+		double bmax_sq = 0.0;
+		for (int i=0;i<NDIM;i++)
+			bmax_sq += sqr(max(_center_of_mass[i] - _Bmin[i],_Bmax[i] - _center_of_mass[i]));
+		return bmax_sq;
+	}
+	
+	/**
+	 * Get tight bounding box of particles
+	 */
+	inline tuple<array<double,NDIM>,array<double,NDIM>> get_bounds() {return make_tuple(_Bmin,_Bmax);}
+	
+	/**
+	 * Number of children: zero unless node is Internal
+	 */
+	inline int get_n_children() {return popcount(static_cast<unsigned>(_occupancy));}
+	
+	/**
+	 * Determine whether a position is in the cube associated with this node. The
+	 * upper bound is inclusive, to match _get_octant_number().
+	 */
+	inline bool contains(const array<double,NDIM> & position) {
+		for (int i=0;i<NDIM;i++)
+			if (!(_Xmin[i] < position[i] && position[i] <= _Xmax[i])) return false;
+		return true;
+	}
 
   private:
   
@@ -222,21 +540,222 @@ class Node {
 	 *     n			Number of particles
 	 *     pad			Box will be expanded by a factor of (1+pad)
      */
-	static tuple<double,double> _get_limits(unique_ptr<Particle[]> &particles, int n, const double pad=1.0e-4);
+	static tuple<double,double> _get_limits(ParticleStore &particles, int n, const double pad=1.0e-4);
+	
+	/**
+	 * Create root of tree, with a bounding box that contains all the particles
+	 *
+	 * Parameters:
+	 *     particles    The particles
+	 *     n			Number of particles
+	 *     pad			Box will be expanded by a factor of (1+pad)
+	 *     arena        Used to allocate nodes below root (a new one is created if this is null)
+	 *     lanes        Number of threads that will use arena
+	 */
+	static unique_ptr<Node> _create_root(ParticleStore &particles, int n, const double pad, shared_ptr<NodeArena> & arena, const int lanes);
+	
+	/**
+	 * Used by NodeArena to update count when Nodes are released
+	 */
+	static void _release(const int n) {_count -= n;}
+	
+	/**
+	 * Verify tree if requested by caller of create(...)
+	 */
+	static void _verify(Node * root,ParticleStore &particles, const int n, const bool check_moments=false);
+	
+	/**
+	 * Calculate Morton key for a particle, from the cell that contains it, so each
+	 * group of N_Bits is the octant that insert() would have chosen at that level.
+	 *
+	 * Parameters:
+	 *     position    Position of particle
+	 *     Xmin        Lower bound of box for root of tree
+	 *     Xmax        Upper bound of box for root of tree
+	 */
+	static uint64_t _get_morton_key(const array<double,NDIM> & position,array<double,NDIM> Xmin, array<double,NDIM> Xmax);
+	
+	/**
+	 * Extract octant for one level of tree from Morton key
+	 */
+	static inline int _get_octant(uint64_t key, int level) {
+		return (key >> (N_Bits*(N_Levels-1-level))) & (N_Children-1);
+	}
+	
+	/**
+	 * Determine number of levels, starting from root, for which two keys are in the same octant
+	 */
+	static int _get_shared_levels(uint64_t key1, uint64_t key2);
+	
+	/**
+	 * Build tree below this node (which must be Unused) from particles sorted by Morton key.
+	 *
+	 * Parameters:
+	 *     particles    The particles: only used if options.fused_moments is set
+	 *     keys         Pairs (Morton key, particle index), sorted by key 
+	 *     bucket       Indices of the same particles, in the same order: External nodes point into this
+	 *     options      Determine bucket size, maximum depth, and whether to calculate moments
+	 *     lane         Used to allocate Nodes 
+	 *     level        Level of this node in tree: all keys share this many levels
+	 */
+	void _insert_sorted(ParticleStore &particles, span<pair<uint64_t,int>> keys, int * bucket,
+						const TreeOptions & options, NodeArena::Lane & lane, const int level=0);
+	
+	/**
+	 * Calculate mass and centre of mass of an External node from its bucket,
+	 * and quadrupole moment and tight bounding box if required.
+	 *
+	 * Parameters:
+	 *     particles   The particles
+	 *     options     Determine whether quadrupole moment and bounding box are required
+	 */
+	void _set_moments_from_bucket(ParticleStore &particles, const TreeOptions & options);
+	
+	/**
+	 * Calculate mass and centre of mass of an Internal node from its children,
+	 * in the same order as CentreOfMassCalculator.
+	 *
+	 * Parameters:
+	 *     options     Determine whether quadrupole moment and bounding box are required
+	 */
+	void _set_moments_from_children(const TreeOptions & options);
+	
+	/**
+	 * Add the quadrupole moment of a point mass to a quadrupole tensor
+	 *
+	 * Parameters:
+	 *     Q     The tensor
+	 *     m     Mass of point
+	 *     d     Displacement of point from centre of mass
+	 */
+	static void _add_point_quadrupole(Quadrupole & Q, const double m, const array<double,NDIM> & d);
+	
+	/**
+	 * Used by _insert_sorted_parallel() to calculate moments for the levels of the
+	 * tree above the subtrees that were built in parallel.
+	 *
+	 * Parameters:
+	 *     particles        The particles
+	 *     level            Level of this node in tree
+	 *     partition_level  Level of the subtrees that were built in parallel
+	 *     options          Determine whether quadrupole moments and bounding boxes are required
+	 */
+	void _set_top_level_moments(ParticleStore &particles, const int level, const int partition_level, const TreeOptions & options);
+	
+	/**
+	 * Make this node External, holding a bucket of particles
+	 *
+	 * Parameters:
+	 *     bucket       Indices of particles
+	 *     n            Number of particles
+	 */
+	void _set_bucket(int * bucket, const int n);
+	
+	/**
+	 * Used to check that options are valid before we build tree
+	 */
+	static void _validate(const TreeOptions & options);
+	
+	/**
+	 * Used by update() to remove particles that have left the cube of their External node,
+	 * and to remove subtrees that have been emptied.
+	 *
+	 * Parameters:
+	 *     particles    The particles
+	 *     movers       Used to collect particles that have been removed
+	 *     lane         Used to record nodes that have been removed
+	 *
+	 * Returns:
+	 *     true if this node is now empty
+	 */
+	bool _remove_movers(ParticleStore &particles, vector<int> & movers, NodeArena::Lane & lane);
+	
+	/**
+	 * Remove an empty child, moving the children that follow it down
+	 * to keep the block contiguous.
+	 *
+	 * Parameters:
+	 *     octant    The octant whose child is to be removed
+	 *     lane      Used to record nodes that have been removed
+	 */
+	void _remove_child(const int octant, NodeArena::Lane & lane);
+	
+	/**
+	 * Used by update() to insert a particle that has been removed. It is added to 
+	 * the bucket of the External node whose cube contains it, which is split if it is full.
+	 *
+	 * Parameters:
+	 *     index        The particle
+	 *     particles    The particles
+	 *     options      Determine bucket size and maximum depth
+	 *     arena        Used to allocate Nodes and buckets
+	 *     level        Level of this node in tree
+	 */
+	void _reinsert(const int index, ParticleStore &particles, const TreeOptions & options, NodeArena & arena, const int level);
+	
+	/**
+	 * Add one particle to the bucket of an External node. The bucket is copied into
+	 * a larger one, allocated from the arena.
+	 */
+	void _add_to_bucket(const int index, NodeArena & arena);
+	
+	/**
+	 * Build tree below this node (the root) using several threads.
+	 *
+	 * Parameters:
+	 *     particles    The particles
+	 *     n            Number of particles
+	 *     options      Determine number of threads, bucket size, and maximum depth
+	 *     arena        Used to allocate Nodes: each thread has its own Lane
+	 */
+	void _insert_sorted_parallel(ParticleStore &particles, const int n, const TreeOptions & options, NodeArena & arena);
+	
+	/**
+	 * Used by _insert_sorted_parallel() to build the levels of the tree above the subtrees
+	 * that will be built in parallel.
+	 *
+	 * Parameters:
+	 *     keys         Pairs (Morton key, particle index), grouped by cell
+	 *     cells        Index into keys for the start of each cell; cells[i+1] is one past the end 
+	 *     cell_begin   The first cell that belongs to this node
+	 *     cell_end     One past the last cell that belongs to this node
+	 *     level        Level of this node in tree
+	 *     partition_level   Level of the subtrees that will be built in parallel
+	 *     subtrees     Used to record the subtrees, with indices into keys
+	 *     bucket       Indices of particles for External nodes, in the same order as keys
+	 *     options      Determine bucket size and maximum depth
+	 *     lane         Used to allocate Nodes 
+	 */
+	void _split_top_levels(vector<pair<uint64_t,int>> & keys, vector<int> & cells, const int cell_begin, const int cell_end,
+						   const int level, const int partition_level, vector<tuple<Node*,int,int>> & subtrees,
+						   int * bucket, const TreeOptions & options, NodeArena::Lane & lane);
+	
+	/**
+	 * Determine level of subtrees that will be built in parallel.
+	 * We need enough subtrees to keep all the threads busy. 
+	 */
+	static int _get_partition_level(const int threads);
 	
 	/**
 	 * Used to map a triple to an octant
 	 */
-	inline auto _triple_to_octant(int i, int j, int k) {
+	static inline auto _triple_to_octant(int i, int j, int k) {
 		return N_Halves*(N_Halves*i + j) + k;
 	}
 	
 	/**
 	 * Used to map an array of 3 ints to an octant
 	 */
-	inline auto _triple_to_octant(array<int,NDIM> indices) {
+	static inline auto _triple_to_octant(array<int,NDIM> indices) {
 		return _triple_to_octant(indices[0],indices[1],indices[2]);
 	}
+	
+	/**
+	 * Used to map an octant to an array of 3 ints: inverse of _triple_to_octant
+	 */
+	static inline array<int,NDIM> _octant_to_triple(const int octant) {
+		return {octant / (N_Halves*N_Halves), (octant / N_Halves) % N_Halves, octant % N_Halves};
+	}
 
 	/**
 	 * Find correct subtree to store particle, using bounding rectangular box
@@ -246,20 +765,58 @@ class Node {
 	/**
 	 * Split an External node, and insert the new particle and the incumbent into subtrees.
 	 */
-	void _split_and_insert_below(int particle_index,int incumbent,unique_ptr<Particle[]> &particles);
+	void _split_and_insert_below(int particle_index,int incumbent,ParticleStore &particles,NodeArena::Lane & lane);
 	
 	/**
 	 * Used when we have just split an External node, so we need to pass
 	 * the incumbent and a new particle down the tree
 	 */
-	void _insert_or_propagate(int new_particle_index,int incumbent,unique_ptr<Particle[]> &particles);
+	void _insert_or_propagate(int new_particle_index,int incumbent,ParticleStore &particles,NodeArena::Lane & lane);
 	
 	/**
 	 * Convert an External Node into an Internal one, and
 	 * determine bounding boxes for children, so we can 
-	 * Propagate particle down
+	 * Propagate particle down. The children are allocated together from lane.
+	 *
+	 * Parameters:
+	 *     lane         Used to allocate children
+	 *     occupancy    Bit i is set iff a child is needed for octant i
 	 */
-	void _split_node();
+	void _split_node(NodeArena::Lane & lane,const uint8_t occupancy);
+	
+	/**
+	 * Used by insert() to create a child for an octant that was empty.
+	 * We need a bigger block, so the existing children are copied.
+	 *
+	 * Parameters:
+	 *     octant    The octant that needs a child
+	 *     lane      Used to allocate children
+	 *
+	 * Returns:
+	 *     The new child
+	 */
+	Node * _add_child(const int octant,NodeArena::Lane & lane);
+	
+	/**
+	 * Construct a child node, whose box is one octant of this node's box
+	 *
+	 * Parameters:
+	 *     slot      Where the child is to be constructed
+	 *     octant    Octant for child
+	 */
+	void _create_child(Node * slot,const int octant);
+	
+	/**
+	 * Find child for a specified octant
+	 *
+	 * Returns:
+	 *     The child, or nullptr if the octant is empty
+	 */
+	inline Node * _get_child(const int octant) {
+		if (!((_occupancy >> octant) & 1)) return nullptr;
+		return _children + popcount(static_cast<unsigned>(_occupancy & ((1u << octant) - 1)));
+	}
+
 	 
 	/**
 	 *   Used when we split the box associated with a Node into octants
@@ -273,7 +830,7 @@ class Node {
 	 *   Returns:
 	 *      Lower and upper bound of octant along one dimension
 	 */
-	inline auto _get_refined_bounds(int i,double wmin, double wmax, double wmean){
+	static inline auto _get_refined_bounds(int i,double wmin, double wmax, double wmean){
 		if (i == 0)
 			return make_tuple(wmin, wmean);
 		else